@@ -0,0 +1,263 @@
+/*------------------------------------------------------------------------------
+ * Arena.c -- bump pointer arenas, and pools of fixed size objects
+ *
+ * Objects that live and die together (a pipelined batch, a refill of the
+ * queue) are carved from one arena, and released by one reset. A reset
+ * keeps the chunks for the arena's next use, or hands them back to a pool
+ * shared by many short-lived arenas; either way, once the high water mark
+ * is reached, allocating no longer calls malloc().
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Arena.h"
+#include "MallocCount.h"
+
+#pragma weak MallocCount
+
+#define ARENA_ALIGN	sizeof(((ArenaChunk_t*)0)->data[0])
+#define ARENA_ROUND(n)	(((n) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+/*------------------------------------------------------------------------------
+ * ArenaInit() - an empty arena, of 'chunkSize' byte chunks (0 for default)
+ */
+void ArenaInit(Arena_t* arena, size_t chunkSize)
+{
+    assert(NULL != arena);
+
+    arena->chunks    = NULL;
+    arena->spare     = NULL;
+    arena->pool      = NULL;
+    arena->chunkSize = ARENA_ROUND(chunkSize);
+}
+
+/*------------------------------------------------------------------------------
+ * ArenaInitPooled() - an empty arena, whose chunks come from 'pool'
+ *
+ * Objects of the pool are chunks, of ARENA_POOL_SIZE() bytes; arenas sharing
+ * a pool then share its chunks, which go back to it on a reset.
+ */
+void ArenaInitPooled(Arena_t* arena, Pool_t* pool)
+{
+    assert(NULL != arena);
+    assert(NULL != pool);
+    assert(pool->size > ARENA_POOL_SIZE(0));
+
+    arena->chunks    = NULL;
+    arena->spare     = NULL;
+    arena->pool      = pool;
+    arena->chunkSize = pool->size - ARENA_POOL_SIZE(0);
+}
+
+/*------------------------------------------------------------------------------
+ * newChunk() - a chunk of at least 'size' bytes: a spare, one from the pool,
+ * or a new one; NULL if out of memory
+ */
+static ArenaChunk_t* newChunk(Arena_t* arena, size_t size)
+{
+    size_t chunkSize = (0 == arena->chunkSize) ? ARENA_CHUNK : arena->chunkSize;
+
+    ArenaChunk_t* chunk;
+    ArenaChunk_t** link;
+
+    for (link = &arena->spare; NULL != *link; link = &(*link)->next)
+    {
+	if ((*link)->size >= size)
+	{
+	    chunk = *link;
+	    *link = chunk->next;
+
+	    return chunk;
+	}
+    }
+
+    if ((NULL != arena->pool) && (size <= chunkSize))
+    {
+	chunk = PoolGet(arena->pool);
+    }
+    else
+    {
+	if (size < chunkSize)
+	{
+	    size = chunkSize;
+	}
+
+	chunk = malloc(ARENA_POOL_SIZE(size));
+    }
+
+    if (NULL != chunk)
+    {
+	chunk->size = (size < chunkSize) ? chunkSize : size;
+    }
+
+    return chunk;
+}
+
+/*------------------------------------------------------------------------------
+ * ArenaAlloc() - 'size' bytes, aligned for any object; NULL if out of memory
+ */
+void* ArenaAlloc(Arena_t* arena, size_t size)
+{
+    ArenaChunk_t* chunk;
+
+    assert(NULL != arena);
+
+    size  = ARENA_ROUND((0 == size) ? 1 : size);
+    chunk = arena->chunks;
+
+    if ((NULL == chunk) || (chunk->size - chunk->used < size))
+    {
+	if (NULL == (chunk = newChunk(arena, size)))
+	{
+	    return NULL;
+	}
+
+	chunk->used   = 0;
+	chunk->next   = arena->chunks;
+	arena->chunks = chunk;
+    }
+
+    chunk->used += size;
+
+    return (char*)chunk->data + chunk->used - size;
+}
+
+/*------------------------------------------------------------------------------
+ * ArenaStrdup() - a copy of 's', in the arena
+ */
+char* ArenaStrdup(Arena_t* arena, const char* s)
+{
+    size_t len = strlen(s) + 1;
+    char* copy;
+
+    if (NULL != (copy = ArenaAlloc(arena, len)))
+    {
+	memcpy(copy, s, len);
+    }
+
+    return copy;
+}
+
+/*------------------------------------------------------------------------------
+ * ArenaReset() - release everything allocated, keeping the chunks
+ *
+ * Pooled chunks go back to the pool; any larger are freed.
+ */
+void ArenaReset(Arena_t* arena)
+{
+    ArenaChunk_t* chunk;
+
+    assert(NULL != arena);
+
+    while (NULL != (chunk = arena->chunks))
+    {
+	arena->chunks = chunk->next;
+
+	if (NULL == arena->pool)
+	{
+	    chunk->next  = arena->spare;
+	    arena->spare = chunk;
+	}
+	else if (chunk->size == arena->chunkSize)
+	{
+	    PoolPut(arena->pool, chunk);
+	}
+	else
+	{
+	    free(chunk);
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * ArenaFree() - release everything, chunks and all
+ */
+void ArenaFree(Arena_t* arena)
+{
+    ArenaChunk_t* chunk;
+
+    assert(NULL != arena);
+
+    ArenaReset(arena);
+
+    while (NULL != (chunk = arena->spare))
+    {
+	arena->spare = chunk->next;
+	free(chunk);
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * PoolInit() - an empty pool of 'size' byte objects
+ */
+void PoolInit(Pool_t* pool, size_t size)
+{
+    assert(NULL != pool);
+
+    size = ARENA_ROUND((size < sizeof(void*)) ? sizeof(void*) : size);
+
+    ArenaInit(&pool->arena, (size > ARENA_CHUNK) ? size : ARENA_CHUNK);
+    pool->free = NULL;
+    pool->size = size;
+}
+
+/*------------------------------------------------------------------------------
+ * PoolGet() - an object, put back or new; NULL if out of memory
+ */
+void* PoolGet(Pool_t* pool)
+{
+    void* object;
+
+    assert(NULL != pool);
+
+    if (NULL != (object = pool->free))
+    {
+	pool->free = *(void**)object;
+
+	return object;
+    }
+
+    return ArenaAlloc(&pool->arena, pool->size);
+}
+
+/*------------------------------------------------------------------------------
+ * PoolPut() - put an object back, for the next PoolGet()
+ */
+void PoolPut(Pool_t* pool, void* object)
+{
+    assert(NULL != pool);
+    assert(NULL != object);
+
+    *(void**)object = pool->free;
+    pool->free      = object;
+}
+
+/*------------------------------------------------------------------------------
+ * PoolFree() - release every object, whether put back or not
+ */
+void PoolFree(Pool_t* pool)
+{
+    assert(NULL != pool);
+
+    ArenaFree(&pool->arena);
+    pool->free = NULL;
+}
+
+/*------------------------------------------------------------------------------
+ * ArenaMallocs() - calls to malloc() and friends so far; -1 if they are not
+ * counted
+ *
+ * They are counted only in programs linked with MallocCount.o, which
+ * replaces the allocator; elsewhere 'MallocCount' is a null weak reference.
+ */
+long ArenaMallocs(void)
+{
+    return (NULL != MallocCount) ? MallocCount() : -1;
+}
+
+/*
+ * EOF
+ */
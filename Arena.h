@@ -0,0 +1,77 @@
+#ifndef ARENA_H
+#define ARENA_H 1
+/*------------------------------------------------------------------------------
+ * Arena.h -- bump pointer arenas, and pools of fixed size objects
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stddef.h>
+
+/*
+ * Bytes in an arena chunk, unless told otherwise
+ */
+#define ARENA_CHUNK 16384
+
+struct arena_chunk
+{
+    struct arena_chunk* next;		/* older chunk, or spare */
+    size_t size;			/* bytes in 'data' */
+    size_t used;			/* bytes handed out */
+    union				/* aligned for any object */
+    {
+	long double ld;
+	void* p;
+	long long ll;
+    } data[1];
+};
+typedef struct arena_chunk ArenaChunk_t;
+
+/*
+ * Pool object size that holds a chunk of 'n' bytes, for ArenaInitPooled()
+ */
+#define ARENA_POOL_SIZE(n) (offsetof(ArenaChunk_t, data) + (n))
+
+struct pool;
+
+/*
+ * Allocations are carved from the current chunk, and released all at once.
+ * A reset keeps the chunks for reuse, or puts them back in the pool they
+ * came from; so a reused arena soon stops calling malloc(). A zeroed arena
+ * is empty, with chunks of ARENA_CHUNK bytes.
+ */
+struct arena
+{
+    ArenaChunk_t* chunks;		/* in use, newest first */
+    ArenaChunk_t* spare;		/* kept by a reset, unless pooled */
+    struct pool* pool;			/* where chunks come from, or NULL */
+    size_t chunkSize;			/* bytes per chunk, or 0 for default */
+};
+typedef struct arena Arena_t;
+
+/*
+ * Fixed size objects, recycled through a free list; their memory is carved
+ * from an arena, and released only by PoolFree()
+ */
+struct pool
+{
+    Arena_t arena;			/* where objects come from */
+    void* free;				/* objects put back */
+    size_t size;			/* bytes per object */
+};
+typedef struct pool Pool_t;
+
+extern void ArenaInit(Arena_t* arena, size_t chunkSize);
+extern void ArenaInitPooled(Arena_t* arena, Pool_t* pool);
+extern void* ArenaAlloc(Arena_t* arena, size_t size);
+extern char* ArenaStrdup(Arena_t* arena, const char* s);
+extern void ArenaReset(Arena_t* arena);
+extern void ArenaFree(Arena_t* arena);
+
+extern void PoolInit(Pool_t* pool, size_t size);
+extern void* PoolGet(Pool_t* pool);
+extern void PoolPut(Pool_t* pool, void* object);
+extern void PoolFree(Pool_t* pool);
+
+extern long ArenaMallocs(void);
+
+#endif
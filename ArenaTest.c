@@ -0,0 +1,179 @@
+/*------------------------------------------------------------------------------
+ * ArenaTest.c -- Test for arenas and pools
+ *
+ * Fills an arena with strings of assorted sizes (some larger than a chunk),
+ * checks each survives until the reset, and that a reset arena refilled the
+ * same way calls malloc() no more; then does the same for arenas sharing
+ * a pool of chunks, and recycles objects through a pool.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "Arena.h"
+#include "dbug.h"
+
+#define TEST_STRINGS	1000		/* strings per fill */
+#define TEST_CHUNK	1024		/* small, to force many chunks */
+
+/*
+ * fill() - copy strings into the arena, and check them. Returns the number
+ * of failures.
+ */
+static int fill(Arena_t* arena)
+{
+    static char* copies[TEST_STRINGS];
+
+    char s[3000];
+    int failures = 0;
+    int i;
+
+    for (i = 0; i < TEST_STRINGS; ++i)
+    {
+	size_t len = (i * 37) % ((0 == i % 100) ? sizeof s - 1 : 100);
+
+	memset(s, 'a' + i % 26, len);
+	s[len] = '\0';
+
+	if (NULL == (copies[i] = ArenaStrdup(arena, s)))
+	{
+	    return 1;
+	}
+
+	if (0 != ((unsigned long)copies[i] % sizeof(void*)))
+	{
+	    printf("string %d is misaligned\n", i);
+	    ++failures;
+	}
+    }
+
+    for (i = 0; i < TEST_STRINGS; ++i)
+    {
+	size_t len = (i * 37) % ((0 == i % 100) ? sizeof s - 1 : 100);
+
+	if ((strlen(copies[i]) != len)
+	    || ((len > 0)
+		&& ((copies[i][0] != 'a' + i % 26)
+		    || (copies[i][len - 1] != 'a' + i % 26))))
+	{
+	    printf("string %d was overwritten\n", i);
+	    ++failures;
+	}
+    }
+
+    return failures;
+}
+
+/*
+ * stanadlone test program.
+ */
+int main(int argc, char** argv)
+{
+    Arena_t arena;
+    Arena_t other;
+    Pool_t chunks;
+    Pool_t pool;
+
+    void* objects[100];
+    void* first;
+    long mallocs;
+    int failures = 0;
+    int i;
+
+    DBUG_PUSH("d,test");
+    DBUG_ENTER("main");
+
+    ArenaInit(&arena, TEST_CHUNK);
+
+    failures += fill(&arena);
+    ArenaReset(&arena);
+
+    mallocs   = ArenaMallocs();
+    failures += fill(&arena);
+
+    if (ArenaMallocs() != mallocs)
+    {
+	printf("refilled arena called malloc() %ld times\n",
+	       ArenaMallocs() - mallocs);
+	++failures;
+    }
+
+    ArenaFree(&arena);
+
+    /*
+     * Arenas sharing chunks: one's reset feeds the other
+     */
+
+    PoolInit(&chunks, ARENA_POOL_SIZE(TEST_CHUNK));
+    ArenaInitPooled(&arena, &chunks);
+    ArenaInitPooled(&other, &chunks);
+
+    failures += fill(&arena);
+    ArenaReset(&arena);
+
+    mallocs   = ArenaMallocs();
+    failures += fill(&other);
+    ArenaReset(&other);
+    failures += fill(&arena);
+
+    /* only the strings larger than a chunk need a malloc() of their own */
+    if (ArenaMallocs() - mallocs > 2 * TEST_STRINGS / 100)
+    {
+	printf("pooled arenas called malloc() %ld times\n",
+	       ArenaMallocs() - mallocs);
+	++failures;
+    }
+
+    ArenaFree(&arena);
+    ArenaFree(&other);
+    PoolFree(&chunks);
+
+    /*
+     * Objects put back come out again, before any new ones
+     */
+
+    PoolInit(&pool, 48);
+
+    for (i = 0; i < 100; ++i)
+    {
+	objects[i] = PoolGet(&pool);
+	memset(objects[i], i, 48);
+    }
+
+    first = objects[0];
+
+    for (i = 0; i < 100; ++i)
+    {
+	PoolPut(&pool, objects[i]);
+    }
+
+    mallocs = ArenaMallocs();
+
+    for (i = 0; i < 100; ++i)
+    {
+	objects[i] = PoolGet(&pool);
+    }
+
+    if (objects[99] != first)
+    {
+	printf("pool did not reuse its objects\n");
+	++failures;
+    }
+
+    if (ArenaMallocs() != mallocs)
+    {
+	printf("pool called malloc() to reuse objects\n");
+	++failures;
+    }
+
+    PoolFree(&pool);
+
+    DBUG_PRINT("test",((0 == failures) ? "Looks good!" : "Failed"));
+
+    DBUG_RETURN(0 != failures);
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,1648 @@
+/*------------------------------------------------------------------------------
+ * Event.c -- readiness notification for many descriptors
+ *
+ * Uses epoll() on Linux; poll() on other systems. On Linux, an io_uring
+ * backend may be asked for instead; it adds receives into a pool of
+ * buffers, and writes and closes that complete in the background.
+ *
+ * All functions return -1 on failure, leaving the reason in 'errno'.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#else
+#include <poll.h>
+#endif
+
+#include "Event.h"
+#include "dbug.h"
+
+#ifdef __linux__
+#include "Ring.h"
+#endif
+
+/*------------------------------------------------------------------------------
+ * writeAt() - write a whole buffer at 'offset', retrying short writes
+ */
+static int writeAt(int fd, const char* buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+	ssize_t rc;
+
+	if (-1 == (rc = pwrite(fd, buf, len, offset)))
+	{
+	    if (EINTR == errno)
+	    {
+		continue;
+	    }
+
+	    return -1;
+	}
+
+	buf    += rc;
+	len    -= rc;
+	offset += rc;
+    }
+
+    return 0;
+}
+
+#ifdef __linux__
+
+struct event_loop
+{
+    struct epoll_event* ready;		/* results from epoll_wait() */
+    struct event_ring* ring;		/* io_uring backend, or NULL */
+    int maxReady;			/* elements in 'ready' */
+    int epfd;				/* the epoll descriptor */
+};
+
+/*------------------------------------------------------------------------------
+ * toEpoll() - translate EVENT_* flags to EPOLL* flags
+ */
+static unsigned int toEpoll(int events)
+{
+    unsigned int result = 0;
+
+    if (events & EVENT_READ)
+    {
+	result |= EPOLLIN;
+    }
+
+    if (events & EVENT_WRITE)
+    {
+	result |= EPOLLOUT;
+    }
+
+    return result;
+}
+
+/*------------------------------------------------------------------------------
+ * io_uring backend
+ *
+ * Readiness is watched with one-shot polls, re-armed at each wait, so that
+ * a descriptor stays reported while it is ready, as with epoll(). Changes to
+ * what is watched, receives, writes and closes are queued, and submitted
+ * together by the next EventLoopWait(), in one system call.
+ *
+ * Receives land in a pool of buffers, registered with the kernel. Where the
+ * kernel supports provided-buffer rings (5.19), it picks a free buffer once
+ * data arrives; otherwise one is set aside for each receive. A buffer is
+ * handed to the caller with the data, and returns to the pool once both the
+ * caller has recycled it, and every write queued from it is done.
+ */
+
+/*
+ * Submission entries; more are submitted early, when the ring fills
+ */
+#define RING_ENTRIES 1024
+
+/*
+ * Operation kinds
+ */
+enum ring_kind
+{
+    ring_poll,				/* readiness watch */
+    ring_recv,				/* receive into a pool buffer */
+    ring_write,				/* write to a file offset */
+    ring_close				/* close, of any descriptor */
+};
+
+/*
+ * One operation in flight, or awaiting submission; 'user_data' points here
+ */
+struct ring_op
+{
+    struct ring_op* next;		/* free, re-arm or starved list */
+    void* data;				/* caller's data */
+    const char* buf;			/* write: bytes still to write */
+    size_t len;				/* write: their length */
+    off_t offset;			/* write: where they go */
+    int fd;				/* the descriptor */
+    int kind;				/* ring_poll, ring_recv, ring_write */
+    int events;				/* poll: EVENT_* flags watched */
+    int bufId;				/* pool buffer used, or -1 */
+    int isArmed;			/* submitted, not yet completed? */
+    int isDead;				/* cancelled; freed on completion */
+};
+
+/*
+ * Per descriptor state
+ */
+struct ring_fd
+{
+    struct ring_op* poll;		/* readiness watch, or NULL */
+    struct ring_op* recv;		/* receive, or NULL */
+    int writes;				/* writes not yet done */
+    int isClosing;			/* close once 'writes' are done */
+};
+
+struct event_ring
+{
+    Ring_t* ring;			/* the submission and completion queues */
+    struct ring_fd* fds;		/* indexed by descriptor */
+    struct ring_op* freeOps;		/* unused operations */
+    struct ring_op* rearm;		/* polls to submit at the next wait */
+    struct ring_op* starved;		/* receives waiting for a buffer */
+    struct ring_op closeOp;		/* 'user_data' of every close */
+    void** chunks;			/* operations, as allocated */
+    char* pool;				/* receive buffers */
+    int* refs;				/* references, per buffer */
+    int* freeBufs;			/* free buffers, without 'bufRing' */
+    struct io_uring_buf_ring* bufRing;	/* provided buffers, or NULL */
+    size_t bufRingLen;			/* bytes in 'bufRing' */
+    size_t bufferSize;			/* bytes per buffer */
+    int bufferCount;			/* buffers in 'pool' */
+    int freeCount;			/* buffers free to receive into */
+    int fdCount;			/* elements in 'fds' */
+    int chunkCount;			/* elements in 'chunks' */
+    int writes;				/* writes not yet done */
+    int closes;				/* closes not yet done */
+    int isFixed;			/* buffers registered? */
+    int canClose;			/* IORING_OP_CLOSE supported? */
+};
+
+/*------------------------------------------------------------------------------
+ * ringFd() - the state of a descriptor, growing the table as needed
+ */
+static struct ring_fd* ringFd(struct event_ring* er, int fd)
+{
+    if (fd >= er->fdCount)
+    {
+	int count = (fd < 64) ? 128 : 2 * fd;
+	struct ring_fd* fds;
+
+	if (NULL == (fds = realloc(er->fds, count * sizeof(struct ring_fd))))
+	{
+	    return NULL;
+	}
+
+	memset(&fds[er->fdCount], 0, (count - er->fdCount) * sizeof *fds);
+
+	er->fds     = fds;
+	er->fdCount = count;
+    }
+
+    return &er->fds[fd];
+}
+
+/*------------------------------------------------------------------------------
+ * newOp() - allocate an operation
+ */
+static struct ring_op* newOp(struct event_ring* er, int kind, int fd, void* data)
+{
+    struct ring_op* op;
+
+    if (NULL == er->freeOps)
+    {
+	struct ring_op* chunk;
+	void** chunks;
+
+	int i;
+
+	if ((NULL == (chunks = realloc(er->chunks,
+				       (er->chunkCount + 1) * sizeof(void*))))
+	||  (NULL == (chunk = calloc(64, sizeof(struct ring_op)))))
+	{
+	    if (NULL != chunks)
+	    {
+		er->chunks = chunks;
+	    }
+
+	    return NULL;
+	}
+
+	er->chunks = chunks;
+	er->chunks[er->chunkCount++] = chunk;
+
+	for (i = 0; i < 64; ++i)
+	{
+	    chunk[i].next = er->freeOps;
+	    er->freeOps   = &chunk[i];
+	}
+    }
+
+    op = er->freeOps;
+    er->freeOps = op->next;
+
+    memset(op, 0, sizeof *op);
+    op->kind  = kind;
+    op->fd    = fd;
+    op->data  = data;
+    op->bufId = -1;
+
+    return op;
+}
+
+/*------------------------------------------------------------------------------
+ * freeOp() - return an operation to the free list
+ */
+static void freeOp(struct event_ring* er, struct ring_op* op)
+{
+    op->next    = er->freeOps;
+    er->freeOps = op;
+}
+
+/*------------------------------------------------------------------------------
+ * bufferOf() - the pool buffer holding 'len' bytes at 'buf', or -1
+ */
+static int bufferOf(struct event_ring* er, const char* buf, size_t len)
+{
+    size_t offset;
+    int bufId;
+
+    if ((buf < er->pool)
+    ||  (buf >= er->pool + er->bufferCount * er->bufferSize))
+    {
+	return -1;
+    }
+
+    offset = buf - er->pool;
+    bufId  = offset / er->bufferSize;
+
+    return (offset + len <= (bufId + 1) * er->bufferSize) ? bufId : -1;
+}
+
+/*------------------------------------------------------------------------------
+ * unref() - drop a reference to a buffer; the last returns it to the pool
+ */
+static void unref(struct event_ring* er, int bufId)
+{
+    assert((0 <= bufId) && (bufId < er->bufferCount));
+    assert(er->refs[bufId] > 0);
+
+    if (0 < --er->refs[bufId])
+    {
+	return;
+    }
+
+    if (NULL != er->bufRing)
+    {
+	unsigned short tail = er->bufRing->tail;
+	struct io_uring_buf* buf =
+	    &er->bufRing->bufs[tail & (er->bufferCount - 1)];
+
+	buf->addr = (unsigned long)(er->pool + bufId * er->bufferSize);
+	buf->len  = er->bufferSize;
+	buf->bid  = bufId;
+
+	__atomic_store_n(&er->bufRing->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    else
+    {
+	er->freeBufs[er->freeCount] = bufId;
+    }
+
+    ++er->freeCount;
+}
+
+/*------------------------------------------------------------------------------
+ * submitPoll() - queue a readiness watch
+ */
+static int submitPoll(struct event_ring* er, struct ring_op* op)
+{
+    struct io_uring_sqe* sqe;
+
+    if (NULL == (sqe = RingGet(er->ring)))
+    {
+	return -1;
+    }
+
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = op->fd;
+    sqe->poll32_events = toEpoll(op->events);
+    sqe->user_data     = (unsigned long)op;
+
+    op->isArmed = 1;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * submitRecv() - queue a receive; without a free buffer, it waits for one
+ */
+static int submitRecv(struct event_ring* er, struct ring_op* op)
+{
+    struct io_uring_sqe* sqe;
+
+    if (0 == er->freeCount)
+    {
+	op->next    = er->starved;
+	er->starved = op;
+
+	return 0;
+    }
+
+    if (NULL == (sqe = RingGet(er->ring)))
+    {
+	return -1;
+    }
+
+    sqe->fd        = op->fd;
+    sqe->user_data = (unsigned long)op;
+
+    if (NULL != er->bufRing)		/* the kernel picks the buffer */
+    {
+	sqe->opcode    = IORING_OP_RECV;
+	sqe->flags     = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->len       = er->bufferSize;
+    }
+    else
+    {
+	op->bufId = er->freeBufs[--er->freeCount];
+	er->refs[op->bufId] = 1;
+
+	sqe->opcode = er->isFixed ? IORING_OP_READ_FIXED : IORING_OP_RECV;
+	sqe->addr   = (unsigned long)(er->pool + op->bufId * er->bufferSize);
+	sqe->len    = er->bufferSize;
+
+	if (er->isFixed)
+	{
+	    sqe->buf_index = op->bufId;
+	}
+    }
+
+    op->isArmed = 1;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * submitWrite() - queue a write, of what remains of it
+ */
+static int submitWrite(struct event_ring* er, struct ring_op* op)
+{
+    struct io_uring_sqe* sqe;
+
+    if (NULL == (sqe = RingGet(er->ring)))
+    {
+	return -1;
+    }
+
+    sqe->opcode    = IORING_OP_WRITE;
+    sqe->fd        = op->fd;
+    sqe->addr      = (unsigned long)op->buf;
+    sqe->len       = op->len;
+    sqe->off       = op->offset;
+    sqe->user_data = (unsigned long)op;
+
+    if (er->isFixed && (0 <= op->bufId))
+    {
+	sqe->opcode    = IORING_OP_WRITE_FIXED;
+	sqe->buf_index = op->bufId;
+    }
+
+    op->isArmed = 1;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * cancel() - retire an operation; a submitted one is cancelled
+ */
+static int cancel(struct event_ring* er, struct ring_op* op)
+{
+    struct io_uring_sqe* sqe;
+
+    op->isDead = 1;
+
+    if (!op->isArmed)
+    {
+	return 0;			/* freed from its list */
+    }
+
+    if (NULL == (sqe = RingGet(er->ring)))
+    {
+	return -1;
+    }
+
+    sqe->opcode = (ring_poll == op->kind) ? IORING_OP_POLL_REMOVE
+					  : IORING_OP_ASYNC_CANCEL;
+    sqe->addr   = (unsigned long)op;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * closeFd() - queue a close, now that nothing is outstanding
+ */
+static int closeFd(struct event_ring* er, int fd)
+{
+    struct io_uring_sqe* sqe;
+
+    memset(&er->fds[fd], 0, sizeof(struct ring_fd));
+
+    if (!er->canClose || (NULL == (sqe = RingGet(er->ring))))
+    {
+	return close(fd);
+    }
+
+    sqe->opcode    = IORING_OP_CLOSE;
+    sqe->fd        = fd;
+    sqe->user_data = (unsigned long)&er->closeOp;
+
+    ++er->closes;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * ringFree() - free the io_uring backend; operations in flight are cancelled
+ */
+static void ringFree(struct event_ring* er)
+{
+    int i;
+
+    RingFree(er->ring);
+
+    if (NULL != er->pool)
+    {
+	munmap(er->pool, er->bufferCount * er->bufferSize);
+    }
+
+    if (NULL != er->bufRing)
+    {
+	munmap(er->bufRing, er->bufRingLen);
+    }
+
+    for (i = 0; i < er->chunkCount; ++i)
+    {
+	free(er->chunks[i]);
+    }
+
+    free(er->chunks);
+    free(er->fds);
+    free(er->refs);
+    free(er->freeBufs);
+    free(er);
+}
+
+/*------------------------------------------------------------------------------
+ * ringCreate() - set up the ring, and its pool of 'buffers' buffers
+ */
+static struct event_ring* ringCreate(int buffers, size_t bufferSize)
+{
+    struct io_uring_buf_reg reg;
+    struct event_ring* er;
+    struct iovec* iov;
+
+    int count;
+    int i;
+
+    for (count = 1; count < buffers; count <<= 1)
+    {
+	;				/* a power of 2, for the buffer ring */
+    }
+
+    if (NULL == (er = calloc(1, sizeof(struct event_ring))))
+    {
+	return NULL;
+    }
+
+    er->bufferCount  = count;
+    er->bufferSize   = bufferSize;
+    er->closeOp.kind = ring_close;
+
+    if ((NULL == (er->ring = RingCreate(RING_ENTRIES)))
+    ||  !RingIsSupported(er->ring, IORING_OP_POLL_ADD)
+    ||  !RingIsSupported(er->ring, IORING_OP_POLL_REMOVE)
+    ||  !RingIsSupported(er->ring, IORING_OP_ASYNC_CANCEL)
+    ||  !RingIsSupported(er->ring, IORING_OP_RECV)
+    ||  !RingIsSupported(er->ring, IORING_OP_WRITE))
+    {
+	if (NULL != er->ring)
+	{
+	    errno = EOPNOTSUPP;
+	}
+
+	ringFree(er);
+
+	return NULL;
+    }
+
+    er->canClose = RingIsSupported(er->ring, IORING_OP_CLOSE);
+
+    if ((MAP_FAILED == (er->pool = mmap(NULL,
+					count * bufferSize,
+					PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS,
+					-1,
+					0)))
+    ||  (NULL == (er->refs = calloc(count, sizeof(int))))
+    ||  (NULL == (er->freeBufs = malloc(count * sizeof(int))))
+    ||  (NULL == (iov = malloc(count * sizeof(struct iovec)))))
+    {
+	if (MAP_FAILED == er->pool)
+	{
+	    er->pool = NULL;
+	}
+
+	ringFree(er);
+
+	return NULL;
+    }
+
+    /* registered buffers spare the kernel mapping each page, per I/O */
+    for (i = 0; i < count; ++i)
+    {
+	iov[i].iov_base = er->pool + i * bufferSize;
+	iov[i].iov_len  = bufferSize;
+    }
+
+    er->isFixed = RingIsSupported(er->ring, IORING_OP_READ_FIXED)
+	       && RingIsSupported(er->ring, IORING_OP_WRITE_FIXED)
+	       && (0 == RingRegister(er->ring, IORING_REGISTER_BUFFERS, iov, count));
+
+    free(iov);
+
+    /* a provided-buffer ring, where the kernel has them */
+    er->bufRingLen = count * sizeof(struct io_uring_buf);
+    er->bufRing    = mmap(NULL,
+			  er->bufRingLen,
+			  PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS,
+			  -1,
+			  0);
+
+    memset(&reg, 0, sizeof reg);
+    reg.ring_addr    = (unsigned long)er->bufRing;
+    reg.ring_entries = count;
+    reg.bgid         = 0;
+
+    if ((MAP_FAILED != er->bufRing)
+    &&  (0 != RingRegister(er->ring, IORING_REGISTER_PBUF_RING, &reg, 1)))
+    {
+	munmap(er->bufRing, er->bufRingLen);
+	er->bufRing = MAP_FAILED;
+    }
+
+    if (MAP_FAILED == er->bufRing)
+    {
+	er->bufRing = NULL;
+    }
+
+    for (i = count - 1; i >= 0; --i)
+    {
+	er->refs[i] = 1;
+	unref(er, i);
+    }
+
+    DBUG_PRINT("ring", ("%d buffers of %lu bytes, %s, %s",
+			count,
+			(unsigned long)bufferSize,
+			er->isFixed ? "registered" : "not registered",
+			(NULL != er->bufRing) ? "provided" : "chosen"));
+
+    return er;
+}
+
+/*------------------------------------------------------------------------------
+ * ringModify() - watch a descriptor for 'events', or stop if 0
+ */
+static int ringModify(struct event_ring* er, int fd, int events, void* data)
+{
+    struct ring_fd* rfd;
+    struct ring_op* op;
+
+    if (NULL == (rfd = ringFd(er, fd)))
+    {
+	return -1;
+    }
+
+    if ((NULL != (op = rfd->poll)) && !op->isArmed)
+    {
+	if (0 != events)		/* not yet submitted; just change it */
+	{
+	    op->events = events;
+	    op->data   = data;
+
+	    return 0;
+	}
+
+	op->isDead = 1;
+	rfd->poll  = NULL;
+
+	return 0;
+    }
+
+    if ((NULL != op) && (-1 == cancel(er, op)))
+    {
+	return -1;
+    }
+
+    rfd->poll = NULL;
+
+    if (0 == events)
+    {
+	return 0;
+    }
+
+    if (NULL == (op = newOp(er, ring_poll, fd, data)))
+    {
+	return -1;
+    }
+
+    op->events = events;
+    op->next   = er->rearm;
+    er->rearm  = op;
+    rfd->poll  = op;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * ringDelete() - stop watching and receiving on a descriptor
+ */
+static int ringDelete(struct event_ring* er, int fd)
+{
+    struct ring_fd* rfd;
+
+    if (NULL == (rfd = ringFd(er, fd)))
+    {
+	return -1;
+    }
+
+    if ((NULL != rfd->recv) && (-1 == cancel(er, rfd->recv)))
+    {
+	return -1;
+    }
+
+    rfd->recv = NULL;
+
+    return ringModify(er, fd, 0, NULL);
+}
+
+/*------------------------------------------------------------------------------
+ * ringPrepare() - submit the polls to re-arm, and receives given buffers
+ */
+static int ringPrepare(struct event_ring* er)
+{
+    struct ring_op* op;
+    struct ring_op* starved;
+
+    while (NULL != (op = er->rearm))
+    {
+	er->rearm = op->next;
+
+	if (op->isDead)
+	{
+	    freeOp(er, op);
+	}
+	else if (-1 == submitPoll(er, op))
+	{
+	    return -1;
+	}
+    }
+
+    starved     = er->starved;
+    er->starved = NULL;
+
+    while (NULL != (op = starved))
+    {
+	starved = op->next;
+
+	if (op->isDead)
+	{
+	    freeOp(er, op);
+	}
+	else if (-1 == submitRecv(er, op))
+	{
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * ringComplete() - handle one completion; returns 1 if it is to be reported
+ */
+static int ringComplete(
+	struct event_ring* er,
+	struct io_uring_cqe* cqe,
+	Event_t* ready)
+{
+    struct ring_op* op = (struct ring_op*)(unsigned long)cqe->user_data;
+    struct ring_fd* rfd;
+
+    int res = cqe->res;
+    int bufId;
+
+    if (NULL == op)
+    {
+	return 0;			/* a cancel */
+    }
+
+    op->isArmed = 0;
+
+    switch (op->kind)
+    {
+    case ring_poll:
+	if (op->isDead)
+	{
+	    freeOp(er, op);
+	    return 0;
+	}
+
+	ready->data   = op->data;
+	ready->events = 0;
+
+	if (res < 0)
+	{
+	    ready->events = EVENT_ERROR;
+	}
+	else
+	{
+	    if (res & EPOLLIN)
+	    {
+		ready->events |= EVENT_READ;
+	    }
+
+	    if (res & EPOLLOUT)
+	    {
+		ready->events |= EVENT_WRITE;
+	    }
+
+	    if (res & (EPOLLERR | EPOLLHUP))
+	    {
+		ready->events |= EVENT_ERROR;
+	    }
+	}
+
+	/* level-triggered, as with epoll(); re-armed at the next wait */
+	op->next  = er->rearm;
+	er->rearm = op;
+
+	return 1;
+
+    case ring_recv:
+	bufId = op->bufId;
+
+	if (cqe->flags & IORING_CQE_F_BUFFER)
+	{
+	    bufId = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	    er->refs[bufId] = 1;
+	    --er->freeCount;
+	}
+
+	if (op->isDead)
+	{
+	    if (0 <= bufId)
+	    {
+		unref(er, bufId);
+	    }
+
+	    freeOp(er, op);
+	    return 0;
+	}
+
+	if (-ENOBUFS == res)		/* the kernel's ring ran dry */
+	{
+	    op->next    = er->starved;
+	    er->starved = op;
+
+	    return 0;
+	}
+
+	if ((res <= 0) && (0 <= bufId))
+	{
+	    unref(er, bufId);
+	    bufId = -1;
+	}
+
+	er->fds[op->fd].recv = NULL;
+
+	ready->data   = op->data;
+	ready->events = EVENT_READ | EVENT_DATA;
+	ready->result = res;
+	ready->buf    = (0 <= bufId) ? er->pool + bufId * er->bufferSize : NULL;
+	ready->bufId  = bufId;
+
+	freeOp(er, op);
+
+	return 1;
+
+    case ring_write:
+	if ((0 < res) && ((size_t)res < op->len))
+	{
+	    op->buf    += res;		/* short; write the rest */
+	    op->len    -= res;
+	    op->offset += res;
+
+	    if (0 == submitWrite(er, op))
+	    {
+		return 0;
+	    }
+
+	    res = -errno;
+	}
+
+	if (0 <= op->bufId)
+	{
+	    unref(er, op->bufId);
+	}
+
+	rfd = &er->fds[op->fd];
+
+	--er->writes;
+
+	if ((0 == --rfd->writes) && rfd->isClosing)
+	{
+	    closeFd(er, op->fd);
+	}
+
+	ready->data   = op->data;
+	ready->events = EVENT_ERROR;
+	ready->result = (0 == res) ? -EIO : res;
+
+	freeOp(er, op);
+
+	return (0 < res) ? 0 : 1;	/* report only failures */
+
+    case ring_close:
+	--er->closes;
+	return 0;
+    }
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * ringWait() - submit what is queued, and wait for events to report
+ */
+static int ringWait(
+	struct event_ring* er,
+	Event_t* ready,
+	int maxReady,
+	int timeoutMs)
+{
+    struct io_uring_cqe* cqe;
+
+    int count = 0;
+
+    do
+    {
+	int isReaped = (NULL != RingPeek(er->ring));
+
+	if ((-1 == ringPrepare(er))
+	||  ((-1 == RingSubmit(er->ring,
+			       (isReaped || (0 == timeoutMs)) ? 0 : 1,
+			       timeoutMs))
+	     && (EBUSY != errno)))
+	{
+	    return -1;
+	}
+
+	while ((count < maxReady) && (NULL != (cqe = RingPeek(er->ring))))
+	{
+	    ready[count].result = 0;
+	    ready[count].buf    = NULL;
+	    ready[count].bufId  = -1;
+
+	    count += ringComplete(er, cqe, &ready[count]);
+
+	    RingSeen(er->ring);
+	}
+    }
+    while ((0 == count) && (-1 == timeoutMs));
+
+    return count;
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopCreate() - create an event loop for up to 'maxFds' descriptors
+ *
+ * Returns NULL on failure.
+ */
+EventLoop_t* EventLoopCreate(int maxFds)
+{
+    EventLoop_t* loop;
+
+    DBUG_ENTER("EventLoopCreate");
+
+    assert(maxFds > 0);
+
+    if (NULL == (loop = calloc(1, sizeof(EventLoop_t))))
+    {
+	DBUG_RETURN(NULL);
+    }
+
+    loop->maxReady = maxFds;
+
+    if (NULL == (loop->ready = calloc(maxFds, sizeof(struct epoll_event))))
+    {
+	free(loop);
+
+	DBUG_RETURN(NULL);
+    }
+
+    if (-1 == (loop->epfd = epoll_create(maxFds)))
+    {
+	DBUG_PRINT("syscall", ("epoll_create() failed"));
+
+	free(loop->ready);
+	free(loop);
+
+	DBUG_RETURN(NULL);
+    }
+
+    DBUG_RETURN(loop);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopCreateRing() - create an io_uring event loop
+ *
+ * Receives use a pool of 'buffers' buffers of 'bufferSize' bytes. Returns
+ * NULL on failure, or if the kernel lacks what is needed; the caller then
+ * falls back to EventLoopCreate().
+ */
+EventLoop_t* EventLoopCreateRing(int maxFds, int buffers, size_t bufferSize)
+{
+    EventLoop_t* loop;
+
+    DBUG_ENTER("EventLoopCreateRing");
+
+    assert(maxFds > 0);
+    assert(buffers > 0);
+
+    if (NULL == (loop = calloc(1, sizeof(EventLoop_t))))
+    {
+	DBUG_RETURN(NULL);
+    }
+
+    loop->epfd = -1;
+
+    if (NULL == (loop->ring = ringCreate(buffers, bufferSize)))
+    {
+	DBUG_PRINT("ring", ("io_uring unavailable, errno %d", errno));
+
+	free(loop);
+
+	DBUG_RETURN(NULL);
+    }
+
+    DBUG_RETURN(loop);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopFree() - free an event loop
+ */
+void EventLoopFree(EventLoop_t* loop)
+{
+    DBUG_ENTER("EventLoopFree");
+
+    if (NULL != loop)
+    {
+	if (NULL != loop->ring)
+	{
+	    ringFree(loop->ring);
+	}
+	else
+	{
+	    close(loop->epfd);
+	}
+
+	free(loop->ready);
+	free(loop);
+    }
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopAdd() - watch a descriptor
+ */
+int EventLoopAdd(EventLoop_t* loop, int fd, int events, void* data)
+{
+    struct epoll_event ev;
+
+    DBUG_ENTER("EventLoopAdd");
+
+    assert(NULL != loop);
+
+    if (NULL != loop->ring)
+    {
+	DBUG_RETURN(ringModify(loop->ring, fd, events, data));
+    }
+
+    memset(&ev, 0, sizeof ev);
+    ev.events   = toEpoll(events);
+    ev.data.ptr = data;
+
+    DBUG_RETURN(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev));
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopModify() - change the events watched on a descriptor
+ */
+int EventLoopModify(EventLoop_t* loop, int fd, int events, void* data)
+{
+    struct epoll_event ev;
+
+    DBUG_ENTER("EventLoopModify");
+
+    assert(NULL != loop);
+
+    if (NULL != loop->ring)
+    {
+	DBUG_RETURN(ringModify(loop->ring, fd, events, data));
+    }
+
+    memset(&ev, 0, sizeof ev);
+    ev.events   = toEpoll(events);
+    ev.data.ptr = data;
+
+    DBUG_RETURN(epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev));
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopDelete() - stop watching a descriptor
+ */
+int EventLoopDelete(EventLoop_t* loop, int fd)
+{
+    struct epoll_event ev;		/* pre 2.6.9 kernels want non-NULL */
+
+    DBUG_ENTER("EventLoopDelete");
+
+    assert(NULL != loop);
+
+    if (NULL != loop->ring)
+    {
+	DBUG_RETURN(ringDelete(loop->ring, fd));
+    }
+
+    memset(&ev, 0, sizeof ev);
+
+    DBUG_RETURN(epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, &ev));
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopWait() - wait for events
+ *
+ * Returns the number of 'ready' events, 0 on timeout.
+ */
+int EventLoopWait(EventLoop_t* loop, Event_t* ready, int maxReady, int timeoutMs)
+{
+    int count;
+    int i;
+
+    DBUG_ENTER("EventLoopWait");
+
+    assert(NULL != loop);
+    assert(NULL != ready);
+
+    if (NULL != loop->ring)
+    {
+	DBUG_RETURN(ringWait(loop->ring, ready, maxReady, timeoutMs));
+    }
+
+    if (maxReady > loop->maxReady)
+    {
+	maxReady = loop->maxReady;
+    }
+
+    if (-1 == (count = epoll_wait(loop->epfd, loop->ready, maxReady, timeoutMs)))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+	unsigned int events = loop->ready[i].events;
+
+	ready[i].data   = loop->ready[i].data.ptr;
+	ready[i].events = 0;
+	ready[i].result = 0;
+	ready[i].buf    = NULL;
+	ready[i].bufId  = -1;
+
+	if (events & EPOLLIN)
+	{
+	    ready[i].events |= EVENT_READ;
+	}
+
+	if (events & EPOLLOUT)
+	{
+	    ready[i].events |= EVENT_WRITE;
+	}
+
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+	    ready[i].events |= EVENT_ERROR;
+	}
+    }
+
+    DBUG_RETURN(count);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopName() - name the mechanism, for verbose messages
+ */
+const char* EventLoopName(EventLoop_t* loop)
+{
+    return (NULL != loop->ring) ? "io_uring" : "epoll";
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopRecv() - receive on a descriptor, once, into a pool buffer
+ *
+ * Completes as an EVENT_DATA event: 'result' bytes at 'buf', 0 at end of
+ * file, or -errno. The caller hands the buffer back with EventLoopRecycle().
+ * Only the io_uring backend receives; others fail with ENOSYS.
+ */
+int EventLoopRecv(EventLoop_t* loop, int fd, void* data)
+{
+    struct ring_fd* rfd;
+    struct ring_op* op;
+
+    DBUG_ENTER("EventLoopRecv");
+
+    assert(NULL != loop);
+
+    if (NULL == loop->ring)
+    {
+	errno = ENOSYS;
+
+	DBUG_RETURN(-1);
+    }
+
+    if ((NULL == (rfd = ringFd(loop->ring, fd)))
+    ||  (NULL == (op = newOp(loop->ring, ring_recv, fd, data))))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    assert(NULL == rfd->recv);
+
+    rfd->recv = op;
+
+    DBUG_RETURN(submitRecv(loop->ring, op));
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopRecycle() - done with a buffer from an EVENT_DATA event
+ */
+void EventLoopRecycle(EventLoop_t* loop, int bufId)
+{
+    assert(NULL != loop);
+
+    if ((NULL != loop->ring) && (0 <= bufId))
+    {
+	unref(loop->ring, bufId);
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopWrite() - write a whole buffer at a file offset
+ *
+ * With io_uring, the write is queued, and completes in the background; the
+ * bytes must stay put until then, unless they are in a pool buffer, which is
+ * held for the write. Only a failure is reported: an EVENT_ERROR event, for
+ * 'data', with -errno in 'result'. Other backends write before returning.
+ */
+int EventLoopWrite(
+	EventLoop_t* loop,
+	int fd,
+	const char* buf,
+	size_t len,
+	off_t offset,
+	void* data)
+{
+    struct ring_fd* rfd;
+    struct ring_op* op;
+
+    DBUG_ENTER("EventLoopWrite");
+
+    assert(NULL != loop);
+    assert(NULL != buf);
+
+    if (NULL == loop->ring)
+    {
+	DBUG_RETURN(writeAt(fd, buf, len, offset));
+    }
+
+    if (0 == len)
+    {
+	DBUG_RETURN(0);
+    }
+
+    if ((NULL == (rfd = ringFd(loop->ring, fd)))
+    ||  (NULL == (op = newOp(loop->ring, ring_write, fd, data))))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    op->buf    = buf;
+    op->len    = len;
+    op->offset = offset;
+    op->bufId  = bufferOf(loop->ring, buf, len);
+
+    if (0 <= op->bufId)
+    {
+	++loop->ring->refs[op->bufId];
+    }
+
+    ++rfd->writes;
+    ++loop->ring->writes;
+
+    DBUG_RETURN(submitWrite(loop->ring, op));
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopFlush() - wait until every queued write and close is done
+ *
+ * Other events that complete meanwhile are dropped; so this is for the end.
+ * Returns -1 if a write failed.
+ */
+int EventLoopFlush(EventLoop_t* loop)
+{
+    struct event_ring* er;
+    struct io_uring_cqe* cqe;
+    Event_t event;
+
+    int rc = 0;
+
+    DBUG_ENTER("EventLoopFlush");
+
+    assert(NULL != loop);
+
+    if (NULL == (er = loop->ring))
+    {
+	DBUG_RETURN(0);			/* written already */
+    }
+
+    while ((er->writes > 0) || (er->closes > 0))
+    {
+	if ((-1 == RingSubmit(er->ring, 1, -1)) && (EINTR != errno))
+	{
+	    DBUG_RETURN(-1);
+	}
+
+	while (NULL != (cqe = RingPeek(er->ring)))
+	{
+	    event.bufId = -1;
+
+	    if (ringComplete(er, cqe, &event)
+	    &&  (EVENT_ERROR == event.events)
+	    &&  (0 == rc))
+	    {
+		errno = -event.result;
+		rc    = -1;
+	    }
+
+	    EventLoopRecycle(loop, event.bufId);
+	    RingSeen(er->ring);
+	}
+    }
+
+    DBUG_RETURN(rc);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopClose() - stop watching a descriptor, and close it
+ *
+ * With io_uring, the close is queued behind the descriptor's writes.
+ */
+int EventLoopClose(EventLoop_t* loop, int fd)
+{
+    struct ring_fd* rfd;
+
+    DBUG_ENTER("EventLoopClose");
+
+    assert(NULL != loop);
+
+    if (NULL == loop->ring)
+    {
+	EventLoopDelete(loop, fd);	/* unless never watched */
+
+	DBUG_RETURN(close(fd));
+    }
+
+    if ((NULL == (rfd = ringFd(loop->ring, fd)))
+    ||  (-1 == ringDelete(loop->ring, fd)))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    if (rfd->writes > 0)
+    {
+	rfd->isClosing = 1;
+
+	DBUG_RETURN(0);
+    }
+
+    DBUG_RETURN(closeFd(loop->ring, fd));
+}
+
+#else /* !__linux__ */
+
+struct event_loop
+{
+    struct pollfd* fds;			/* watched descriptors */
+    void** data;			/* caller's data, per descriptor */
+    int count;				/* descriptors in use */
+    int maxFds;				/* descriptors allocated */
+};
+
+/*------------------------------------------------------------------------------
+ * toPoll() - translate EVENT_* flags to POLL* flags
+ */
+static short toPoll(int events)
+{
+    short result = 0;
+
+    if (events & EVENT_READ)
+    {
+	result |= POLLIN;
+    }
+
+    if (events & EVENT_WRITE)
+    {
+	result |= POLLOUT;
+    }
+
+    return result;
+}
+
+/*------------------------------------------------------------------------------
+ * find() - find a watched descriptor, returning its index, or -1
+ */
+static int find(EventLoop_t* loop, int fd)
+{
+    int i;
+
+    for (i = 0; i < loop->count; ++i)
+    {
+	if (fd == loop->fds[i].fd)
+	{
+	    return i;
+	}
+    }
+
+    return -1;
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopCreate() - create an event loop for up to 'maxFds' descriptors
+ *
+ * Returns NULL on failure.
+ */
+EventLoop_t* EventLoopCreate(int maxFds)
+{
+    EventLoop_t* loop;
+
+    DBUG_ENTER("EventLoopCreate");
+
+    assert(maxFds > 0);
+
+    if (NULL == (loop = calloc(1, sizeof(EventLoop_t))))
+    {
+	DBUG_RETURN(NULL);
+    }
+
+    loop->maxFds = maxFds;
+
+    if ((NULL == (loop->fds  = calloc(maxFds, sizeof(struct pollfd))))
+    ||  (NULL == (loop->data = calloc(maxFds, sizeof(void*)))))
+    {
+	free(loop->fds);
+	free(loop);
+
+	DBUG_RETURN(NULL);
+    }
+
+    DBUG_RETURN(loop);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopFree() - free an event loop
+ */
+void EventLoopFree(EventLoop_t* loop)
+{
+    DBUG_ENTER("EventLoopFree");
+
+    if (NULL != loop)
+    {
+	free(loop->fds);
+	free(loop->data);
+	free(loop);
+    }
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopAdd() - watch a descriptor
+ */
+int EventLoopAdd(EventLoop_t* loop, int fd, int events, void* data)
+{
+    DBUG_ENTER("EventLoopAdd");
+
+    assert(NULL != loop);
+
+    if (loop->count >= loop->maxFds)
+    {
+	errno = ENOSPC;
+
+	DBUG_RETURN(-1);
+    }
+
+    loop->fds[loop->count].fd      = fd;
+    loop->fds[loop->count].events  = toPoll(events);
+    loop->fds[loop->count].revents = 0;
+    loop->data[loop->count]        = data;
+    ++loop->count;
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopModify() - change the events watched on a descriptor
+ */
+int EventLoopModify(EventLoop_t* loop, int fd, int events, void* data)
+{
+    int i;
+
+    DBUG_ENTER("EventLoopModify");
+
+    assert(NULL != loop);
+
+    if (-1 == (i = find(loop, fd)))
+    {
+	errno = ENOENT;
+
+	DBUG_RETURN(-1);
+    }
+
+    loop->fds[i].events = toPoll(events);
+    loop->data[i]       = data;
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopDelete() - stop watching a descriptor
+ */
+int EventLoopDelete(EventLoop_t* loop, int fd)
+{
+    int i;
+
+    DBUG_ENTER("EventLoopDelete");
+
+    assert(NULL != loop);
+
+    if (-1 == (i = find(loop, fd)))
+    {
+	errno = ENOENT;
+
+	DBUG_RETURN(-1);
+    }
+
+    /* move the last entry into the hole */
+    --loop->count;
+    loop->fds[i]  = loop->fds[loop->count];
+    loop->data[i] = loop->data[loop->count];
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopWait() - wait for events
+ *
+ * Returns the number of 'ready' events, 0 on timeout.
+ */
+int EventLoopWait(EventLoop_t* loop, Event_t* ready, int maxReady, int timeoutMs)
+{
+    int count;
+    int i;
+    int n;
+
+    DBUG_ENTER("EventLoopWait");
+
+    assert(NULL != loop);
+    assert(NULL != ready);
+
+    if (-1 == (count = poll(loop->fds, loop->count, timeoutMs)))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    for (i = 0, n = 0; (i < loop->count) && (n < count) && (n < maxReady); ++i)
+    {
+	short revents = loop->fds[i].revents;
+
+	if (0 == revents)
+	{
+	    continue;
+	}
+
+	ready[n].data   = loop->data[i];
+	ready[n].events = 0;
+	ready[n].result = 0;
+	ready[n].buf    = NULL;
+	ready[n].bufId  = -1;
+
+	if (revents & POLLIN)
+	{
+	    ready[n].events |= EVENT_READ;
+	}
+
+	if (revents & POLLOUT)
+	{
+	    ready[n].events |= EVENT_WRITE;
+	}
+
+	if (revents & (POLLERR | POLLHUP | POLLNVAL))
+	{
+	    ready[n].events |= EVENT_ERROR;
+	}
+
+	++n;
+    }
+
+    DBUG_RETURN(n);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopName() - name the mechanism, for verbose messages
+ */
+const char* EventLoopName(EventLoop_t* loop)
+{
+    return "poll";
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopCreateRing() - io_uring is Linux only
+ */
+EventLoop_t* EventLoopCreateRing(int maxFds, int buffers, size_t bufferSize)
+{
+    errno = ENOSYS;
+
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopRecv() - only the io_uring backend receives
+ */
+int EventLoopRecv(EventLoop_t* loop, int fd, void* data)
+{
+    errno = ENOSYS;
+
+    return -1;
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopRecycle() - no buffers to recycle
+ */
+void EventLoopRecycle(EventLoop_t* loop, int bufId)
+{
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopWrite() - write a whole buffer at a file offset, now
+ */
+int EventLoopWrite(
+	EventLoop_t* loop,
+	int fd,
+	const char* buf,
+	size_t len,
+	off_t offset,
+	void* data)
+{
+    return writeAt(fd, buf, len, offset);
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopFlush() - nothing is queued
+ */
+int EventLoopFlush(EventLoop_t* loop)
+{
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * EventLoopClose() - stop watching a descriptor, and close it
+ */
+int EventLoopClose(EventLoop_t* loop, int fd)
+{
+    EventLoopDelete(loop, fd);
+
+    return close(fd);
+}
+
+#endif /* __linux__ */
+
+/*
+ * EOF
+ */
@@ -0,0 +1,49 @@
+#ifndef EVENT_H
+#define EVENT_H 1
+/*------------------------------------------------------------------------------
+ * Event.h -- readiness notification for many descriptors
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Event flags
+ */
+#define EVENT_READ	0x1		/* descriptor is readable */
+#define EVENT_WRITE	0x2		/* descriptor is writable */
+#define EVENT_ERROR	0x4		/* error or hangup */
+#define EVENT_DATA	0x8		/* EventLoopRecv() completed */
+
+struct event
+{
+    void* data;				/* caller's data */
+    int events;				/* EVENT_* flags */
+    int result;				/* bytes received, or -errno */
+    char* buf;				/* EVENT_DATA: the bytes received */
+    int bufId;				/* EVENT_DATA: to recycle, or -1 */
+};
+typedef struct event Event_t;
+
+typedef struct event_loop EventLoop_t;
+
+extern EventLoop_t* EventLoopCreate(int maxFds);
+extern EventLoop_t* EventLoopCreateRing(int maxFds, int buffers,
+	size_t bufferSize);
+extern void EventLoopFree(EventLoop_t* loop);
+extern int EventLoopAdd(EventLoop_t* loop, int fd, int events, void* data);
+extern int EventLoopModify(EventLoop_t* loop, int fd, int events, void* data);
+extern int EventLoopDelete(EventLoop_t* loop, int fd);
+extern int EventLoopWait(EventLoop_t* loop, Event_t* ready, int maxReady,
+	int timeoutMs);
+extern const char* EventLoopName(EventLoop_t* loop);
+
+extern int EventLoopRecv(EventLoop_t* loop, int fd, void* data);
+extern void EventLoopRecycle(EventLoop_t* loop, int bufId);
+extern int EventLoopWrite(EventLoop_t* loop, int fd, const char* buf,
+	size_t len, off_t offset, void* data);
+extern int EventLoopClose(EventLoop_t* loop, int fd);
+extern int EventLoopFlush(EventLoop_t* loop);
+
+#endif
@@ -0,0 +1,251 @@
+/*------------------------------------------------------------------------------
+ * Histogram.c -- HDR-style histograms of latencies
+ *
+ * After HdrHistogram: a value's bucket is found from its highest set bit,
+ * and its sub-bucket from the bits below that, with no search and no
+ * floating point; so recording is a few instructions, and percentiles are
+ * good to a fixed relative error however wide the range. Counts are
+ * allocated only as far as the largest value seen.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Histogram.h"
+
+#define HISTOGRAM_SUBS	(1 << HISTOGRAM_SUB_BITS)	/* exact below this */
+#define HISTOGRAM_HALF	(HISTOGRAM_SUBS >> 1)	/* sub-buckets per bucket */
+
+/*------------------------------------------------------------------------------
+ * indexOf() - the counts index of 'value'
+ */
+static int indexOf(long long value)
+{
+    int shift;
+
+    if (value < HISTOGRAM_SUBS)
+    {
+	return (int)value;
+    }
+
+    /* bits above the sub-bucket bits; at least 1 */
+    shift = 64 - __builtin_clzll((unsigned long long)value) - HISTOGRAM_SUB_BITS;
+
+    return (shift << (HISTOGRAM_SUB_BITS - 1)) + (int)(value >> shift);
+}
+
+/*------------------------------------------------------------------------------
+ * highestOf() - the greatest value counted at 'index'
+ */
+static long long highestOf(int index)
+{
+    int shift;
+
+    if (index < HISTOGRAM_SUBS)
+    {
+	return index;
+    }
+
+    shift = (index >> (HISTOGRAM_SUB_BITS - 1)) - 1;
+
+    return ((long long)(index - (shift << (HISTOGRAM_SUB_BITS - 1)) + 1)
+	    << shift) - 1;
+}
+
+/*------------------------------------------------------------------------------
+ * grow() - make room for counts up to 'index'; -1 if out of memory
+ */
+static int grow(Histogram_t* histogram, int index)
+{
+    uint32_t* counts;
+    int countLen;
+
+    if (index < histogram->countLen)
+    {
+	return 0;
+    }
+
+    /* whole buckets, at least twice as many */
+    countLen = (index + HISTOGRAM_HALF) & ~(HISTOGRAM_HALF - 1);
+
+    if (countLen < 2 * histogram->countLen)
+    {
+	countLen = 2 * histogram->countLen;
+    }
+
+    if (NULL == (counts = realloc(histogram->counts,
+				  countLen * sizeof(uint32_t))))
+    {
+	return -1;
+    }
+
+    memset(&counts[histogram->countLen],
+	   0,
+	   (countLen - histogram->countLen) * sizeof(uint32_t));
+
+    histogram->counts   = counts;
+    histogram->countLen = countLen;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * HistogramInit() - an empty histogram
+ */
+void HistogramInit(Histogram_t* histogram)
+{
+    assert(NULL != histogram);
+
+    memset(histogram, 0, sizeof *histogram);
+}
+
+/*------------------------------------------------------------------------------
+ * HistogramRecord() - count one value; negative values count as 0
+ *
+ * Returns 0, or -1 if out of memory.
+ */
+int HistogramRecord(Histogram_t* histogram, long long value)
+{
+    int index;
+
+    assert(NULL != histogram);
+
+    if (value < 0)
+    {
+	value = 0;
+    }
+
+    index = indexOf(value);
+
+    if (0 != grow(histogram, index))
+    {
+	return -1;
+    }
+
+    ++histogram->counts[index];
+
+    if ((0 == histogram->count) || (value < histogram->min))
+    {
+	histogram->min = value;
+    }
+
+    if ((0 == histogram->count) || (value > histogram->max))
+    {
+	histogram->max = value;
+    }
+
+    ++histogram->count;
+    histogram->sum += value;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * HistogramMerge() - add the counts of 'from' to 'to'
+ *
+ * Returns 0, or -1 if out of memory.
+ */
+int HistogramMerge(Histogram_t* to, const Histogram_t* from)
+{
+    int i;
+
+    assert(NULL != to);
+    assert(NULL != from);
+
+    if (0 == from->count)
+    {
+	return 0;
+    }
+
+    if (0 != grow(to, from->countLen - 1))
+    {
+	return -1;
+    }
+
+    for (i = 0; i < from->countLen; ++i)
+    {
+	to->counts[i] += from->counts[i];
+    }
+
+    if ((0 == to->count) || (from->min < to->min))
+    {
+	to->min = from->min;
+    }
+
+    if ((0 == to->count) || (from->max > to->max))
+    {
+	to->max = from->max;
+    }
+
+    to->count += from->count;
+    to->sum   += from->sum;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * HistogramPercentile() - the value 'percent' of the values are at or below
+ *
+ * As HdrHistogram reports it: the greatest value of the sub-bucket reached,
+ * though never beyond the greatest recorded. 0 if the histogram is empty.
+ */
+long long HistogramPercentile(const Histogram_t* histogram, double percent)
+{
+    long long wanted;
+    long long seen = 0;
+
+    int i;
+
+    assert(NULL != histogram);
+
+    if (0 == histogram->count)
+    {
+	return 0;
+    }
+
+    if (percent > 100)
+    {
+	percent = 100;
+    }
+
+    /* the rank of the value wanted, from 1: rounded up */
+    wanted = (long long)(percent / 100 * histogram->count);
+
+    if ((wanted < percent / 100 * histogram->count) || (wanted < 1))
+    {
+	++wanted;
+    }
+
+    for (i = 0; i < histogram->countLen; ++i)
+    {
+	if ((seen += histogram->counts[i]) >= wanted)
+	{
+	    break;
+	}
+    }
+
+    if ((i == histogram->countLen) || (highestOf(i) > histogram->max))
+    {
+	return histogram->max;
+    }
+
+    return highestOf(i);
+}
+
+/*------------------------------------------------------------------------------
+ * HistogramFree() - free the counts; the histogram is empty again
+ */
+void HistogramFree(Histogram_t* histogram)
+{
+    assert(NULL != histogram);
+
+    free(histogram->counts);
+
+    HistogramInit(histogram);
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,39 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H 1
+/*------------------------------------------------------------------------------
+ * Histogram.h -- HDR-style histograms of latencies
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stdint.h>
+
+/*
+ * Sub-buckets per power of two, as a power of two: values are kept within
+ * 1 part in 2^(HISTOGRAM_SUB_BITS - 1), about 1.6%
+ */
+#define HISTOGRAM_SUB_BITS 7
+
+/*
+ * Values below 2^HISTOGRAM_SUB_BITS are counted exactly; above, each power
+ * of two is split into the same number of equal sub-buckets, so that the
+ * error is relative. 'counts' grows to the largest value recorded. A zeroed
+ * histogram is empty.
+ */
+struct histogram
+{
+    uint32_t* counts;			/* by bucket index, or NULL */
+    int countLen;			/* elements in 'counts' */
+    long long count;			/* values recorded */
+    long long min;			/* least recorded, if any */
+    long long max;			/* greatest recorded, if any */
+    long double sum;			/* of the values, for the mean */
+};
+typedef struct histogram Histogram_t;
+
+extern void HistogramInit(Histogram_t* histogram);
+extern int HistogramRecord(Histogram_t* histogram, long long value);
+extern int HistogramMerge(Histogram_t* to, const Histogram_t* from);
+extern long long HistogramPercentile(const Histogram_t* histogram, double percent);
+extern void HistogramFree(Histogram_t* histogram);
+
+#endif
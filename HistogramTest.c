@@ -0,0 +1,138 @@
+/*------------------------------------------------------------------------------
+ * HistogramTest.c -- Test for HDR-style histograms
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Histogram.h"
+#include "dbug.h"
+
+#define TEST_VALUES 100000		/* random values per histogram */
+
+/*
+ * Percentiles checked, against the sorted values
+ */
+static double percents[] = { 0, 1, 10, 50, 90, 99, 99.9, 100 };
+
+/*
+ * compare() - order long longs, for qsort()
+ */
+static int compare(const void* a, const void* b)
+{
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * near() - is 'value' within the histogram's error of 'exact', and not below?
+ */
+static int near(long long value, long long exact)
+{
+    return (value >= exact)
+	&& (value - exact <= exact >> (HISTOGRAM_SUB_BITS - 1));
+}
+
+/*
+ * check() - compare the percentiles of 'histogram' with those of 'values'
+ */
+static int check(Histogram_t* histogram, long long* values, int count)
+{
+    int failures = 0;
+    int i;
+
+    qsort(values, count, sizeof *values, compare);
+
+    for (i = 0; i < (int)(sizeof percents / sizeof percents[0]); ++i)
+    {
+	long long rank = (long long)(percents[i] / 100 * count + 0.999999);
+	long long exact = values[(rank < 1) ? 0 : rank - 1];
+	long long value = HistogramPercentile(histogram, percents[i]);
+
+	if (!near(value, exact))
+	{
+	    printf("p%g is %lld, not about %lld\n", percents[i], value, exact);
+	    ++failures;
+	}
+    }
+
+    failures += (histogram->count != count);
+    failures += (histogram->min != values[0]);
+    failures += (histogram->max != values[count - 1]);
+
+    return failures;
+}
+
+/*
+ * stanadlone test program.
+ */
+int main(int argc, char** argv)
+{
+    static long long values[2 * TEST_VALUES];
+
+    Histogram_t a;
+    Histogram_t b;
+
+    int failures = 0;
+    int i;
+
+    DBUG_PUSH("d,test");
+    DBUG_ENTER("main");
+
+    srand(1);
+
+    HistogramInit(&a);
+    HistogramInit(&b);
+
+    /* empty */
+    failures += (0 != HistogramPercentile(&a, 50));
+
+    /* small values are exact */
+    for (i = 0; i < 100; ++i)
+    {
+	failures += (0 != HistogramRecord(&a, i + 1));
+    }
+
+    failures += (50 != HistogramPercentile(&a, 50));
+    failures += (99 != HistogramPercentile(&a, 99));
+    failures += (100 != HistogramPercentile(&a, 100));
+    failures += (1 != HistogramPercentile(&a, 0));
+
+    HistogramFree(&a);
+
+    /* log-uniform, from 1 us to about 1000 s */
+    for (i = 0; i < 2 * TEST_VALUES; ++i)
+    {
+	values[i] = (long long)1 << (rand() % 30);
+	values[i] += rand() % values[i];
+
+	failures += (0 != HistogramRecord((i < TEST_VALUES) ? &a : &b,
+					  values[i]));
+    }
+
+    failures += check(&a, values, TEST_VALUES);
+    failures += check(&b, &values[TEST_VALUES], TEST_VALUES);
+
+    /* merged, the same as recorded together */
+    failures += (0 != HistogramMerge(&a, &b));
+    failures += check(&a, values, 2 * TEST_VALUES);
+
+    /* negative values count as 0 */
+    HistogramFree(&b);
+    failures += (0 != HistogramRecord(&b, -5));
+    failures += (0 != b.min) || (0 != b.max);
+
+    HistogramFree(&a);
+    HistogramFree(&b);
+
+    DBUG_PRINT("test",((0 == failures) ? "Looks good!" : "Failed"));
+
+    DBUG_RETURN(0 != failures);
+}
+
+/*
+ * EOF
+ */
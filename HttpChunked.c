@@ -0,0 +1,235 @@
+/*------------------------------------------------------------------------------
+ * HttpChunked.c -- incremental decoder for a chunked response body
+ *
+ * Like the header parser, the decoder is fed arbitrary slices of the
+ * response, as they arrive from the socket, and remembers its position
+ * between them; a size line or CR/LF split across reads costs nothing extra.
+ *
+ * Chunk data is never copied: each span is handed to the sink where it lies,
+ * in the caller's buffer. The size line is parsed a byte at a time, chunk
+ * extensions are skipped, and the trailers are passed to a header parser.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <limits.h>
+
+#include "HttpChunked.h"
+#include "Scan.h"
+#include "dbug.h"
+
+/*------------------------------------------------------------------------------
+ * endSizeLine() - the size line is complete; expect data, or the trailers
+ */
+static void endSizeLine(HttpChunked_t* chunked)
+{
+    DBUG_PRINT("chunk", ("0x%lx %ld.", chunked->remaining, chunked->remaining));
+
+    if (0 == chunked->remaining)	/* last chunk */
+    {
+	HttpHeaderInit(chunked->trailer, 1);
+	chunked->state = http_chunked_trailers;
+    }
+    else
+    {
+	chunked->state = http_chunked_data;
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * HttpChunkedInit() - prepare to decode a chunked body
+ *
+ * The trailers are parsed by 'trailer', which is initialized when they begin;
+ * so it may be the parser that read the response headers. The sink and its
+ * context are left as they were.
+ */
+void HttpChunkedInit(HttpChunked_t* chunked, HttpHeader_t* trailer)
+{
+    DBUG_ENTER("HttpChunkedInit");
+
+    assert(NULL != chunked);
+    assert(NULL != trailer);
+
+    chunked->trailer   = trailer;
+    chunked->remaining = 0;
+    chunked->digits    = 0;
+    chunked->state     = http_chunked_size;
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * HttpChunkedPush() - decode the next slice of the body
+ *
+ * Sets '*consumed' to the number of bytes used. On HTTP_CHUNKED_DONE, that is
+ * just past the blank line that ends the trailers, so the rest of the slice
+ * is the next response. Otherwise, every byte has been used.
+ */
+int HttpChunkedPush(HttpChunked_t* chunked,
+	const char* buf, size_t len, size_t* consumed)
+{
+    const char* p = buf;
+    const char* end = buf + len;
+
+    DBUG_ENTER("HttpChunkedPush");
+
+    assert(NULL != chunked);
+    assert(NULL != chunked->sink);
+    assert(NULL != buf);
+    assert(NULL != consumed);
+
+    while (p < end)
+    {
+	const char* t;
+	size_t n;
+	int digit;
+	int rc;
+
+	switch (chunked->state)
+	{
+	case http_chunked_size:
+	    if (0 <= (digit = ScanHexValue[(unsigned char)*p]))
+	    {
+		if (chunked->remaining > (LONG_MAX >> 4))
+		{
+		    DBUG_PRINT("chunk", ("chunk size overflow"));
+		    break;
+		}
+
+		chunked->remaining = (chunked->remaining << 4) | digit;
+		++chunked->digits;
+		++p;
+		continue;
+	    }
+
+	    if (0 == chunked->digits)
+	    {
+		DBUG_PRINT("chunk", ("no chunk size digits"));
+		break;
+	    }
+
+	    chunked->digits = 0;
+
+	    if ('\r' == *p)
+	    {
+		chunked->state = http_chunked_size_lf;
+	    }
+	    else if ('\n' == *p)	/* tolerate a bare LF */
+	    {
+		endSizeLine(chunked);
+	    }
+	    else if ((';' == *p) || (' ' == *p) || ('\t' == *p))
+	    {
+		chunked->state = http_chunked_extension;
+	    }
+	    else
+	    {
+		DBUG_PRINT("chunk", ("bad character after chunk size"));
+		break;
+	    }
+
+	    ++p;
+	    continue;
+
+	case http_chunked_extension:
+	    if (NULL == (t = ScanChar(p, end, '\n')))
+	    {
+		p = end;		/* extension continues in next slice */
+		continue;
+	    }
+
+	    p = t + 1;
+	    endSizeLine(chunked);
+	    continue;
+
+	case http_chunked_size_lf:
+	case http_chunked_data_lf:
+	    if ('\n' != *p)
+	    {
+		DBUG_PRINT("chunk", ("CR not followed by LF"));
+		break;
+	    }
+
+	    ++p;
+
+	    if (http_chunked_size_lf == chunked->state)
+	    {
+		endSizeLine(chunked);
+	    }
+	    else
+	    {
+		chunked->state = http_chunked_size;
+	    }
+	    continue;
+
+	case http_chunked_data:
+	    n = end - p;
+
+	    if (n > (size_t)chunked->remaining)
+	    {
+		n = chunked->remaining;
+	    }
+
+	    if (0 != chunked->sink(chunked->context, p, n))
+	    {
+		*consumed = p - buf;
+
+		DBUG_RETURN(HTTP_CHUNKED_ABORT);
+	    }
+
+	    p += n;
+
+	    if (0 == (chunked->remaining -= n))
+	    {
+		chunked->state = http_chunked_data_cr;
+	    }
+	    continue;
+
+	case http_chunked_data_cr:
+	    if ('\r' == *p)
+	    {
+		chunked->state = http_chunked_data_lf;
+	    }
+	    else if ('\n' == *p)	/* tolerate a bare LF */
+	    {
+		chunked->state = http_chunked_size;
+	    }
+	    else
+	    {
+		DBUG_PRINT("chunk", ("chunk data did not end with CR/LF"));
+		break;
+	    }
+
+	    ++p;
+	    continue;
+
+	case http_chunked_trailers:
+	    rc = HttpHeaderPush(chunked->trailer, p, end - p, &n);
+	    p += n;
+
+	    if (HTTP_HEADER_MORE == rc)
+	    {
+		continue;
+	    }
+
+	    *consumed = p - buf;
+
+	    DBUG_RETURN((HTTP_HEADER_DONE == rc)
+			? HTTP_CHUNKED_DONE
+			: HTTP_CHUNKED_ERROR);
+	}
+
+	/* malformed; only a 'break' above gets here */
+	*consumed = p - buf;
+
+	DBUG_RETURN(HTTP_CHUNKED_ERROR);
+    }
+
+    *consumed = len;
+
+    DBUG_RETURN(HTTP_CHUNKED_MORE);
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,54 @@
+#ifndef HTTPCHUNKED_H
+#define HTTPCHUNKED_H 1
+/*------------------------------------------------------------------------------
+ * HttpChunked.h -- incremental decoder for a chunked response body
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stddef.h>
+
+#include "HttpHeader.h"
+
+/*
+ * HttpChunkedPush() return codes
+ */
+#define HTTP_CHUNKED_ABORT (-2)		/* the sink failed */
+#define HTTP_CHUNKED_ERROR (-1)		/* malformed body */
+#define HTTP_CHUNKED_MORE  0		/* need more bytes */
+#define HTTP_CHUNKED_DONE  1		/* found the end of the trailers */
+
+/*
+ * Called with each span of chunk data, in place; returns 0, or -1 to abort.
+ */
+typedef int (*HttpChunkedSink_t)(void* context, const char* buf, size_t len);
+
+/*
+ * Decoder states
+ */
+enum http_chunked_state
+{
+    http_chunked_size = 0,		/* in the chunk size digits */
+    http_chunked_extension,		/* in "; name=value", or spaces */
+    http_chunked_size_lf,		/* expect LF after the size line */
+    http_chunked_data,			/* in the chunk data */
+    http_chunked_data_cr,		/* expect CR after the data */
+    http_chunked_data_lf,		/* expect LF after the data */
+    http_chunked_trailers		/* in the trailers */
+};
+
+struct http_chunked
+{
+    HttpChunkedSink_t sink;		/* receives the chunk data */
+    void* context;			/* passed to 'sink' */
+    HttpHeader_t* trailer;		/* parses the trailers */
+    long remaining;			/* chunk size, then bytes left */
+    int digits;				/* size digits seen */
+    enum http_chunked_state state;	/* where the last slice ended */
+};
+typedef struct http_chunked HttpChunked_t;
+
+extern void HttpChunkedInit(HttpChunked_t* chunked, HttpHeader_t* trailer);
+extern int HttpChunkedPush(HttpChunked_t* chunked,
+	const char* buf, size_t len, size_t* consumed);
+
+#endif
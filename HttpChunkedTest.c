@@ -0,0 +1,185 @@
+/*------------------------------------------------------------------------------
+ * HttpChunkedTest.c -- Test for incremental chunked body decoding
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "HttpChunked.h"
+#include "dbug.h"
+
+/*
+ * Sample body: tiny chunks, an extension, trailers, then the next response.
+ */
+static char* body =
+    "5\r\n"
+    "Hello\r\n"
+    "1\r\n"
+    ",\r\n"
+    "1\r\n"
+    " \r\n"
+    "0000A;name=\"value\"\r\n"
+    "chunked wo\r\n"
+    "3 \r\n"
+    "rld\r\n"
+    "0\r\n"
+    "X-Trailer: yes\r\n"
+    "\r\n"
+    "NEXT";
+
+static char* decoded = "Hello, chunked world";
+
+/*
+ * Malformed bodies
+ */
+static char* malformed[] =
+{
+    "\r\n",				/* no size */
+    "g\r\n",				/* not hex */
+    "5\r\nHelloXX",			/* data not followed by CR/LF */
+    "5\rX",				/* CR not followed by LF */
+    "fffffffffffffffff\r\n",		/* overflow */
+    NULL
+};
+
+/*
+ * Sink output
+ */
+struct output
+{
+    char buf[64];
+    size_t len;
+    int isFull;
+};
+
+/*
+ * sink() - collect the decoded data; fails once 'buf' is full.
+ */
+static int sink(void* context, const char* buf, size_t len)
+{
+    struct output* output = context;
+
+    if (len > sizeof output->buf - output->len)
+    {
+	output->isFull = 1;
+	return -1;
+    }
+
+    memcpy(&output->buf[output->len], buf, len);
+    output->len += len;
+
+    return 0;
+}
+
+/*
+ * decode() - decode 's' in slices of at most 'step' bytes, split first at
+ * 'split'. Returns the last return code, and the offset reached.
+ */
+static int decode(char* s, size_t split, size_t step,
+	struct output* output, size_t* offset)
+{
+    HttpHeader_t trailer;
+    HttpChunked_t chunked;
+
+    size_t len = strlen(s);
+    size_t consumed;
+
+    int rc = HTTP_CHUNKED_MORE;
+    int isFirst = 1;
+
+    memset(output, 0, sizeof *output);
+
+    chunked.sink = sink;
+    chunked.context = output;
+    trailer.callback = NULL;
+    HttpChunkedInit(&chunked, &trailer);
+
+    *offset = 0;
+
+    while ((HTTP_CHUNKED_MORE == rc) && (*offset < len))
+    {
+	size_t n = isFirst ? split : step;
+
+	if (n > len - *offset)
+	{
+	    n = len - *offset;
+	}
+
+	rc = HttpChunkedPush(&chunked, &s[*offset], n, &consumed);
+	*offset += consumed;
+	isFirst = 0;
+    }
+
+    return rc;
+}
+
+/*
+ * parse() - decode 'body'. Returns 0 if the result is as expected.
+ */
+static int parse(size_t split, size_t step)
+{
+    struct output output;
+    size_t offset;
+
+    int rc = decode(body, split, step, &output, &offset);
+
+    return (HTTP_CHUNKED_DONE != rc)
+	|| (strlen(decoded) != output.len)
+	|| (0 != memcmp(output.buf, decoded, output.len))
+	|| (0 != strcmp(&body[offset], "NEXT"));
+}
+
+/*
+ * reject() - decode a malformed body. Returns 0 if it is rejected.
+ */
+static int reject(char* s, size_t step)
+{
+    struct output output;
+    size_t offset;
+
+    return HTTP_CHUNKED_ERROR != decode(s, step, step, &output, &offset);
+}
+
+/*
+ * stanadlone test program.
+ */
+int main(int argc, char** argv)
+{
+    struct output output;
+    size_t offset;
+    size_t split;
+    int failures = 0;
+    int i;
+
+    DBUG_PUSH("d,test");
+    DBUG_ENTER("main");
+
+    for (split = 0; split <= strlen(body); ++split)
+    {
+	failures += parse(split, 1);
+	failures += parse(split, 3);
+	failures += parse(split, strlen(body));
+    }
+
+    for (i = 0; NULL != malformed[i]; ++i)
+    {
+	failures += reject(malformed[i], 1);
+	failures += reject(malformed[i], strlen(malformed[i]));
+    }
+
+    /* a failing sink stops the decoder */
+    failures += (HTTP_CHUNKED_ABORT != decode(
+	"41\r\n"
+	"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+	"x\r\n",
+	80, 80, &output, &offset)) || !output.isFull;
+
+    DBUG_PRINT("test",((0 == failures) ? "Looks good!" : "Failed"));
+
+    DBUG_RETURN(0 != failures);
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,458 @@
+/*------------------------------------------------------------------------------
+ * HttpHeader.c -- incremental HTTP response header parser
+ *
+ * The parser is fed arbitrary slices of the response, as they arrive from
+ * the socket. It remembers its position between slices, so each byte is
+ * examined once; a header block split across reads costs nothing extra, and
+ * its total size is not limited by the receive buffer.
+ *
+ * Only the current line is held, in a small fixed buffer. The parser
+ * understands the status line, Content-Length, Content-Range,
+ * Content-Encoding, Transfer-Encoding and Connection, and keeps the
+ * validators, ETag and Last-Modified; every header line is also offered to
+ * the caller's callback, if any.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "HttpHeader.h"
+#include "Scan.h"
+#include "dbug.h"
+
+#define HTTP_VERSION_PREFIX	"HTTP/"
+#define HTTP_CONTENT_LENGTH	"Content-Length"
+#define HTTP_CONTENT_RANGE	"Content-Range"
+#define HTTP_BYTES		"bytes "
+#define HTTP_CONTENT_ENCODING	"Content-Encoding"
+#define HTTP_GZIP		"gzip"
+#define HTTP_X_GZIP		"x-gzip"
+#define HTTP_DEFLATE		"deflate"
+#define HTTP_IDENTITY		"identity"
+#define HTTP_TRANSFER_ENCODING	"Transfer-Encoding"
+#define HTTP_CHUNKED		"chunked"
+#define HTTP_CONNECTION		"Connection"
+#define HTTP_ETAG		"ETag"
+#define HTTP_LAST_MODIFIED	"Last-Modified"
+#define HTTP_CLOSE		"close"
+#define HTTP_KEEP_ALIVE		"keep-alive"
+
+/*------------------------------------------------------------------------------
+ * isToken() - does a counted string match a token, ignoring case?
+ */
+static int isToken(const char* s, size_t len, const char* token)
+{
+    return (len == strlen(token)) && (0 == strncasecmp(s, token, len));
+}
+
+/*------------------------------------------------------------------------------
+ * parseStatusLine() - parse "HTTP/1.1 200 OK"
+ */
+static int parseStatusLine(HttpHeader_t* header, char* line, size_t len)
+{
+    size_t n;
+
+    DBUG_ENTER("parseStatusLine");
+
+    /* keep a copy, for messages */
+    n = (len < sizeof header->statusLine) ? len : sizeof header->statusLine - 1;
+    memcpy(header->statusLine, line, n);
+    header->statusLine[n] = '\0';
+
+    DBUG_PRINT("responseHeader", ("%s", header->statusLine));
+
+    /* "HTTP/x.y NNN" */
+    if ((len < strlen(HTTP_VERSION_PREFIX "1.1 200"))
+    ||  (0 != strncmp(line, HTTP_VERSION_PREFIX, strlen(HTTP_VERSION_PREFIX)))
+    ||  (' ' != line[8])
+    ||  !isdigit((unsigned char)line[9])
+    ||  !isdigit((unsigned char)line[10])
+    ||  !isdigit((unsigned char)line[11]))
+    {
+	DBUG_RETURN(HTTP_HEADER_ERROR);
+    }
+
+    header->status = (line[9]  - '0') * 100
+		   + (line[10] - '0') * 10
+		   + (line[11] - '0');
+    header->isStatusSeen = 1;
+
+    /* HTTP/1.0 closes, unless asked to keep alive */
+    header->isClose = (0 == strncmp(line, HTTP_VERSION_PREFIX "1.0", 8));
+
+    DBUG_RETURN(HTTP_HEADER_MORE);
+}
+
+/*------------------------------------------------------------------------------
+ * parseNumber() - parse a run of decimal digits; NULL if there are none
+ */
+static char* parseNumber(char* p, long* n)
+{
+    char* end;
+
+    if (!isdigit((unsigned char)*p))
+    {
+	return NULL;
+    }
+
+    *n = strtol(p, &end, 10);
+
+    return end;
+}
+
+/*------------------------------------------------------------------------------
+ * parseContentRange() - parse "bytes 0-499/1234"
+ *
+ * The length may be "*", if unknown; an unsatisfied range, "*" in place of
+ * the bytes, has only the length. Anything else leaves the range unknown.
+ */
+static void parseContentRange(HttpHeader_t* header, char* value, size_t len)
+{
+    long first = -1;
+    long last  = -1;
+    long total = -1;
+
+    char* p;
+
+    DBUG_ENTER("parseContentRange");
+
+    value[len] = '\0';			/* 'line' has room */
+
+    if ((len < strlen(HTTP_BYTES))
+    ||  (0 != strncasecmp(value, HTTP_BYTES, strlen(HTTP_BYTES))))
+    {
+	DBUG_VOID_RETURN;		/* not in bytes */
+    }
+
+    p = value + strlen(HTTP_BYTES);
+
+    if ('*' == *p)
+    {
+	++p;
+    }
+    else if ((NULL == (p = parseNumber(p, &first)))
+	 ||  ('-' != *p)
+	 ||  (NULL == (p = parseNumber(p + 1, &last)))
+	 ||  (last < first))
+    {
+	DBUG_VOID_RETURN;
+    }
+
+    if ('/' != *p++)
+    {
+	DBUG_VOID_RETURN;
+    }
+
+    if ('*' == *p)
+    {
+	++p;
+    }
+    else if ((NULL == (p = parseNumber(p, &total)))
+	 ||  ((first >= 0) && (last >= total)))
+    {
+	DBUG_VOID_RETURN;
+    }
+
+    if (('\0' != *p) || ((first < 0) && (total < 0)))
+    {
+	DBUG_VOID_RETURN;
+    }
+
+    header->rangeFirst = first;
+    header->rangeLast  = last;
+    header->rangeTotal = total;
+
+    DBUG_PRINT("responseHeader",
+	      ("%s %ld-%ld/%ld", HTTP_CONTENT_RANGE, first, last, total));
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * keepValidator() - keep a validator, unless too long to keep whole
+ */
+static void keepValidator(char* buf, const char* value, size_t len)
+{
+    if (len < HTTP_HEADER_VALIDATOR_MAX)
+    {
+	memcpy(buf, value, len);
+	buf[len] = '\0';
+    }
+    else
+    {
+	buf[0] = '\0';
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * parseEncoding() - classify a Content-Encoding value
+ *
+ * Only a single coding is understood; a list, such as "gzip, gzip", is not.
+ */
+static int parseEncoding(const char* value, size_t len)
+{
+    if ((0 == len) || isToken(value, len, HTTP_IDENTITY))
+    {
+	return HTTP_ENCODING_IDENTITY;
+    }
+
+    if (isToken(value, len, HTTP_GZIP) || isToken(value, len, HTTP_X_GZIP))
+    {
+	return HTTP_ENCODING_GZIP;
+    }
+
+    if (isToken(value, len, HTTP_DEFLATE))
+    {
+	return HTTP_ENCODING_DEFLATE;
+    }
+
+    return HTTP_ENCODING_OTHER;
+}
+
+/*------------------------------------------------------------------------------
+ * parseLine() - parse one complete line, without its CR/LF
+ */
+static int parseLine(HttpHeader_t* header, char* line, size_t len)
+{
+    char* colon;
+    char* value;
+    size_t nameLen;
+    size_t valueLen;
+
+    DBUG_ENTER("parseLine");
+
+    if (!header->isTrailer && !header->isStatusSeen)
+    {
+	DBUG_RETURN(parseStatusLine(header, line, len));
+    }
+
+    if (NULL == (colon = (char*)ScanChar(line, line + len, ':')))
+    {
+	DBUG_PRINT("responseHeader", ("ignored line without ':'"));
+
+	DBUG_RETURN(HTTP_HEADER_MORE);	/* be lenient */
+    }
+
+    nameLen = colon - line;
+
+    /* trim the value */
+    for (value = colon + 1;
+	 (value < line + len) && isspace((unsigned char)*value);
+	 ++value)
+    {
+	;
+    }
+
+    for (valueLen = (line + len) - value;
+	 (valueLen > 0) && isspace((unsigned char)value[valueLen - 1]);
+	 --valueLen)
+    {
+	;
+    }
+
+    if (isToken(line, nameLen, HTTP_CONTENT_LENGTH))
+    {
+	char* end;
+
+	long contentLength;
+
+	value[valueLen] = '\0';		/* 'line' has room */
+	errno = 0;
+	contentLength = strtol(value, &end, 10);
+
+	/*
+	 * Digits only, to the (trimmed) end: not "12abc", nor "12, 13". A
+	 * repeated header must agree with the first (RFC 9112, 6.3), or the
+	 * framing of every later pipelined response is in doubt.
+	 */
+	if (!isdigit((unsigned char)*value)
+	||  ('\0' != *end)
+	||  (ERANGE == errno)
+	||  ((-1 != header->contentLength)
+	     && (contentLength != header->contentLength)))
+	{
+	    DBUG_RETURN(HTTP_HEADER_ERROR);
+	}
+
+	header->contentLength = contentLength;
+
+	DBUG_PRINT("responseHeader",
+		  ("%s %ld", HTTP_CONTENT_LENGTH, header->contentLength));
+    }
+    else if (isToken(line, nameLen, HTTP_CONTENT_RANGE))
+    {
+	parseContentRange(header, value, valueLen);
+    }
+    else if (isToken(line, nameLen, HTTP_ETAG))
+    {
+	keepValidator(header->etag, value, valueLen);
+    }
+    else if (isToken(line, nameLen, HTTP_LAST_MODIFIED))
+    {
+	keepValidator(header->lastModified, value, valueLen);
+    }
+    else if (isToken(line, nameLen, HTTP_CONTENT_ENCODING))
+    {
+	header->contentEncoding = parseEncoding(value, valueLen);
+    }
+    else if (isToken(line, nameLen, HTTP_TRANSFER_ENCODING))
+    {
+	/* the final coding is what matters: "gzip, chunked" */
+	if ((valueLen >= strlen(HTTP_CHUNKED))
+	&&  isToken(value + valueLen - strlen(HTTP_CHUNKED),
+		    strlen(HTTP_CHUNKED),
+		    HTTP_CHUNKED))
+	{
+	    header->isChunked = 1;
+	    DBUG_PRINT("responseHeader", ("%s chunked", HTTP_TRANSFER_ENCODING));
+	}
+    }
+
+    else if (isToken(line, nameLen, HTTP_CONNECTION))
+    {
+	if (isToken(value, valueLen, HTTP_CLOSE))
+	{
+	    header->isClose = 1;
+	}
+	else if (isToken(value, valueLen, HTTP_KEEP_ALIVE))
+	{
+	    header->isClose = 0;
+	}
+    }
+
+    if (NULL != header->callback)
+    {
+	header->callback(header->context, line, nameLen, value, valueLen);
+    }
+
+    DBUG_RETURN(HTTP_HEADER_MORE);
+}
+
+/*------------------------------------------------------------------------------
+ * HttpHeaderInit() - prepare to parse a header block
+ *
+ * Trailers (following a chunked body) have no status line; what was learned
+ * from the response headers is kept. The callback, if any, is left as it was.
+ */
+void HttpHeaderInit(HttpHeader_t* header, int isTrailer)
+{
+    DBUG_ENTER("HttpHeaderInit");
+
+    assert(NULL != header);
+
+    if (!isTrailer)
+    {
+	header->contentLength   = -1;
+	header->rangeFirst      = -1;
+	header->rangeLast       = -1;
+	header->rangeTotal      = -1;
+	header->status          = 0;
+	header->contentEncoding = HTTP_ENCODING_IDENTITY;
+	header->isChunked       = 0;
+	header->isClose         = 0;
+	header->isStatusSeen    = 0;
+	header->statusLine[0]   = '\0';
+	header->etag[0]         = '\0';
+	header->lastModified[0] = '\0';
+    }
+
+    header->isTrailer       = isTrailer;
+    header->lineLen         = 0;
+    header->isLineTruncated = 0;
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * HttpHeaderPush() - parse the next slice of the header block
+ *
+ * Sets '*consumed' to the number of bytes used. On HTTP_HEADER_DONE, that is
+ * just past the blank line, so the rest of the slice is body. Otherwise,
+ * every byte has been used.
+ */
+int HttpHeaderPush(HttpHeader_t* header,
+	const char* buf, size_t len, size_t* consumed)
+{
+    const char* p = buf;
+    const char* end = buf + len;
+
+    DBUG_ENTER("HttpHeaderPush");
+
+    assert(NULL != header);
+    assert(NULL != buf);
+    assert(NULL != consumed);
+
+    while (p < end)
+    {
+	const char* nl = ScanChar(p, end, '\n');
+	size_t n = ((NULL == nl) ? end : nl) - p;
+	size_t room = sizeof header->line - 1 - header->lineLen;
+
+	/* accumulate the line, so far */
+	if (n > room)
+	{
+	    header->isLineTruncated = 1;
+	    n = room;
+	}
+
+	memcpy(&header->line[header->lineLen], p, n);
+	header->lineLen += n;
+
+	if (NULL == nl)
+	{
+	    break;			/* line continues in next slice */
+	}
+
+	p = nl + 1;
+
+	/* strip the CR, tolerating a bare LF */
+	if ((header->lineLen > 0) && ('\r' == header->line[header->lineLen - 1]))
+	{
+	    --header->lineLen;
+	}
+
+	header->line[header->lineLen] = '\0';
+
+	if (0 == header->lineLen)	/* found header terminator */
+	{
+	    if (!header->isTrailer && !header->isStatusSeen)
+	    {
+		*consumed = p - buf;
+
+		DBUG_RETURN(HTTP_HEADER_ERROR);
+	    }
+
+	    *consumed = p - buf;
+
+	    DBUG_RETURN(HTTP_HEADER_DONE);
+	}
+
+	if (header->isLineTruncated)
+	{
+	    DBUG_PRINT("responseHeader", ("long line truncated"));
+	}
+
+	if (HTTP_HEADER_ERROR == parseLine(header, header->line, header->lineLen))
+	{
+	    *consumed = p - buf;
+
+	    DBUG_RETURN(HTTP_HEADER_ERROR);
+	}
+
+	header->lineLen = 0;
+	header->isLineTruncated = 0;
+    }
+
+    *consumed = len;
+
+    DBUG_RETURN(HTTP_HEADER_MORE);
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,69 @@
+#ifndef HTTPHEADER_H
+#define HTTPHEADER_H 1
+/*------------------------------------------------------------------------------
+ * HttpHeader.h -- incremental HTTP response header parser
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stddef.h>
+
+/*
+ * Longest header line kept; the rest of a longer line is skipped.
+ */
+#define HTTP_HEADER_LINE_MAX 1024
+
+/*
+ * Longest validator kept; a longer one is ignored, not truncated.
+ */
+#define HTTP_HEADER_VALIDATOR_MAX 128
+
+/*
+ * Content-Encoding values
+ */
+#define HTTP_ENCODING_IDENTITY	0	/* none, or "identity" */
+#define HTTP_ENCODING_GZIP	1	/* "gzip", or "x-gzip" */
+#define HTTP_ENCODING_DEFLATE	2	/* "deflate" */
+#define HTTP_ENCODING_OTHER	3	/* anything else, or several */
+
+/*
+ * HttpHeaderPush() return codes
+ */
+#define HTTP_HEADER_ERROR (-1)		/* malformed headers */
+#define HTTP_HEADER_MORE  0		/* need more bytes */
+#define HTTP_HEADER_DONE  1		/* found the blank line */
+
+/*
+ * Called for every header line, with the name and (trimmed) value.
+ */
+typedef void (*HttpHeaderCallback_t)(void* context,
+	const char* name, size_t nameLen,
+	const char* value, size_t valueLen);
+
+struct http_header
+{
+    HttpHeaderCallback_t callback;	/* optional, per header line */
+    void* context;			/* passed to 'callback' */
+    long contentLength;			/* Content-Length, or -1 */
+    long rangeFirst;			/* Content-Range: first byte, or -1 */
+    long rangeLast;			/* Content-Range: last byte, or -1 */
+    long rangeTotal;			/* Content-Range: length, or -1 */
+    int status;				/* status code, e.g. 200 */
+    int contentEncoding;		/* HTTP_ENCODING_* */
+    int isChunked;			/* Transfer-Encoding: chunked? */
+    int isClose;			/* will the server close? */
+    int isTrailer;			/* parsing trailers (no status line)? */
+    int isStatusSeen;			/* status line parsed? */
+    int lineLen;			/* bytes held in 'line' */
+    int isLineTruncated;		/* did 'line' overflow? */
+    char statusLine[128];		/* status line, for messages */
+    char etag[HTTP_HEADER_VALIDATOR_MAX];		/* ETag, or "" */
+    char lastModified[HTTP_HEADER_VALIDATOR_MAX];	/* or "" */
+    char line[HTTP_HEADER_LINE_MAX];	/* current line, so far */
+};
+typedef struct http_header HttpHeader_t;
+
+extern void HttpHeaderInit(HttpHeader_t* header, int isTrailer);
+extern int HttpHeaderPush(HttpHeader_t* header,
+	const char* buf, size_t len, size_t* consumed);
+
+#endif
@@ -0,0 +1,179 @@
+/*------------------------------------------------------------------------------
+ * HttpHeaderTest.c -- Test for incremental HTTP header parsing
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "HttpHeader.h"
+#include "dbug.h"
+
+/*
+ * Sample response: headers, then the start of the body.
+ */
+static char* response =
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Mon, 12 Dec 2011 08:00:00 GMT\r\n"
+    "content-length:   1234  \r\n"
+    "Content-Range: bytes 100-1333/5000\r\n"
+    "ETag:  \"v1-abc\" \r\n"
+    "Last-Modified: Sun, 11 Dec 2011 08:00:00 GMT\r\n"
+    "Content-Encoding: X-GZip\r\n"
+    "Transfer-Encoding: gzip, chunked\r\n"
+    "X-Empty:\r\n"
+    "\r\n"
+    "BODY";
+
+/*
+ * parse() - parse 'response' in slices of at most 'step' bytes, split first
+ * at 'split'. Returns 0 if the result is as expected.
+ */
+static int parse(size_t split, size_t step)
+{
+    HttpHeader_t header;
+
+    size_t len = strlen(response);
+    size_t offset = 0;
+    size_t consumed;
+
+    int rc = HTTP_HEADER_MORE;
+    int isFirst = 1;
+
+    HttpHeaderInit(&header, 0);
+    header.callback = NULL;
+
+    while ((HTTP_HEADER_MORE == rc) && (offset < len))
+    {
+	size_t n = isFirst ? split : step;
+
+	if (n > len - offset)
+	{
+	    n = len - offset;
+	}
+
+	rc = HttpHeaderPush(&header, &response[offset], n, &consumed);
+	offset += consumed;
+	isFirst = 0;
+    }
+
+    return (HTTP_HEADER_DONE != rc)
+	|| (200 != header.status)
+	|| (1234 != header.contentLength)
+	|| (100 != header.rangeFirst)
+	|| (1333 != header.rangeLast)
+	|| (5000 != header.rangeTotal)
+	|| (0 != strcmp(header.etag, "\"v1-abc\""))
+	|| (0 != strcmp(header.lastModified, "Sun, 11 Dec 2011 08:00:00 GMT"))
+	|| (HTTP_ENCODING_GZIP != header.contentEncoding)
+	|| (1 != header.isChunked)
+	|| (0 != strcmp(&response[offset], "BODY"));
+}
+
+/*
+ * range() - parse a Content-Range value. Returns 0 if the result is as
+ * expected.
+ */
+static int range(char* value, long first, long last, long total)
+{
+    HttpHeader_t header;
+
+    char buf[256];
+    size_t consumed;
+
+    int len;
+
+    len = snprintf(buf,
+		   sizeof buf,
+		   "HTTP/1.1 206 Partial Content\r\nContent-Range: %s\r\n\r\n",
+		   value);
+
+    HttpHeaderInit(&header, 0);
+    header.callback = NULL;
+
+    return (HTTP_HEADER_DONE != HttpHeaderPush(&header, buf, len, &consumed))
+	|| (first != header.rangeFirst)
+	|| (last != header.rangeLast)
+	|| (total != header.rangeTotal);
+}
+
+/*
+ * length() - parse a Content-Length value. Returns 0 if it is accepted as
+ * 'expected', or rejected when 'expected' is -1.
+ */
+static int length(char* value, long expected)
+{
+    HttpHeader_t header;
+
+    char buf[256];
+    size_t consumed;
+
+    int len;
+    int rc;
+
+    len = snprintf(buf,
+		   sizeof buf,
+		   "HTTP/1.1 200 OK\r\nContent-Length: %s\r\n\r\n",
+		   value);
+
+    HttpHeaderInit(&header, 0);
+    header.callback = NULL;
+
+    rc = HttpHeaderPush(&header, buf, len, &consumed);
+
+    return (-1 == expected) ? (HTTP_HEADER_ERROR != rc)
+			    : ((HTTP_HEADER_DONE != rc)
+			       || (expected != header.contentLength));
+}
+
+/*
+ * stanadlone test program.
+ */
+int main(int argc, char** argv)
+{
+    size_t split;
+    int failures = 0;
+
+    DBUG_PUSH("d,test");
+    DBUG_ENTER("main");
+
+    for (split = 0; split <= strlen(response); ++split)
+    {
+	failures += parse(split, 1);
+	failures += parse(split, 7);
+	failures += parse(split, strlen(response));
+    }
+
+    failures += range("bytes 0-1048575/5000000", 0, 1048575, 5000000);
+    failures += range("BYTES 7-7/8", 7, 7, 8);
+    failures += range("bytes 0-99/*", 0, 99, -1);
+    failures += range("bytes */5000", -1, -1, 5000);
+    failures += range("bytes 0-99/50", -1, -1, -1);
+    failures += range("bytes 9-1/50", -1, -1, -1);
+    failures += range("bytes -5/50", -1, -1, -1);
+    failures += range("bytes 0-99/100x", -1, -1, -1);
+    failures += range("lines 0-9/10", -1, -1, -1);
+    failures += range("bytes */*", -1, -1, -1);
+
+    failures += length("0", 0);
+    failures += length("  42 ", 42);
+    failures += length("12abc", -1);
+    failures += length("12, 13", -1);
+    failures += length("12 13", -1);
+    failures += length("-1", -1);
+    failures += length("+5", -1);
+    failures += length("", -1);
+    failures += length("99999999999999999999999", -1);
+
+    /* repeated: the same length is allowed, another is not */
+    failures += length("7\r\nContent-Length: 7", 7);
+    failures += length("5\r\nContent-Length: 50", -1);
+
+    DBUG_PRINT("test",((0 == failures) ? "Looks good!" : "Failed"));
+
+    DBUG_RETURN(0 != failures);
+}
+
+/*
+ * EOF
+ */
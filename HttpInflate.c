@@ -0,0 +1,225 @@
+/*------------------------------------------------------------------------------
+ * HttpInflate.c -- incremental decoder for a gzip or deflate response body
+ *
+ * Like the chunked decoder, this is fed arbitrary slices of the body, as
+ * they arrive, and hands what it decodes to a sink; it never holds more than
+ * zlib's window and one buffer of decoded bytes, however long the body.
+ *
+ * "deflate" ought to be a zlib stream (RFC 1950), but some servers send raw
+ * deflate data (RFC 1951); the first two bytes tell which, as a zlib header
+ * is a multiple of 31. A gzip stream ends at its first member; anything
+ * after that is ignored.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HttpInflate.h"
+#include "dbug.h"
+
+/*
+ * zlib window bits: the largest window, and the wrappers
+ */
+#define HTTP_INFLATE_GZIP (15 + 16)
+#define HTTP_INFLATE_ZLIB 15
+#define HTTP_INFLATE_RAW  (-15)
+
+/*------------------------------------------------------------------------------
+ * start() - initialise zlib, for the wrapper expected
+ */
+static int start(HttpInflate_t* decoder, int windowBits)
+{
+    DBUG_ENTER("start");
+
+    memset(&decoder->stream, 0, sizeof decoder->stream);
+
+    if (Z_OK != inflateInit2(&decoder->stream, windowBits))
+    {
+	DBUG_PRINT("inflate", ("inflateInit2() failed"));
+
+	DBUG_RETURN(-1);
+    }
+
+    decoder->isStarted = 1;
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * decode() - inflate a slice, handing the decoded bytes to the sink
+ */
+static int decode(HttpInflate_t* decoder, const char* buf, size_t len)
+{
+    z_stream* stream = &decoder->stream;
+
+    DBUG_ENTER("decode");
+
+    stream->next_in  = (Bytef*)buf;
+    stream->avail_in = len;
+
+    do
+    {
+	size_t produced;
+
+	int rc;
+
+	stream->next_out  = (Bytef*)decoder->out;
+	stream->avail_out = HTTP_INFLATE_BUFFER;
+
+	rc = inflate(stream, Z_NO_FLUSH);
+
+	if ((Z_OK != rc) && (Z_STREAM_END != rc) && (Z_BUF_ERROR != rc))
+	{
+	    DBUG_PRINT("inflate", ("inflate() failed, %d", rc));
+
+	    DBUG_RETURN(HTTP_INFLATE_ERROR);
+	}
+
+	produced = HTTP_INFLATE_BUFFER - stream->avail_out;
+
+	if (produced > 0)
+	{
+	    if (0 != decoder->sink(decoder->context, decoder->out, produced))
+	    {
+		DBUG_RETURN(HTTP_INFLATE_ABORT);
+	    }
+
+	    decoder->outBytes += produced;
+	}
+
+	if (Z_STREAM_END == rc)
+	{
+	    DBUG_PRINT("inflate", ("end, %u bytes ignored", stream->avail_in));
+
+	    decoder->isDone = 1;
+
+	    DBUG_RETURN(HTTP_INFLATE_DONE);
+	}
+    }
+    while ((stream->avail_in > 0) || (0 == stream->avail_out));
+
+    DBUG_RETURN(HTTP_INFLATE_MORE);
+}
+
+/*------------------------------------------------------------------------------
+ * HttpInflateInit() - prepare to decode a body of the given encoding
+ *
+ * The sink and context are left as they were. Returns 0, or -1 if memory is
+ * short; HttpInflateEnd() must follow, either way.
+ */
+int HttpInflateInit(HttpInflate_t* decoder, int encoding)
+{
+    DBUG_ENTER("HttpInflateInit");
+
+    assert(NULL != decoder);
+    assert((HTTP_ENCODING_GZIP == encoding)
+	|| (HTTP_ENCODING_DEFLATE == encoding));
+
+    decoder->inBytes   = 0;
+    decoder->outBytes  = 0;
+    decoder->encoding  = encoding;
+    decoder->isStarted = 0;
+    decoder->isDone    = 0;
+    decoder->headLen   = 0;
+
+    if (NULL == (decoder->out = malloc(HTTP_INFLATE_BUFFER)))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    /* deflate waits for its opening bytes */
+    if (HTTP_ENCODING_GZIP == encoding)
+    {
+	DBUG_RETURN(start(decoder, HTTP_INFLATE_GZIP));
+    }
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * HttpInflatePush() - decode the next slice of the body
+ *
+ * Every byte is used. Once HTTP_INFLATE_DONE has been returned, later slices
+ * are ignored, and it is returned again.
+ */
+int HttpInflatePush(HttpInflate_t* decoder, const char* buf, size_t len)
+{
+    DBUG_ENTER("HttpInflatePush");
+
+    assert(NULL != decoder);
+    assert(NULL != decoder->sink);
+
+    decoder->inBytes += len;
+
+    if (decoder->isDone)
+    {
+	DBUG_RETURN(HTTP_INFLATE_DONE);
+    }
+
+    if (!decoder->isStarted)		/* deflate: zlib, or raw? */
+    {
+	unsigned int cmf;
+	unsigned int flg;
+
+	int rc;
+
+	while ((decoder->headLen < 2) && (len > 0))
+	{
+	    decoder->head[decoder->headLen++] = *buf++;
+	    --len;
+	}
+
+	if (decoder->headLen < 2)
+	{
+	    DBUG_RETURN(HTTP_INFLATE_MORE);
+	}
+
+	cmf = decoder->head[0];
+	flg = decoder->head[1];
+
+	if (0 != start(decoder,
+		       ((8 == (cmf & 0x0f)) && (0 == ((cmf << 8) | flg) % 31))
+		       ? HTTP_INFLATE_ZLIB
+		       : HTTP_INFLATE_RAW))
+	{
+	    DBUG_RETURN(HTTP_INFLATE_ERROR);
+	}
+
+	if ((HTTP_INFLATE_MORE != (rc = decode(decoder,
+					       (char*)decoder->head,
+					       decoder->headLen)))
+	||  (0 == len))
+	{
+	    DBUG_RETURN(rc);
+	}
+    }
+
+    DBUG_RETURN(decode(decoder, buf, len));
+}
+
+/*------------------------------------------------------------------------------
+ * HttpInflateEnd() - release the decoder's memory
+ */
+void HttpInflateEnd(HttpInflate_t* decoder)
+{
+    DBUG_ENTER("HttpInflateEnd");
+
+    assert(NULL != decoder);
+
+    if (decoder->isStarted)
+    {
+	inflateEnd(&decoder->stream);
+	decoder->isStarted = 0;
+    }
+
+    free(decoder->out);
+    decoder->out = NULL;
+
+    DBUG_VOID_RETURN;
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,52 @@
+#ifndef HTTPINFLATE_H
+#define HTTPINFLATE_H 1
+/*------------------------------------------------------------------------------
+ * HttpInflate.h -- incremental decoder for a gzip or deflate response body
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stddef.h>
+#include <zlib.h>
+
+#include "HttpHeader.h"
+
+/*
+ * Decoded bytes held between calls to the sink
+ */
+#define HTTP_INFLATE_BUFFER (16 * 1024)
+
+/*
+ * HttpInflatePush() return codes
+ */
+#define HTTP_INFLATE_ABORT (-2)		/* the sink failed */
+#define HTTP_INFLATE_ERROR (-1)		/* malformed body */
+#define HTTP_INFLATE_MORE  0		/* need more bytes */
+#define HTTP_INFLATE_DONE  1		/* found the end of the stream */
+
+/*
+ * Called with each span of decoded data; returns 0, or -1 to abort.
+ */
+typedef int (*HttpInflateSink_t)(void* context, const char* buf, size_t len);
+
+struct http_inflate
+{
+    HttpInflateSink_t sink;		/* receives the decoded data */
+    void* context;			/* passed to 'sink' */
+    z_stream stream;			/* zlib state, once started */
+    char* out;				/* decoded data, for the sink */
+    long long inBytes;			/* encoded bytes pushed */
+    long long outBytes;			/* decoded bytes given to the sink */
+    int encoding;			/* HTTP_ENCODING_GZIP, or _DEFLATE */
+    int isStarted;			/* is 'stream' initialised? */
+    int isDone;				/* end of the stream seen? */
+    int headLen;			/* deflate: bytes held in 'head' */
+    unsigned char head[2];		/* deflate: the opening bytes */
+};
+typedef struct http_inflate HttpInflate_t;
+
+extern int HttpInflateInit(HttpInflate_t* decoder, int encoding);
+extern int HttpInflatePush(HttpInflate_t* decoder,
+	const char* buf, size_t len);
+extern void HttpInflateEnd(HttpInflate_t* decoder);
+
+#endif
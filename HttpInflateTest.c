@@ -0,0 +1,206 @@
+/*------------------------------------------------------------------------------
+ * HttpInflateTest.c -- Test for incremental gzip and deflate body decoding
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "HttpInflate.h"
+#include "dbug.h"
+
+/*
+ * zlib window bits, per wrapper
+ */
+#define GZIP (15 + 16)
+#define ZLIB 15
+#define RAW  (-15)
+
+/*
+ * Sample page: long enough to fill the decoder's buffer several times.
+ */
+static char page[5 * HTTP_INFLATE_BUFFER + 123];
+
+/*
+ * Encoded sample, and trailing bytes after it
+ */
+static char encoded[sizeof page + 1024];
+
+/*
+ * Sink output
+ */
+struct output
+{
+    char buf[sizeof page];
+    size_t len;
+    size_t limit;			/* fail once past this */
+};
+
+/*
+ * sink() - collect the decoded data; fails once past 'limit'.
+ */
+static int sink(void* context, const char* buf, size_t len)
+{
+    struct output* output = context;
+
+    if (len > output->limit - output->len)
+    {
+	return -1;
+    }
+
+    memcpy(&output->buf[output->len], buf, len);
+    output->len += len;
+
+    return 0;
+}
+
+/*
+ * encode() - compress 'page' with the given wrapper; returns its length.
+ */
+static size_t encode(int windowBits)
+{
+    z_stream stream;
+
+    size_t len;
+
+    memset(&stream, 0, sizeof stream);
+    deflateInit2(&stream, 6, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+
+    stream.next_in   = (Bytef*)page;
+    stream.avail_in  = sizeof page;
+    stream.next_out  = (Bytef*)encoded;
+    stream.avail_out = sizeof encoded;
+
+    deflate(&stream, Z_FINISH);
+    len = stream.total_out;
+    deflateEnd(&stream);
+
+    return len;
+}
+
+/*
+ * decode() - decode 'len' bytes of 'encoded' in slices of at most 'step'
+ * bytes. Returns the last return code.
+ */
+static int decode(int encoding, size_t len, size_t step,
+	struct output* output, size_t limit)
+{
+    HttpInflate_t decoder;
+
+    size_t offset;
+    size_t pushed = 0;
+
+    int rc = HTTP_INFLATE_MORE;
+
+    output->len   = 0;
+    output->limit = limit;
+
+    decoder.sink    = sink;
+    decoder.context = output;
+
+    if (0 != HttpInflateInit(&decoder, encoding))
+    {
+	HttpInflateEnd(&decoder);
+
+	return HTTP_INFLATE_ERROR;
+    }
+
+    for (offset = 0; (offset < len) && (0 <= rc); offset += step)
+    {
+	size_t n = (step < len - offset) ? step : len - offset;
+
+	rc = HttpInflatePush(&decoder, &encoded[offset], n);
+	pushed += n;
+    }
+
+    if ((decoder.inBytes != (long long)pushed)
+    ||  ((HTTP_INFLATE_DONE == rc) && (decoder.outBytes != sizeof page)))
+    {
+	rc = HTTP_INFLATE_ERROR;
+    }
+
+    HttpInflateEnd(&decoder);
+
+    return rc;
+}
+
+/*
+ * parse() - encode 'page', and decode it again. Returns 0 if the result is
+ * as expected; trailing bytes are ignored.
+ */
+static int parse(int encoding, int windowBits, size_t step)
+{
+    struct output output;
+
+    size_t len = encode(windowBits);
+
+    memset(&encoded[len], 'x', 10);
+
+    return (HTTP_INFLATE_DONE != decode(encoding,
+					len + 10,
+					step,
+					&output,
+					sizeof page))
+	|| (sizeof page != output.len)
+	|| (0 != memcmp(output.buf, page, sizeof page));
+}
+
+/*
+ * stanadlone test program.
+ */
+int main(int argc, char** argv)
+{
+    struct output output;
+    size_t steps[] = { 1, 2, 3, 1000, sizeof encoded };
+    size_t i;
+    size_t len;
+    int failures = 0;
+
+    DBUG_PUSH("d,test");
+    DBUG_ENTER("main");
+
+    for (i = 0; i < sizeof page; ++i)	/* compressible, not trivially */
+    {
+	page[i] = "abcdefgh"[(i * 7 + i / 97) % 8];
+    }
+
+    for (i = 0; i < sizeof steps / sizeof steps[0]; ++i)
+    {
+	failures += parse(HTTP_ENCODING_GZIP, GZIP, steps[i]);
+	failures += parse(HTTP_ENCODING_DEFLATE, ZLIB, steps[i]);
+	failures += parse(HTTP_ENCODING_DEFLATE, RAW, steps[i]);
+    }
+
+    /* a truncated body wants more */
+    len = encode(GZIP);
+    failures += (HTTP_INFLATE_MORE != decode(HTTP_ENCODING_GZIP,
+					     len - 1,
+					     len,
+					     &output,
+					     sizeof page));
+
+    /* a corrupt body is rejected */
+    memset(encoded, 0xff, 16);
+    failures += (HTTP_INFLATE_ERROR != decode(HTTP_ENCODING_GZIP,
+					      len,
+					      7,
+					      &output,
+					      sizeof page));
+
+    /* a failing sink stops the decoder */
+    len = encode(ZLIB);
+    failures += (HTTP_INFLATE_ABORT != decode(HTTP_ENCODING_DEFLATE,
+					      len,
+					      len,
+					      &output,
+					      100));
+
+    DBUG_PRINT("test",((0 == failures) ? "Looks good!" : "Failed"));
+
+    DBUG_RETURN(0 != failures);
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,103 @@
+/*------------------------------------------------------------------------------
+ * MallocCount.c -- count calls to malloc(), for tests and benchmarks
+ *
+ * Linked only into the programs that report it (ArenaTest, and the bench
+ * builds), never into the shipped 'rp': it replaces the allocator's entry
+ * points for the whole process, and counts every call with a shared atomic.
+ *
+ * With glibc, the functions of its "replacing malloc" rules are provided:
+ * malloc(), free(), calloc(), realloc(), and the aligned allocations. Each
+ * counts the call (free() excepted) and hands on to the library's own, so
+ * memory from either may be freed by either. Not under a sanitizer, which
+ * has its own.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <errno.h>
+#include <stddef.h>
+
+#include "MallocCount.h"
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+
+extern void* __libc_malloc(size_t size);
+extern void __libc_free(void* ptr);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+static long mallocs = 0;
+
+void* malloc(size_t size)
+{
+    __atomic_fetch_add(&mallocs, 1, __ATOMIC_RELAXED);
+
+    return __libc_malloc(size);
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    __atomic_fetch_add(&mallocs, 1, __ATOMIC_RELAXED);
+
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    __atomic_fetch_add(&mallocs, 1, __ATOMIC_RELAXED);
+
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    __atomic_fetch_add(&mallocs, 1, __ATOMIC_RELAXED);
+
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    void* p;
+
+    /* a power of two, and a multiple of sizeof(void*) */
+    if ((0 != (alignment & (alignment - 1)))
+    ||  (0 != alignment % sizeof(void*)))
+    {
+	return EINVAL;
+    }
+
+    if (NULL == (p = memalign(alignment, size)))
+    {
+	return ENOMEM;
+    }
+
+    *ptr = p;
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * MallocCount() - allocations so far: malloc(), calloc(), realloc() and the
+ * aligned ones
+ */
+long MallocCount(void)
+{
+    return __atomic_load_n(&mallocs, __ATOMIC_RELAXED);
+}
+
+#endif
+
+/*
+ * EOF
+ */
@@ -0,0 +1,11 @@
+#ifndef MALLOCCOUNT_H
+#define MALLOCCOUNT_H 1
+/*------------------------------------------------------------------------------
+ * MallocCount.h -- count calls to malloc(), for tests and benchmarks
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+
+extern long MallocCount(void);
+
+#endif
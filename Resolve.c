@@ -0,0 +1,819 @@
+/*------------------------------------------------------------------------------
+ * Resolve.c -- caching, asynchronous host name resolution
+ *
+ * getaddrinfo() blocks, so lookups are handed to a small pool of resolver
+ * threads. The caller is told, via a pipe it may watch in its event loop,
+ * when any lookup completes; it then asks again. Answers are cached for a
+ * fixed time to live (getaddrinfo() does not report the DNS TTL), so a host
+ * is resolved once however many times it recurs in the URL list.
+ *
+ * One resolver may serve several event loops, each in its own thread: each
+ * is a listener, with a pipe of its own, and every completion is told to
+ * all of them.
+ *
+ * An optional hosts file, in the format of /etc/hosts, overrides the DNS; its
+ * names are answered at once, and never expire.
+ *
+ * The resolver threads do not use DBUG, which is not thread safe.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <arpa/inet.h>
+
+#include <netinet/in.h>
+
+#include "Resolve.h"
+#include "dbug.h"
+
+/*
+ * Cache size: hash buckets; entries kept before expired ones are pruned.
+ */
+#define RESOLVE_BUCKETS   1024
+#define RESOLVE_CACHE_MAX 4096
+
+/*
+ * One cached lookup, of host, port and address family
+ */
+struct resolve_entry
+{
+    struct resolve_entry* next;		/* hash chain */
+    struct resolve_entry* nextJob;	/* job queue */
+    struct addrinfo* info;		/* answer, or NULL */
+    char* host;
+    char* port;
+    double expires;			/* when the answer expires */
+    int family;
+    int state;				/* RESOLVE_* */
+    int error;				/* getaddrinfo() error */
+    int isFresh;			/* answer not yet looked up? */
+};
+typedef struct resolve_entry ResolveEntry_t;
+
+/*
+ * One hosts file address, for one name
+ */
+struct resolve_host
+{
+    struct resolve_host* next;
+    char* name;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int family;
+};
+typedef struct resolve_host ResolveHost_t;
+
+struct resolver
+{
+    pthread_mutex_t lock;		/* guards everything below */
+    pthread_cond_t cond;		/* signals jobs, or stopping */
+    pthread_t* threads;			/* resolver threads */
+    ResolveEntry_t* buckets[RESOLVE_BUCKETS];/* the cache */
+    ResolveEntry_t* jobs;		/* lookups not yet started */
+    ResolveEntry_t* lastJob;		/* end of 'jobs' */
+    ResolveHost_t* hosts;		/* hosts file overrides */
+    int threadCount;			/* threads started */
+    int count;				/* entries in the cache */
+    int ttl;				/* seconds an answer is cached */
+    int isStopping;			/* should the threads exit? */
+    int listenerCount;			/* pipes in 'pipes' */
+    int* pipes;				/* per listener: read end, write end */
+};
+
+/*------------------------------------------------------------------------------
+ * now() - monotonic time, in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*------------------------------------------------------------------------------
+ * hash() - hash a host name, ignoring case, and port
+ */
+static unsigned int hash(const char* host, const char* port, int family)
+{
+    unsigned int h = 5381 + family;
+
+    for ( ; '\0' != *host; ++host)
+    {
+	h = h * 33 + tolower((unsigned char)*host);
+    }
+
+    for ( ; '\0' != *port; ++port)
+    {
+	h = h * 33 + *port;
+    }
+
+    return h % RESOLVE_BUCKETS;
+}
+
+/*------------------------------------------------------------------------------
+ * copyInfo() - copy an addrinfo list, each element in one allocation
+ *
+ * Only the fields used to connect are kept. Returns NULL if out of memory.
+ */
+static struct addrinfo* copyInfo(struct addrinfo* src)
+{
+    struct addrinfo* head = NULL;
+    struct addrinfo** tail = &head;
+
+    for ( ; NULL != src; src = src->ai_next)
+    {
+	struct addrinfo* p;
+
+	if (NULL == (p = malloc(sizeof(struct addrinfo) + src->ai_addrlen)))
+	{
+	    ResolveFreeInfo(head);
+
+	    return NULL;
+	}
+
+	*p = *src;
+	p->ai_addr      = (struct sockaddr*)(p + 1);
+	p->ai_canonname = NULL;
+	p->ai_next      = NULL;
+
+	memcpy(p->ai_addr, src->ai_addr, src->ai_addrlen);
+
+	*tail = p;
+	tail  = &p->ai_next;
+    }
+
+    return head;
+}
+
+/*------------------------------------------------------------------------------
+ * notify() - tell every listener a lookup completed
+ */
+static void notify(Resolver_t* resolver)
+{
+    char c = 0;
+
+    int i;
+
+    for (i = 0; i < resolver->listenerCount; ++i)
+    {
+	/* a full pipe already holds a notice */
+	if (-1 == write(resolver->pipes[2 * i + 1], &c, 1))
+	{
+	    ;
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * worker() - resolver thread: run queued lookups
+ */
+static void* worker(void* arg)
+{
+    Resolver_t* resolver = arg;
+
+    pthread_mutex_lock(&resolver->lock);
+
+    for (;;)
+    {
+	struct addrinfo hints;
+	struct addrinfo* info = NULL;
+
+	ResolveEntry_t* entry;
+
+	int rc;
+
+	while ((NULL == resolver->jobs) && !resolver->isStopping)
+	{
+	    pthread_cond_wait(&resolver->cond, &resolver->lock);
+	}
+
+	if (resolver->isStopping)
+	{
+	    break;
+	}
+
+	entry = resolver->jobs;
+
+	if (NULL == (resolver->jobs = entry->nextJob))
+	{
+	    resolver->lastJob = NULL;
+	}
+
+	/* pending entries are never pruned, so may be used unlocked */
+	pthread_mutex_unlock(&resolver->lock);
+
+	memset(&hints, 0, sizeof hints);
+
+	hints.ai_socktype = SOCK_STREAM;/* TCP */
+	hints.ai_family   = entry->family;
+
+	rc = getaddrinfo(entry->host, entry->port, &hints, &info);
+
+	pthread_mutex_lock(&resolver->lock);
+
+	if (0 == rc)
+	{
+	    if (NULL != (entry->info = copyInfo(info)))
+	    {
+		entry->state = RESOLVE_DONE;
+	    }
+	    else
+	    {
+		entry->state = RESOLVE_ERROR;
+		entry->error = EAI_MEMORY;
+	    }
+
+	    freeaddrinfo(info);
+	}
+	else
+	{
+	    entry->state = RESOLVE_ERROR;
+	    entry->error = rc;
+	}
+
+	entry->expires = now() + resolver->ttl;
+	entry->isFresh = 1;
+
+	notify(resolver);
+    }
+
+    pthread_mutex_unlock(&resolver->lock);
+
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+ * freeEntry() - free a cache entry
+ */
+static void freeEntry(ResolveEntry_t* entry)
+{
+    ResolveFreeInfo(entry->info);
+    free(entry->host);
+    free(entry->port);
+    free(entry);
+}
+
+/*------------------------------------------------------------------------------
+ * prune() - drop expired answers from the cache
+ */
+static void prune(Resolver_t* resolver)
+{
+    double t = now();
+
+    int i;
+
+    for (i = 0; i < RESOLVE_BUCKETS; ++i)
+    {
+	ResolveEntry_t** p = &resolver->buckets[i];
+
+	while (NULL != *p)
+	{
+	    ResolveEntry_t* entry = *p;
+
+	    if ((RESOLVE_PENDING != entry->state)
+	    &&  !entry->isFresh
+	    &&  (entry->expires <= t))
+	    {
+		*p = entry->next;
+		freeEntry(entry);
+		--resolver->count;
+	    }
+	    else
+	    {
+		p = &entry->next;
+	    }
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * readHosts() - read a hosts file: "address name [alias ...]" lines
+ *
+ * Returns -1 on failure, leaving the reason in 'errno'.
+ */
+static int readHosts(Resolver_t* resolver, const char* hostsFile)
+{
+    ResolveHost_t** tail = &resolver->hosts;
+
+    char line[1024];
+    FILE* fp;
+
+    DBUG_ENTER("readHosts");
+
+    if (NULL == (fp = fopen(hostsFile, "r")))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    while (NULL != fgets(line, sizeof line, fp))
+    {
+	struct sockaddr_in ipv4;
+	struct sockaddr_in6 ipv6;
+
+	char* save;
+	char* address;
+	char* name;
+	char* p;
+
+	int family;
+
+	if (NULL != (p = strchr(line, '#')))
+	{
+	    *p = '\0';			/* strip comment */
+	}
+
+	if (NULL == (address = strtok_r(line, " \t\r\n", &save)))
+	{
+	    continue;			/* blank */
+	}
+
+	memset(&ipv4, 0, sizeof ipv4);
+	memset(&ipv6, 0, sizeof ipv6);
+
+	ipv4.sin_family  = AF_INET;
+	ipv6.sin6_family = AF_INET6;
+
+	if (1 == inet_pton(AF_INET, address, &ipv4.sin_addr))
+	{
+	    family = AF_INET;
+	}
+	else if (1 == inet_pton(AF_INET6, address, &ipv6.sin6_addr))
+	{
+	    family = AF_INET6;
+	}
+	else
+	{
+	    DBUG_PRINT("resolve", ("bad address %s", address));
+	    continue;
+	}
+
+	while (NULL != (name = strtok_r(NULL, " \t\r\n", &save)))
+	{
+	    ResolveHost_t* host;
+
+	    if ((NULL == (host = calloc(1, sizeof(ResolveHost_t))))
+	    ||  (NULL == (host->name = strdup(name))))
+	    {
+		free(host);
+		fclose(fp);
+
+		errno = ENOMEM;
+
+		DBUG_RETURN(-1);
+	    }
+
+	    host->family = family;
+
+	    if (AF_INET6 == family)
+	    {
+		host->addrlen = sizeof ipv6;
+		memcpy(&host->addr, &ipv6, sizeof ipv6);
+	    }
+	    else
+	    {
+		host->addrlen = sizeof ipv4;
+		memcpy(&host->addr, &ipv4, sizeof ipv4);
+	    }
+
+	    DBUG_PRINT("resolve", ("override %s %s", name, address));
+
+	    *tail = host;
+	    tail  = &host->next;
+	}
+    }
+
+    fclose(fp);
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * lookupHosts() - answer from the hosts file
+ *
+ * Returns RESOLVE_DONE with the addresses, or RESOLVE_ERROR if the hosts
+ * file does not name the host.
+ */
+static int lookupHosts(Resolver_t* resolver,
+	const char* host, const char* port, int family,
+	struct addrinfo** result)
+{
+    struct addrinfo* head = NULL;
+    struct addrinfo** tail = &head;
+
+    ResolveHost_t* p;
+
+    int portNumber = atoi(port);
+
+    for (p = resolver->hosts; NULL != p; p = p->next)
+    {
+	struct addrinfo* info;
+
+	if ((0 != strcasecmp(p->name, host))
+	||  ((AF_UNSPEC != family) && (family != p->family)))
+	{
+	    continue;
+	}
+
+	if (NULL == (info = calloc(1, sizeof(struct addrinfo) + p->addrlen)))
+	{
+	    break;
+	}
+
+	info->ai_family   = p->family;
+	info->ai_socktype = SOCK_STREAM;
+	info->ai_protocol = IPPROTO_TCP;
+	info->ai_addrlen  = p->addrlen;
+	info->ai_addr     = (struct sockaddr*)(info + 1);
+
+	memcpy(info->ai_addr, &p->addr, p->addrlen);
+
+	if (AF_INET6 == p->family)
+	{
+	    ((struct sockaddr_in6*)info->ai_addr)->sin6_port = htons(portNumber);
+	}
+	else
+	{
+	    ((struct sockaddr_in*)info->ai_addr)->sin_port = htons(portNumber);
+	}
+
+	*tail = info;
+	tail  = &info->ai_next;
+    }
+
+    *result = head;
+
+    return (NULL == head) ? RESOLVE_ERROR : RESOLVE_DONE;
+}
+
+/*------------------------------------------------------------------------------
+ * find() - find, or start, the lookup of host, port and family
+ *
+ * Call with the lock held. Returns NULL if out of memory.
+ */
+static ResolveEntry_t* find(Resolver_t* resolver,
+	const char* host, const char* port, int family)
+{
+    ResolveEntry_t* entry;
+
+    unsigned int h = hash(host, port, family);
+
+    for (entry = resolver->buckets[h]; NULL != entry; entry = entry->next)
+    {
+	if ((family == entry->family)
+	&&  (0 == strcasecmp(host, entry->host))
+	&&  (0 == strcmp(port, entry->port)))
+	{
+	    break;
+	}
+    }
+
+    if (NULL == entry)
+    {
+	if (resolver->count >= RESOLVE_CACHE_MAX)
+	{
+	    prune(resolver);
+	}
+
+	if ((NULL == (entry = calloc(1, sizeof(ResolveEntry_t))))
+	||  (NULL == (entry->host = strdup(host)))
+	||  (NULL == (entry->port = strdup(port))))
+	{
+	    if (NULL != entry)
+	    {
+		freeEntry(entry);
+	    }
+
+	    return NULL;
+	}
+
+	entry->family = family;
+	entry->state  = RESOLVE_ERROR;	/* expired, so looked up below */
+	entry->next   = resolver->buckets[h];
+
+	resolver->buckets[h] = entry;
+	++resolver->count;
+    }
+
+    /* an answer is always used once, however short its time to live */
+    if ((RESOLVE_PENDING != entry->state)
+    &&  !entry->isFresh
+    &&  (entry->expires <= now()))
+    {
+	DBUG_PRINT("resolve", ("lookup %s:%s", host, port));
+
+	ResolveFreeInfo(entry->info);
+
+	entry->info    = NULL;
+	entry->state   = RESOLVE_PENDING;
+	entry->nextJob = NULL;
+
+	if (NULL == resolver->lastJob)
+	{
+	    resolver->jobs = entry;
+	}
+	else
+	{
+	    resolver->lastJob->nextJob = entry;
+	}
+
+	resolver->lastJob = entry;
+
+	pthread_cond_signal(&resolver->cond);
+    }
+
+    return entry;
+}
+
+/*------------------------------------------------------------------------------
+ * ResolveCreate() - create a resolver, with its threads
+ *
+ * Answers are cached for 'ttl' seconds. 'hostsFile' may be NULL. Each of
+ * the 'listeners', numbered from 0, has its own descriptor to watch. Returns
+ * NULL on failure, leaving the reason in 'errno'.
+ */
+Resolver_t* ResolveCreate(
+	int threads,
+	int ttl,
+	const char* hostsFile,
+	int listeners)
+{
+    Resolver_t* resolver;
+
+    int i;
+
+    DBUG_ENTER("ResolveCreate");
+
+    assert(threads > 0);
+    assert(listeners > 0);
+
+    if (NULL == (resolver = calloc(1, sizeof(Resolver_t))))
+    {
+	DBUG_RETURN(NULL);
+    }
+
+    resolver->ttl = ttl;
+
+    pthread_mutex_init(&resolver->lock, NULL);
+    pthread_cond_init(&resolver->cond, NULL);
+
+    if (((NULL != hostsFile) && (-1 == readHosts(resolver, hostsFile)))
+    ||  (NULL == (resolver->pipes = malloc(2 * listeners * sizeof(int))))
+    ||  (NULL == (resolver->threads = calloc(threads, sizeof(pthread_t)))))
+    {
+	ResolveFree(resolver);
+
+	DBUG_RETURN(NULL);
+    }
+
+    for (i = 0; i < listeners; ++i)
+    {
+	int* fds = &resolver->pipes[2 * i];
+
+	if (-1 == pipe(fds))
+	{
+	    ResolveFree(resolver);
+
+	    DBUG_RETURN(NULL);
+	}
+
+	++resolver->listenerCount;
+
+	if ((-1 == fcntl(fds[0], F_SETFL, O_NONBLOCK))
+	||  (-1 == fcntl(fds[1], F_SETFL, O_NONBLOCK)))
+	{
+	    ResolveFree(resolver);
+
+	    DBUG_RETURN(NULL);
+	}
+    }
+
+    for (i = 0; i < threads; ++i)
+    {
+	if (0 != (errno = pthread_create(&resolver->threads[i],
+					 NULL,
+					 worker,
+					 resolver)))
+	{
+	    ResolveFree(resolver);
+
+	    DBUG_RETURN(NULL);
+	}
+
+	++resolver->threadCount;
+    }
+
+    DBUG_RETURN(resolver);
+}
+
+/*------------------------------------------------------------------------------
+ * ResolveFree() - stop the threads, and free the resolver
+ */
+void ResolveFree(Resolver_t* resolver)
+{
+    int i;
+
+    DBUG_ENTER("ResolveFree");
+
+    if (NULL == resolver)
+    {
+	DBUG_VOID_RETURN;
+    }
+
+    pthread_mutex_lock(&resolver->lock);
+    resolver->isStopping = 1;
+    pthread_cond_broadcast(&resolver->cond);
+    pthread_mutex_unlock(&resolver->lock);
+
+    for (i = 0; i < resolver->threadCount; ++i)
+    {
+	pthread_join(resolver->threads[i], NULL);
+    }
+
+    for (i = 0; i < RESOLVE_BUCKETS; ++i)
+    {
+	while (NULL != resolver->buckets[i])
+	{
+	    ResolveEntry_t* entry = resolver->buckets[i];
+
+	    resolver->buckets[i] = entry->next;
+	    freeEntry(entry);
+	}
+    }
+
+    while (NULL != resolver->hosts)
+    {
+	ResolveHost_t* host = resolver->hosts;
+
+	resolver->hosts = host->next;
+	free(host->name);
+	free(host);
+    }
+
+    for (i = 0; i < resolver->listenerCount; ++i)
+    {
+	close(resolver->pipes[2 * i]);
+	close(resolver->pipes[2 * i + 1]);
+    }
+
+    pthread_cond_destroy(&resolver->cond);
+    pthread_mutex_destroy(&resolver->lock);
+
+    free(resolver->pipes);
+    free(resolver->threads);
+    free(resolver);
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * ResolveFd() - descriptor that is readable when a lookup completes, for one
+ * listener
+ */
+int ResolveFd(Resolver_t* resolver, int listener)
+{
+    assert(NULL != resolver);
+    assert(listener < resolver->listenerCount);
+
+    return resolver->pipes[2 * listener];
+}
+
+/*------------------------------------------------------------------------------
+ * ResolveDrain() - consume one listener's completion notices
+ */
+void ResolveDrain(Resolver_t* resolver, int listener)
+{
+    char buf[64];
+
+    assert(NULL != resolver);
+    assert(listener < resolver->listenerCount);
+
+    while (0 < read(resolver->pipes[2 * listener], buf, sizeof buf))
+    {
+	;
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * ResolveLookup() - look up a host
+ *
+ * On RESOLVE_DONE, '*result' is a copy of the addresses, to be freed with
+ * ResolveFreeInfo(). On RESOLVE_ERROR, '*error' is the getaddrinfo() error.
+ * On RESOLVE_PENDING, ask again once ResolveFd() is readable.
+ */
+int ResolveLookup(Resolver_t* resolver,
+	const char* host, const char* port, int family,
+	struct addrinfo** result, int* error)
+{
+    ResolveEntry_t* entry;
+
+    int state;
+
+    DBUG_ENTER("ResolveLookup");
+
+    assert(NULL != resolver);
+    assert(NULL != result);
+    assert(NULL != error);
+
+    *result = NULL;
+    *error  = 0;
+
+    if (RESOLVE_DONE == lookupHosts(resolver, host, port, family, result))
+    {
+	DBUG_PRINT("resolve", ("%s from hosts file", host));
+
+	DBUG_RETURN(RESOLVE_DONE);
+    }
+
+    pthread_mutex_lock(&resolver->lock);
+
+    if (NULL == (entry = find(resolver, host, port, family)))
+    {
+	state  = RESOLVE_ERROR;
+	*error = EAI_MEMORY;
+    }
+    else if (RESOLVE_DONE == (state = entry->state))
+    {
+	entry->isFresh = 0;
+
+	if (NULL == (*result = copyInfo(entry->info)))
+	{
+	    state  = RESOLVE_ERROR;
+	    *error = EAI_MEMORY;
+	}
+    }
+    else
+    {
+	if (RESOLVE_ERROR == state)
+	{
+	    entry->isFresh = 0;
+	}
+
+	*error = entry->error;
+    }
+
+    pthread_mutex_unlock(&resolver->lock);
+
+    DBUG_PRINT("resolve", ("%s:%s state %d", host, port, state));
+
+    DBUG_RETURN(state);
+}
+
+/*------------------------------------------------------------------------------
+ * ResolvePrefetch() - start looking up a host, if not already cached
+ */
+void ResolvePrefetch(Resolver_t* resolver,
+	const char* host, const char* port, int family)
+{
+    struct addrinfo* result;
+
+    DBUG_ENTER("ResolvePrefetch");
+
+    assert(NULL != resolver);
+
+    if (RESOLVE_DONE == lookupHosts(resolver, host, port, family, &result))
+    {
+	ResolveFreeInfo(result);
+
+	DBUG_VOID_RETURN;
+    }
+
+    pthread_mutex_lock(&resolver->lock);
+    find(resolver, host, port, family);
+    pthread_mutex_unlock(&resolver->lock);
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * ResolveFreeInfo() - free addresses returned by ResolveLookup()
+ */
+void ResolveFreeInfo(struct addrinfo* info)
+{
+    while (NULL != info)
+    {
+	struct addrinfo* next = info->ai_next;
+
+	free(info);
+	info = next;
+    }
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,37 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H 1
+/*------------------------------------------------------------------------------
+ * Resolve.h -- caching, asynchronous host name resolution
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <netdb.h>
+
+/*
+ * ResolveLookup() return codes
+ */
+#define RESOLVE_ERROR   (-1)		/* lookup failed; see 'error' */
+#define RESOLVE_DONE    0		/* addresses returned */
+#define RESOLVE_PENDING 1		/* lookup in progress */
+
+/*
+ * Defaults: resolver threads; seconds an answer is cached.
+ */
+#define RESOLVE_THREADS 4
+#define RESOLVE_TTL     60
+
+typedef struct resolver Resolver_t;
+
+extern Resolver_t* ResolveCreate(int threads, int ttl, const char* hostsFile,
+	int listeners);
+extern void ResolveFree(Resolver_t* resolver);
+extern int ResolveFd(Resolver_t* resolver, int listener);
+extern void ResolveDrain(Resolver_t* resolver, int listener);
+extern int ResolveLookup(Resolver_t* resolver,
+	const char* host, const char* port, int family,
+	struct addrinfo** result, int* error);
+extern void ResolvePrefetch(Resolver_t* resolver,
+	const char* host, const char* port, int family);
+extern void ResolveFreeInfo(struct addrinfo* info);
+
+#endif
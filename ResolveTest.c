@@ -0,0 +1,125 @@
+/*------------------------------------------------------------------------------
+ * ResolveTest.c -- Test for caching, asynchronous host name resolution
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include <netinet/in.h>
+
+#include "Resolve.h"
+#include "dbug.h"
+
+/*
+ * lookup() - look up 'host', waiting for the resolver as needed
+ */
+static int lookup(Resolver_t* resolver, const char* host,
+	struct addrinfo** result)
+{
+    struct pollfd pfd;
+
+    int error;
+    int rc;
+
+    pfd.fd     = ResolveFd(resolver, 0);
+    pfd.events = POLLIN;
+
+    while (RESOLVE_PENDING == (rc = ResolveLookup(resolver,
+						  host,
+						  "80",
+						  AF_UNSPEC,
+						  result,
+						  &error)))
+    {
+	poll(&pfd, 1, 1000);
+	ResolveDrain(resolver, 0);
+    }
+
+    return rc;
+}
+
+/*
+ * stanadlone test program.
+ */
+int main(int argc, char** argv)
+{
+    char path[] = "/tmp/ResolveTest.XXXXXX";
+
+    Resolver_t* resolver;
+    struct addrinfo* info;
+    struct pollfd pfd;
+    FILE* fp;
+
+    int failures = 0;
+    int error;
+
+    DBUG_PUSH("d,test");
+    DBUG_ENTER("main");
+
+    fp = fdopen(mkstemp(path), "w");
+    fprintf(fp, "# overrides\n192.0.2.1  alpha.test  beta.test\n2001:db8::1 alpha.test\n");
+    fclose(fp);
+
+    resolver = ResolveCreate(2, 60, path, 1);
+
+    /* hosts file: answered at once, in file order, with the port */
+    failures += (RESOLVE_DONE != ResolveLookup(resolver, "ALPHA.test", "8080",
+					       AF_UNSPEC, &info, &error));
+    failures += (NULL == info) || (AF_INET != info->ai_family)
+	     || (htons(8080) != ((struct sockaddr_in*)info->ai_addr)->sin_port)
+	     || (NULL == info->ai_next) || (AF_INET6 != info->ai_next->ai_family);
+    ResolveFreeInfo(info);
+
+    failures += (RESOLVE_DONE != ResolveLookup(resolver, "beta.test", "80",
+					       AF_INET, &info, &error));
+    failures += (NULL == info) || (NULL != info->ai_next);
+    ResolveFreeInfo(info);
+
+    /* the DNS: pending at first, then answered from the cache */
+    failures += (RESOLVE_DONE != lookup(resolver, "localhost", &info));
+    failures += (NULL == info);
+    ResolveFreeInfo(info);
+
+    failures += (RESOLVE_DONE != ResolveLookup(resolver, "localhost", "80",
+					       AF_UNSPEC, &info, &error));
+    failures += (NULL == info);
+    ResolveFreeInfo(info);
+
+    /* errors are reported */
+    failures += (RESOLVE_ERROR != lookup(resolver, "nonexistent.invalid", &info));
+
+    ResolveFree(resolver);
+
+    /* with no time to live, every lookup goes to the DNS */
+    resolver = ResolveCreate(1, 0, NULL, 2);
+
+    failures += (RESOLVE_DONE != lookup(resolver, "localhost", &info));
+    ResolveFreeInfo(info);
+
+    /* every listener is told of the completion */
+    pfd.fd     = ResolveFd(resolver, 1);
+    pfd.events = POLLIN;
+    failures += (1 != poll(&pfd, 1, 0));
+    ResolveDrain(resolver, 1);
+    failures += (0 != poll(&pfd, 1, 0));
+
+    failures += (RESOLVE_PENDING != ResolveLookup(resolver, "localhost", "80",
+						  AF_UNSPEC, &info, &error));
+
+    ResolveFree(resolver);
+    remove(path);
+
+    DBUG_PRINT("test",((0 == failures) ? "Looks good!" : "Failed"));
+
+    DBUG_RETURN(0 != failures);
+}
+
+/*
+ * EOF
+ */
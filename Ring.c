@@ -0,0 +1,369 @@
+/*------------------------------------------------------------------------------
+ * Ring.c -- minimal io_uring interface, without liburing (Linux only)
+ *
+ * Sets up a submission and completion queue pair with the raw system calls,
+ * and maps them. Submission entries are filled in place, and published to
+ * the kernel only by RingSubmit(); so any number of operations cost one
+ * io_uring_enter(), along with the wait for completions.
+ *
+ * The kernel must offer what the event loop relies on: waits with a timeout
+ * (5.11), internal polling of sockets that are not ready (5.7), and no
+ * dropped completions (5.5). Otherwise RingCreate() fails, and the caller
+ * falls back to epoll().
+ *
+ * All functions return -1 (or NULL) on failure, leaving the reason in 'errno'.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#ifdef __linux__
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "Ring.h"
+#include "dbug.h"
+
+/*
+ * Kernel features required
+ */
+#define RING_FEATURES (IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL \
+		       | IORING_FEAT_EXT_ARG)
+
+struct ring
+{
+    struct io_uring_sqe* sqes;		/* submission entries */
+    struct io_uring_cqe* cqes;		/* completion entries */
+    unsigned* sqHead;			/* kernel's next entry to consume */
+    unsigned* sqTail;			/* our last published entry */
+    unsigned* sqArray;			/* indices of entries, in order */
+    unsigned* cqHead;			/* our next completion to reap */
+    unsigned* cqTail;			/* kernel's last completion */
+    void* sqMap;			/* mapped submission ring */
+    void* cqMap;			/* mapped completion ring, or 'sqMap' */
+    size_t sqMapLen;			/* bytes in 'sqMap' */
+    size_t cqMapLen;			/* bytes in 'cqMap' */
+    size_t sqesLen;			/* bytes in 'sqes' */
+    unsigned sqMask;			/* entries - 1 */
+    unsigned cqMask;			/* completions - 1 */
+    unsigned sqEntries;			/* submission entries */
+    unsigned tail;			/* next entry to fill */
+    unsigned char ops[IORING_OP_LAST];	/* supported opcodes */
+    int fd;				/* the io_uring descriptor */
+};
+
+/*------------------------------------------------------------------------------
+ * probe() - note which opcodes the kernel supports
+ */
+static void probe(Ring_t* ring)
+{
+    struct io_uring_probe* probe;
+
+    size_t len = sizeof *probe + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+
+    int i;
+
+    if (NULL == (probe = calloc(1, len)))
+    {
+	return;				/* treat all as unsupported */
+    }
+
+    if (0 <= RingRegister(ring, IORING_REGISTER_PROBE, probe, IORING_OP_LAST))
+    {
+	for (i = 0; (i < probe->ops_len) && (i < IORING_OP_LAST); ++i)
+	{
+	    ring->ops[i] = (probe->ops[i].flags & IO_URING_OP_SUPPORTED) ? 1 : 0;
+	}
+    }
+
+    free(probe);
+}
+
+/*------------------------------------------------------------------------------
+ * RingCreate() - set up a ring of (at least) 'entries' submission entries
+ *
+ * Returns NULL on failure, including EOPNOTSUPP when the kernel is too old.
+ */
+Ring_t* RingCreate(unsigned entries)
+{
+    struct io_uring_params params;
+    Ring_t* ring;
+
+    char* sq;
+    char* cq;
+
+    DBUG_ENTER("RingCreate");
+
+    if (NULL == (ring = calloc(1, sizeof(Ring_t))))
+    {
+	DBUG_RETURN(NULL);
+    }
+
+    ring->sqMap = MAP_FAILED;
+    ring->cqMap = MAP_FAILED;
+    ring->sqes  = MAP_FAILED;
+
+    memset(&params, 0, sizeof params);
+
+    if (-1 == (ring->fd = syscall(__NR_io_uring_setup, entries, &params)))
+    {
+	DBUG_PRINT("syscall", ("io_uring_setup() failed, errno %d", errno));
+
+	free(ring);
+
+	DBUG_RETURN(NULL);
+    }
+
+    if (RING_FEATURES != (params.features & RING_FEATURES))
+    {
+	DBUG_PRINT("ring", ("features 0x%x lacking", params.features));
+
+	RingFree(ring);
+	errno = EOPNOTSUPP;
+
+	DBUG_RETURN(NULL);
+    }
+
+    ring->sqMapLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqMapLen = params.cq_off.cqes
+		   + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesLen  = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+	if (ring->cqMapLen > ring->sqMapLen)
+	{
+	    ring->sqMapLen = ring->cqMapLen;
+	}
+
+	ring->cqMapLen = ring->sqMapLen;
+    }
+
+    ring->sqMap = mmap(NULL, ring->sqMapLen, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+    if (MAP_FAILED != ring->sqMap)
+    {
+	ring->cqMap = (params.features & IORING_FEAT_SINGLE_MMAP)
+		    ? ring->sqMap
+		    : mmap(NULL, ring->cqMapLen, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+	ring->sqes = mmap(NULL, ring->sqesLen, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    }
+
+    if ((MAP_FAILED == ring->sqMap)
+    ||  (MAP_FAILED == ring->cqMap)
+    ||  (MAP_FAILED == ring->sqes))
+    {
+	DBUG_PRINT("syscall", ("mmap() of ring failed"));
+
+	RingFree(ring);
+
+	DBUG_RETURN(NULL);
+    }
+
+    sq = ring->sqMap;
+    cq = ring->cqMap;
+
+    ring->sqHead    = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail    = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqArray   = (unsigned*)(sq + params.sq_off.array);
+    ring->sqMask    = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqEntries = params.sq_entries;
+    ring->cqHead    = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail    = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask    = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes      = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->tail      = *ring->sqTail;
+
+    probe(ring);
+
+    DBUG_PRINT("ring", ("%u entries, %u completions, features 0x%x",
+			params.sq_entries,
+			params.cq_entries,
+			params.features));
+
+    DBUG_RETURN(ring);
+}
+
+/*------------------------------------------------------------------------------
+ * RingFree() - unmap and close a ring; operations in flight are cancelled
+ */
+void RingFree(Ring_t* ring)
+{
+    DBUG_ENTER("RingFree");
+
+    if (NULL != ring)
+    {
+	if (MAP_FAILED != ring->sqes)
+	{
+	    munmap(ring->sqes, ring->sqesLen);
+	}
+
+	if ((MAP_FAILED != ring->cqMap) && (ring->cqMap != ring->sqMap))
+	{
+	    munmap(ring->cqMap, ring->cqMapLen);
+	}
+
+	if (MAP_FAILED != ring->sqMap)
+	{
+	    munmap(ring->sqMap, ring->sqMapLen);
+	}
+
+	close(ring->fd);
+	free(ring);
+    }
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * RingIsSupported() - does the kernel support this IORING_OP_*?
+ */
+int RingIsSupported(Ring_t* ring, int opcode)
+{
+    assert(NULL != ring);
+
+    return (0 <= opcode) && (opcode < IORING_OP_LAST) && ring->ops[opcode];
+}
+
+/*------------------------------------------------------------------------------
+ * RingRegister() - register buffers, or other resources, with the ring
+ */
+int RingRegister(Ring_t* ring, unsigned opcode, void* arg, unsigned nr)
+{
+    assert(NULL != ring);
+
+    return syscall(__NR_io_uring_register, ring->fd, opcode, arg, nr);
+}
+
+/*------------------------------------------------------------------------------
+ * RingGet() - the next free submission entry, cleared
+ *
+ * When the ring is full, what it holds is submitted first. Returns NULL if
+ * that fails.
+ */
+struct io_uring_sqe* RingGet(Ring_t* ring)
+{
+    struct io_uring_sqe* sqe;
+
+    unsigned index;
+
+    assert(NULL != ring);
+
+    if (ring->tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE)
+	>= ring->sqEntries)
+    {
+	if (-1 == RingSubmit(ring, 0, 0))
+	{
+	    return NULL;
+	}
+    }
+
+    index = ring->tail & ring->sqMask;
+    sqe   = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof *sqe);
+    ring->sqArray[index] = index;
+    ++ring->tail;
+
+    return sqe;
+}
+
+/*------------------------------------------------------------------------------
+ * RingSubmit() - submit the entries filled so far; wait for completions
+ *
+ * Waits for 'waitNr' completions, or 'timeoutMs' (-1 waits indefinitely).
+ * Returns the number of entries submitted; a timeout is not an error.
+ */
+int RingSubmit(Ring_t* ring, unsigned waitNr, int timeoutMs)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+
+    unsigned flags = 0;
+    unsigned toSubmit;
+
+    int rc;
+
+    assert(NULL != ring);
+
+    __atomic_store_n(ring->sqTail, ring->tail, __ATOMIC_RELEASE);
+
+    toSubmit = ring->tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+    memset(&arg, 0, sizeof arg);
+
+    if (waitNr > 0)
+    {
+	flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+	if (timeoutMs >= 0)
+	{
+	    ts.tv_sec  = timeoutMs / 1000;
+	    ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+	    arg.ts     = (unsigned long)&ts;
+	}
+    }
+
+    if ((0 == toSubmit) && (0 == waitNr))
+    {
+	return 0;
+    }
+
+    rc = syscall(__NR_io_uring_enter,
+		 ring->fd,
+		 toSubmit,
+		 waitNr,
+		 flags,
+		 (waitNr > 0) ? (void*)&arg : NULL,
+		 sizeof arg);
+
+    if ((-1 == rc) && (ETIME == errno))
+    {
+	rc = 0;
+    }
+
+    return rc;
+}
+
+/*------------------------------------------------------------------------------
+ * RingPeek() - the oldest completion not yet seen, or NULL
+ */
+struct io_uring_cqe* RingPeek(Ring_t* ring)
+{
+    unsigned head;
+
+    assert(NULL != ring);
+
+    head = *ring->cqHead;
+
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+    {
+	return NULL;
+    }
+
+    return &ring->cqes[head & ring->cqMask];
+}
+
+/*------------------------------------------------------------------------------
+ * RingSeen() - release the completion returned by RingPeek()
+ */
+void RingSeen(Ring_t* ring)
+{
+    assert(NULL != ring);
+
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* __linux__ */
+
+/*
+ * EOF
+ */
@@ -0,0 +1,21 @@
+#ifndef RING_H
+#define RING_H 1
+/*------------------------------------------------------------------------------
+ * Ring.h -- minimal io_uring interface, without liburing (Linux only)
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <linux/io_uring.h>
+
+typedef struct ring Ring_t;
+
+extern Ring_t* RingCreate(unsigned entries);
+extern void RingFree(Ring_t* ring);
+extern int RingIsSupported(Ring_t* ring, int opcode);
+extern int RingRegister(Ring_t* ring, unsigned opcode, void* arg, unsigned nr);
+extern struct io_uring_sqe* RingGet(Ring_t* ring);
+extern int RingSubmit(Ring_t* ring, unsigned waitNr, int timeoutMs);
+extern struct io_uring_cqe* RingPeek(Ring_t* ring);
+extern void RingSeen(Ring_t* ring);
+
+#endif
@@ -0,0 +1,375 @@
+/*------------------------------------------------------------------------------
+ * Scan.c -- fast delimiter scanning for response parsing
+ *
+ * Locates a character (e.g. '\n' or ':'), "\r\n", or "\r\n\r\n" in a counted
+ * buffer, which need not be NUL terminated. Each function returns a pointer to
+ * the first match, or NULL.
+ *
+ * On x86, SSE2 and AVX2 kernels compare 16 or 32 bytes at a time. The best
+ * kernel the CPU supports is selected at run time by 'ScanInit()'; until then,
+ * and on other CPUs, the scalar kernel is used.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+
+#include "Scan.h"
+#include "dbug.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Hex digit values, or -1
+ */
+const signed char ScanHexValue[256] =
+{
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/*
+ * A set of kernels
+ */
+struct scan_kernels
+{
+    const char* name;
+    const char* (*scanChar)(const char* p, const char* end, int ch);
+    const char* (*scanCrlf)(const char* p, const char* end);
+    const char* (*scanEndOfHeaders)(const char* p, const char* end);
+};
+typedef struct scan_kernels ScanKernels_t;
+
+/*------------------------------------------------------------------------------
+ * Scalar kernels
+ */
+static const char* scalarChar(const char* p, const char* end, int ch)
+{
+    return (p < end) ? memchr(p, ch, end - p) : NULL;
+}
+
+static const char* scalarCrlf(const char* p, const char* end)
+{
+    while ((p < end - 1) && (NULL != (p = memchr(p, '\r', (end - 1) - p))))
+    {
+	if ('\n' == p[1])
+	{
+	    return p;
+	}
+
+	++p;
+    }
+
+    return NULL;
+}
+
+static const char* scalarEndOfHeaders(const char* p, const char* end)
+{
+    while (NULL != (p = scalarCrlf(p, end)))
+    {
+	if ((end - p >= 4) && ('\r' == p[2]) && ('\n' == p[3]))
+	{
+	    return p;
+	}
+
+	p += 2;
+    }
+
+    return NULL;
+}
+
+static const ScanKernels_t scalarKernels =
+{
+    "scalar", scalarChar, scalarCrlf, scalarEndOfHeaders
+};
+
+#ifdef SCAN_X86
+
+/*------------------------------------------------------------------------------
+ * SSE2 kernels
+ *
+ * Each compares 16 bytes at once; a match at byte 'i' sets bit 'i' of the
+ * mask. For multi-byte delimiters, the masks of the shifted loads are ANDed.
+ * The tail is left to the scalar kernel.
+ */
+__attribute__((target("sse2")))
+static const char* sse2Char(const char* p, const char* end, int ch)
+{
+    const __m128i needle = _mm_set1_epi8((char)ch);
+
+    for ( ; end - p >= 16; p += 16)
+    {
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+
+	if (0 != mask)
+	{
+	    return p + __builtin_ctz(mask);
+	}
+    }
+
+    return scalarChar(p, end, ch);
+}
+
+__attribute__((target("sse2")))
+static const char* sse2Crlf(const char* p, const char* end)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    for ( ; end - p >= 17; p += 16)
+    {
+	__m128i v0 = _mm_loadu_si128((const __m128i*)p);
+	__m128i v1 = _mm_loadu_si128((const __m128i*)(p + 1));
+	unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v0, cr))
+			  & _mm_movemask_epi8(_mm_cmpeq_epi8(v1, lf));
+
+	if (0 != mask)
+	{
+	    return p + __builtin_ctz(mask);
+	}
+    }
+
+    return scalarCrlf(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char* sse2EndOfHeaders(const char* p, const char* end)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    for ( ; end - p >= 19; p += 16)
+    {
+	unsigned int mask =
+	    _mm_movemask_epi8(_mm_cmpeq_epi8(
+		_mm_loadu_si128((const __m128i*)p), cr))
+	  & _mm_movemask_epi8(_mm_cmpeq_epi8(
+		_mm_loadu_si128((const __m128i*)(p + 1)), lf))
+	  & _mm_movemask_epi8(_mm_cmpeq_epi8(
+		_mm_loadu_si128((const __m128i*)(p + 2)), cr))
+	  & _mm_movemask_epi8(_mm_cmpeq_epi8(
+		_mm_loadu_si128((const __m128i*)(p + 3)), lf));
+
+	if (0 != mask)
+	{
+	    return p + __builtin_ctz(mask);
+	}
+    }
+
+    return scalarEndOfHeaders(p, end);
+}
+
+static const ScanKernels_t sse2Kernels =
+{
+    "sse2", sse2Char, sse2Crlf, sse2EndOfHeaders
+};
+
+/*------------------------------------------------------------------------------
+ * AVX2 kernels
+ *
+ * As for SSE2, 32 bytes at once.
+ */
+__attribute__((target("avx2")))
+static const char* avx2Char(const char* p, const char* end, int ch)
+{
+    const __m256i needle = _mm256_set1_epi8((char)ch);
+
+    for ( ; end - p >= 32; p += 32)
+    {
+	__m256i v = _mm256_loadu_si256((const __m256i*)p);
+	unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+
+	if (0 != mask)
+	{
+	    return p + __builtin_ctz(mask);
+	}
+    }
+
+    return sse2Char(p, end, ch);
+}
+
+__attribute__((target("avx2")))
+static const char* avx2Crlf(const char* p, const char* end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    for ( ; end - p >= 33; p += 32)
+    {
+	__m256i v0 = _mm256_loadu_si256((const __m256i*)p);
+	__m256i v1 = _mm256_loadu_si256((const __m256i*)(p + 1));
+	unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, cr))
+			  & _mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, lf));
+
+	if (0 != mask)
+	{
+	    return p + __builtin_ctz(mask);
+	}
+    }
+
+    return sse2Crlf(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* avx2EndOfHeaders(const char* p, const char* end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    for ( ; end - p >= 35; p += 32)
+    {
+	unsigned int mask =
+	    _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		_mm256_loadu_si256((const __m256i*)p), cr))
+	  & _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		_mm256_loadu_si256((const __m256i*)(p + 1)), lf))
+	  & _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		_mm256_loadu_si256((const __m256i*)(p + 2)), cr))
+	  & _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		_mm256_loadu_si256((const __m256i*)(p + 3)), lf));
+
+	if (0 != mask)
+	{
+	    return p + __builtin_ctz(mask);
+	}
+    }
+
+    return sse2EndOfHeaders(p, end);
+}
+
+static const ScanKernels_t avx2Kernels =
+{
+    "avx2", avx2Char, avx2Crlf, avx2EndOfHeaders
+};
+
+#endif /* SCAN_X86 */
+
+/*
+ * The selected kernels
+ */
+static const ScanKernels_t* kernels = &scalarKernels;
+
+/*------------------------------------------------------------------------------
+ * ScanInit() - select the best kernels for this CPU
+ *
+ * Call once, before any threads are started.
+ */
+void ScanInit(void)
+{
+    DBUG_ENTER("ScanInit");
+
+    kernels = &scalarKernels;
+
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+	kernels = &avx2Kernels;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+	kernels = &sse2Kernels;
+    }
+#endif
+
+    DBUG_PRINT("scan", ("using %s", kernels->name));
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * ScanSelect() - select kernels by name, for testing and benchmarks
+ *
+ * Returns 0 on success, -1 if the kernels are unknown or unsupported.
+ */
+int ScanSelect(const char* name)
+{
+    DBUG_ENTER("ScanSelect");
+
+    assert(NULL != name);
+
+    if (0 == strcasecmp(name, scalarKernels.name))
+    {
+	kernels = &scalarKernels;
+
+	DBUG_RETURN(0);
+    }
+
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if ((0 == strcasecmp(name, sse2Kernels.name))
+    &&  __builtin_cpu_supports("sse2"))
+    {
+	kernels = &sse2Kernels;
+
+	DBUG_RETURN(0);
+    }
+
+    if ((0 == strcasecmp(name, avx2Kernels.name))
+    &&  __builtin_cpu_supports("avx2"))
+    {
+	kernels = &avx2Kernels;
+
+	DBUG_RETURN(0);
+    }
+#endif
+
+    DBUG_RETURN(-1);
+}
+
+/*------------------------------------------------------------------------------
+ * ScanName() - name the selected kernels
+ */
+const char* ScanName(void)
+{
+    return kernels->name;
+}
+
+/*------------------------------------------------------------------------------
+ * ScanChar() - find a character
+ */
+const char* ScanChar(const char* p, const char* end, int ch)
+{
+    return kernels->scanChar(p, end, ch);
+}
+
+/*------------------------------------------------------------------------------
+ * ScanCrlf() - find "\r\n"
+ */
+const char* ScanCrlf(const char* p, const char* end)
+{
+    return kernels->scanCrlf(p, end);
+}
+
+/*------------------------------------------------------------------------------
+ * ScanEndOfHeaders() - find "\r\n\r\n"
+ */
+const char* ScanEndOfHeaders(const char* p, const char* end)
+{
+    return kernels->scanEndOfHeaders(p, end);
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,20 @@
+#ifndef SCAN_H
+#define SCAN_H 1
+/*------------------------------------------------------------------------------
+ * Scan.h -- fast delimiter scanning for response parsing
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stddef.h>
+
+extern void ScanInit(void);
+extern int ScanSelect(const char* name);
+extern const char* ScanName(void);
+
+extern const char* ScanChar(const char* p, const char* end, int ch);
+extern const char* ScanCrlf(const char* p, const char* end);
+extern const char* ScanEndOfHeaders(const char* p, const char* end);
+
+extern const signed char ScanHexValue[256];
+
+#endif
@@ -0,0 +1,224 @@
+/*------------------------------------------------------------------------------
+ * ScanBench.c -- Microbenchmark for delimiter scanning
+ *
+ * Compares the strstr() path that response parsing used to take with each
+ * 'Scan' kernel this CPU supports, after checking that every kernel agrees
+ * with the scalar kernel.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Scan.h"
+#include "dbug.h"
+
+#define BENCH_BYTES	(64 * 1024)	/* size of the header block */
+#define BENCH_ROUNDS	2000		/* passes over the header block */
+
+static char* kernelNames[] = { "scalar", "sse2", "avx2", NULL };
+
+/*
+ * Called through a volatile pointer, so the compiler cannot hoist the
+ * (pure) baseline out of the timing loop.
+ */
+static char* (*volatile baseline)(const char*, const char*) = strstr;
+
+/*
+ * now() - monotonic time, in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * makeHeaders() - fill 'buf' with header lines, ending with a blank line
+ */
+static size_t makeHeaders(char* buf, size_t size)
+{
+    static char* lines[] =
+    {
+	"Date: Mon, 12 Dec 2011 08:00:00 GMT\r\n",
+	"Server: Apache/2.2.3 (CentOS)\r\n",
+	"Set-Cookie: session=0123456789abcdef0123456789abcdef; path=/\r\n",
+	"Cache-Control: private, max-age=0, must-revalidate\r\n",
+	"Content-Type: text/html; charset=UTF-8\r\n",
+	"X-Powered-By: PHP/5.1.6\r\n",
+	NULL
+    };
+
+    size_t len = 0;
+    char** p = lines;
+
+    while (len + strlen(*p) + 3 < size)
+    {
+	memcpy(&buf[len], *p, strlen(*p));
+	len += strlen(*p);
+
+	if (NULL == *++p)
+	{
+	    p = lines;
+	}
+    }
+
+    memcpy(&buf[len], "\r\n", 3);	/* blank line, and NUL */
+
+    return len + 2;
+}
+
+/*
+ * check() - compare a kernel with the scalar kernel, on noisy buffers
+ */
+static int check(char* name)
+{
+    static char buf[4096];
+
+    int failures = 0;
+    int round;
+
+    srand(1);
+
+    for (round = 0; round < 1000; ++round)
+    {
+	size_t len = rand() % sizeof buf;
+	size_t i;
+	size_t start = (len > 0) ? rand() % len : 0;
+
+	const char* r[3];
+
+	for (i = 0; i < len; ++i)
+	{
+	    static char alphabet[] = "\r\n\r\n:ab";
+
+	    buf[i] = alphabet[rand() % (sizeof alphabet - 1)];
+	}
+
+	ScanSelect("scalar");
+	r[0] = ScanChar(buf + start, buf + len, ':');
+	r[1] = ScanCrlf(buf + start, buf + len);
+	r[2] = ScanEndOfHeaders(buf + start, buf + len);
+
+	ScanSelect(name);
+	failures += (r[0] != ScanChar(buf + start, buf + len, ':'));
+	failures += (r[1] != ScanCrlf(buf + start, buf + len));
+	failures += (r[2] != ScanEndOfHeaders(buf + start, buf + len));
+    }
+
+    return failures;
+}
+
+/*
+ * report() - print one result line
+ */
+static void report(char* what, char* name, double seconds, size_t len)
+{
+    printf("%-16s %-8s %8.1f MB/s\n",
+	   what,
+	   name,
+	   (double)len * BENCH_ROUNDS / seconds / (1024 * 1024));
+}
+
+/*
+ * stanadlone benchmark program.
+ */
+int main(int argc, char** argv)
+{
+    static char buf[BENCH_BYTES];
+
+    size_t len;
+    long lines = 0;
+    int failures = 0;
+    int round;
+    char** name;
+
+    double start;
+
+    DBUG_ENTER("main");
+
+    len = makeHeaders(buf, sizeof buf);
+
+    /*
+     * Baseline: strstr() on a NUL terminated buffer
+     */
+
+    start = now();
+    for (round = 0; round < BENCH_ROUNDS; ++round)
+    {
+	char* p;
+	char* t;
+
+	for (p = buf; NULL != (t = baseline(p, "\r\n")) && (t != p); p = t + 2)
+	{
+	    lines += (NULL != strchr(p, ':'));
+	}
+    }
+    report("lines", "strstr", now() - start, len);
+
+    start = now();
+    for (round = 0; round < BENCH_ROUNDS; ++round)
+    {
+	lines += (NULL != baseline(buf, "\r\n\r\n"));
+    }
+    report("end of headers", "strstr", now() - start, len);
+
+    /*
+     * Each kernel
+     */
+
+    for (name = kernelNames; NULL != *name; ++name)
+    {
+	int f;
+
+	if (0 != ScanSelect(*name))
+	{
+	    printf("%-16s %-8s unsupported\n", "", *name);
+	    continue;
+	}
+
+	if (0 != (f = check(*name)))
+	{
+	    printf("%-16s %-8s FAILED %d checks\n", "", *name, f);
+	    failures += f;
+	    continue;
+	}
+
+	ScanSelect(*name);
+
+	start = now();
+	for (round = 0; round < BENCH_ROUNDS; ++round)
+	{
+	    const char* p;
+	    const char* t;
+	    const char* end = buf + len;
+
+	    for (p = buf; NULL != (t = ScanCrlf(p, end)) && (t != p); p = t + 2)
+	    {
+		lines += (NULL != ScanChar(p, t, ':'));
+	    }
+	}
+	report("lines", *name, now() - start, len);
+
+	start = now();
+	for (round = 0; round < BENCH_ROUNDS; ++round)
+	{
+	    lines += (NULL != ScanEndOfHeaders(buf, buf + len));
+	}
+	report("end of headers", *name, now() - start, len);
+    }
+
+    ScanInit();
+    printf("selected: %s (%ld lines)\n", ScanName(), lines);
+
+    DBUG_RETURN(0 != failures);
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,240 @@
+/*------------------------------------------------------------------------------
+ * Sha256.c -- incremental SHA-256 (FIPS 180-4)
+ *
+ * Fed arbitrary slices, as they arrive; whole blocks are hashed where they
+ * lie, and only a partial block is copied, to be completed by the next
+ * slice. Written from the standard, so as to need no crypto library.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "Sha256.h"
+
+#define ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z)	(((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define S0(x)		(ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x)		(ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define G0(x)		(ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define G1(x)		(ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+/*
+ * Round constants: the first 32 bits of the fractional parts of the cube
+ * roots of the first 64 primes
+ */
+static const uint32_t k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*------------------------------------------------------------------------------
+ * compress() - hash one 64-byte block into the state
+ */
+static void compress(uint32_t* state, const unsigned char* block)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+
+    int i;
+
+    for (i = 0; i < 16; ++i)
+    {
+	w[i] = ((uint32_t)block[i * 4] << 24)
+	     | ((uint32_t)block[i * 4 + 1] << 16)
+	     | ((uint32_t)block[i * 4 + 2] << 8)
+	     |  (uint32_t)block[i * 4 + 3];
+    }
+
+    for (i = 16; i < 64; ++i)
+    {
+	w[i] = G1(w[i - 2]) + w[i - 7] + G0(w[i - 15]) + w[i - 16];
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (i = 0; i < 64; ++i)
+    {
+	uint32_t t1 = h + S1(e) + CH(e, f, g) + k[i] + w[i];
+	uint32_t t2 = S0(a) + MAJ(a, b, c);
+
+	h = g;
+	g = f;
+	f = e;
+	e = d + t1;
+	d = c;
+	c = b;
+	b = a;
+	a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+/*------------------------------------------------------------------------------
+ * Sha256Init() - prepare to hash a message
+ */
+void Sha256Init(Sha256_t* sha)
+{
+    static const uint32_t initial[8] =
+    {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    assert(NULL != sha);
+
+    memcpy(sha->state, initial, sizeof initial);
+    sha->length   = 0;
+    sha->blockLen = 0;
+}
+
+/*------------------------------------------------------------------------------
+ * Sha256Update() - hash the next slice of the message
+ */
+void Sha256Update(Sha256_t* sha, const void* buf, size_t len)
+{
+    const unsigned char* p = buf;
+
+    assert(NULL != sha);
+    assert((NULL != buf) || (0 == len));
+
+    sha->length += len;
+
+    if (sha->blockLen > 0)		/* complete the partial block */
+    {
+	size_t n = SHA256_BLOCK_SIZE - sha->blockLen;
+
+	if (n > len)
+	{
+	    n = len;
+	}
+
+	memcpy(&sha->block[sha->blockLen], p, n);
+	sha->blockLen += n;
+	p   += n;
+	len -= n;
+
+	if (SHA256_BLOCK_SIZE > sha->blockLen)
+	{
+	    return;
+	}
+
+	compress(sha->state, sha->block);
+	sha->blockLen = 0;
+    }
+
+    while (len >= SHA256_BLOCK_SIZE)	/* whole blocks, in place */
+    {
+	compress(sha->state, p);
+	p   += SHA256_BLOCK_SIZE;
+	len -= SHA256_BLOCK_SIZE;
+    }
+
+    memcpy(sha->block, p, len);
+    sha->blockLen = len;
+}
+
+/*------------------------------------------------------------------------------
+ * Sha256Final() - pad the message, and write its digest
+ *
+ * The context must be initialised again before reuse.
+ */
+void Sha256Final(Sha256_t* sha, unsigned char* digest)
+{
+    uint64_t bits;
+
+    int i;
+
+    assert(NULL != sha);
+    assert(NULL != digest);
+
+    bits = sha->length * 8;
+
+    sha->block[sha->blockLen++] = 0x80;
+
+    if (sha->blockLen > SHA256_BLOCK_SIZE - 8)	/* no room for the length */
+    {
+	memset(&sha->block[sha->blockLen],
+	       0,
+	       SHA256_BLOCK_SIZE - sha->blockLen);
+	compress(sha->state, sha->block);
+	sha->blockLen = 0;
+    }
+
+    memset(&sha->block[sha->blockLen],
+	   0,
+	   SHA256_BLOCK_SIZE - 8 - sha->blockLen);
+
+    for (i = 0; i < 8; ++i)
+    {
+	sha->block[SHA256_BLOCK_SIZE - 1 - i] = (unsigned char)(bits >> (i * 8));
+    }
+
+    compress(sha->state, sha->block);
+
+    for (i = 0; i < 8; ++i)
+    {
+	digest[i * 4]     = (unsigned char)(sha->state[i] >> 24);
+	digest[i * 4 + 1] = (unsigned char)(sha->state[i] >> 16);
+	digest[i * 4 + 2] = (unsigned char)(sha->state[i] >> 8);
+	digest[i * 4 + 3] = (unsigned char)sha->state[i];
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * Sha256Hex() - a digest in lower case hex; 'hex' holds 65 bytes
+ */
+char* Sha256Hex(const unsigned char* digest, char* hex)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    int i;
+
+    assert(NULL != digest);
+    assert(NULL != hex);
+
+    for (i = 0; i < SHA256_DIGEST_SIZE; ++i)
+    {
+	hex[i * 2]     = digits[digest[i] >> 4];
+	hex[i * 2 + 1] = digits[digest[i] & 0x0f];
+    }
+
+    hex[SHA256_DIGEST_SIZE * 2] = '\0';
+
+    return hex;
+}
+
+/*
+ * EOF
+ */
@@ -0,0 +1,28 @@
+#ifndef SHA256_H
+#define SHA256_H 1
+/*------------------------------------------------------------------------------
+ * Sha256.h -- incremental SHA-256 (FIPS 180-4)
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE  64
+
+struct sha256
+{
+    uint32_t state[8];			/* hash so far */
+    uint64_t length;			/* bytes hashed */
+    size_t blockLen;			/* bytes held in 'block' */
+    unsigned char block[SHA256_BLOCK_SIZE];	/* partial block */
+};
+typedef struct sha256 Sha256_t;
+
+extern void Sha256Init(Sha256_t* sha);
+extern void Sha256Update(Sha256_t* sha, const void* buf, size_t len);
+extern void Sha256Final(Sha256_t* sha, unsigned char* digest);
+extern char* Sha256Hex(const unsigned char* digest, char* hex);
+
+#endif
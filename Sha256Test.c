@@ -0,0 +1,116 @@
+/*------------------------------------------------------------------------------
+ * Sha256Test.c -- Test for incremental SHA-256
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "Sha256.h"
+#include "dbug.h"
+
+/*
+ * Messages, and their digests (FIPS 180-2, appendix B; and the empty one)
+ */
+static struct
+{
+    char* message;
+    char* digest;
+}
+vectors[] =
+{
+    {
+	"",
+	"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+    },
+    {
+	"abc",
+	"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+    },
+    {
+	"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+	"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+    },
+    {
+	NULL,
+	NULL
+    }
+};
+
+/*
+ * One million 'a's
+ */
+static char* millionA =
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+
+/*
+ * hash() - hash 's' in slices of at most 'step' bytes, split first at
+ * 'split'. Returns 0 if the digest is as expected.
+ */
+static int hash(char* s, size_t split, size_t step, char* expected)
+{
+    Sha256_t sha;
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_DIGEST_SIZE * 2 + 1];
+
+    size_t len = strlen(s);
+    size_t offset = 0;
+    size_t n = split;
+
+    Sha256Init(&sha);
+
+    while (offset < len)
+    {
+	if (n > len - offset)
+	{
+	    n = len - offset;
+	}
+
+	Sha256Update(&sha, &s[offset], n);
+	offset += n;
+	n = step;
+    }
+
+    Sha256Final(&sha, digest);
+
+    return 0 != strcmp(Sha256Hex(digest, hex), expected);
+}
+
+/*
+ * stanadlone test program.
+ */
+int main(int argc, char** argv)
+{
+    static char a[1000001];
+
+    size_t split;
+    int failures = 0;
+    int i;
+
+    DBUG_PUSH("d,test");
+    DBUG_ENTER("main");
+
+    for (i = 0; NULL != vectors[i].message; ++i)
+    {
+	for (split = 0; split <= strlen(vectors[i].message); ++split)
+	{
+	    failures += hash(vectors[i].message, split, 1, vectors[i].digest);
+	    failures += hash(vectors[i].message, split, 7, vectors[i].digest);
+	}
+    }
+
+    memset(a, 'a', sizeof a - 1);
+
+    failures += hash(a, sizeof a, sizeof a, millionA);
+    failures += hash(a, 63, 65, millionA);
+    failures += hash(a, 1, 4096, millionA);
+
+    DBUG_PRINT("test",((0 == failures) ? "Looks good!" : "Failed"));
+
+    DBUG_RETURN(0 != failures);
+}
+
+/*
+ * EOF
+ */
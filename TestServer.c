@@ -0,0 +1,723 @@
+/*------------------------------------------------------------------------------
+ * TestServer.c -- Local HTTP/1.1 server, for testing and benchmarking 'rp'
+ *
+ * Listens on the loopback address, and answers every request, whatever its
+ * path, with the same page: of any size, sent with Content-Length or in
+ * chunks of any size. Pipelined requests are answered in order, up to a
+ * configurable depth; many responses go out in each writev(), so that the
+ * server is rarely the bottleneck. Artificial latency holds each batch of
+ * requests read for a while before it is answered.
+ *
+ * The port is written to the standard output once the server is listening,
+ * so a script may start it on an ephemeral port.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "Event.h"
+#include "dbug.h"
+
+#define TS_PORT		0		/* default port: any */
+#define TS_SIZE		2048		/* default body size */
+#define TS_CHUNK	0		/* default chunk size: Content-Length */
+#define TS_LATENCY	0		/* default latency, ms */
+#define TS_DEPTH	1024		/* default requests answered at once */
+#define TS_MAX_CONNS	256		/* connections at once */
+#define TS_MAX_HELD	64		/* request batches held, per connection */
+#define TS_MAX_QUEUED	1024		/* stop reading, with this many queued */
+#define TS_BUF_LEN	16384		/* request read size */
+#define TS_MAX_IOV	64		/* responses per writev() */
+
+/*
+ * Server options
+ */
+struct ts_options
+{
+    long size;				/* body bytes per response */
+    long chunk;				/* chunk size, or 0 for Content-Length */
+    long depth;				/* requests answered at once */
+    int latency;			/* ms to hold requests */
+    int port;				/* port to listen on */
+};
+typedef struct ts_options tsOptions_t;
+
+/*
+ * Requests read together, and held for the latency
+ */
+struct ts_held
+{
+    double due;				/* when to answer them */
+    long count;				/* requests */
+};
+typedef struct ts_held tsHeld_t;
+
+/*
+ * Connection state
+ */
+struct ts_conn
+{
+    tsHeld_t held[TS_MAX_HELD];		/* ring of held batches */
+    long queued;			/* requests read, not yet taken up */
+    long owed;				/* responses due, not yet sent */
+    long heldRequests;			/* requests in held batches */
+    int heldFirst;			/* oldest held batch */
+    int heldCount;			/* held batches */
+    size_t offset;			/* bytes of the current response sent */
+    int sock;				/* the socket, or -1 */
+    int match;				/* bytes of CR LF CR LF matched */
+    int events;				/* EVENT_* flags registered */
+};
+typedef struct ts_conn tsConn_t;
+
+/*
+ * Server state
+ */
+struct ts_server
+{
+    EventLoop_t* events;		/* readiness notification */
+    tsConn_t conns[TS_MAX_CONNS];	/* connection slots */
+    char* response;			/* the response, headers and body */
+    size_t responseLen;			/* bytes in 'response' */
+    long requests;			/* requests seen */
+    int listener;			/* the listening socket */
+};
+typedef struct ts_server tsServer_t;
+
+/*------------------------------------------------------------------------------
+ * now() - monotonic time, in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*------------------------------------------------------------------------------
+ * makeResponse() - build the response every request is answered with
+ */
+static int makeResponse(tsOptions_t* options, tsServer_t* server)
+{
+    char* p;
+    long chunks;
+    long i;
+
+    DBUG_ENTER("makeResponse");
+
+    /* room for the headers, and each chunk's size line and CR/LF */
+    chunks = (0 == options->chunk)
+	   ? 0
+	   : (options->size + options->chunk - 1) / options->chunk;
+
+    if (NULL == (server->response = malloc(256 + options->size + chunks * 24)))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    p = server->response;
+
+    if (0 == options->chunk)
+    {
+	p += sprintf(p,
+		     "HTTP/1.1 200 OK\r\n"
+		     "Content-Type: text/plain\r\n"
+		     "Content-Length: %ld\r\n"
+		     "\r\n",
+		     options->size);
+    }
+    else
+    {
+	p += sprintf(p,
+		     "HTTP/1.1 200 OK\r\n"
+		     "Content-Type: text/plain\r\n"
+		     "Transfer-Encoding: chunked\r\n"
+		     "\r\n");
+    }
+
+    for (i = 0; i < options->size; ++i)
+    {
+	if ((0 != options->chunk) && (0 == (i % options->chunk)))
+	{
+	    long n = options->size - i;
+
+	    if (n > options->chunk)
+	    {
+		n = options->chunk;
+	    }
+
+	    p += sprintf(p, "%s%lx\r\n", (0 == i) ? "" : "\r\n", n);
+	}
+
+	*p++ = ((i % 64) == 63) ? '\n' : 'a' + (i % 26);
+    }
+
+    if (0 != options->chunk)
+    {
+	p += sprintf(p, "%s0\r\n\r\n", (0 == options->size) ? "" : "\r\n");
+    }
+
+    server->responseLen = p - server->response;
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * closeConn() - close a connection, and free its slot
+ */
+static void closeConn(tsServer_t* server, tsConn_t* conn)
+{
+    DBUG_ENTER("closeConn");
+
+    EventLoopDelete(server->events, conn->sock);
+    close(conn->sock);
+
+    conn->sock = -1;
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * setInterest() - read while few requests are queued; write while any
+ * responses are due
+ */
+static int setInterest(tsServer_t* server, tsConn_t* conn)
+{
+    int events = 0;
+
+    DBUG_ENTER("setInterest");
+
+    if (conn->queued < TS_MAX_QUEUED)
+    {
+	events |= EVENT_READ;
+    }
+
+    if (conn->owed > 0)
+    {
+	events |= EVENT_WRITE;
+    }
+
+    if ((events != conn->events)
+    &&  (-1 == EventLoopModify(server->events, conn->sock, events, conn)))
+    {
+	perror("EventLoopModify()");
+
+	DBUG_RETURN(-1);
+    }
+
+    conn->events = events;
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * countRequests() - count the requests that end in a slice
+ *
+ * A request ends with a blank line. The headers are otherwise ignored; so is
+ * a request body, which these clients never send.
+ */
+static long countRequests(tsConn_t* conn, const char* buf, size_t len)
+{
+    long requests = 0;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+	char c = buf[i];
+
+	if ('\r' == c)
+	{
+	    conn->match = (2 == conn->match) ? 3 : 1;
+	}
+	else if (('\n' == c) && ((1 == conn->match) || (3 == conn->match)))
+	{
+	    if (4 == ++conn->match)
+	    {
+		conn->match = 0;
+		++requests;
+	    }
+	}
+	else
+	{
+	    conn->match = 0;
+	}
+    }
+
+    return requests;
+}
+
+/*------------------------------------------------------------------------------
+ * releaseHeld() - make held requests due, once their latency has passed
+ */
+static void releaseHeld(tsConn_t* conn, double when)
+{
+    while ((conn->heldCount > 0) && (conn->held[conn->heldFirst].due <= when))
+    {
+	tsHeld_t* held = &conn->held[conn->heldFirst];
+
+	conn->owed         += held->count;
+	conn->heldRequests -= held->count;
+	conn->heldFirst     = (conn->heldFirst + 1) % TS_MAX_HELD;
+	--conn->heldCount;
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * takeUp() - take up queued requests, as the depth allows
+ *
+ * They are due at once, or held for the latency.
+ */
+static void takeUp(tsOptions_t* options, tsConn_t* conn, double when)
+{
+    long n = options->depth - conn->owed - conn->heldRequests;
+
+    if (n > conn->queued)
+    {
+	n = conn->queued;
+    }
+
+    if (n <= 0)
+    {
+	return;
+    }
+
+    if (0 == options->latency)
+    {
+	conn->owed += n;
+    }
+    else if (conn->heldCount < TS_MAX_HELD)
+    {
+	tsHeld_t* held = &conn->held[(conn->heldFirst + conn->heldCount)
+				     % TS_MAX_HELD];
+
+	held->due   = when + options->latency / 1000.0;
+	held->count = n;
+
+	conn->heldRequests += n;
+	++conn->heldCount;
+    }
+    else
+    {
+	return;
+    }
+
+    conn->queued -= n;
+}
+
+/*------------------------------------------------------------------------------
+ * readRequests() - read, and queue, pipelined requests
+ *
+ * Returns -1 once the connection is closed.
+ */
+static int readRequests(tsServer_t* server, tsConn_t* conn)
+{
+    char buf[TS_BUF_LEN];
+    ssize_t len;
+
+    DBUG_ENTER("readRequests");
+
+    if (-1 == (len = read(conn->sock, buf, sizeof buf)))
+    {
+	if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+	{
+	    DBUG_RETURN(0);
+	}
+
+	DBUG_PRINT("syscall", ("read(sock) failed, errno %d", errno));
+    }
+
+    if (len <= 0)			/* closed by client, or failed */
+    {
+	closeConn(server, conn);
+
+	DBUG_RETURN(-1);
+    }
+
+    len = countRequests(conn, buf, len);
+
+    conn->queued     += len;
+    server->requests += len;
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * writeResponses() - send owed responses, until done or the socket is full
+ *
+ * Returns -1 once the connection is closed.
+ */
+static int writeResponses(tsServer_t* server, tsConn_t* conn)
+{
+    struct iovec iov[TS_MAX_IOV];
+
+    DBUG_ENTER("writeResponses");
+
+    while (conn->owed > 0)
+    {
+	ssize_t len;
+	size_t n;
+	int iovcnt;
+
+	iov[0].iov_base = server->response + conn->offset;
+	iov[0].iov_len  = server->responseLen - conn->offset;
+
+	for (iovcnt = 1; (iovcnt < TS_MAX_IOV) && (iovcnt < conn->owed); ++iovcnt)
+	{
+	    iov[iovcnt].iov_base = server->response;
+	    iov[iovcnt].iov_len  = server->responseLen;
+	}
+
+	if (-1 == (len = writev(conn->sock, iov, iovcnt)))
+	{
+	    if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+	    {
+		break;
+	    }
+
+	    DBUG_PRINT("syscall", ("writev(sock) failed, errno %d", errno));
+
+	    closeConn(server, conn);
+
+	    DBUG_RETURN(-1);
+	}
+
+	/* walk past the responses sent */
+	n = conn->offset + len;
+
+	conn->owed  -= n / server->responseLen;
+	conn->offset = n % server->responseLen;
+    }
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * service() - answer what is due, and take up more, until the socket is full
+ *
+ * Returns the seconds until the next held batch is due, or -1 if none is held
+ * (or the connection is closed).
+ */
+static double service(tsOptions_t* options, tsServer_t* server,
+	tsConn_t* conn, double when)
+{
+    DBUG_ENTER("service");
+
+    do
+    {
+	releaseHeld(conn, when);
+	takeUp(options, conn, when);
+
+	if (0 != writeResponses(server, conn))
+	{
+	    DBUG_RETURN(-1);
+	}
+    }
+    while ((conn->queued > 0)
+	&& (0 == conn->owed)
+	&& (conn->heldRequests < options->depth)
+	&& (conn->heldCount < TS_MAX_HELD));
+
+    setInterest(server, conn);
+
+    DBUG_RETURN((conn->heldCount > 0)
+		? conn->held[conn->heldFirst].due - when
+		: -1);
+}
+
+/*------------------------------------------------------------------------------
+ * acceptConns() - accept every pending connection
+ */
+static void acceptConns(tsServer_t* server)
+{
+    int sock;
+    int one = 1;
+    int i;
+
+    DBUG_ENTER("acceptConns");
+
+    while (-1 != (sock = accept(server->listener, NULL, NULL)))
+    {
+	for (i = 0; (i < TS_MAX_CONNS) && (-1 != server->conns[i].sock); ++i)
+	{
+	    ;
+	}
+
+	if ((TS_MAX_CONNS == i)
+	||  (-1 == fcntl(sock, F_SETFL, O_NONBLOCK))
+	||  (-1 == EventLoopAdd(server->events, sock, EVENT_READ, &server->conns[i])))
+	{
+	    DBUG_PRINT("accept", ("connection refused"));
+
+	    close(sock);
+	    continue;
+	}
+
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+	server->conns[i].sock         = sock;
+	server->conns[i].queued       = 0;
+	server->conns[i].owed         = 0;
+	server->conns[i].heldRequests = 0;
+	server->conns[i].heldFirst    = 0;
+	server->conns[i].heldCount    = 0;
+	server->conns[i].offset       = 0;
+	server->conns[i].match        = 0;
+	server->conns[i].events       = EVENT_READ;
+
+	DBUG_PRINT("accept", ("connection %d", i));
+    }
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * listenLoopback() - listen on the loopback address; report the port
+ */
+static int listenLoopback(tsOptions_t* options, tsServer_t* server)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof addr;
+    int one = 1;
+
+    DBUG_ENTER("listenLoopback");
+
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(options->port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((-1 == (server->listener = socket(AF_INET, SOCK_STREAM, 0)))
+    ||  (-1 == setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR,
+			  &one, sizeof one))
+    ||  (-1 == bind(server->listener, (struct sockaddr*)&addr, sizeof addr))
+    ||  (-1 == listen(server->listener, SOMAXCONN))
+    ||  (-1 == fcntl(server->listener, F_SETFL, O_NONBLOCK))
+    ||  (-1 == getsockname(server->listener, (struct sockaddr*)&addr, &addrLen)))
+    {
+	perror("listen");
+
+	DBUG_RETURN(-1);
+    }
+
+    printf("%d\n", ntohs(addr.sin_port));
+    fflush(stdout);
+
+    DBUG_RETURN(0);
+}
+
+/*------------------------------------------------------------------------------
+ * serve() - answer requests, until killed
+ */
+static int serve(tsOptions_t* options, tsServer_t* server)
+{
+    Event_t ready[64];
+
+    int i;
+
+    DBUG_ENTER("serve");
+
+    for (i = 0; i < TS_MAX_CONNS; ++i)
+    {
+	server->conns[i].sock = -1;
+    }
+
+    if ((0 != makeResponse(options, server))
+    ||  (NULL == (server->events = EventLoopCreate(TS_MAX_CONNS + 1)))
+    ||  (0 != listenLoopback(options, server))
+    ||  (-1 == EventLoopAdd(server->events, server->listener, EVENT_READ, NULL)))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    for (;;)
+    {
+	int timeout = -1;
+	int count;
+
+	/* answer held requests that are now due */
+	if (0 != options->latency)
+	{
+	    double when = now();
+
+	    for (i = 0; i < TS_MAX_CONNS; ++i)
+	    {
+		tsConn_t* conn = &server->conns[i];
+		double wait;
+
+		if ((-1 != conn->sock)
+		&&  (conn->heldCount > 0)
+		&&  (0 <= (wait = service(options, server, conn, when)))
+		&&  ((-1 == timeout) || (wait * 1000 + 1 < timeout)))
+		{
+		    timeout = wait * 1000 + 1;
+		}
+	    }
+	}
+
+	if (-1 == (count = EventLoopWait(server->events, ready, 64, timeout)))
+	{
+	    if (EINTR == errno)
+	    {
+		continue;
+	    }
+
+	    perror("EventLoopWait()");
+
+	    DBUG_RETURN(-1);
+	}
+
+	for (i = 0; i < count; ++i)
+	{
+	    tsConn_t* conn = ready[i].data;
+
+	    if (NULL == conn)
+	    {
+		acceptConns(server);
+		continue;
+	    }
+
+	    if (-1 == conn->sock)
+	    {
+		continue;		/* closed earlier in this batch */
+	    }
+
+	    if ((ready[i].events & (EVENT_READ|EVENT_ERROR))
+	    &&  (conn->queued < TS_MAX_QUEUED)
+	    &&  (0 != readRequests(server, conn)))
+	    {
+		continue;
+	    }
+
+	    service(options, server, conn, now());
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * usage() - print a help message
+ */
+static void usage(char* programName)
+{
+    fprintf(stderr,
+	    "Usage: %s [options]\n"
+	    "    -h --help              Print this message\n"
+	    "    -p --port <n>          Listen on this port (default any)\n"
+	    "    -s --size <bytes>      Body size (default %d)\n"
+	    "    -c --chunk <bytes>     Send chunks of this size (default 0,\n"
+	    "                           meaning Content-Length)\n"
+	    "    -l --latency <ms>      Hold requests before answering (default %d)\n"
+	    "    -d --depth <n>         Pipelined requests answered at once\n"
+	    "                           (default %d; 1 disables pipelining)\n"
+#ifndef DBUG_OFF
+	    "    -# --dbug <state>      Specify DBUG state\n"
+#endif
+	    "\n"
+	    "    Listens on 127.0.0.1, and prints the port.\n",
+	    programName,
+	    TS_SIZE,
+	    TS_LATENCY,
+	    TS_DEPTH);
+}
+
+/*
+ * standalone server program.
+ */
+int main(int argc, char** argv)
+{
+    static struct option opts[] =
+    {
+	{ "help", no_argument,       NULL, 'h' },
+	{ "port", required_argument, NULL, 'p' },
+	{ "size", required_argument, NULL, 's' },
+	{ "chunk", required_argument, NULL, 'c' },
+	{ "latency", required_argument, NULL, 'l' },
+	{ "depth", required_argument, NULL, 'd' },
+#ifndef DBUG_OFF
+	{ "dbug", required_argument, NULL, '#' },
+#endif
+	{ NULL,   no_argument,       NULL, 0 },
+    };
+
+    tsOptions_t options;
+    tsServer_t server;
+
+    int opt;
+
+    DBUG_ENTER("main");
+
+    memset(&server, 0, sizeof server);
+
+    options.port = TS_PORT;
+    options.size    = TS_SIZE;
+    options.chunk   = TS_CHUNK;
+    options.latency = TS_LATENCY;
+    options.depth   = TS_DEPTH;
+
+    while (-1 != (opt = getopt_long(argc, argv, "hp:s:c:l:d:#:", opts, NULL)))
+    {
+	switch (opt)
+	{
+	case 'p':
+	    options.port = atoi(optarg);
+	    break;
+
+	case 's':
+	    options.size = atol(optarg);
+	    break;
+
+	case 'c':
+	    options.chunk = atol(optarg);
+	    break;
+
+	case 'l':
+	    options.latency = atoi(optarg);
+	    break;
+
+	case 'd':
+	    options.depth = atol(optarg);
+	    break;
+
+	case '#':
+	    DBUG_PUSH(optarg);
+	    break;
+
+	default:
+	    usage(argv[0]);
+	    DBUG_RETURN(1);
+	}
+    }
+
+    if ((options.port < 0) || (options.port > 65535) || (options.size < 0)
+    ||  (options.chunk < 0) || (options.latency < 0) || (options.depth < 1))
+    {
+	usage(argv[0]);
+	DBUG_RETURN(1);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    DBUG_RETURN(0 != serve(&options, &server));
+}
+
+/*
+ * EOF
+ */
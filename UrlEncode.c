@@ -5,71 +5,488 @@
  *
  *  ! * ' ( ) ; : @ & = + $ , / ? # [ ]
  *
+ * Encoding keeps the unreserved characters (letters, digits, and "-._~"),
+ * turns a space into '+', and writes anything else as "%XX". Decoding
+ * reverses that; a '%' must be followed by two hex digits.
+ *
+ * Both work on counted strings, and may work in place. Most of a URL needs
+ * no escaping, so each first copies the run of bytes that stay as they
+ * are: on x86, SSE2 and AVX2 kernels classify and copy 16 or 32 bytes at
+ * once. As with the Scan module, the best kernels are selected by
+ * 'UrlEncodeInit()'; until then, and on other CPUs, the scalar kernels are
+ * used.
+ *
  * Copyright (c) 2011 Kevin Short.
  */
-#include <ctype.h>
+#include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
+#include "Scan.h"
 #include "UrlEncode.h"
 #include "dbug.h"
 
-#define Hex2Bin(ch) (isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define URL_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Characters copied as they are, when encoding
+ */
+#define IsUnreserved(ch) \
+    (isUnreserved[(unsigned char)(ch)])
+
+static const char isUnreserved[256] =
+{
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1,
+    ['G'] = 1, ['H'] = 1, ['I'] = 1, ['J'] = 1, ['K'] = 1, ['L'] = 1,
+    ['M'] = 1, ['N'] = 1, ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1,
+    ['S'] = 1, ['T'] = 1, ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1,
+    ['Y'] = 1, ['Z'] = 1,
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1,
+    ['g'] = 1, ['h'] = 1, ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1,
+    ['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1,
+    ['s'] = 1, ['t'] = 1, ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1,
+    ['y'] = 1, ['z'] = 1,
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1,
+    ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+    ['-'] = 1, ['.'] = 1, ['_'] = 1, ['~'] = 1,
+};
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+/*
+ * Would storing 'n' bytes at 'r' overwrite input at 'p' not yet read?
+ */
+#define IsLagging(r, p, n) \
+    ((uintptr_t)(p) - (uintptr_t)(r) - 1 < (uintptr_t)(n) - 1)
+
+/*
+ * A set of kernels: each copies the bytes from 'p' that stay as they are,
+ * up to the first that does not (or 'end'), to 'r'; and returns how many.
+ *
+ * The vector kernels store whole blocks. Encoding stores a block before
+ * counting, so it may write past the run, though never past the bytes
+ * read; the output, moved ahead of the input in place, stays clear of it.
+ * Decoding in place lags the input, so storing a block could overwrite the
+ * escape that ends the run; when it lags by less than a block, only a block
+ * with no escape is stored whole, and the rest of the run is copied a byte
+ * at a time.
+ */
+struct url_kernels
+{
+    const char* name;
+    size_t (*copyEncode)(char* r, const char* p, const char* end);
+    size_t (*copyDecode)(char* r, const char* p, const char* end);
+};
+typedef struct url_kernels UrlKernels_t;
 
 /*------------------------------------------------------------------------------
- * Use a lookup table for encodings.
- *
- * This ought to be faster than performing various tests based on character
- * class.
- */
-static char* urlEncoding[256] =
-{
-    "%00", "%01", "%02", "%03", "%04", "%05", "%06", "%07",
-    "%08", "%09", "%0A", "%0B", "%0C", "%0D", "%0E", "%0F",
-    "%10", "%11", "%12", "%13", "%14", "%15", "%16", "%17",
-    "%18", "%19", "%1A", "%1B", "%1C", "%1D", "%1E", "%1F",
-      "+", "%21", "%22", "%23", "%24", "%25", "%26", "%27",
-    "%28", "%29", "%2A", "%2B", "%2C",   "-",   ".", "%2F",
-      "0",   "1",   "2",   "3",   "4",   "5",   "6",   "7",
-      "8",   "9", "%3A", "%3B", "%3C", "%3D", "%3E", "%3F",
-    "%40",   "A",   "B",   "C",   "D",   "E",   "F",   "G",
-      "H",   "I",   "J",   "K",   "L",   "M",   "N",   "O",
-      "P",   "Q",   "R",   "S",   "T",   "U",   "V",   "W",
-      "X",   "Y",   "Z", "%5B", "%5C", "%5D", "%5E",   "_",
-    "%60",   "a",   "b",   "c",   "d",   "e",   "f",   "g",
-      "h",   "i",   "j",   "k",   "l",   "m",   "n",   "o",
-      "p",   "q",   "r",   "s",   "t",   "u",   "v",   "w",
-      "x",   "y",   "z", "%7B", "%7C", "%7D",   "~", "%7F",
-    "%80", "%81", "%82", "%83", "%84", "%85", "%86", "%87",
-    "%88", "%89", "%8A", "%8B", "%8C", "%8D", "%8E", "%8F",
-    "%90", "%91", "%92", "%93", "%94", "%95", "%96", "%97",
-    "%98", "%99", "%9A", "%9B", "%9C", "%9D", "%9E", "%9F",
-    "%A0", "%A1", "%A2", "%A3", "%A4", "%A5", "%A6", "%A7",
-    "%A8", "%A9", "%AA", "%AB", "%AC", "%AD", "%AE", "%AF",
-    "%B0", "%B1", "%B2", "%B3", "%B4", "%B5", "%B6", "%B7",
-    "%B8", "%B9", "%BA", "%BB", "%BC", "%BD", "%BE", "%BF",
-    "%C0", "%C1", "%C2", "%C3", "%C4", "%C5", "%C6", "%C7",
-    "%C8", "%C9", "%CA", "%CB", "%CC", "%CD", "%CE", "%CF",
-    "%D0", "%D1", "%D2", "%D3", "%D4", "%D5", "%D6", "%D7",
-    "%D8", "%D9", "%DA", "%DB", "%DC", "%DD", "%DE", "%DF",
-    "%E0", "%E1", "%E2", "%E3", "%E4", "%E5", "%E6", "%E7",
-    "%E8", "%E9", "%EA", "%EB", "%EC", "%ED", "%EE", "%EF",
-    "%F0", "%F1", "%F2", "%F3", "%F4", "%F5", "%F6", "%F7",
-    "%F8", "%F9", "%FA", "%FB", "%FC", "%FD", "%FE", "%FF",
+ * Scalar kernels
+ */
+static size_t scalarCopyEncode(char* r, const char* p, const char* end)
+{
+    const char* start = p;
+
+    while ((p < end) && IsUnreserved(*p))
+    {
+	*r++ = *p++;
+    }
+
+    return p - start;
+}
+
+static size_t scalarCopyDecode(char* r, const char* p, const char* end)
+{
+    const char* start = p;
+
+    while ((p < end) && ('%' != *p) && ('+' != *p))
+    {
+	*r++ = *p++;
+    }
+
+    return p - start;
+}
+
+static const UrlKernels_t scalarKernels =
+{
+    "scalar", scalarCopyEncode, scalarCopyDecode
 };
 
+#ifdef URL_X86
+
+/*------------------------------------------------------------------------------
+ * SSE2 kernels
+ *
+ * A byte is in a range [lo, lo + n] if (byte - lo), saturated unsigned, less
+ * n, is zero. Letters are folded to lower case first, by setting bit 5;
+ * that moves no other byte into 'a' to 'z'. A byte that stays sets its bit
+ * of the mask; the first clear bit is the first that does not. The tail is
+ * left to the scalar kernel.
+ */
+__attribute__((target("sse2")))
+static inline __m128i sse2InRange(__m128i v, char lo, char n)
+{
+    return _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(v, _mm_set1_epi8(lo)),
+					_mm_set1_epi8(n)),
+			  _mm_setzero_si128());
+}
+
+__attribute__((target("sse2")))
+static size_t sse2CopyEncode(char* r, const char* p, const char* end)
+{
+    const __m128i bit5 = _mm_set1_epi8(0x20);
+    const __m128i underscore = _mm_set1_epi8('_');
+    const __m128i tilde = _mm_set1_epi8('~');
+
+    const char* start = p;
+
+    for ( ; end - p >= 16; p += 16, r += 16)
+    {
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	__m128i ok = _mm_or_si128(
+	    _mm_or_si128(sse2InRange(_mm_or_si128(v, bit5), 'a', 25),
+			 sse2InRange(v, '0', 9)),
+	    _mm_or_si128(sse2InRange(v, '-', 1),
+			 _mm_or_si128(_mm_cmpeq_epi8(v, underscore),
+				      _mm_cmpeq_epi8(v, tilde))));
+	unsigned int mask = ~_mm_movemask_epi8(ok) & 0xffff;
+
+	_mm_storeu_si128((__m128i*)r, v);
+
+	if (0 != mask)
+	{
+	    return p - start + __builtin_ctz(mask);
+	}
+    }
+
+    return p - start + scalarCopyEncode(r, p, end);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2CopyDecode(char* r, const char* p, const char* end)
+{
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+
+    const char* start = p;
+
+    for ( ; end - p >= 16; p += 16, r += 16)
+    {
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	unsigned int mask = _mm_movemask_epi8(
+	    _mm_or_si128(_mm_cmpeq_epi8(v, percent), _mm_cmpeq_epi8(v, plus)));
+
+	if ((0 != mask) && IsLagging(r, p, 16))
+	{
+	    return p - start + scalarCopyDecode(r, p, p + __builtin_ctz(mask));
+	}
+
+	_mm_storeu_si128((__m128i*)r, v);
+
+	if (0 != mask)
+	{
+	    return p - start + __builtin_ctz(mask);
+	}
+    }
+
+    return p - start + scalarCopyDecode(r, p, end);
+}
+
+static const UrlKernels_t sse2Kernels =
+{
+    "sse2", sse2CopyEncode, sse2CopyDecode
+};
+
+/*------------------------------------------------------------------------------
+ * AVX2 kernels
+ *
+ * As for SSE2, 32 bytes at once.
+ */
+__attribute__((target("avx2")))
+static inline __m256i avx2InRange(__m256i v, char lo, char n)
+{
+    return _mm256_cmpeq_epi8(
+	_mm256_subs_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(lo)),
+			 _mm256_set1_epi8(n)),
+	_mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static size_t avx2CopyEncode(char* r, const char* p, const char* end)
+{
+    const __m256i bit5 = _mm256_set1_epi8(0x20);
+    const __m256i underscore = _mm256_set1_epi8('_');
+    const __m256i tilde = _mm256_set1_epi8('~');
+
+    const char* start = p;
+
+    for ( ; end - p >= 32; p += 32, r += 32)
+    {
+	__m256i v = _mm256_loadu_si256((const __m256i*)p);
+	__m256i ok = _mm256_or_si256(
+	    _mm256_or_si256(avx2InRange(_mm256_or_si256(v, bit5), 'a', 25),
+			    avx2InRange(v, '0', 9)),
+	    _mm256_or_si256(avx2InRange(v, '-', 1),
+			    _mm256_or_si256(_mm256_cmpeq_epi8(v, underscore),
+					    _mm256_cmpeq_epi8(v, tilde))));
+	unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(ok);
+
+	_mm256_storeu_si256((__m256i*)r, v);
+
+	if (0 != mask)
+	{
+	    return p - start + __builtin_ctz(mask);
+	}
+    }
+
+    return p - start + sse2CopyEncode(r, p, end);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2CopyDecode(char* r, const char* p, const char* end)
+{
+    const __m256i percent = _mm256_set1_epi8('%');
+    const __m256i plus = _mm256_set1_epi8('+');
+
+    const char* start = p;
+
+    for ( ; end - p >= 32; p += 32, r += 32)
+    {
+	__m256i v = _mm256_loadu_si256((const __m256i*)p);
+	unsigned int mask = _mm256_movemask_epi8(
+	    _mm256_or_si256(_mm256_cmpeq_epi8(v, percent),
+			    _mm256_cmpeq_epi8(v, plus)));
+
+	if ((0 != mask) && IsLagging(r, p, 32))
+	{
+	    return p - start + scalarCopyDecode(r, p, p + __builtin_ctz(mask));
+	}
+
+	_mm256_storeu_si256((__m256i*)r, v);
+
+	if (0 != mask)
+	{
+	    return p - start + __builtin_ctz(mask);
+	}
+    }
+
+    return p - start + sse2CopyDecode(r, p, end);
+}
+
+static const UrlKernels_t avx2Kernels =
+{
+    "avx2", avx2CopyEncode, avx2CopyDecode
+};
+
+#endif /* URL_X86 */
+
+/*
+ * The selected kernels
+ */
+static const UrlKernels_t* kernels = &scalarKernels;
+
+/*------------------------------------------------------------------------------
+ * UrlEncodeInit() - select the best kernels for this CPU
+ *
+ * Call once, before any threads are started.
+ */
+void UrlEncodeInit(void)
+{
+    DBUG_ENTER("UrlEncodeInit");
+
+    kernels = &scalarKernels;
+
+#ifdef URL_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+	kernels = &avx2Kernels;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+	kernels = &sse2Kernels;
+    }
+#endif
+
+    DBUG_PRINT("url", ("using %s", kernels->name));
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * UrlEncodeSelect() - select kernels by name, for testing and benchmarks
+ *
+ * Returns 0 on success, -1 if the kernels are unknown or unsupported.
+ */
+int UrlEncodeSelect(const char* name)
+{
+    DBUG_ENTER("UrlEncodeSelect");
+
+    assert(NULL != name);
+
+    if (0 == strcasecmp(name, scalarKernels.name))
+    {
+	kernels = &scalarKernels;
+
+	DBUG_RETURN(0);
+    }
+
+#ifdef URL_X86
+    __builtin_cpu_init();
+
+    if ((0 == strcasecmp(name, sse2Kernels.name))
+    &&  __builtin_cpu_supports("sse2"))
+    {
+	kernels = &sse2Kernels;
+
+	DBUG_RETURN(0);
+    }
+
+    if ((0 == strcasecmp(name, avx2Kernels.name))
+    &&  __builtin_cpu_supports("avx2"))
+    {
+	kernels = &avx2Kernels;
+
+	DBUG_RETURN(0);
+    }
+#endif
+
+    DBUG_RETURN(-1);
+}
+
+/*------------------------------------------------------------------------------
+ * UrlEncodeName() - name the selected kernels
+ */
+const char* UrlEncodeName(void)
+{
+    return kernels->name;
+}
+
+/*------------------------------------------------------------------------------
+ * UrlEncodeTo() - encode 'len' bytes from 'in' into 'out'
+ *
+ * 'out' holds at least 3 * 'len' + 1 bytes, and may be 'in' itself. The
+ * result is NUL terminated; returns its length.
+ *
+ * In place, the input is first moved to the end of the buffer: the
+ * encoding, at most three bytes per byte read, then never overtakes it.
+ */
+size_t UrlEncodeTo(char* out, const char* in, size_t len)
+{
+    const char* p;
+    const char* end;
+    char* r = out;
+
+    assert(NULL != out);
+    assert((NULL != in) || (0 == len));
+
+    if (out == in)
+    {
+	in = memmove(out + 2 * len, in, len);
+    }
+
+    for (p = in, end = in + len; p < end; ++p)
+    {
+	size_t n = kernels->copyEncode(r, p, end);
+	unsigned char ch;
+
+	r += n;				/* a run copied as it is */
+	p += n;
+
+	if (p == end)
+	{
+	    break;
+	}
+
+	ch = (unsigned char)*p;
+
+	if (' ' == ch)
+	{
+	    *r++ = '+';
+	}
+	else
+	{
+	    *r++ = '%';
+	    *r++ = hexDigits[ch >> 4];
+	    *r++ = hexDigits[ch & 0x0f];
+	}
+    }
+
+    *r = '\0';				/* terminate string */
+
+    return r - out;
+}
+
+/*------------------------------------------------------------------------------
+ * UrlDecodeTo() - decode 'len' bytes from 'in' into 'out'
+ *
+ * 'out' holds at least 'len' + 1 bytes, and may be 'in' itself: decoding
+ * never lengthens, so the output lags the input. The result is NUL
+ * terminated.
+ *
+ * Returns its length, or -1 if a '%' is not followed by two hex digits.
+ */
+long UrlDecodeTo(char* out, const char* in, size_t len)
+{
+    const char* p = in;
+    const char* end = in + len;
+    char* r = out;
+
+    assert(NULL != out);
+    assert((NULL != in) || (0 == len));
+
+    while (p < end)
+    {
+	size_t n = kernels->copyDecode(r, p, end);
+
+	r += n;				/* a run copied as it is */
+	p += n;
+
+	if (p == end)
+	{
+	    break;
+	}
+
+	if ('+' == *p)
+	{
+	    *r++ = ' ';
+	    ++p;
+	}
+	else if ((end - p >= 3)
+	     &&  (0 <= ScanHexValue[(unsigned char)p[1]])
+	     &&  (0 <= ScanHexValue[(unsigned char)p[2]]))
+	{
+	    *r++ = (char)((ScanHexValue[(unsigned char)p[1]] << 4)
+			 | ScanHexValue[(unsigned char)p[2]]);
+	    p += 3;
+	}
+	else
+	{
+	    return -1;			/* malformed "%xx" */
+	}
+    }
+
+    *r = '\0';				/* terminate string */
+
+    return r - out;
+}
+
 /*------------------------------------------------------------------------------
  * Encode a URL string.
  *
  * Returns the encoded string -- which the caller must 'free()'.
  *
- * Returns NULL if passed a NULL pointer.
+ * Returns NULL if passed a NULL pointer, or out of memory.
  */
 char* UrlEncode(char* string)
 {
     char* result;
-    unsigned char* s;
-    char* r;
+    size_t len;
 
     DBUG_ENTER("UrlEncode");
 
@@ -78,20 +495,14 @@ char* UrlEncode(char* string)
 	DBUG_RETURN(NULL);
     }
 
-    /* allocate enough space for complete encoding */
-    result = malloc(3 * strlen(string) + 1);
+    len = strlen(string);
 
-    for (s = (unsigned char*)string, r = result; *s; ++s)
+    /* allocate enough space for complete encoding */
+    if (NULL != (result = malloc(3 * len + 1)))
     {
-	char* p = urlEncoding[*s];	/* lookup */
-	while (*p)
-	{
-	    *r++ = *p++;		/* copy string */
-	}
+	UrlEncodeTo(result, string, len);
     }
 
-    *r = '\0';				/* terminate string */
-
     DBUG_RETURN(result);
 }
 
@@ -100,14 +511,13 @@ char* UrlEncode(char* string)
  *
  * Returns the decoded string -- which the caller must 'free()'.
  *
- * Returns NULL if passed a NULL pointer.
+ * Returns NULL if passed a NULL pointer, or out of memory.
  * Returns NULL if an invalid "%xx" sequence is encountered.
  */
 char* UrlDecode(char* string)
 {
     char* result;
-    char* s;
-    char* r;
+    size_t len;
 
     DBUG_ENTER("UrlDecode");
 
@@ -116,39 +526,16 @@ char* UrlDecode(char* string)
 	DBUG_RETURN(NULL);
     }
 
-    /* allocate enough space for straight pass through */
-    result = malloc(strlen(string) + 1);
+    len = strlen(string);
 
-    for (s = string, r = result; *s; ++s)
+    /* allocate enough space for straight pass through */
+    if ((NULL != (result = malloc(len + 1)))
+    &&  (0 > UrlDecodeTo(result, string, len)))
     {
-	if ('%' == *s)
-	{
-	    if (s[1] && s[2])		/* incomplete sequence? */
-	    {
-		*r++ = (Hex2Bin(s[1]) << 4) | Hex2Bin(s[2]);
-		s += 2;
-	    }
-	    else
-	    {
-		free(result);
-		return NULL;		/* error! */
-	    }
-	}
-	else
-	{
-	    if ('+' == *s)
-	    {
-		*r++ = ' ';
-	    }
-	    else 
-	    {
-		*r++ = *s;
-	    }
-	}
+	free(result);
+	result = NULL;			/* error! */
     }
 
-    *r = '\0';				/* terminate string */
-
     DBUG_RETURN(result);
 }
 
@@ -5,6 +5,14 @@
  *
  * Copyright (c) 2011 Kevin Short.
  */
+#include <stddef.h>
+
+extern void UrlEncodeInit(void);
+extern int UrlEncodeSelect(const char* name);
+extern const char* UrlEncodeName(void);
+
+extern size_t UrlEncodeTo(char* out, const char* in, size_t len);
+extern long UrlDecodeTo(char* out, const char* in, size_t len);
 
 extern char* UrlEncode(char* string);
 extern char* UrlDecode(char* string);
@@ -1,15 +1,348 @@
 /*------------------------------------------------------------------------------
  * UrlEncodeTest.c -- Test for URL encoding and decoding
  *
+ * Checks each kernel set this CPU supports against the scalar code the
+ * module used to have (kept here as the reference): encoding, decoding,
+ * round trips, in place, and malformed escapes. With "bench", then times
+ * the reference and each kernel set over URL-like text.
+ *
  * Copyright (c) 2011 Kevin Short.
  */
+#include <ctype.h>
 #include <stdio.h>
-// #include <stdlib.h>
-// #include <string.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "UrlEncode.h"
 #include "dbug.h"
 
+#define TEST_ROUNDS	20000		/* random strings per kernel set */
+#define TEST_LEN	200		/* longest random string */
+#define BENCH_BYTES	(1024 * 1024)	/* size of the text */
+#define BENCH_ROUNDS	200		/* passes over the text */
+
+#define Hex2Bin(ch) (isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10)
+
+static char* kernelNames[] = { "scalar", "sse2", "avx2", NULL };
+
+/*------------------------------------------------------------------------------
+ * The reference: the module's scalar code, before it took lengths
+ */
+static char* referenceEncoding[256] =
+{
+    "%00", "%01", "%02", "%03", "%04", "%05", "%06", "%07",
+    "%08", "%09", "%0A", "%0B", "%0C", "%0D", "%0E", "%0F",
+    "%10", "%11", "%12", "%13", "%14", "%15", "%16", "%17",
+    "%18", "%19", "%1A", "%1B", "%1C", "%1D", "%1E", "%1F",
+      "+", "%21", "%22", "%23", "%24", "%25", "%26", "%27",
+    "%28", "%29", "%2A", "%2B", "%2C",   "-",   ".", "%2F",
+      "0",   "1",   "2",   "3",   "4",   "5",   "6",   "7",
+      "8",   "9", "%3A", "%3B", "%3C", "%3D", "%3E", "%3F",
+    "%40",   "A",   "B",   "C",   "D",   "E",   "F",   "G",
+      "H",   "I",   "J",   "K",   "L",   "M",   "N",   "O",
+      "P",   "Q",   "R",   "S",   "T",   "U",   "V",   "W",
+      "X",   "Y",   "Z", "%5B", "%5C", "%5D", "%5E",   "_",
+    "%60",   "a",   "b",   "c",   "d",   "e",   "f",   "g",
+      "h",   "i",   "j",   "k",   "l",   "m",   "n",   "o",
+      "p",   "q",   "r",   "s",   "t",   "u",   "v",   "w",
+      "x",   "y",   "z", "%7B", "%7C", "%7D",   "~", "%7F",
+    "%80", "%81", "%82", "%83", "%84", "%85", "%86", "%87",
+    "%88", "%89", "%8A", "%8B", "%8C", "%8D", "%8E", "%8F",
+    "%90", "%91", "%92", "%93", "%94", "%95", "%96", "%97",
+    "%98", "%99", "%9A", "%9B", "%9C", "%9D", "%9E", "%9F",
+    "%A0", "%A1", "%A2", "%A3", "%A4", "%A5", "%A6", "%A7",
+    "%A8", "%A9", "%AA", "%AB", "%AC", "%AD", "%AE", "%AF",
+    "%B0", "%B1", "%B2", "%B3", "%B4", "%B5", "%B6", "%B7",
+    "%B8", "%B9", "%BA", "%BB", "%BC", "%BD", "%BE", "%BF",
+    "%C0", "%C1", "%C2", "%C3", "%C4", "%C5", "%C6", "%C7",
+    "%C8", "%C9", "%CA", "%CB", "%CC", "%CD", "%CE", "%CF",
+    "%D0", "%D1", "%D2", "%D3", "%D4", "%D5", "%D6", "%D7",
+    "%D8", "%D9", "%DA", "%DB", "%DC", "%DD", "%DE", "%DF",
+    "%E0", "%E1", "%E2", "%E3", "%E4", "%E5", "%E6", "%E7",
+    "%E8", "%E9", "%EA", "%EB", "%EC", "%ED", "%EE", "%EF",
+    "%F0", "%F1", "%F2", "%F3", "%F4", "%F5", "%F6", "%F7",
+    "%F8", "%F9", "%FA", "%FB", "%FC", "%FD", "%FE", "%FF",
+};
+
+static void referenceEncode(char* string, char* result)
+{
+    unsigned char* s;
+    char* r;
+
+    for (s = (unsigned char*)string, r = result; *s; ++s)
+    {
+	char* p = referenceEncoding[*s];
+	while (*p)
+	{
+	    *r++ = *p++;
+	}
+    }
+
+    *r = '\0';
+}
+
+static long referenceDecode(char* string, char* result)
+{
+    char* s;
+    char* r;
+
+    for (s = string, r = result; *s; ++s)
+    {
+	if ('%' == *s)
+	{
+	    if (s[1] && s[2])
+	    {
+		*r++ = (Hex2Bin(s[1]) << 4) | Hex2Bin(s[2]);
+		s += 2;
+	    }
+	    else
+	    {
+		return -1;
+	    }
+	}
+	else
+	{
+	    *r++ = ('+' == *s) ? ' ' : *s;
+	}
+    }
+
+    *r = '\0';
+
+    return r - result;
+}
+
+/*
+ * now() - monotonic time, in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * makeString() - a random NUL terminated string, of bytes 1 to 255, with
+ * runs of unreserved characters as in URLs; or, when 'isEncoded', of valid
+ * escapes and '+'s among them
+ */
+static size_t makeString(char* buf, int isEncoded)
+{
+    static char plain[] = "abcdefghijklmnopqrstuvwxyz0123456789-._~ABCXYZ";
+    static char hex[] = "0123456789abcdefABCDEF";
+
+    size_t len = rand() % TEST_LEN;
+    size_t i = 0;
+
+    while (i < len)
+    {
+	int kind = rand() % 8;
+
+	if (isEncoded && (0 == kind) && (i + 3 <= len))
+	{
+	    buf[i++] = '%';
+	    buf[i++] = hex[rand() % (sizeof hex - 1)];
+	    buf[i++] = hex[rand() % (sizeof hex - 1)];
+	}
+	else if (isEncoded && (1 == kind))
+	{
+	    buf[i++] = '+';
+	}
+	else if (!isEncoded && (0 == kind))
+	{
+	    buf[i++] = (char)(1 + rand() % 255);
+	}
+	else
+	{
+	    buf[i++] = plain[rand() % (sizeof plain - 1)];
+	}
+    }
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+/*
+ * check() - compare the selected kernels with the reference. Returns the
+ * number of failures.
+ */
+static int check(char* name)
+{
+    static char* malformed[] = { "%", "%4", "a%4", "%G1", "%1g", "abc%zz", NULL };
+
+    char in[TEST_LEN + 1];
+    char expected[3 * TEST_LEN + 1];
+    char out[3 * TEST_LEN + 1];
+
+    long expectedLen;
+
+    int failures = 0;
+    int round;
+    int i;
+
+    srand(1);
+
+    for (round = 0; round < TEST_ROUNDS; ++round)
+    {
+	size_t len = makeString(in, 0);
+	char* encoded;
+	char* decoded;
+
+	/* encode, copying and in place; then decode it back */
+
+	referenceEncode(in, expected);
+
+	encoded = UrlEncode(in);
+	decoded = UrlDecode(encoded);
+
+	failures += (0 != strcmp(encoded, expected));
+	failures += (0 != strcmp(decoded, in));
+
+	free(encoded);
+	free(decoded);
+
+	memcpy(out, in, len + 1);
+	failures += (strlen(expected) != UrlEncodeTo(out, out, len));
+	failures += (0 != strcmp(out, expected));
+
+	failures += ((long)len != UrlDecodeTo(out, out, strlen(out)));
+	failures += (0 != strcmp(out, in));
+
+	/* decode escapes, copying and in place */
+
+	len = makeString(in, 1);
+
+	expectedLen = referenceDecode(in, expected);
+
+	decoded = UrlDecode(in);
+	failures += (0 != memcmp(decoded, expected, expectedLen + 1));
+	free(decoded);
+
+	memcpy(out, in, len + 1);
+	failures += (expectedLen != UrlDecodeTo(out, out, len));
+	failures += (0 != memcmp(out, expected, expectedLen + 1));
+    }
+
+    /* the reference let bad hex digits through; now they are refused */
+
+    for (i = 0; NULL != malformed[i]; ++i)
+    {
+	if (NULL != UrlDecode(malformed[i]))
+	{
+	    printf("%s: accepted \"%s\"\n", name, malformed[i]);
+	    ++failures;
+	}
+    }
+
+    if (0 != failures)
+    {
+	printf("%s: %d failures\n", name, failures);
+    }
+
+    return failures;
+}
+
+/*
+ * report() - print one result line
+ */
+static void report(char* what, char* name, double seconds, size_t len)
+{
+    printf("%-8s %-10s %8.1f MB/s\n",
+	   what,
+	   name,
+	   (double)len * BENCH_ROUNDS / seconds / (1024 * 1024));
+}
+
+/*
+ * bench() - time the reference and each kernel set over URL-like text
+ */
+static void bench(void)
+{
+    char* text = malloc(BENCH_BYTES + 1);
+    char* encoded = malloc(3 * BENCH_BYTES + 1);
+    char* out = malloc(3 * BENCH_BYTES + 1);
+    char** name;
+
+    size_t len = 0;
+    size_t encodedLen;
+    double start;
+    int round;
+
+    /* paths and queries: mostly plain, some spaces and reserved */
+    srand(1);
+    while (len < BENCH_BYTES)
+    {
+	static char plain[] = "abcdefghijklmnopqrstuvwxyz0123456789-._~/";
+	int run = 1 + rand() % 40;
+
+	while ((run-- > 0) && (len < BENCH_BYTES))
+	{
+	    text[len++] = plain[rand() % (sizeof plain - 1)];
+	}
+
+	if (len < BENCH_BYTES)
+	{
+	    text[len++] = " =&?"[rand() % 4];
+	}
+    }
+    text[len] = '\0';
+
+    referenceEncode(text, encoded);
+    encodedLen = strlen(encoded);
+
+    start = now();
+    for (round = 0; round < BENCH_ROUNDS; ++round)
+    {
+	referenceEncode(text, out);
+    }
+    report("encode", "reference", now() - start, len);
+
+    for (name = kernelNames; NULL != *name; ++name)
+    {
+	if (0 != UrlEncodeSelect(*name))
+	{
+	    continue;
+	}
+
+	start = now();
+	for (round = 0; round < BENCH_ROUNDS; ++round)
+	{
+	    UrlEncodeTo(out, text, len);
+	}
+	report("encode", *name, now() - start, len);
+    }
+
+    start = now();
+    for (round = 0; round < BENCH_ROUNDS; ++round)
+    {
+	referenceDecode(encoded, out);
+    }
+    report("decode", "reference", now() - start, encodedLen);
+
+    for (name = kernelNames; NULL != *name; ++name)
+    {
+	if (0 != UrlEncodeSelect(*name))
+	{
+	    continue;
+	}
+
+	start = now();
+	for (round = 0; round < BENCH_ROUNDS; ++round)
+	{
+	    UrlDecodeTo(out, encoded, encodedLen);
+	}
+	report("decode", *name, now() - start, encodedLen);
+    }
+
+    free(text);
+    free(encoded);
+    free(out);
+}
+
 /*
  * stanadlone test program.
  */
@@ -25,22 +358,41 @@ int main(int argc, char** argv)
 
     char* encoded;
     char* decoded;
+    char** name;
 
-    DBUG_PUSH("d:t");
+    int failures = 0;
+
+    DBUG_PUSH("d,test");
     DBUG_ENTER("main");
 
     encoded = UrlEncode(s);
     decoded = UrlDecode(encoded);
 
-    DBUG_PRINT("test",(s));
-    DBUG_PRINT("test",(encoded));
-    DBUG_PRINT("test",(decoded));
-    DBUG_PRINT("test",((0 == strcmp(s, decoded)) ? "Looks good!" : "Failed"));
+    DBUG_PRINT("test",("%s", s));
+    DBUG_PRINT("test",("%s", encoded));
+    DBUG_PRINT("test",("%s", decoded));
+
+    failures += (0 != strcmp(s, decoded));
 
     free(encoded);
     free(decoded);
 
-    DBUG_RETURN(0);
+    for (name = kernelNames; NULL != *name; ++name)
+    {
+	if (0 == UrlEncodeSelect(*name))
+	{
+	    failures += check(*name);
+	}
+    }
+
+    DBUG_PRINT("test",((0 == failures) ? "Looks good!" : "Failed"));
+
+    if ((argc > 1) && (0 == strcmp(argv[1], "bench")))
+    {
+	bench();
+    }
+
+    DBUG_RETURN(0 != failures);
 }
 
 /*
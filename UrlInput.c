@@ -0,0 +1,247 @@
+/*------------------------------------------------------------------------------
+ * UrlInput.c -- stream "URL [output-path]" lines from a file
+ *
+ * The file is read in large chunks; lines are found with ScanChar(), and
+ * handed out in place, so memory use depends on the longest line, not on the
+ * length of the file. Blank lines, and lines starting with '#', are skipped.
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/errno.h>
+
+#include "Scan.h"
+#include "UrlInput.h"
+#include "dbug.h"
+
+/*------------------------------------------------------------------------------
+ * isSpace() - is this a field separator?
+ */
+static int isSpace(char c)
+{
+    return (' ' == c) || ('\t' == c) || ('\r' == c);
+}
+
+/*------------------------------------------------------------------------------
+ * fill() - read more of the file, keeping the partial line
+ *
+ * Returns the number of bytes read, 0 at end of file, or -1 on error.
+ */
+static ssize_t fill(UrlInput_t* input)
+{
+    ssize_t len;
+
+    DBUG_ENTER("fill");
+
+    /* keep the partial line, at the front */
+    if (input->start > 0)
+    {
+	memmove(input->buf, &input->buf[input->start], input->end - input->start);
+	input->end   -= input->start;
+	input->start  = 0;
+    }
+
+    /* make room for another chunk, when the line is long */
+    if (input->size - input->end < URL_INPUT_CHUNK)
+    {
+	size_t size = input->size + URL_INPUT_CHUNK;
+	char* buf;
+
+	if (NULL == (buf = realloc(input->buf, size)))
+	{
+	    DBUG_PRINT("syslib", ("realloc() failed, size %lu",
+				  (unsigned long)size));
+
+	    DBUG_RETURN(-1);
+	}
+
+	input->buf  = buf;
+	input->size = size;
+    }
+
+    do
+    {
+	/* always leave room to terminate the last line */
+	len = read(input->fd,
+		   &input->buf[input->end],
+		   input->size - input->end - 1);
+    }
+    while ((-1 == len) && (EINTR == errno));
+
+    if (len > 0)
+    {
+	input->end += len;
+    }
+
+    DBUG_PRINT("input", ("read %ld bytes", (long)len));
+
+    DBUG_RETURN(len);
+}
+
+/*------------------------------------------------------------------------------
+ * UrlInputOpen() - open a file of URLs; "-" is the standard input
+ */
+UrlInput_t* UrlInputOpen(const char* path)
+{
+    UrlInput_t* input;
+
+    DBUG_ENTER("UrlInputOpen");
+
+    assert(NULL != path);
+
+    if (NULL == (input = calloc(1, sizeof(UrlInput_t))))
+    {
+	DBUG_RETURN(NULL);
+    }
+
+    if (0 == strcmp(path, "-"))
+    {
+	input->fd = STDIN_FILENO;
+    }
+    else if (-1 == (input->fd = open(path, O_RDONLY)))
+    {
+	free(input);
+
+	DBUG_RETURN(NULL);
+    }
+
+    DBUG_RETURN(input);
+}
+
+/*------------------------------------------------------------------------------
+ * UrlInputNext() - get the next line
+ *
+ * Sets '*url', and '*path' (or NULL, when the line has only a URL). Both
+ * point into the read buffer, so are valid until the next call.
+ */
+int UrlInputNext(UrlInput_t* input, char** url, char** path)
+{
+    DBUG_ENTER("UrlInputNext");
+
+    assert(NULL != input);
+    assert(NULL != url);
+    assert(NULL != path);
+
+    for (;;)
+    {
+	char* p = &input->buf[input->start];
+	char* end = &input->buf[input->end];
+	char* nl = (p < end) ? (char*)ScanChar(p, end, '\n') : NULL;
+
+	if (NULL == nl)
+	{
+	    ssize_t len;
+
+	    if (input->isEof)
+	    {
+		if (p == end)
+		{
+		    DBUG_RETURN(URL_INPUT_EOF);
+		}
+
+		nl = end;		/* last line lacks a newline */
+	    }
+	    else
+	    {
+		if (-1 == (len = fill(input)))
+		{
+		    DBUG_RETURN(URL_INPUT_ERROR);
+		}
+
+		if (0 == len)
+		{
+		    input->isEof = 1;
+		}
+
+		continue;
+	    }
+	}
+
+	/*
+	 * Split the line into fields
+	 */
+
+	++input->lineNumber;
+
+	input->start = nl - input->buf + ((nl < end) ? 1 : 0);
+	*nl = '\0';
+
+	while (isSpace(*p))
+	{
+	    ++p;
+	}
+
+	if (('\0' == *p) || ('#' == *p))
+	{
+	    continue;			/* blank, or comment */
+	}
+
+	*url = p;
+
+	while (('\0' != *p) && !isSpace(*p))
+	{
+	    ++p;
+	}
+
+	*path = NULL;
+
+	if ('\0' != *p)
+	{
+	    *p++ = '\0';
+
+	    while (isSpace(*p))
+	    {
+		++p;
+	    }
+
+	    if ('\0' != *p)
+	    {
+		*path = p;
+
+		/* trim trailing blanks, and any CR */
+		for (p += strlen(p); isSpace(p[-1]); --p)
+		{
+		    p[-1] = '\0';
+		}
+	    }
+	}
+
+	DBUG_PRINT("input", ("line %ld: %s %s",
+			     input->lineNumber,
+			     *url,
+			     (NULL == *path) ? "-" : *path));
+
+	DBUG_RETURN(URL_INPUT_LINE);
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * UrlInputClose() - close the file, and free the reader
+ */
+void UrlInputClose(UrlInput_t* input)
+{
+    DBUG_ENTER("UrlInputClose");
+
+    if (NULL != input)
+    {
+	if (STDIN_FILENO != input->fd)
+	{
+	    close(input->fd);
+	}
+
+	free(input->buf);
+	free(input);
+    }
+
+    DBUG_VOID_RETURN;
+}
+
+/*
+ * EOF
+ */
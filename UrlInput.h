@@ -0,0 +1,37 @@
+#ifndef URLINPUT_H
+#define URLINPUT_H 1
+/*------------------------------------------------------------------------------
+ * UrlInput.h -- stream "URL [output-path]" lines from a file
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+
+/*
+ * Bytes read at a time; longer lines grow the buffer.
+ */
+#define URL_INPUT_CHUNK 65536
+
+/*
+ * UrlInputNext() return codes
+ */
+#define URL_INPUT_ERROR (-1)		/* read() failed */
+#define URL_INPUT_EOF   0		/* no more lines */
+#define URL_INPUT_LINE  1		/* found a line */
+
+struct url_input
+{
+    char* buf;				/* read buffer */
+    size_t size;			/* bytes allocated */
+    size_t start;			/* start of the next line */
+    size_t end;				/* end of the bytes read */
+    long lineNumber;			/* lines seen, for messages */
+    int fd;				/* the file */
+    int isEof;				/* has read() returned 0? */
+};
+typedef struct url_input UrlInput_t;
+
+extern UrlInput_t* UrlInputOpen(const char* path);
+extern int UrlInputNext(UrlInput_t* input, char** url, char** path);
+extern void UrlInputClose(UrlInput_t* input);
+
+#endif
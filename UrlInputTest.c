@@ -0,0 +1,115 @@
+/*------------------------------------------------------------------------------
+ * UrlInputTest.c -- Test for streaming "URL [output-path]" lines
+ *
+ * Copyright (c) 2011 Kevin Short.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "UrlInput.h"
+#include "dbug.h"
+
+/*
+ * Lines written; every one but the comment and blank lines should be read
+ * back. Far more lines than fit in one read, and one line longer than a read.
+ */
+#define LINES 20000
+
+/*
+ * stanadlone test program.
+ */
+int main(int argc, char** argv)
+{
+    char path[] = "/tmp/UrlInputTest.XXXXXX";
+    char* longPath;
+
+    UrlInput_t* input;
+    FILE* fp;
+
+    char* url;
+    char* filename;
+
+    int failures = 0;
+    int count = 0;
+    int rc;
+    int i;
+
+    DBUG_PUSH("d,test");
+    DBUG_ENTER("main");
+
+    longPath = malloc(URL_INPUT_CHUNK * 2);
+    memset(longPath, 'x', URL_INPUT_CHUNK * 2 - 1);
+    longPath[URL_INPUT_CHUNK * 2 - 1] = '\0';
+
+    fp = fdopen(mkstemp(path), "w");
+
+    fprintf(fp, "# comment\n\n   \r\n");
+
+    for (i = 0; i < LINES; ++i)
+    {
+	if (LINES / 2 == i)
+	{
+	    fprintf(fp, "http://host/%d %s\n", i, longPath);
+	}
+	else if (0 == i % 3)
+	{
+	    fprintf(fp, "  http://host/%d\t out.%d \r\n", i, i);
+	}
+	else if (1 == i % 3)
+	{
+	    fprintf(fp, "http://host/%d\r\n", i);
+	}
+	else
+	{
+	    fprintf(fp, "http://host/%d out.%d", i, i);
+
+	    if (i != LINES - 1)
+	    {
+		fprintf(fp, "\n");	/* last line lacks a newline */
+	    }
+	}
+    }
+
+    fclose(fp);
+
+    input = UrlInputOpen(path);
+
+    while (URL_INPUT_LINE == (rc = UrlInputNext(input, &url, &filename)))
+    {
+	char expect[32];
+
+	snprintf(expect, sizeof expect, "http://host/%d", count);
+	failures += (0 != strcmp(url, expect));
+
+	if (LINES / 2 == count)
+	{
+	    failures += (NULL == filename) || (0 != strcmp(filename, longPath));
+	}
+	else if (1 == count % 3)
+	{
+	    failures += (NULL != filename);
+	}
+	else
+	{
+	    snprintf(expect, sizeof expect, "out.%d", count);
+	    failures += (NULL == filename) || (0 != strcmp(filename, expect));
+	}
+
+	++count;
+    }
+
+    failures += (URL_INPUT_EOF != rc) || (LINES != count);
+
+    UrlInputClose(input);
+    remove(path);
+    free(longPath);
+
+    DBUG_PRINT("test",((0 == failures) ? "Looks good!" : "Failed"));
+
+    DBUG_RETURN(0 != failures);
+}
+
+/*
+ * EOF
+ */
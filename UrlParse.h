@@ -19,6 +19,40 @@ struct url_parse
 };
 typedef struct url_parse UrlParse_t;
 
+/*
+ * A part of a URL, as a view into the caller's string. A part that is
+ * absent has length 0; the scheme, port and path then take their defaults.
+ */
+struct url_span
+{
+    int offset;				/* from the start of the URL */
+    int length;				/* bytes, not NUL terminated */
+};
+typedef struct url_span UrlSpan_t;
+
+struct url_spans
+{
+    UrlSpan_t scheme;			/* absent: "http" */
+    UrlSpan_t username;
+    UrlSpan_t password;
+    UrlSpan_t domain;
+    UrlSpan_t port;			/* absent: "80" */
+    UrlSpan_t path;			/* with its leading '/'; absent: "/" */
+    UrlSpan_t query_string;		/* after the '?' */
+    UrlSpan_t fragment_id;		/* after the '#' */
+};
+typedef struct url_spans UrlSpans_t;
+
+#define URL_SCHEME_DEFAULT	"http"
+#define URL_PORT_DEFAULT	"80"
+#define URL_PATH_DEFAULT	"/"
+
+/* the start of a span, for "%.*s" */
+#define URL_SPAN(url, span)	(&(url)[(span).offset])
+
+extern int UrlParseSpans(const char* url, UrlSpans_t* spans);
+extern int UrlSpanIs(const char* url, UrlSpan_t span, const char* s);
+
 extern UrlParse_t* UrlParse(char* url);
 extern void UrlParseFree(UrlParse_t* rpURL);
 extern void UrlParsePrint(UrlParse_t* url);
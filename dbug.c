@@ -394,7 +394,19 @@ code_state(void)
 #define code_state() (&static_code_state)
 #define pthread_mutex_lock(A) {}
 #define pthread_mutex_unlock(A) {}
-static CODE_STATE static_code_state = { 0, 0, "?func", "?file", NULL, 0, NULL,
+
+/*
+** Without THREAD, each thread still gets its own call stack state, so
+** that threads calling DBUG_ENTER/DBUG_RETURN do not corrupt each other's
+** nesting; the settings pushed by DBUG_PUSH are shared, read-only.
+*/
+#if defined(__GNUC__)
+#define DBUG_THREAD_LOCAL __thread
+#else
+#define DBUG_THREAD_LOCAL
+#endif
+
+static DBUG_THREAD_LOCAL CODE_STATE static_code_state = { 0, 0, "?func", "?file", NULL, 0, NULL,
     NULL, 0, "?", 0
 };
 #endif
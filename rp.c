@@ -6,27 +6,55 @@
  * Copyright (c) 2011 Kevin Short.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE 1			/* splice() */
+#endif
+
 #include <assert.h>
 #include <ctype.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <limits.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <sys/errno.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <arpa/inet.h>
 
 #include <netinet/in.h>
 
+#ifdef __linux__
+#include <linux/fs.h>			/* FICLONE */
+#endif
+
+#include <pthread.h>
+
+#include <time.h>
+
+#include "Arena.h"
+#include "Event.h"
+#include "Histogram.h"
+#include "HttpChunked.h"
+#include "HttpHeader.h"
+#include "HttpInflate.h"
+#include "Resolve.h"
+#include "Scan.h"
+#include "Sha256.h"
 #include "UrlEncode.h"
+#include "UrlInput.h"
 #include "UrlParse.h"
 #include "dbug.h"
 
@@ -38,7 +66,9 @@
 enum rp_result
 {
     rp_success = 0,
-    rp_failure = -1
+    rp_failure = -1,
+    rp_pending = 1,			/* would block; try again later */
+    rp_retry = 2			/* connection dropped; send the rest again */
 };
 typedef enum rp_result rpResult_t;
 
@@ -47,21 +77,127 @@ typedef enum rp_result rpResult_t;
  */
 #define RP_SOCK_CLOSED (-1)
 
+/*
+ * Most iovec elements per sendmsg() (POSIX guarantees at least 16)
+ */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/*
+ * Default number of connections in flight
+ */
+#define RP_MAX_CONNECTIONS 1
+
+/*
+ * Connection pool: idle keep-alive connections kept, beyond those in flight;
+ * default connections in flight per server; default idle timeout, in seconds.
+ */
+#define RP_MAX_IDLE 16
+#define RP_MAX_PER_HOST 2
+#define RP_IDLE_TIMEOUT 5
+
+/*
+ * URLs queued, from an input file, between reading and retiring
+ */
+#define RP_QUEUE_SIZE 4096
+
+/*
+ * Bytes per arena chunk: for a connection's batch (its URLs, and their
+ * Range and conditional headers); for a refill of the queue (its URLs and
+ * filenames). Chunks are pooled, per loop and per engine respectively.
+ */
+#define RP_BATCH_CHUNK 4096
+#define RP_REFILL_CHUNK 1024
+
+/*
+ * Emptied stdout spools are kept for reuse, rather than closed; one that
+ * held a page longer than this is truncated first, to give back its space
+ */
+#define RP_SPOOL_TRUNCATE 1048576
+
+/*
+ * Connect attempts in flight per connection; default ms between attempts
+ * (RFC 8305 "Connection Attempt Delay").
+ */
+#define RP_MAX_ATTEMPTS 8
+#define RP_CONNECT_DELAY 250
+
+/*
+ * Event loops, one per thread: most allowed; most URLs per run when there
+ * are several, so that one server's URLs may be spread over them; longest
+ * wait for an event, so that a loop notices runs queued to it, or failure.
+ */
+#define RP_MAX_THREADS 64
+#define RP_MAX_RUN 256
+#define RP_THREAD_POLL 10
+
+/*
+ * With io_uring: bytes per receive buffer; buffers per connection slot
+ */
+#define RP_RING_BUFFER_SIZE (64 * 1024)
+#define RP_RING_BUFFERS 2
+
+/*
+ * Byte-range segments: most per page; bytes asked for by the first request,
+ * which probes for range support, and least bytes per further segment.
+ */
+#define RP_MAX_SEGMENTS 16
+#define RP_SEGMENT_PROBE (1024 * 1024)
+
+/*
+ * With '--continue', appended to an output filename for the file that
+ * records a partial page's length and validator
+ */
+#define RP_RESUME_SUFFIX ".resume"
+
+/*
+ * With '--cache-dir', the files of a cached page: its body, and a record of
+ * its URL and validators. Both are named for a hash of the URL, in a
+ * subdirectory named for the hash's first two digits, so that no directory
+ * grows too large; a file being written has the URL's queue position added.
+ */
+#define RP_CACHE_BODY ".body"
+#define RP_CACHE_META ".meta"
+#define RP_CACHE_URL "URL: "
+#define RP_CACHE_LENGTH "Length: "
+
+/*
+ * With '--store', the file listing each page stored: its SHA-256, its
+ * length, and its URL, one line each; and the suffix of a page being
+ * written, before it is named for its hash.
+ */
+#define RP_STORE_MANIFEST "manifest"
+#define RP_STORE_TEMP ".tmp"
+
+/*
+ * Chunk data spans gathered into each writev() (IOV_MAX on Linux)
+ */
+#define RP_MAX_SPANS 1024
+
 /*
  * HTTP Request header components
  */
 #define HTTP_GET		"GET "
 #define HTTP_HTTP_1_1		" HTTP/1.1\r\n"
+#define HTTP_QUERY		"?"
 #define HTTP_HOST    		"Host: "
 #define HTTP_CONNECTION		"Connection: keep-alive\r\n"
 #define HTTP_CACHE_CONTROL	"Cache-Control: no-cache\r\n"
+#define HTTP_RANGE		"Range: bytes="
+#define HTTP_IF_RANGE		"If-Range: "
+#define HTTP_IF_NONE_MATCH	"If-None-Match: "
+#define HTTP_IF_MODIFIED_SINCE	"If-Modified-Since: "
+#define HTTP_ACCEPT_ENCODING	"Accept-Encoding: gzip, deflate\r\n"
 #define HTTP_CRLF    		"\r\n"
 
 /*
  * HTTP Respone header components
  */
-#define HTTP_200_OK		"HTTP/1.1 200 OK\r\n"
-#define HTTP_CONTENT_LENGTH	"Content-Length: "
+#define HTTP_STATUS_OK		200
+#define HTTP_STATUS_PARTIAL	206
+#define HTTP_STATUS_NOT_MODIFIED 304
+#define HTTP_CONTENT_LENGTH	"Content-Length"
 #define HTTP_TRANSFER_ENCODING	"Transfer-Encoding: chunked"
 
 /*
@@ -71,1078 +207,5805 @@ struct rp_options
 {
     char** urls;			/* URLS */
     char** filenames;			/* output filenames */
+    char* inputPath;			/* file of URLs, "-" for stdin, or NULL */
+    char* hostsFile;			/* hosts file overriding DNS, or NULL */
+    char* cacheDir;			/* cache of pages and validators, or NULL */
+    char* storeDir;			/* pages stored by hash, or NULL */
+    int urlCount;			/* number of URLs */
+    int filenameCount;			/* number of output filenames */
+    int maxConnections;			/* connections in flight, per loop */
+    int threads;			/* event loops, one per thread */
+    int isGroupByHost;			/* dispatch URLs grouped by server? */
+    int maxPerHost;			/* connections in flight per server */
+    int idleTimeout;			/* seconds to keep idle connections */
+    int dnsTtl;				/* seconds to cache DNS answers */
+    int connectDelay;			/* ms between connect attempts */
+    int segments;			/* byte ranges per page, in parallel */
+    int isContinue;			/* resume partial output files? */
+    int isCompressed;			/* ask for, and decode, compression? */
+    int isZeroCopy;			/* is zero-copy (splice) mode enabled? */
+    int isRing;				/* use io_uring, where available? */
     int isVerbose;			/* is verbose mode enabled? */
+    int isStats;			/* report latencies at exit? */
+    int isStatsJson;			/* as JSON? */
     int isIPV4only;			/* is IPV4 only mode enabled? */
     int isIPV6only;			/* is IPv6 only mode enabled? */
 };
 typedef struct rp_options rpOptions_t;
 
 /*
- * Current state
+ * Connection phases
+ */
+enum rp_phase
+{
+    rp_phase_idle = 0,			/* slot is free */
+    rp_phase_resolving,			/* awaiting the resolver */
+    rp_phase_connecting,		/* non-blocking connect() in progress */
+    rp_phase_sending,			/* request batch partially sent */
+    rp_phase_receiving,			/* awaiting responses */
+    rp_phase_pooled			/* idle keep-alive, in the pool */
+};
+typedef enum rp_phase rpPhase_t;
+
+/*
+ * Response parser states
+ */
+enum rp_parse
+{
+    rp_parse_headers = 0,		/* expect response headers */
+    rp_parse_content_length,		/* expect Content-Length bytes */
+    rp_parse_chunked,			/* expect a chunked body, and trailers */
+    rp_parse_until_close		/* neither; body ends at close */
+};
+typedef enum rp_parse rpParse_t;
+
+/*
+ * Latencies measured, with '--stats'
+ */
+enum rp_timing
+{
+    rp_timing_dns = 0,			/* lookup, to addresses */
+    rp_timing_connect,			/* first attempt, to connected */
+    rp_timing_ttfb,			/* request sent, to first response byte */
+    rp_timing_transfer,			/* first response byte, to last */
+    RP_TIMINGS
+};
+typedef enum rp_timing rpTiming_t;
+
+/*
+ * Latencies of one server, or of all
+ */
+struct rp_latency
+{
+    Histogram_t timings[RP_TIMINGS];	/* in microseconds */
+};
+typedef struct rp_latency rpLatency_t;
+
+/*
+ * One connect attempt, to one of the server's addresses
+ */
+struct rp_attempt
+{
+    struct addrinfo* addr;		/* the address */
+    double started;			/* when connect() was called */
+    int sock;				/* the socket */
+};
+typedef struct rp_attempt rpAttempt_t;
+
+/*
+ * Connection state
+ *
+ * Each connection in flight has its own state, and its own response parser,
+ * so that the parser may resume wherever the previous read() left off.
  */
 struct rp_state
 {
-    char** currUrl;			/* current URL */
-    char** currFilename;		/* current filename */
+    Arena_t arena;			/* the batch: URLs, headers, addresses */
+    int* urls;				/* pipelined URLs, as index in urls[] */
+    struct addrinfo* serverInfo;	/* addresses of the server */
+    struct addrinfo** addrs;		/* addresses, in the order tried */
     char* so_rcvbuf;			/* socket receive buffer */
     char* pBuf;				/* ptr to data in so_rcvbuf */
-    long contentLength;			/* content length */
+    FILE* spool;			/* stdout spool, when out of turn */
+    struct rp_origin* origin;		/* pool key: the server, or NULL */
+    struct iovec* iov;			/* request batch */
+    HttpHeader_t header;		/* response header parser */
+    HttpChunked_t chunked;		/* chunked body decoder */
+    HttpInflate_t inflater;		/* gzip or deflate body decoder */
+    Sha256_t sha;			/* hash of the body, as written */
+    rpAttempt_t attempts[RP_MAX_ATTEMPTS];/* connects in flight */
+    long contentLength;			/* remaining content length */
+    long rangeFirst;			/* segment: first byte, or -1 */
+    long rangeLast;			/* segment: last byte */
+    long rangeTotal;			/* segment: bytes in the page */
+    char range[64];			/* Range header, if any */
+    long batchBytes;			/* bytes in request batch */
+    long batchSyscalls;			/* syscalls to send request batch */
+    double idleSince;			/* when pooled */
+    double resolveAt;			/* when the lookup started */
+    double connectAt;			/* when the first attempt started */
+    double requestAt;			/* when this response was asked for */
+    double firstByteAt;			/* its first byte, or 0 */
     socklen_t so_rcvbuf_len;		/* socket receive buffer length */
+    rpPhase_t phase;			/* connection phase */
+    rpParse_t parse;			/* response parser state */
     int sock;				/* the socket */
     int fd;				/* the file */
     int pipeline;			/* pipelined requests */
+    int responses;			/* responses completed */
     int bytes;				/* bytes in buffer */
+    int iovcnt;				/* elements in request batch */
+    int iovmax;				/* elements allocated */
+    int iovNext;			/* first element not yet sent */
+    int isSplice;			/* splice() this response's body? */
+    int isQueued;			/* queue file writes to the ring? */
+    int isInflate;			/* decode this response's body? */
+    int isHashed;			/* hash this response's body, to store? */
+    off_t offset;			/* file offset of the next write */
+    int pipefd[2];			/* pipe for splice(), or -1 */
+    int family;				/* pool key: address family */
+    int addrCount;			/* elements in 'addrs' */
+    int nextAddr;			/* next address to attempt */
+    int attemptCount;			/* elements in 'attempts' */
+    int isReused;			/* batch sent on a pooled connection? */
+    int isReceived;			/* any response bytes for this batch? */
+    int isClose;			/* will the server close after this batch? */
 };
 typedef struct rp_state rpState_t;
 
-/*------------------------------------------------------------------------------
- * getChunkSize() - get a chunk size
+/*
+ * Output state, per queued URL
+ *
+ * Pages destined for the standard output are written in command line order.
+ * A page that completes out of turn is spooled, and copied once its turn
+ * arrives. The loop that fetched a URL sets 'isDone' last, with a release
+ * store; the first loop alone then copies and retires it.
+ *
+ * URLs are queued in a ring, from the command line or an input file, and
+ * retired in order once complete; so memory use is bounded by the ring, not
+ * by the number of URLs.
  */
-static rpResult_t getChunkSize(char** p, long* chunkSize)
+struct rp_output
 {
-    char* t;
-    long chunk = 0;
+    char* url;				/* the URL, decoded */
+    UrlSpans_t spans;			/* its parts, parsed once when queued */
+    struct rp_origin* origin;		/* its server */
+    char* filename;			/* output filename, or NULL for stdout */
+    FILE* spool;			/* spooled page, or NULL */
+    int spooler;			/* loop that spooled it */
+    char* resume;			/* Range and If-Range headers, or NULL */
+    long resumeFrom;			/* bytes already in the file */
+    long resumeTotal;			/* bytes in the page, or -1 */
+    char* conditional;			/* If-None-Match, If-Modified-Since */
+    int pending;			/* segments in flight, besides one */
+    int isDone;				/* is the response complete? */
+};
+typedef struct rp_output rpOutput_t;
 
-    DBUG_ENTER("getChunkSize");
+/*
+ * URLs queued by one refill of the ring, and the memory they use
+ *
+ * Each refill's URLs, filenames and grouping are carved from its arena,
+ * which is reset once the last of them retires. Refills retire in the order
+ * they were made, so the engine keeps them in a FIFO.
+ */
+struct rp_refill
+{
+    struct rp_refill* next;		/* the next refill made */
+    Arena_t arena;			/* its URLs, filenames and groups */
+    int last;				/* one past its last URL */
+};
+typedef struct rp_refill rpRefill_t;
 
-    assert(NULL != p);
-    assert(NULL != chunkSize);
+/*
+ * Server of queued URLs: scheme, domain and port
+ *
+ * Each is interned once, when its first URL is queued, and kept until exit.
+ * URLs and connections then refer to it, so that grouping, pipelining and
+ * pooling compare origins, not strings; its ID indexes per-server counts.
+ */
+struct rp_origin
+{
+    char* scheme;			/* as first seen */
+    char* domain;
+    char* port;
+    unsigned int hash;			/* of the lower case parts */
+    int id;				/* position in engine->origins */
+    int rank;				/* grouping: first URL in this refill */
+    int refill;				/* grouping: refill 'rank' is for */
+    char parts[1];			/* scheme, domain and port, NULs */
+};
+typedef struct rp_origin rpOrigin_t;
 
-    for (t = *p; '\r' != *t; ++t)
-    {
-	if (isdigit(*t))
-	{
-	    chunk = (chunk << 4) | (*t - '0');
-	}
-	else
-	{
-	    char ch = tolower(*t);
+/*
+ * URL, in dispatch order, for grouping by server
+ */
+struct rp_group
+{
+    int url;				/* URL, in queue order */
+    int rank;				/* first URL to the same server */
+};
+typedef struct rp_group rpGroup_t;
 
-	    if (('a' <= ch) && ('f' >= ch))
-	    {
-		chunk = (chunk << 4) | (10 + ch - 'a');
-	    }
-	    else
-	    {
-		break;			/* could be "; options */
-	    }
-	}
-    }
+/*
+ * Run of queued URLs to one server, sent as one pipeline
+ */
+struct rp_run
+{
+    int first;				/* first URL, as position in order[] */
+    int count;				/* URLs in the run */
+};
+typedef struct rp_run rpRun_t;
 
-    /* find CR/LF */
-    if (NULL == (t = strstr(t, HTTP_CRLF)))
-    {
-	DBUG_RETURN(rp_failure);
-    }
+/*
+ * Byte range of a page, fetched on a connection of its own
+ */
+struct rp_segment
+{
+    long first;				/* first byte */
+    long last;				/* last byte */
+    long total;				/* bytes in the page */
+    int url;				/* URL, in queue order */
+};
+typedef struct rp_segment rpSegment_t;
 
-    *p = t + 2;				/* walk past CR/LF */
+typedef struct rp_loop rpLoop_t;
 
-    *chunkSize = chunk;
+/*
+ * Fetch engine state, shared by the event loops
+ *
+ * 'lock' guards refilling the URL queue, and interning servers; never taken
+ * per page. An origin never moves once interned, so loops may follow a
+ * queued URL's 'origin' without it. The first loop owns the order of
+ * stdout: it alone advances 'nextStdout' and 'nextRetire', and the other
+ * loops read them atomically.
+ */
+struct rp_engine
+{
+    pthread_mutex_t lock;		/* guards refilling the queue */
+    rpOptions_t* options;		/* command line options */
+    rpLoop_t* loops;			/* event loops, one per thread */
+    Resolver_t* resolver;		/* caching, asynchronous DNS, for all */
+    rpOutput_t* outputs;		/* output state, ring of queued URLs */
+    int* order;				/* dispatch order, ring of URLs */
+    UrlInput_t* input;			/* file of URLs, or NULL */
+    rpOrigin_t** origins;		/* interned servers, by ID */
+    int* originIndex;			/* hash table of IDs + 1, or 0 */
+    Pool_t chunks;			/* for the refills' arenas */
+    Pool_t refills;			/* of rpRefill_t */
+    rpRefill_t* oldest;			/* refills not yet retired, FIFO */
+    rpRefill_t* newest;
+    int originCount;			/* elements in 'origins' */
+    int originSlots;			/* elements in 'originIndex' */
+    FILE* manifest;			/* store manifest, or NULL */
+    int loopCount;			/* elements in 'loops' */
+    int queued;				/* URLs queued so far */
+    int queueSize;			/* URLs in the ring */
+    int nextArg;			/* next command line URL to queue */
+    int nextStdout;			/* next URL owed to stdout */
+    int nextRetire;			/* oldest URL still queued */
+    int isInputDone;			/* every URL queued? */
+    int undispatched;			/* URLs in runs not yet dispatched */
+    int isFailed;			/* has any loop failed? */
+    int running;			/* loops not yet finished */
+};
+typedef struct rp_engine rpEngine_t;
 
-    DBUG_PRINT("chunk", ("0x%lx %ld.", chunk, chunk));
+/*
+ * Event loop state, one per thread
+ *
+ * Each loop owns its connections and its pool; the loops share the engine's
+ * resolver, each watching a pipe of its own for answers. Runs of URLs
+ * are queued to a loop chosen by server, so that pooled connections are
+ * found again; a loop with nothing to do steals runs from the back of the
+ * busiest loop's queue. A run whose server is at its limit is deferred, so
+ * that runs to other servers go ahead of it. Each loop's runs have their
+ * own lock. The segments of a page are queued to the loop that probed it,
+ * and only it takes them. A loop's spools come back to it emptied, from
+ * the first loop, through a ring that each of the two only appends to or
+ * only takes from.
+ */
+struct rp_loop
+{
+    rpEngine_t* engine;			/* the shared engine */
+    EventLoop_t* events;		/* readiness notification */
+    rpState_t* conns;			/* connection slots */
+    Event_t* ready;			/* results from EventLoopWait() */
+    rpRun_t* runs;			/* ring of runs, not yet dispatched */
+    rpRun_t* deferred;			/* ring of runs for busy servers */
+    rpSegment_t* segments;		/* segments, not yet dispatched */
+    int* busy;				/* connections in flight, by origin ID */
+    rpLatency_t* latency;		/* with '--stats', by origin ID */
+    FILE** spools;			/* emptied spools, ring, for reuse */
+    int spoolsPut;			/* next put back, by the first loop */
+    int spoolsTaken;			/* next taken again, by this loop */
+    Pool_t chunks;			/* for the batch arenas of 'conns' */
+    pthread_mutex_t lock;		/* guards 'runs' and 'deferred' */
+    pthread_t thread;			/* the thread, unless the first loop */
+    long long bodyBytes;		/* response body bytes received */
+    long long encodedBytes;		/* of those, compressed */
+    long long decodedBytes;		/* bytes those decoded to */
+    long cacheHits;			/* pages not modified, from the cache */
+    long stored;			/* pages stored by hash */
+    long duplicates;			/* of those, already stored */
+    long long duplicateBytes;		/* bytes not stored again */
+    long waits;				/* EventLoopWait() calls */
+    rpResult_t result;			/* how the loop ended */
+    int runFirst;			/* oldest run in 'runs' */
+    int runCount;			/* runs in 'runs' */
+    int deferredFirst;			/* oldest run in 'deferred' */
+    int deferredCount;			/* runs in 'deferred' */
+    int segmentFirst;			/* oldest segment in 'segments' */
+    int segmentCount;			/* segments queued */
+    int segmentMax;			/* elements allocated */
+    int busyMax;			/* elements in 'busy' */
+    int active;				/* connections in flight */
+    int slotCount;			/* connection slots, in flight or pooled */
+    int index;				/* position in engine->loops */
+    int isRing;				/* 'events' is io_uring? */
+};
 
-    DBUG_RETURN(rp_success);
-}
+/*
+ * Chunked body sink context, for the duration of one HttpChunkedPush()
+ *
+ * The spans lie in the receive buffer, which is not reused until the next
+ * read; so they are gathered, and written together.
+ */
+struct rp_sink
+{
+    rpLoop_t* loop;			/* the event loop */
+    rpState_t* state;			/* the connection */
+    struct iovec spans[RP_MAX_SPANS];	/* chunk data, not yet written */
+    int spanCount;			/* elements in 'spans' */
+};
+typedef struct rp_sink rpSink_t;
 
 /*------------------------------------------------------------------------------
- * processTransferEncodingResponse()
+ * now() - monotonic time, in seconds
  */
-static rpResult_t processTransferEncodingResponse(
-	rpOptions_t* options,
-	rpState_t* state)
+static double now(void)
 {
-#define RP_EXPECT_CHUNK_SIZE (-1)
-#define RP_EXPECT_CHUNK_TERMINATOR (-2)
+    struct timespec ts;
 
-    long chunk = RP_EXPECT_CHUNK_SIZE;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    int rc;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    int bytesWritten;
+/*------------------------------------------------------------------------------
+ * recordLatency() - with '--stats', count the time from 'from' to 'to'
+ * against the connection's server
+ *
+ * Each loop keeps its own histograms, so recording takes no lock; they are
+ * merged at exit. A time not recorded for want of memory is just lost.
+ */
+static void recordLatency(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state,
+	rpTiming_t timing,
+	double from,
+	double to)
+{
+    if (options->isStats && (from > 0))
+    {
+	HistogramRecord(&loop->latency[state->origin->id].timings[timing],
+			(long long)((to - from) * 1e6 + 0.5));
+    }
+}
 
-    DBUG_ENTER("processTransferEncodingResponse");
+/*------------------------------------------------------------------------------
+ * getOutput() - the output state of a queued URL
+ */
+static rpOutput_t* getOutput(rpEngine_t* engine, int url)
+{
+    return &engine->outputs[url % engine->queueSize];
+}
 
-    assert(NULL != options);
-    assert(NULL != state);
+/*------------------------------------------------------------------------------
+ * getOrder() - the URL dispatched in this position
+ */
+static int* getOrder(rpEngine_t* engine, int position)
+{
+    return &engine->order[position % engine->queueSize];
+}
 
-    /*
-     * See if we have bytes left in the buffer, following the headers
-     */
+/*------------------------------------------------------------------------------
+ * writeAll() - write a whole buffer, retrying short writes
+ */
+static rpResult_t writeAll(int fd, char* buf, size_t len)
+{
+    DBUG_ENTER("writeAll");
 
-    if (state->bytes > 0)
+    while (len > 0)
     {
-	char* t = state->pBuf;
-
-	if (rp_success != getChunkSize(&state->pBuf, &chunk))
-	{
-	    DBUG_RETURN(rp_failure);
-	}
-	state->bytes -= (state->pBuf - t);
+	ssize_t rc;
 
-	if (0 == chunk)
+	if (-1 == (rc = write(fd, buf, len)))
 	{
-	    /* we are done */
-	    DBUG_RETURN(rp_success);
-	}
-
-	bytesWritten = (state->bytes < chunk) ? state->bytes : chunk;
+	    if (EINTR == errno)
+	    {
+		continue;
+	    }
 
-	if (-1 == (rc = write(state->fd, state->pBuf, bytesWritten)))
-	{
 	    perror("write(fd)");
 
 	    DBUG_PRINT("syscall", ("write(fd) failed"));
 
 	    DBUG_RETURN(rp_failure);
 	}
-	chunk -= bytesWritten;		/* remaining chunk length */
 
-	DBUG_PRINT("response",
-		  ("wrote %10d, chunk %10ld", bytesWritten, chunk));
+	buf += rc;
+	len -= rc;
+    }
 
-	if (state->bytes > bytesWritten)
-	{
-	    /*
-	     * The header of the next response is already in our buffer, so we
-	     * will move the response to the front of the buffer and setup a
-	     * short read, to fill the buffer.
-	     */
+    DBUG_RETURN(rp_success);
+}
 
-	    state->bytes -= bytesWritten;
-	    memcpy(state->so_rcvbuf, &state->pBuf[bytesWritten], state->bytes);
+/*------------------------------------------------------------------------------
+ * writeInflated() - compressed body sink; write a span of decoded bytes
+ *
+ * The decoder reuses its buffer, so the bytes are written before returning;
+ * never queued to the ring.
+ */
+static int writeInflated(void* context, const char* buf, size_t len)
+{
+    rpState_t* state = context;
 
-	    /* setup for a short read */
-	    state->pBuf  = &state->so_rcvbuf[state->bytes];
-	    state->bytes = state->so_rcvbuf_len - state->bytes;
-	}
-    }
-    else
+    assert(NULL != state);
+
+    if (state->isHashed)
     {
-	/* setup for a full read */
-	state->pBuf  = state->so_rcvbuf;
-	state->bytes = state->so_rcvbuf_len;
+	Sha256Update(&state->sha, buf, len);
     }
 
-    /*
-     * Process the remainder of the current response
-     */
+    return (rp_success == writeAll(state->fd, (char*)buf, len)) ? 0 : -1;
+}
 
-    while (1)
-    {
-	int bytesWritten;
+/*------------------------------------------------------------------------------
+ * writeBody() - write response body bytes to the output
+ *
+ * A compressed body is decoded on the way.
+ */
+static rpResult_t writeBody(
+	rpLoop_t* loop,
+	rpState_t* state,
+	char* buf,
+	size_t len)
+{
+    DBUG_ENTER("writeBody");
 
-	DBUG_PRINT("response",
-		  ("max   %10d, chunk %10ld", state->bytes, chunk));
+    assert(NULL != loop);
+    assert(NULL != state);
 
-	if (-1 == (state->bytes = read(state->sock, state->pBuf, state->bytes)))
-	{
-	    perror("read(sock)");
+    loop->bodyBytes += len;
 
-	    DBUG_PRINT("syscall", ("read(sock)"));
+    if (state->isInflate)
+    {
+	int rc = HttpInflatePush(&state->inflater, buf, len);
 
-	    DBUG_RETURN(rp_failure);
+	if (HTTP_INFLATE_ERROR == rc)
+	{
+	    fprintf(stderr, "Malformed compressed body -- stopping.\n");
 	}
 
-	DBUG_PRINT("response",
-		  ("read  %10d, offset %d",
-		  state->bytes,
-		  state->pBuf - state->so_rcvbuf));
+	DBUG_RETURN((0 <= rc) ? rp_success : rp_failure);
+    }
 
-	state->pBuf = state->so_rcvbuf; /* reset to start of buffer */
+    if (state->isHashed)		/* as it is written; no second pass */
+    {
+	Sha256Update(&state->sha, buf, len);
+    }
 
-	if (0 == state->bytes)
+    if (state->isQueued)
+    {
+	if (-1 == EventLoopWrite(loop->events,
+				 state->fd,
+				 buf,
+				 len,
+				 state->offset,
+				 loop))
 	{
-	    break;
-	}
+	    perror("EventLoopWrite()");
 
-	bytesWritten = state->bytes;
+	    DBUG_RETURN(rp_failure);
+	}
 
+	state->offset += len;
 
-	if (RP_EXPECT_CHUNK_TERMINATOR == chunk)
-	{
-	    /* expect CRLF */
-	    if (('\r' == state->pBuf[0]) && ('\n' == state->pBuf[1]))
-	    {
-		state->pBuf  += 2;
-		state->bytes -= 2;
-	    }
-	    else
-	    {
-		int i;
+	DBUG_RETURN(rp_success);
+    }
 
-		if (options->isVerbose)
-		{
-		    printf("Malformed chunk: did not end with CR/LF -- stopping.\n");
-		}
+    DBUG_RETURN(writeAll(state->fd, buf, len));
+}
 
-		for (i = 0; (i < state->bytes) && (i < 16); ++i)
-		{
-		    DBUG_PRINT("chunkTerminator",
-			      ("0x%02.2x %d", state->pBuf[i], i));
-		}
+/*------------------------------------------------------------------------------
+ * writeSpans() - write the gathered chunk data, retrying short writes
+ */
+static rpResult_t writeSpans(rpSink_t* sink)
+{
+    struct iovec* iov = sink->spans;
 
-		DBUG_RETURN(rp_failure);
-	    }
+    int iovcnt = sink->spanCount;
 
-	    chunk = RP_EXPECT_CHUNK_SIZE;
-	}
+    DBUG_ENTER("writeSpans");
 
-	if (RP_EXPECT_CHUNK_SIZE == chunk)
-	{
-	    /*
-	     * Expect a chunk size
-	     */
+    sink->spanCount = 0;
 
-	    char* t = state->pBuf;
+    /* one write each: one submission, or one slice to decode */
+    if (sink->state->isQueued || sink->state->isInflate)
+    {
+	int i;
 
-	    if (rp_success != getChunkSize(&state->pBuf, &chunk))
+	for (i = 0; i < iovcnt; ++i)
+	{
+	    if (rp_success != writeBody(sink->loop,
+					sink->state,
+					iov[i].iov_base,
+					iov[i].iov_len))
 	    {
 		DBUG_RETURN(rp_failure);
 	    }
-	    state->bytes -= (state->pBuf - t);
+	}
 
-	    if (0 == chunk)
-	    {
-		/* we are done */
-		DBUG_RETURN(rp_success);
-	    }
+	DBUG_RETURN(rp_success);
+    }
 
-	    if (state->bytes > chunk)
-	    {
-		/* buffer contains part of next response */
-		bytesWritten = chunk;
-	    }
+    if (sink->state->isHashed)
+    {
+	int i;
+
+	for (i = 0; i < iovcnt; ++i)
+	{
+	    Sha256Update(&sink->state->sha, iov[i].iov_base, iov[i].iov_len);
 	}
+    }
+
+    while (iovcnt > 0)
+    {
+	ssize_t rc;
 
-	if (-1 == (rc = write(state->fd, state->pBuf, bytesWritten)))
+	if (-1 == (rc = writev(sink->state->fd, iov, iovcnt)))
 	{
-	    perror("write(fd)");
+	    if (EINTR == errno)
+	    {
+		continue;
+	    }
 
-	    DBUG_PRINT("syscall", ("write(fd) failed"));
+	    perror("writev(fd)");
+
+	    DBUG_PRINT("syscall", ("writev(fd) failed"));
 
 	    DBUG_RETURN(rp_failure);
 	}
 
-	state->pBuf  += bytesWritten;
-	state->bytes -= bytesWritten;
-
-	chunk -= bytesWritten;
+	sink->loop->bodyBytes += rc;
 
-	DBUG_PRINT("response",
-		  ("wrote %10d, chunk %10ld", bytesWritten, chunk));
-
-	if (0 == chunk)
+	/* walk past the spans written */
+	while ((iovcnt > 0) && ((size_t)rc >= iov->iov_len))
 	{
-	    memcpy(state->so_rcvbuf, state->pBuf, state->bytes);
-
-	    chunk = RP_EXPECT_CHUNK_TERMINATOR;
-
-	    /* setup for a short read */
-	    state->pBuf  = &state->so_rcvbuf[state->bytes];
-	    state->bytes = state->so_rcvbuf_len - state->bytes;
+	    rc -= iov->iov_len;
+	    ++iov;
+	    --iovcnt;
 	}
-	else
+
+	if (iovcnt > 0)
 	{
-	    /* setup for a full, or end of chunk, read */
-	    state->pBuf  = state->so_rcvbuf;
-	    state->bytes = (0 < chunk) && (chunk < state->so_rcvbuf_len)
-		? chunk
-		: state->so_rcvbuf_len;
+	    iov->iov_base  = (char*)iov->iov_base + rc;
+	    iov->iov_len  -= rc;
 	}
     }
 
-    /* setup for a full read */
-    state->pBuf  = state->so_rcvbuf;
-    state->bytes = state->so_rcvbuf_len;
-
     DBUG_RETURN(rp_success);
 }
 
 /*------------------------------------------------------------------------------
- * processContentLengthResponse()
+ * writeChunk() - chunked body sink; gather a span of chunk data
  */
-static rpResult_t processContentLengthResponse(
-	rpOptions_t* options,
-	rpState_t* state)
+static int writeChunk(void* context, const char* buf, size_t len)
 {
-    int rc;
-    int bytesWritten;
+    rpSink_t* sink = context;
 
-    DBUG_ENTER("processContentLengthResponse");
+    assert(NULL != sink);
 
-    assert(NULL != options);
-    assert(NULL != state);
-
-    /*
-     * See if we have bytes left in the buffer, following the headers
-     */
-
-    bytesWritten = state->bytes;
-
-    if (bytesWritten > state->contentLength)
+    if ((RP_MAX_SPANS == sink->spanCount)
+    &&  (rp_success != writeSpans(sink)))
     {
-	/* buffer contains part of next response */
-	bytesWritten = state->contentLength;
+	return -1;
     }
 
-    DBUG_PRINT("response",
-	      ("wrote %10d, contentLength %10d",
-	      bytesWritten,
-	      state->contentLength));
+    sink->spans[sink->spanCount].iov_base = (char*)buf;
+    sink->spans[sink->spanCount].iov_len  = len;
+    ++sink->spanCount;
 
-    if (-1 == (rc = write(state->fd, state->pBuf, bytesWritten)))
-    {
-	perror("write(fd)");
+    return 0;
+}
 
-	DBUG_PRINT("syscall", ("write(fd) failed"));
+/*------------------------------------------------------------------------------
+ * unspool() - copy a spooled page to stdout, and hand the spool back
+ *
+ * The page ends where its writes left the file offset; it is read by that
+ * length, so a small one takes one read, and the spool need not be emptied
+ * to be reused. It goes back to the loop that spooled it, whose ring holds
+ * every spool that loop ever had in flight at once.
+ */
+static rpResult_t unspool(rpEngine_t* engine, rpOutput_t* output)
+{
+    rpLoop_t* spooler = &engine->loops[output->spooler];
 
-	DBUG_RETURN(rp_failure);
-    }
+    int fd = fileno(output->spool);
 
-    state->contentLength -= bytesWritten;/* remaining content length */
+    int put = spooler->spoolsPut;
+    int next = (put + 1) % (engine->queueSize + 1);
 
-    if (state->bytes > bytesWritten)
-    {
-	/*
-	 * The header of the next response is already in our buffer, so we
-	 * will move the response to the front of the buffer and setup a
-	 * short read, to fill the buffer.
-	 */
+    off_t length;
+    off_t offset;
 
-	state->bytes -= bytesWritten;
-	memcpy(state->so_rcvbuf, &state->pBuf[bytesWritten], state->bytes);
+    DBUG_ENTER("unspool");
 
-	/* setup for a short read */
-	state->pBuf  = &state->so_rcvbuf[state->bytes];
-	state->bytes = state->so_rcvbuf_len - state->bytes;
+    if (-1 == (length = lseek(fd, 0, SEEK_CUR)))
+    {
+	perror("lseek(spool)");
 
-	DBUG_RETURN(rp_success);
-    }
+	DBUG_PRINT("syscall", ("lseek() failed for spool"));
 
-    /*
-     * Process the remainder of the current response
-     */
+	DBUG_RETURN(rp_failure);
+    }
 
-    while (state->contentLength > 0)
+    for (offset = 0; offset < length; )
     {
-	state->pBuf = state->so_rcvbuf;
-
-	state->bytes = (state->contentLength < state->so_rcvbuf_len)
-	    ? state->contentLength
-	    : state->so_rcvbuf_len;
-
-	DBUG_PRINT("response",
-		  ("max   %10d, contentLength %10d",
-		  state->bytes,
-		  state->contentLength));
+	char buf[BUFSIZ];
+	ssize_t len;
 
-	if (-1 == (state->bytes = read(state->sock, state->pBuf, state->bytes)))
+	if (-1 == (len = pread(fd, buf, sizeof buf, offset)))
 	{
-	    perror("read(sock)");
+	    if (EINTR == errno)
+	    {
+		continue;
+	    }
 
-	    DBUG_PRINT("syscall", ("read(sock)"));
+	    perror("pread(spool)");
+
+	    DBUG_PRINT("syscall", ("pread() failed for spool"));
 
 	    DBUG_RETURN(rp_failure);
 	}
 
-	DBUG_PRINT("response", ("read  %10d", state->bytes));
-
-	if (0 == state->bytes)
+	if (0 == len)
 	{
-	    break;
+	    break;			/* shorter than written */
 	}
 
-	if (-1 == (rc = write(state->fd, state->pBuf, state->bytes)))
+	if (len > length - offset)
 	{
-	    perror("write(fd)");
-
-	    DBUG_PRINT("syscall", ("write(fd) failed"));
+	    len = length - offset;	/* the rest is an older page's */
+	}
 
+	if (rp_success != writeAll(STDOUT_FILENO, buf, len))
+	{
 	    DBUG_RETURN(rp_failure);
 	}
 
-	state->contentLength -= state->bytes;
+	offset += len;
+    }
+
+    if ((next != __atomic_load_n(&spooler->spoolsTaken, __ATOMIC_ACQUIRE))
+    &&  ((length <= RP_SPOOL_TRUNCATE) || (0 == ftruncate(fd, 0))))
+    {
+	rewind(output->spool);
 
-	DBUG_PRINT("response",
-		  ("wrote %10d, contentLength %10d",
-		  state->bytes,
-		  state->contentLength));
+	spooler->spools[put] = output->spool;
+	__atomic_store_n(&spooler->spoolsPut, next, __ATOMIC_RELEASE);
+    }
+    else
+    {
+	fclose(output->spool);
     }
 
-    /* setup for a full read */
-    state->pBuf  = state->so_rcvbuf;
-    state->bytes = state->so_rcvbuf_len;
+    output->spool = NULL;
 
     DBUG_RETURN(rp_success);
 }
 
 /*------------------------------------------------------------------------------
- * processResponses() - process the [pipelined] HTTP responses
+ * flushOutputs() - copy completed pages to stdout, in command line order
+ *
+ * Only the first loop calls this, or the main thread once every loop has
+ * finished; so it takes no lock. Each output is read once its 'isDone' is
+ * seen, and 'nextStdout' and 'nextRetire' are published after it.
  */
-static rpResult_t processResponses(rpOptions_t* options, rpState_t* state)
+static rpResult_t flushOutputs(rpOptions_t* options, rpEngine_t* engine)
 {
-    rpResult_t result = rp_success;
+    int queued;
+    int nextStdout;
+    int nextRetire;
 
-    DBUG_ENTER("processResponses");
+    DBUG_ENTER("flushOutputs");
 
     assert(NULL != options);
-    assert(NULL != state);
+    assert(NULL != engine);
 
-    /*
-     * Process the responses.
-     *
-     * We must handle a mix of responses with either Content-Length or
-     * Transfer-Encoding.
-     */
+    queued     = __atomic_load_n(&engine->queued, __ATOMIC_ACQUIRE);
+    nextStdout = engine->nextStdout;
+    nextRetire = engine->nextRetire;
 
-    for (state->pBuf = state->so_rcvbuf, state->bytes = state->so_rcvbuf_len;
-         state->pipeline > 0;
-	 --state->pipeline)
+    while (nextStdout < queued)
     {
-	int isTransferEncoding = 0;
-
-	int len;
-	int rc;
-
-	char* t;			/* temporary buffer pointer */
-
-	state->contentLength = -1;
+	rpOutput_t* output = getOutput(engine, nextStdout);
 
-	/*
-	 * Process the response headers
-	 */
+	if (NULL != output->filename)
+	{
+	    ++nextStdout;		/* written to a file; not ordered */
+	    continue;
+	}
 
-	if (-1 == (state->bytes = read(state->sock, state->pBuf, state->bytes)))
+	if (!__atomic_load_n(&output->isDone, __ATOMIC_ACQUIRE))
 	{
-	    perror("read(sock)");
+	    break;			/* not its turn yet */
+	}
 
-	    DBUG_PRINT("syscall", ("read(sock)"));
+	if (NULL != output->spool)
+	{
+	    DBUG_PRINT("output", ("unspool %d", nextStdout));
 
-	    DBUG_RETURN(rp_failure);
+	    if (rp_success != unspool(engine, output))
+	    {
+		DBUG_RETURN(rp_failure);
+	    }
 	}
 
-	DBUG_PRINT("responseHeader", ("bytes %d", state->bytes));
+	++nextStdout;
+    }
 
-	state->pBuf[state->bytes] = '\0';/* terminate string */
+    __atomic_store_n(&engine->nextStdout, nextStdout, __ATOMIC_RELEASE);
 
-	/*
-	 * First response header ought to indicate everything is okay
-	 */
+    /*
+     * Retire complete URLs, freeing their place in the queue; their refills
+     * are released by the next refill
+     */
 
-	len = strlen(HTTP_200_OK);
+    while (nextRetire < nextStdout)
+    {
+	rpOutput_t* output = getOutput(engine, nextRetire);
 
-	if (0 != strncmp(state->pBuf, HTTP_200_OK, len))
+	if (!__atomic_load_n(&output->isDone, __ATOMIC_ACQUIRE))
 	{
-	    DBUG_PRINT("responseHeader", ("failed -- not 200"));
-	    DBUG_PRINT("responseHeader", ("%s", state->pBuf));
-
-	    fprintf(stderr, "HTTP request failed.\n");
+	    break;			/* file output still in flight */
+	}
 
-	    if (options->isVerbose)
-	    {
-		printf("%s\n", state->pBuf);
-	    }
+	output->url      = NULL;
+	output->filename = NULL;
 
-	    DBUG_RETURN(rp_failure);
-	}
+	++nextRetire;
+    }
 
-	state->pBuf += len;
+    __atomic_store_n(&engine->nextRetire, nextRetire, __ATOMIC_RELEASE);
 
-	/*
-	 * Process remaining response headers
-	 */
+    DBUG_RETURN(rp_success);
+}
 
-	while (1)
-	{
-	    if ((state->pBuf >= &state->so_rcvbuf[state->so_rcvbuf_len])
-	    ||  (NULL == (t = strstr(state->pBuf, HTTP_CRLF))))
-	    {
-		/*
-		 * ASSUMPTION: All the response headers will fit in one buffer.
-		 */
+/*------------------------------------------------------------------------------
+ * canSplice() - can response bodies be splice()d into this output?
+ *
+ * Only regular files and pipes qualify; never a terminal.
+ */
+static int canSplice(int fd)
+{
+#ifdef __linux__
+    struct stat sb;
 
-		fprintf(stderr, "Response headers did not fit in buffer.\n");
+    if (isatty(fd) || (-1 == fstat(fd, &sb)))
+    {
+	return 0;
+    }
 
-		DBUG_RETURN(rp_failure);
-	    }
+    return S_ISREG(sb.st_mode) || S_ISFIFO(sb.st_mode);
+#else
+    return 0;
+#endif
+}
 
-	    if (t == state->pBuf)	/* found response terminator */
-	    {
-		state->pBuf = t + 2;	/* skip past CR/LF */
-		break;
-	    }
+/*------------------------------------------------------------------------------
+ * progressPath() - the file recording the progress of a partial page
+ *
+ * Returns NULL if the name would be too long.
+ */
+static char* progressPath(const char* filename, char* path, size_t size)
+{
+    if (snprintf(path, size, "%s%s", filename, RP_RESUME_SUFFIX) >= (int)size)
+    {
+	return NULL;
+    }
 
-	    len = strlen(HTTP_CONTENT_LENGTH);
-	    if (0 == strncmp(state->pBuf, HTTP_CONTENT_LENGTH, len))
-	    {
-		/* content length */
-		state->contentLength = atoi(state->pBuf + len);
-		DBUG_PRINT("responseHeader",
-			  ("%s %d", HTTP_CONTENT_LENGTH, state->contentLength));
-	    }
-	    else
-	    {
-		len = strlen(HTTP_TRANSFER_ENCODING);
-		if (0 == strncmp(state->pBuf, HTTP_TRANSFER_ENCODING, len))
-		{
-		    /* transfer enconding */
-		    isTransferEncoding = 1;
-		    DBUG_PRINT("responseHeader", ("%s", HTTP_TRANSFER_ENCODING));
-		}
-	    }
+    return path;
+}
 
-	    /*
-	     * All other reponse headers are ignored
-	     */
+/*------------------------------------------------------------------------------
+ * dropProgress() - forget the progress of a page, before its file is cut
+ *
+ * Otherwise a later run could resume the page against a validator that no
+ * longer describes the file's bytes.
+ */
+static rpResult_t dropProgress(const char* filename)
+{
+    char path[PATH_MAX];
 
-	    state->pBuf = t + 2;	/* walk past CR/LF */
-	}
+    DBUG_ENTER("dropProgress");
 
-	/* decrement remaining byte count by header size */
-	state->bytes -= state->pBuf - state->so_rcvbuf;
+    if ((NULL != progressPath(filename, path, sizeof path))
+    &&  (-1 == unlink(path))
+    &&  (ENOENT != errno))
+    {
+	perror(path);
 
-	if (isTransferEncoding && (state->contentLength >= 0))
-	{
-	    fprintf(stderr,
-		    "Received both %s and %s -- stopping.\n",
-		    HTTP_CONTENT_LENGTH,
-		    HTTP_TRANSFER_ENCODING);
+	DBUG_RETURN(rp_failure);
+    }
 
-	    DBUG_RETURN(rp_failure);
-	}
+    DBUG_RETURN(rp_success);
+}
 
-	/*
-	 * We are past the response headers.
-	 *
-	 * Open the output file, if specified.
-	 */
+/*------------------------------------------------------------------------------
+ * loadProgress() - ask for just the rest of a partial output file
+ *
+ * With '--continue', a page written to a file records its length and its
+ * validator (ETag, or else Last-Modified) beside it, until complete. If the
+ * record and a partial file are found, the request asks for the bytes the
+ * file lacks, provided the page is unchanged ("If-Range"); if it has
+ * changed, the server sends the whole page instead, and the file is
+ * rewritten. Without a record, the page is fetched whole.
+ *
+ * The headers are carved from the batch's arena; they are wanted only until
+ * the page's response is written.
+ */
+static rpResult_t loadProgress(
+	rpOptions_t* options,
+	Arena_t* arena,
+	rpOutput_t* output)
+{
+    char path[PATH_MAX];
+    char line[HTTP_HEADER_VALIDATOR_MAX + 64];
+    char validator[HTTP_HEADER_VALIDATOR_MAX];
+    struct stat sb;
+    FILE* fp;
 
-	state->fd = STDOUT_FILENO;	/* defaults to stdout */
+    long total = -1;
+    size_t len;
 
-	if (NULL != *state->currFilename)
-	{
-	    if (options->isVerbose)
-	    {
-		printf("Output %s\n", *state->currFilename);
-	    }
+    DBUG_ENTER("loadProgress");
 
-	    /* TODO: review mode 0666 */
-	    if (-1 == (state->fd =
-		    open(*state->currFilename, O_CREAT|O_RDWR, 0666)))
-	    {
-		perror("open()");
+    assert(NULL != options);
+    assert(NULL != arena);
+    assert(NULL != output);
+
+    if (!options->isContinue
+    ||  (NULL == output->filename)
+    ||  (NULL != output->resume)
+    ||  (-1 == stat(output->filename, &sb))
+    ||  (0 == sb.st_size)
+    ||  (NULL == progressPath(output->filename, path, sizeof path))
+    ||  (NULL == (fp = fopen(path, "r"))))
+    {
+	DBUG_RETURN(rp_success);	/* nothing to resume */
+    }
 
-		DBUG_PRINT("syscall",
-			   ("open() failed for %s", *state->currFilename));
+    validator[0] = '\0';
 
-		DBUG_RETURN(rp_failure);
-	    }
+    while (NULL != fgets(line, sizeof line, fp))
+    {
+	len = strlen(line);
 
-	    ++state->currFilename;	/* walk to next filename */
+	if ((len > 0) && ('\n' == line[len - 1]))
+	{
+	    line[--len] = '\0';
 	}
 
-	/*
-	 * Process the response data
-	 */
-
-	if (isTransferEncoding)
+	if (0 == strncmp(line, HTTP_CONTENT_LENGTH ": ",
+			 strlen(HTTP_CONTENT_LENGTH ": ")))
 	{
-	    if (rp_success != processTransferEncodingResponse(options, state))
-	    {
-		DBUG_RETURN(rp_failure);
-	    }
+	    total = strtol(line + strlen(HTTP_CONTENT_LENGTH ": "), NULL, 10);
 	}
-	else
+	else if ((0 == strncmp(line, HTTP_IF_RANGE, strlen(HTTP_IF_RANGE)))
+	     &&  (len - strlen(HTTP_IF_RANGE) < sizeof validator))
 	{
-	    if (rp_success != processContentLengthResponse(options, state))
-	    {
-		DBUG_RETURN(rp_failure);
-	    }
+	    strcpy(validator, line + strlen(HTTP_IF_RANGE));
 	}
+    }
 
-	if (STDOUT_FILENO != state->fd)
-	{
-	    if (-1 == (rc = close(state->fd)))
-	    {
-		perror("close(fd)");
+    fclose(fp);
 
-		DBUG_PRINT("syscall", ("close(fd) failed"));
+    if (('\0' == validator[0]) || ((total >= 0) && (sb.st_size >= total)))
+    {
+	DBUG_PRINT("resume", ("%s: no validator, or complete", path));
 
-		result = rp_failure;
-	    }
-	}
-	else
-	{
-	    ;				/* could flush stdout */
-	}
+	DBUG_RETURN(rp_success);	/* fetch it whole */
     }
 
-    DBUG_RETURN(result);
+    len = strlen(HTTP_RANGE) + strlen(HTTP_IF_RANGE) + strlen(validator) + 64;
+
+    if (NULL == (output->resume = ArenaAlloc(arena, len)))
+    {
+	DBUG_PRINT("syslib", ("ArenaAlloc() failed for resume"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    snprintf(output->resume,
+	     len,
+	     "%s%ld-%s%s%s%s",
+	     HTTP_RANGE,
+	     (long)sb.st_size,
+	     HTTP_CRLF,
+	     HTTP_IF_RANGE,
+	     validator,
+	     HTTP_CRLF);
+
+    output->resumeFrom  = sb.st_size;
+    output->resumeTotal = total;
+
+    if (options->isVerbose)
+    {
+	printf("Resume %s at %ld bytes\n", output->filename, (long)sb.st_size);
+    }
+
+    DBUG_RETURN(rp_success);
 }
 
 /*------------------------------------------------------------------------------
- * sendRequests() send the [pipelined] HTTP requests
+ * saveProgress() - record the length and validator of a page begun
+ *
+ * Only a page written whole, from its start, is recorded; one resumed keeps
+ * its record, and one split into segments has none. Without a validator, the
+ * page cannot safely be resumed, so is not recorded; nor is a decoded page,
+ * as the file's length is not the length sent.
  */
-static rpResult_t sendRequests(rpOptions_t* options, rpState_t* state)
+static rpResult_t saveProgress(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
 {
-    rpResult_t result = rp_success;
+    char path[PATH_MAX];
+    HttpHeader_t* header;
+    rpOutput_t* output;
+    FILE* fp;
 
-    UrlParse_t* parsed;
+    char* validator;
 
-    DBUG_ENTER("sendRequests");
+    DBUG_ENTER("saveProgress");
 
     assert(NULL != options);
+    assert(NULL != loop);
     assert(NULL != state);
 
-    /*
-     * Make pipelined requests
-     *
-     * NOTE: Could concatenate some request strings, for fewer write()'s to
-     *       socket. Chose to leave them separate for now -- for clarity.
-     */
+    header = &state->header;
+    output = getOutput(loop->engine, state->urls[state->responses]);
 
-    state->pipeline = 1;
+    if (!options->isContinue
+    ||  (NULL == output->filename)
+    ||  state->isInflate
+    ||  (state->rangeFirst >= 0)
+    ||  (HTTP_STATUS_PARTIAL == header->status))
+    {
+	DBUG_RETURN(rp_success);
+    }
 
-    parsed = UrlParse(*state->currUrl);
+    /* If-Range takes only a strong ETag */
+    validator = (('\0' != header->etag[0]) && (0 != strncmp(header->etag, "W/", 2)))
+	      ? header->etag
+	      : header->lastModified;
 
-    while (1)
+    if (('\0' == validator[0])
+    ||  (NULL == progressPath(output->filename, path, sizeof path)))
     {
-	UrlParse_t* prevUrl;
+	DBUG_PRINT("resume", ("%s cannot be resumed", output->filename));
 
-	int rc;
+	DBUG_RETURN(rp_success);
+    }
 
-	if (options->isVerbose)
-	{
-	    printf("Path   %s\n", parsed->path);
-	}
+    if ((NULL == (fp = fopen(path, "w")))
+    ||  (0 > fprintf(fp,
+		     "%s: %ld\n%s%s\n",
+		     HTTP_CONTENT_LENGTH,
+		     header->contentLength,
+		     HTTP_IF_RANGE,
+		     validator))
+    ||  (0 != fclose(fp)))
+    {
+	perror(path);
 
-	/*
-	 * GET ...
-	 */
+	DBUG_RETURN(rp_failure);
+    }
 
-	if (-1 == (rc = write(state->sock,
-	                      HTTP_GET,
-			      strlen(HTTP_GET))))
-	{
-	    perror("write(sock)");
+    DBUG_RETURN(rp_success);
+}
 
-	    DBUG_PRINT("syscall", ("write(sock)"));
+/*------------------------------------------------------------------------------
+ * cachePath() - a file of a page's cache entry
+ *
+ * The entry is named for a hash of the URL (64-bit FNV-1a); the record
+ * holds the URL itself, so that a collision is only a miss. Returns NULL if
+ * the name would be too long.
+ */
+static char* cachePath(
+	rpOptions_t* options,
+	const char* url,
+	const char* suffix,
+	char* path,
+	size_t size)
+{
+    unsigned long long hash = 14695981039346656037ULL;
 
-	    DBUG_RETURN(rp_failure);
-	}
+    const unsigned char* p;
 
-	if (-1 == (rc = write(state->sock,
-	                      parsed->path,
-			      strlen(parsed->path))))
-	{
-	    perror("write(sock)");
+    char key[17];
 
-	    DBUG_PRINT("syscall", ("write(sock)"));
+    for (p = (const unsigned char*)url; '\0' != *p; ++p)
+    {
+	hash = (hash ^ *p) * 1099511628211ULL;
+    }
 
-	    DBUG_RETURN(rp_failure);
-	}
+    snprintf(key, sizeof key, "%016llx", hash);
 
-	if (-1 == (rc = write(state->sock,
-	                      HTTP_HTTP_1_1,
-			      strlen(HTTP_HTTP_1_1))))
-	{
-	    perror("write(sock)");
+    if (snprintf(path,
+		 size,
+		 "%s/%.2s/%s%s",
+		 options->cacheDir,
+		 key,
+		 key,
+		 suffix) >= (int)size)
+    {
+	return NULL;
+    }
 
-	    DBUG_PRINT("syscall", ("write(sock)"));
+    return path;
+}
 
-	    DBUG_RETURN(rp_failure);
-	}
+/*------------------------------------------------------------------------------
+ * copyFile() - copy a file's bytes to another path
+ */
+static rpResult_t copyFile(const char* from, const char* to)
+{
+    rpResult_t result = rp_success;
 
-	/*
-	 * Host: ...
-	 */
+    char buf[BUFSIZ];
+    ssize_t len;
 
-	if (-1 == (rc = write(state->sock,
-	                      HTTP_HOST,
-			      strlen(HTTP_HOST))))
-	{
-	    perror("write(sock)");
+    int in;
+    int out;
 
-	    DBUG_PRINT("syscall", ("write(sock)"));
+    DBUG_ENTER("copyFile");
 
-	    DBUG_RETURN(rp_failure);
-	}
+    if (-1 == (in = open(from, O_RDONLY)))
+    {
+	perror(from);
 
-	if (-1 == (rc = write(state->sock,
-	                      parsed->domain,
-			      strlen(parsed->domain))))
-	{
-	    perror("write(sock)");
+	DBUG_RETURN(rp_failure);
+    }
 
-	    DBUG_PRINT("syscall", ("write(sock)"));
+    if (-1 == (out = open(to, O_WRONLY|O_CREAT|O_TRUNC, 0666)))
+    {
+	perror(to);
+	close(in);
 
-	    DBUG_RETURN(rp_failure);
-	}
+	DBUG_RETURN(rp_failure);
+    }
 
-	if (-1 == (rc = write(state->sock,
-	                      HTTP_CRLF,
-			      strlen(HTTP_CRLF))))
+    while ((rp_success == result) && (0 != (len = read(in, buf, sizeof buf))))
+    {
+	if (-1 == len)
 	{
-	    perror("write(sock)");
+	    if (EINTR == errno)
+	    {
+		continue;
+	    }
 
-	    DBUG_PRINT("syscall", ("write(sock)"));
+	    perror(from);
 
-	    DBUG_RETURN(rp_failure);
+	    result = rp_failure;
+	}
+	else
+	{
+	    result = writeAll(out, buf, len);
 	}
+    }
 
-	/*
-	 * Connection: ... (may not be necessary)
-	 */
+    close(in);
+
+    if (-1 == close(out))
+    {
+	perror(to);
+
+	result = rp_failure;
+    }
+
+    DBUG_RETURN(result);
+}
+
+/*------------------------------------------------------------------------------
+ * cloneFile() - place a copy of a file at another path
+ *
+ * A reflink shares the blocks, copy on write, so costs no I/O; where the
+ * file system cannot, the bytes are copied. Either way the copy is a file
+ * of its own: never a hard link, which a later write through either name
+ * would change under the other. A path that is not a regular file, such as
+ * a pipe, is written to.
+ */
+static rpResult_t cloneFile(const char* from, const char* to)
+{
+    struct stat sb;
+
+    DBUG_ENTER("cloneFile");
 
-	if (-1 == (rc = write(state->sock,
-	                      HTTP_CONNECTION,
-			      strlen(HTTP_CONNECTION))))
+    if ((0 == lstat(to, &sb)) && !S_ISREG(sb.st_mode))
+    {
+	DBUG_RETURN(copyFile(from, to));
+    }
+
+    if ((-1 == unlink(to)) && (ENOENT != errno))
+    {
+	perror(to);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+#ifdef FICLONE
+    {
+	int in;
+	int out;
+	int rc = -1;
+
+	if (-1 != (in = open(from, O_RDONLY)))
 	{
-	    perror("write(sock)");
+	    if (-1 != (out = open(to, O_WRONLY|O_CREAT|O_EXCL, 0666)))
+	    {
+		if (-1 == (rc = ioctl(out, FICLONE, in)))
+		{
+		    unlink(to);
+		}
 
-	    DBUG_PRINT("syscall", ("write(sock)"));
+		close(out);
+	    }
 
-	    DBUG_RETURN(rp_failure);
+	    close(in);
 	}
 
-	/*
-	 * Cache-control: ... (may not be necessary)
-	 */
+	if (0 == rc)
+	{
+	    DBUG_PRINT("cache", ("reflink %s", to));
+
+	    DBUG_RETURN(rp_success);
+	}
+    }
+#endif
+
+    DBUG_RETURN(copyFile(from, to));
+}
+
+/*------------------------------------------------------------------------------
+ * loadCache() - ask for a cached page only if it has been modified
+ *
+ * With '--cache-dir', a page written whole to a file is kept, with its
+ * validators. If an entry for the URL is found, the request carries them
+ * (If-None-Match, If-Modified-Since); a 304 answer is then served from the
+ * cache, and any other is fetched as usual. A page being resumed is not;
+ * nor one whose cached body is not the length recorded with it. As with
+ * loadProgress(), the headers are carved from the batch's arena.
+ */
+static rpResult_t loadCache(
+	rpOptions_t* options,
+	Arena_t* arena,
+	rpOutput_t* output)
+{
+    char path[PATH_MAX];
+    char line[PATH_MAX + 64];
+    char etag[HTTP_HEADER_VALIDATOR_MAX];
+    char lastModified[HTTP_HEADER_VALIDATOR_MAX];
+    struct stat sb;
+    FILE* fp;
+
+    long long length = -1;
+    size_t len;
 
-	if (-1 == (rc = write(state->sock,
-	                      HTTP_CACHE_CONTROL,
-			      strlen(HTTP_CACHE_CONTROL))))
+    int isSameUrl = 0;
+
+    DBUG_ENTER("loadCache");
+
+    assert(NULL != options);
+    assert(NULL != arena);
+    assert(NULL != output);
+
+    if ((NULL == options->cacheDir)
+    ||  (NULL == output->filename)
+    ||  (NULL != output->resume)
+    ||  (NULL != output->conditional)
+    ||  (NULL == cachePath(options, output->url, RP_CACHE_META,
+			   path, sizeof path))
+    ||  (NULL == (fp = fopen(path, "r"))))
+    {
+	DBUG_RETURN(rp_success);	/* not cached */
+    }
+
+    etag[0]         = '\0';
+    lastModified[0] = '\0';
+
+    while (NULL != fgets(line, sizeof line, fp))
+    {
+	len = strlen(line);
+
+	if ((len > 0) && ('\n' == line[len - 1]))
+	{
+	    line[--len] = '\0';
+	}
+
+	if (0 == strncmp(line, RP_CACHE_URL, strlen(RP_CACHE_URL)))
+	{
+	    isSameUrl = (0 == strcmp(line + strlen(RP_CACHE_URL), output->url));
+	}
+	else if (0 == strncmp(line, RP_CACHE_LENGTH, strlen(RP_CACHE_LENGTH)))
+	{
+	    length = strtoll(line + strlen(RP_CACHE_LENGTH), NULL, 10);
+	}
+	else if ((0 == strncmp(line,
+			       HTTP_IF_NONE_MATCH,
+			       strlen(HTTP_IF_NONE_MATCH)))
+	     &&  (len - strlen(HTTP_IF_NONE_MATCH) < sizeof etag))
 	{
-	    perror("write(sock)");
+	    strcpy(etag, line + strlen(HTTP_IF_NONE_MATCH));
+	}
+	else if ((0 == strncmp(line,
+			       HTTP_IF_MODIFIED_SINCE,
+			       strlen(HTTP_IF_MODIFIED_SINCE)))
+	     &&  (len - strlen(HTTP_IF_MODIFIED_SINCE) < sizeof lastModified))
+	{
+	    strcpy(lastModified, line + strlen(HTTP_IF_MODIFIED_SINCE));
+	}
+    }
+
+    fclose(fp);
+
+    if (!isSameUrl
+    ||  (('\0' == etag[0]) && ('\0' == lastModified[0]))
+    ||  (NULL == cachePath(options, output->url, RP_CACHE_BODY,
+			   path, sizeof path))
+    ||  (-1 == stat(path, &sb))
+    ||  (sb.st_size != length))
+    {
+	DBUG_PRINT("cache", ("%s: another URL's, or no body", output->url));
+
+	DBUG_RETURN(rp_success);	/* fetch it whole */
+    }
+
+    len = strlen(HTTP_IF_NONE_MATCH) + strlen(etag)
+	+ strlen(HTTP_IF_MODIFIED_SINCE) + strlen(lastModified) + 8;
+
+    if (NULL == (output->conditional = ArenaAlloc(arena, len)))
+    {
+	DBUG_PRINT("syslib", ("ArenaAlloc() failed for conditional"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    len = 0;
+
+    if ('\0' != etag[0])
+    {
+	len += sprintf(output->conditional + len,
+		       "%s%s%s",
+		       HTTP_IF_NONE_MATCH,
+		       etag,
+		       HTTP_CRLF);
+    }
+
+    if ('\0' != lastModified[0])
+    {
+	len += sprintf(output->conditional + len,
+		       "%s%s%s",
+		       HTTP_IF_MODIFIED_SINCE,
+		       lastModified,
+		       HTTP_CRLF);
+    }
+
+    output->conditional[len] = '\0';
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * isKept() - is the page being written to a file to be kept in the cache?
+ */
+static int isKept(rpOptions_t* options, rpState_t* state)
+{
+    return (NULL != options->cacheDir)
+	&& (HTTP_STATUS_OK == state->header.status)
+	&& (state->rangeFirst < 0);
+}
+
+/*------------------------------------------------------------------------------
+ * storeCache() - keep a page just written whole to a file, and its validators
+ *
+ * The output is cloned into the cache (see 'cloneFile()'), so the cached
+ * body is never changed by a later write to the output; such a page is not
+ * queued to io_uring, so its bytes are on file by now. The record holds
+ * the body's length, too, to be checked before the body is trusted. Body
+ * and record are written under temporary names, and renamed into place;
+ * the old record goes first, so a record always has its body.
+ *
+ * A page without validators cannot be revalidated, so is not kept; one kept
+ * before is forgotten. Nor is a page written to anything but a regular file.
+ */
+static rpResult_t storeCache(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    char body[PATH_MAX];
+    char meta[PATH_MAX];
+    char bodyTemp[PATH_MAX];
+    char metaTemp[PATH_MAX];
+    char suffix[64];
+    struct stat sb;
+    HttpHeader_t* header;
+    rpOutput_t* output;
+    FILE* fp;
+
+    char* slash;
+
+    int url;
+
+    DBUG_ENTER("storeCache");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    header = &state->header;
+    url    = state->urls[state->responses];
+    output = getOutput(loop->engine, url);
+
+    if ((NULL == cachePath(options, output->url, RP_CACHE_BODY,
+			   body, sizeof body))
+    ||  (NULL == cachePath(options, output->url, RP_CACHE_META,
+			   meta, sizeof meta))
+    ||  (-1 == stat(output->filename, &sb))
+    ||  !S_ISREG(sb.st_mode))
+    {
+	DBUG_RETURN(rp_success);	/* not kept */
+    }
 
-	    DBUG_PRINT("syscall", ("write(sock)"));
+    if (('\0' == header->etag[0]) && ('\0' == header->lastModified[0]))
+    {
+	if ((NULL != output->conditional)
+	&&  (-1 == unlink(meta))
+	&&  (ENOENT != errno))
+	{
+	    perror(meta);
 
 	    DBUG_RETURN(rp_failure);
 	}
 
-	/*
-	 * Terminate with blank line
-	 */
+	DBUG_RETURN(rp_success);
+    }
 
-	if (-1 == (rc = write(state->sock,
-	                      HTTP_CRLF,
-			      strlen(HTTP_CRLF))))
-	{
-	    perror("write(sock)");
+    snprintf(suffix, sizeof suffix, "%s.%d", RP_CACHE_BODY, url);
+
+    if (NULL == cachePath(options, output->url, suffix,
+			  bodyTemp, sizeof bodyTemp))
+    {
+	DBUG_RETURN(rp_success);
+    }
+
+    snprintf(suffix, sizeof suffix, "%s.%d", RP_CACHE_META, url);
+
+    if (NULL == cachePath(options, output->url, suffix,
+			  metaTemp, sizeof metaTemp))
+    {
+	DBUG_RETURN(rp_success);
+    }
+
+    /* the subdirectory, named for the start of the hash */
+    slash  = strrchr(bodyTemp, '/');
+    *slash = '\0';
+
+    if ((-1 == mkdir(bodyTemp, 0777)) && (EEXIST != errno))
+    {
+	perror(bodyTemp);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    *slash = '/';
+
+    unlink(bodyTemp);			/* left by a run that failed */
+
+    if (rp_success != cloneFile(output->filename, bodyTemp))
+    {
+	DBUG_RETURN(rp_failure);
+    }
+
+    if (-1 == stat(bodyTemp, &sb))
+    {
+	perror(bodyTemp);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    if (((-1 == unlink(meta)) && (ENOENT != errno))
+    ||  (-1 == rename(bodyTemp, body)))
+    {
+	perror(body);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    if ((NULL == (fp = fopen(metaTemp, "w")))
+    ||  (0 > fprintf(fp, "%s%s\n", RP_CACHE_URL, output->url))
+    ||  (0 > fprintf(fp, "%s%lld\n", RP_CACHE_LENGTH, (long long)sb.st_size))
+    ||  (('\0' != header->etag[0])
+	 && (0 > fprintf(fp, "%s%s\n", HTTP_IF_NONE_MATCH, header->etag)))
+    ||  (('\0' != header->lastModified[0])
+	 && (0 > fprintf(fp,
+			 "%s%s\n",
+			 HTTP_IF_MODIFIED_SINCE,
+			 header->lastModified)))
+    ||  (0 != fclose(fp))
+    ||  (-1 == rename(metaTemp, meta)))
+    {
+	perror(meta);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * serveCache() - write a page not modified since cached, from the cache
+ *
+ * The answer (304) has no body; the output is cloned from the cache, and
+ * the response is then complete.
+ */
+static rpResult_t serveCache(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    char path[PATH_MAX];
+    rpOutput_t* output;
+
+    DBUG_ENTER("serveCache");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    output = getOutput(loop->engine, state->urls[state->responses]);
+
+    state->fd       = STDOUT_FILENO;	/* nothing to write */
+    state->spool    = NULL;
+    state->isQueued = 0;
+    state->isSplice = 0;
+    state->offset   = 0;
+
+    if (options->isVerbose)
+    {
+	printf("Cached %s\n", output->filename);
+    }
+
+    if ((NULL == cachePath(options, output->url, RP_CACHE_BODY,
+			   path, sizeof path))
+    ||  (rp_success != cloneFile(path, output->filename)))
+    {
+	DBUG_RETURN(rp_failure);
+    }
+
+    ++loop->cacheHits;
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * storePath() - where a page is written in the store, until named for its
+ * hash; or, with 'hex', the page's object
+ *
+ * Objects lie in a subdirectory named for the hash's first two digits, so
+ * that no directory grows too large. Returns NULL if the name would be too
+ * long.
+ */
+static char* storePath(
+	rpOptions_t* options,
+	int url,
+	const char* hex,
+	char* path,
+	size_t size)
+{
+    int len = (NULL == hex)
+	    ? snprintf(path,
+		       size,
+		       "%s/.%ld.%d%s",
+		       options->storeDir,
+		       (long)getpid(),
+		       url,
+		       RP_STORE_TEMP)
+	    : snprintf(path, size, "%s/%.2s/%s", options->storeDir, hex, hex);
+
+    return (len < (int)size) ? path : NULL;
+}
 
-	    DBUG_PRINT("syscall", ("write(sock)"));
+/*------------------------------------------------------------------------------
+ * storeObject() - name a page just written for its hash, once only
+ *
+ * With '--store', each page's body is hashed as it is written. Once it is
+ * complete, the file is hard linked into the store under its hash. If the
+ * store already holds that body, the page is a duplicate: its output becomes
+ * a hard link to the stored copy (replaced by rename(), so it is never
+ * missing), and the bytes just written are freed, usually before they reach
+ * the disk. A page without an output file has only its manifest line.
+ *
+ * Objects are made read-only (and so are the outputs linked to them), so
+ * nothing writes through an output into the store; a later run unlinks an
+ * output with other links rather than cut it (see 'openOutput()').
+ *
+ * The store and output files must be on one file system.
+ */
+static rpResult_t storeObject(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_DIGEST_SIZE * 2 + 1];
+    char object[PATH_MAX];
+    char path[PATH_MAX];
+    char temp[PATH_MAX];
+    rpEngine_t* engine;
+    rpOutput_t* output;
+
+    unsigned long long length;
+
+    char* slash;
+
+    int isDuplicate = 0;
+    int url;
+    int rc;
+
+    DBUG_ENTER("storeObject");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    engine = loop->engine;
+    url    = state->urls[state->responses];
+    output = getOutput(engine, url);
+    length = state->sha.length;
+
+    Sha256Final(&state->sha, digest);
+    Sha256Hex(digest, hex);
+
+    if ((NULL == storePath(options, url, hex, object, sizeof object))
+    ||  ((NULL == output->filename)
+	 && (NULL == storePath(options, url, NULL, path, sizeof path)))
+    ||  ((NULL != output->filename)
+	 && (snprintf(path, sizeof path, "%s", output->filename)
+	     >= (int)sizeof path))
+    ||  (snprintf(temp, sizeof temp, "%s%s", path, RP_STORE_TEMP)
+	 >= (int)sizeof temp))
+    {
+	fprintf(stderr, "Store path too long -- stopping.\n");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    /* the subdirectory, named for the start of the hash */
+    slash  = strrchr(object, '/');
+    *slash = '\0';
+
+    if ((-1 == mkdir(object, 0777)) && (EEXIST != errno))
+    {
+	perror(object);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    *slash = '/';
+
+    if (-1 == link(path, object))
+    {
+	if (EEXIST != errno)
+	{
+	    perror(object);
 
 	    DBUG_RETURN(rp_failure);
 	}
 
-	/*
-	 * Look for opportunity to pipeline requests
-	 */
+	isDuplicate = 1;
+    }
+    else if (-1 == chmod(object, 0444))
+    {
+	perror(object);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    if (NULL == output->filename)
+    {
+	rc = unlink(path);		/* the object, or its twin, remains */
+    }
+    else if (isDuplicate)
+    {
+	unlink(temp);			/* left by a run that failed */
+
+	rc = link(object, temp);
+
+	if ((0 == rc) && (-1 == (rc = rename(temp, path))))
+	{
+	    unlink(temp);
+	}
+    }
+    else
+    {
+	rc = 0;				/* the output is the object */
+    }
+
+    if (-1 == rc)
+    {
+	perror(path);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    if (options->isVerbose)
+    {
+	printf("Store  %s %s%s\n",
+	       hex,
+	       output->url,
+	       isDuplicate ? ", duplicate" : "");
+    }
+
+    ++loop->stored;
+
+    if (isDuplicate)
+    {
+	++loop->duplicates;
+	loop->duplicateBytes += length;
+    }
+
+    pthread_mutex_lock(&engine->lock);
 
-	prevUrl = parsed;		/* remember */
+    rc = fprintf(engine->manifest, "%s %llu %s\n", hex, length, output->url);
+
+    pthread_mutex_unlock(&engine->lock);
+
+    if (0 > rc)
+    {
+	perror(RP_STORE_MANIFEST);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * openOutput() - open the output for the current response
+ */
+static rpResult_t openOutput(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    rpEngine_t* engine;
+    rpOutput_t* output;
+
+    int url;
+
+    DBUG_ENTER("openOutput");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    engine = loop->engine;
+    url    = state->urls[state->responses];
+    output = getOutput(engine, url);
+
+    state->fd       = STDOUT_FILENO;	/* defaults to stdout */
+    state->spool    = NULL;
+    state->isQueued = 0;
+    state->isHashed = 0;
+    state->offset   = 0;
+
+    if (NULL != output->filename)
+    {
+	char* filename = output->filename;
+	struct stat sb;
+
+	int flags = O_CREAT|O_RDWR;
+
+	long start = (state->rangeFirst > 0) ? state->rangeFirst : 0;
+
+	if (options->isVerbose)
+	{
+	    printf("Output %s\n", filename);
+	}
+
+	if ((NULL != output->resume)
+	&&  (HTTP_STATUS_PARTIAL == state->header.status))
+	{
+	    start = output->resumeFrom;	/* append to the partial file */
+	}
+	else if (state->rangeFirst < 0)
+	{
+	    /* rewrite the whole file; segments share it, as sized */
+	    if (options->isContinue && (rp_success != dropProgress(filename)))
+	    {
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    /* a file shared with another name is replaced, not cut */
+	    if ((0 == lstat(filename, &sb))
+	    &&  S_ISREG(sb.st_mode)
+	    &&  (sb.st_nlink > 1)
+	    &&  (-1 == unlink(filename)))
+	    {
+		perror(filename);
+
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    flags |= O_TRUNC;
+	}
+
+	/* TODO: review mode 0666 */
+	if (-1 == (state->fd = open(filename, flags, 0666)))
+	{
+	    perror("open()");
+
+	    DBUG_PRINT("syscall", ("open() failed for %s", filename));
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	/* a segment, or the rest of a page, is written from its start */
+	if (start > 0)
+	{
+	    if (-1 == lseek(state->fd, start, SEEK_SET))
+	    {
+		perror("lseek()");
+
+		DBUG_PRINT("syscall", ("lseek() failed for %s", filename));
+
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    state->offset = start;
+	}
+
+	/* a page to be cached must be on file when it is closed */
+	state->isQueued = loop->isRing
+		       && !state->isInflate
+		       && !isKept(options, state);
+	state->isHashed = (NULL != options->storeDir)
+		       && (0 == fstat(state->fd, &sb))
+		       && S_ISREG(sb.st_mode);
+    }
+    else if (NULL != options->storeDir)
+    {
+	/* no output file: the page is written into the store, unnamed */
+	char path[PATH_MAX];
+
+	if (NULL == storePath(options, url, NULL, path, sizeof path))
+	{
+	    fprintf(stderr, "Store path too long -- stopping.\n");
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	if (-1 == (state->fd = open(path, O_CREAT|O_RDWR|O_TRUNC, 0666)))
+	{
+	    perror(path);
+
+	    DBUG_PRINT("syscall", ("open() failed for %s", path));
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	state->isQueued = loop->isRing && !state->isInflate;
+	state->isHashed = 1;
+    }
+    else
+    {
+	/*
+	 * Write straight to stdout when it is our turn; spool otherwise.
+	 * Once it is our turn, it stays so until this page is done. Only
+	 * the first loop moves the turn on; the others see it move later.
+	 */
+
+	int taken = loop->spoolsTaken;
+
+	if ((0 == loop->index) && (rp_success != flushOutputs(options, engine)))
+	{
+	    DBUG_RETURN(rp_failure);
+	}
+
+	if (url != __atomic_load_n(&engine->nextStdout, __ATOMIC_ACQUIRE))
+	{
+	    if (taken != __atomic_load_n(&loop->spoolsPut, __ATOMIC_ACQUIRE))
+	    {
+		state->spool = loop->spools[taken];
+		__atomic_store_n(&loop->spoolsTaken,
+				 (taken + 1) % (engine->queueSize + 1),
+				 __ATOMIC_RELEASE);
+	    }
+	    else if (NULL == (state->spool = tmpfile()))
+	    {
+		perror("tmpfile()");
+
+		DBUG_PRINT("syslib", ("tmpfile() failed"));
+
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    state->fd = fileno(state->spool);
+
+	    DBUG_PRINT("output", ("spool %d", url));
+	}
+    }
+
+    if (state->isHashed)
+    {
+	Sha256Init(&state->sha);
+    }
+
+    /* a spliced body never passes through, to be hashed */
+    state->isSplice = options->isZeroCopy
+		   && !loop->isRing
+		   && !state->isInflate
+		   && !state->isHashed
+		   && canSplice(state->fd);
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * closeOutput() - close the output for the current response
+ */
+static rpResult_t closeOutput(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    rpResult_t result = rp_success;
+
+    rpEngine_t* engine;
+    rpOutput_t* output;
+    FILE* spool;
+
+    int url;
+    int rc;
+
+    DBUG_ENTER("closeOutput");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    engine = loop->engine;
+    url    = state->urls[state->responses];
+    spool  = state->spool;
+
+    if (state->isInflate)
+    {
+	HttpInflate_t* inflater = &state->inflater;
+
+	/* an empty body is allowed, as nothing to decode */
+	if (!inflater->isDone && (inflater->inBytes > 0))
+	{
+	    fprintf(stderr, "Truncated compressed body -- stopping.\n");
+
+	    result = rp_failure;
+	}
+
+	if (options->isVerbose)
+	{
+	    printf("Decode %s, %lld bytes from %lld\n",
+		   getOutput(engine, url)->url,
+		   inflater->outBytes,
+		   inflater->inBytes);
+	}
+
+	loop->encodedBytes += inflater->inBytes;
+	loop->decodedBytes += inflater->outBytes;
+
+	HttpInflateEnd(inflater);
+	state->isInflate = 0;
+    }
+
+    if (NULL != spool)
+    {
+	fflush(spool);			/* copied to stdout later */
+	state->spool = NULL;
+    }
+    else if (STDOUT_FILENO != state->fd)
+    {
+	/* queued writes finish first */
+	if (-1 == (rc = state->isQueued ? EventLoopClose(loop->events, state->fd)
+					: close(state->fd)))
+	{
+	    perror("close(fd)");
+
+	    DBUG_PRINT("syscall", ("close(fd) failed"));
+
+	    result = rp_failure;
+	}
+
+	/* the page is whole; nothing to resume */
+	if (options->isContinue
+	&&  (state->rangeFirst < 0)
+	&&  (rp_success != dropProgress(getOutput(engine, url)->filename)))
+	{
+	    result = rp_failure;
+	}
+
+	/* a page fetched whole may be cached */
+	if (isKept(options, state)
+	&&  (rp_success != storeCache(options, loop, state)))
+	{
+	    result = rp_failure;
+	}
+
+	/* a page written whole is named for its hash */
+	if (state->isHashed
+	&&  (rp_success == result)
+	&&  (rp_success != storeObject(options, loop, state)))
+	{
+	    result = rp_failure;
+	}
+    }
+    else
+    {
+	;				/* could flush stdout */
+    }
+
+    state->fd       = STDOUT_FILENO;
+    state->isSplice = 0;
+    state->isQueued = 0;
+    state->isHashed = 0;
+
+    /*
+     * Only this loop holds the page, and its segments, so far; once done,
+     * the first loop may copy and retire it, and the output is not touched
+     * again here.
+     */
+
+    output = getOutput(engine, url);
+
+    output->spool       = spool;
+    output->spooler     = loop->index;
+    output->resume      = NULL;	/* in the batch arena */
+    output->conditional = NULL;
+
+    if (output->pending > 0)
+    {
+	--output->pending;		/* other segments still in flight */
+    }
+    else
+    {
+	__atomic_store_n(&output->isDone, 1, __ATOMIC_RELEASE);
+    }
+
+    if ((0 == loop->index) && (rp_success != flushOutputs(options, engine)))
+    {
+	result = rp_failure;
+    }
+
+    /* server think time, then transfer; the next is asked for from now */
+    if (options->isStats)
+    {
+	double t = now();
+
+	recordLatency(options,
+		      loop,
+		      state,
+		      rp_timing_ttfb,
+		      state->requestAt,
+		      state->firstByteAt);
+	recordLatency(options,
+		      loop,
+		      state,
+		      rp_timing_transfer,
+		      state->firstByteAt,
+		      t);
+
+	state->requestAt   = t;
+	state->firstByteAt = 0;
+    }
+
+    ++state->responses;			/* walk to next response */
+
+    state->isClose |= state->header.isClose
+		   || (rp_parse_until_close == state->parse);
+
+    state->parse = rp_parse_headers;
+    HttpHeaderInit(&state->header, 0);
+
+    DBUG_RETURN(result);
+}
+
+/*------------------------------------------------------------------------------
+ * isProbe() - does this request of the batch probe for byte ranges?
+ *
+ * With '--segments', a page written to a file is first asked for only its
+ * opening bytes; the answer shows whether, and how, to fetch the rest in
+ * segments. See 'processRange()'.
+ */
+static int isProbe(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state,
+	int i)
+{
+    rpOutput_t* output = getOutput(loop->engine, state->urls[i]);
+
+    return (options->segments > 1)
+	&& (state->rangeFirst < 0)
+	&& (NULL != output->filename)
+	&& (NULL == output->resume)
+	&& (NULL == output->conditional);
+}
+
+/*------------------------------------------------------------------------------
+ * getRange() - the Range header of this request of the batch, or NULL
+ */
+static char* getRange(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state,
+	int i)
+{
+    rpOutput_t* output = getOutput(loop->engine, state->urls[i]);
+
+    if (state->rangeFirst >= 0)
+    {
+	return state->range;		/* a segment */
+    }
+
+    if (NULL != output->resume)
+    {
+	return output->resume;		/* the rest of a partial file */
+    }
+
+    if (isProbe(options, loop, state, i))
+    {
+	return state->range;		/* the start of a page to split */
+    }
+
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+ * preallocate() - size the output file of a page fetched in segments
+ *
+ * The file is cut, or extended, to the page's length; then its blocks are
+ * reserved, where the file system can, so that segments written side by
+ * side do not fragment it.
+ */
+static rpResult_t preallocate(int fd, long length)
+{
+    DBUG_ENTER("preallocate");
+
+    if (-1 == ftruncate(fd, length))
+    {
+	perror("ftruncate()");
+
+	DBUG_PRINT("syscall", ("ftruncate() failed"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+#ifdef __linux__
+    if (-1 == fallocate(fd, 0, 0, length))
+    {
+	if (ENOSPC == errno)
+	{
+	    perror("fallocate()");
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	DBUG_PRINT("syscall", ("fallocate() unsupported, errno %d", errno));
+    }
+#endif
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * queueSegment() - queue a byte range of a page, to be fetched by this loop
+ */
+static rpResult_t queueSegment(
+	rpLoop_t* loop,
+	int url,
+	long first,
+	long last,
+	long total)
+{
+    rpSegment_t* segment;
+
+    DBUG_ENTER("queueSegment");
+
+    if (loop->segmentFirst + loop->segmentCount == loop->segmentMax)
+    {
+	if (loop->segmentFirst > 0)	/* move down, to the start */
+	{
+	    memmove(loop->segments,
+		    &loop->segments[loop->segmentFirst],
+		    loop->segmentCount * sizeof(rpSegment_t));
+
+	    loop->segmentFirst = 0;
+	}
+	else				/* grow */
+	{
+	    int max = (0 == loop->segmentMax) ? 64 : (loop->segmentMax << 1);
+
+	    rpSegment_t* segments = realloc(loop->segments,
+					    max * sizeof(rpSegment_t));
+
+	    if (NULL == segments)
+	    {
+		DBUG_PRINT("syslib", ("realloc() failed for segments"));
+
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    loop->segments   = segments;
+	    loop->segmentMax = max;
+	}
+    }
+
+    segment = &loop->segments[loop->segmentFirst + loop->segmentCount++];
+
+    segment->first = first;
+    segment->last  = last;
+    segment->total = total;
+    segment->url   = url;
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * processRange() - check the byte range of a response; split a probed page
+ *
+ * A segment must be answered with just its range, and a resumed page with
+ * the rest of it; a resumed page answered with 200, as it has changed (or
+ * ranges are unsupported), has been rewritten whole. A probe answered with
+ * the whole page, or with 200, is an ordinary page. Else the file is sized
+ * to the page, and the rest of it is queued as segments, each on a
+ * connection of its own.
+ */
+static rpResult_t processRange(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    HttpHeader_t* header;
+    rpOutput_t* output;
+
+    long first;
+    long size;
+
+    int count;
+    int url;
+    int i;
+
+    DBUG_ENTER("processRange");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    header = &state->header;
+    url    = state->urls[state->responses];
+    output = getOutput(loop->engine, url);
+
+    if (state->rangeFirst >= 0)		/* a segment */
+    {
+	if ((HTTP_STATUS_PARTIAL != header->status)
+	||  (state->rangeFirst != header->rangeFirst)
+	||  (state->rangeLast != header->rangeLast)
+	||  ((header->rangeTotal >= 0)
+	     && (state->rangeTotal != header->rangeTotal)))
+	{
+	    fprintf(stderr, "Unexpected byte range in response -- stopping.\n");
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	DBUG_RETURN(rp_success);
+    }
+
+    if (NULL != output->resume)		/* the rest of a partial file */
+    {
+	if (HTTP_STATUS_PARTIAL != header->status)
+	{
+	    if (options->isVerbose)
+	    {
+		printf("Redo   %s, as sent whole\n", output->filename);
+	    }
+
+	    DBUG_RETURN(rp_success);
+	}
+
+	if ((output->resumeFrom != header->rangeFirst)
+	||  ((header->rangeTotal >= 0)
+	     && (header->rangeLast + 1 != header->rangeTotal))
+	||  ((output->resumeTotal >= 0)
+	     && (header->rangeTotal >= 0)
+	     && (output->resumeTotal != header->rangeTotal)))
+	{
+	    fprintf(stderr, "Unexpected byte range in response -- stopping.\n");
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	DBUG_RETURN(rp_success);
+    }
+
+    if (HTTP_STATUS_PARTIAL != header->status)
+    {
+	DBUG_PRINT("segment", ("ranges unsupported; one stream"));
+
+	DBUG_RETURN(rp_success);
+    }
+
+    if ((0 != header->rangeFirst) || (header->rangeTotal < 0))
+    {
+	fprintf(stderr, "Unexpected byte range in response -- stopping.\n");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    first = header->rangeLast + 1;
+
+    if (first == header->rangeTotal)
+    {
+	DBUG_RETURN(rp_success);	/* the whole page */
+    }
+
+    /* no segment smaller than the probe */
+    count = (header->rangeTotal - first) / RP_SEGMENT_PROBE;
+
+    if (count > options->segments)
+    {
+	count = options->segments;
+    }
+    else if (count < 1)
+    {
+	count = 1;
+    }
+
+    size = (header->rangeTotal - first + count - 1) / count;
+
+    if (options->isVerbose)
+    {
+	printf("Split  %ld bytes, %d segments\n", header->rangeTotal, count);
+    }
+
+    if (rp_success != preallocate(state->fd, header->rangeTotal))
+    {
+	DBUG_RETURN(rp_failure);
+    }
+
+    for (i = 0; i < count; ++i, first += size)
+    {
+	long last = first + size - 1;
+
+	if (last >= header->rangeTotal)
+	{
+	    last = header->rangeTotal - 1;
+	}
+
+	if (rp_success != queueSegment(loop, url, first, last,
+				       header->rangeTotal))
+	{
+	    DBUG_RETURN(rp_failure);
+	}
+    }
+
+    /* the page is done once every segment is, as well as this */
+    output->pending += count;
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * processHeaders() - process the response headers
+ *
+ * The headers may arrive in any number of reads; returns rp_pending until
+ * the blank line that ends them has been seen.
+ */
+static rpResult_t processHeaders(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    rpOutput_t* output;
+    size_t consumed;
+
+    int isRange;
+    int isCached;
+    int rc;
+
+    DBUG_ENTER("processHeaders");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    rc = HttpHeaderPush(&state->header, state->pBuf, state->bytes, &consumed);
+
+    state->pBuf  += consumed;
+    state->bytes -= consumed;
+
+    if (HTTP_HEADER_MORE == rc)
+    {
+	DBUG_RETURN(rp_pending);
+    }
+
+    if (HTTP_HEADER_ERROR == rc)
+    {
+	fprintf(stderr, "Malformed response headers -- stopping.\n");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    /*
+     * Status line ought to indicate everything is okay; or, when a byte
+     * range was asked for, that it is sent
+     */
+
+    output   = getOutput(loop->engine, state->urls[state->responses]);
+    isRange  = (NULL != getRange(options, loop, state, state->responses));
+    isCached = !isRange
+	    && (NULL != output->conditional)
+	    && (HTTP_STATUS_NOT_MODIFIED == state->header.status);
+
+    if ((HTTP_STATUS_OK != state->header.status)
+    &&  !(isRange && (HTTP_STATUS_PARTIAL == state->header.status))
+    &&  !isCached)
+    {
+	DBUG_PRINT("responseHeader",
+		  ("failed -- not 200: %s", state->header.statusLine));
+
+	fprintf(stderr, "HTTP request failed.\n");
+
+	if (options->isVerbose)
+	{
+	    printf("%s\n", state->header.statusLine);
+	}
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    if (isCached)			/* no body follows */
+    {
+	state->contentLength = 0;
+	state->parse = rp_parse_content_length;
+
+	DBUG_RETURN(serveCache(options, loop, state));
+    }
+
+    if (state->header.isChunked && (state->header.contentLength >= 0))
+    {
+	fprintf(stderr,
+		"Received both %s and %s -- stopping.\n",
+		HTTP_CONTENT_LENGTH,
+		HTTP_TRANSFER_ENCODING);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    state->contentLength = state->header.contentLength;
+
+    if (state->header.isChunked)
+    {
+	state->parse = rp_parse_chunked;
+	state->chunked.sink = writeChunk;
+	HttpChunkedInit(&state->chunked, &state->header);
+    }
+    else if (state->contentLength >= 0)
+    {
+	state->parse = rp_parse_content_length;
+    }
+    else
+    {
+	state->parse = rp_parse_until_close;
+    }
+
+    /*
+     * Decode a compressed body, if compression was asked for; it was not,
+     * with a byte range.
+     */
+
+    state->isInflate = options->isCompressed
+		    && !isRange
+		    && ((HTTP_ENCODING_GZIP == state->header.contentEncoding)
+		    ||  (HTTP_ENCODING_DEFLATE == state->header.contentEncoding));
+
+    if (state->isInflate)
+    {
+	state->inflater.sink    = writeInflated;
+	state->inflater.context = state;
+
+	if (0 != HttpInflateInit(&state->inflater,
+				 state->header.contentEncoding))
+	{
+	    fprintf(stderr, "Cannot decode compressed body -- stopping.\n");
+
+	    DBUG_RETURN(rp_failure);
+	}
+    }
+
+    /*
+     * We are past the response headers.
+     *
+     * Open the output file, if specified.
+     */
+
+    if ((rp_success != openOutput(options, loop, state))
+    ||  (isRange && (rp_success != processRange(options, loop, state))))
+    {
+	DBUG_RETURN(rp_failure);
+    }
+
+    DBUG_RETURN(saveProgress(options, loop, state));
+}
+
+/*------------------------------------------------------------------------------
+ * processResponses() - process the [pipelined] HTTP responses
+ *
+ * Consumes as much of the buffered data as possible, and returns rp_pending
+ * when more data must be read. We must handle a mix of responses with either
+ * Content-Length or Transfer-Encoding.
+ */
+static rpResult_t processResponses(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    DBUG_ENTER("processResponses");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    while (state->responses < state->pipeline)
+    {
+	rpResult_t result;
+
+	long len;
+
+	switch (state->parse)
+	{
+	case rp_parse_headers:
+	    if (options->isStats && (0 == state->firstByteAt) && (state->bytes > 0))
+	    {
+		state->firstByteAt = now();
+	    }
+
+	    if (rp_success != (result = processHeaders(options, loop, state)))
+	    {
+		DBUG_RETURN(result);
+	    }
+
+	    if ((rp_parse_content_length == state->parse)
+	    &&  (0 == state->contentLength))
+	    {
+		if (rp_success != closeOutput(options, loop, state))
+		{
+		    DBUG_RETURN(rp_failure);
+		}
+	    }
+	    break;
+
+	case rp_parse_content_length:
+	    if (0 == state->bytes)
+	    {
+		DBUG_RETURN(rp_pending);
+	    }
+
+	    len = (state->bytes < state->contentLength)
+		? state->bytes
+		: state->contentLength;
+
+	    if (rp_success != writeBody(loop, state, state->pBuf, len))
+	    {
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    state->pBuf          += len;
+	    state->bytes         -= len;
+	    state->contentLength -= len;
+
+	    DBUG_PRINT("response",
+		      ("wrote %10ld, remaining %10ld", len, state->contentLength));
+
+	    if ((0 == state->contentLength)
+	    &&  (rp_success != closeOutput(options, loop, state)))
+	    {
+		DBUG_RETURN(rp_failure);
+	    }
+	    break;
+
+	case rp_parse_chunked:
+	    {
+		rpSink_t sink;
+		size_t consumed;
+
+		int rc;
+
+		if (0 == state->bytes)
+		{
+		    DBUG_RETURN(rp_pending);
+		}
+
+		sink.loop    = loop;
+		sink.state     = state;
+		sink.spanCount = 0;
+		state->chunked.context = &sink;
+
+		rc = HttpChunkedPush(&state->chunked,
+				     state->pBuf,
+				     state->bytes,
+				     &consumed);
+
+		state->chunked.context = NULL;
+
+		if ((sink.spanCount > 0) && (rp_success != writeSpans(&sink)))
+		{
+		    DBUG_RETURN(rp_failure);
+		}
+
+		state->pBuf  += consumed;
+		state->bytes -= consumed;
+
+		if (HTTP_CHUNKED_MORE == rc)
+		{
+		    DBUG_RETURN(rp_pending);
+		}
+
+		if (HTTP_CHUNKED_ABORT == rc)
+		{
+		    DBUG_RETURN(rp_failure);
+		}
+
+		if (HTTP_CHUNKED_ERROR == rc)
+		{
+		    fprintf(stderr, "Malformed chunked body -- stopping.\n");
+
+		    DBUG_RETURN(rp_failure);
+		}
+
+		/* found response terminator; trailers are ignored */
+		if (rp_success != closeOutput(options, loop, state))
+		{
+		    DBUG_RETURN(rp_failure);
+		}
+	    }
+	    break;
+
+	case rp_parse_until_close:
+	    if (0 == state->bytes)
+	    {
+		DBUG_RETURN(rp_pending);
+	    }
+
+	    if (rp_success != writeBody(loop, state, state->pBuf, state->bytes))
+	    {
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    state->pBuf += state->bytes;
+	    state->bytes = 0;
+	    break;
+	}
+    }
+
+    DBUG_RETURN(rp_success);
+}
+
+#ifdef __linux__
+/*------------------------------------------------------------------------------
+ * spliceResponse() - move Content-Length body bytes from socket to output
+ *
+ * The bytes go from the socket into a pipe, and from the pipe into the
+ * output, without being copied through user space.
+ *
+ * Clears 'isSplice', returning rp_success, if the kernel declines; the
+ * caller then falls back to read() and write().
+ */
+static rpResult_t spliceResponse(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    ssize_t len;
+
+    DBUG_ENTER("spliceResponse");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    if ((-1 == state->pipefd[0]) && (-1 == pipe(state->pipefd)))
+    {
+	perror("pipe()");
+
+	DBUG_PRINT("syscall", ("pipe() failed"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    len = (state->contentLength < state->so_rcvbuf_len)
+	? state->contentLength
+	: state->so_rcvbuf_len;
+
+    if (-1 == (len = splice(state->sock,
+			    NULL,
+			    state->pipefd[1],
+			    NULL,
+			    len,
+			    SPLICE_F_MOVE | SPLICE_F_NONBLOCK)))
+    {
+	if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+	{
+	    DBUG_RETURN(rp_pending);
+	}
+
+	if ((EINVAL == errno) || (ENOSYS == errno))
+	{
+	    DBUG_PRINT("syscall", ("splice(sock) unsupported; falling back"));
+
+	    state->isSplice = 0;
+
+	    DBUG_RETURN(rp_success);
+	}
+
+	perror("splice(sock)");
+
+	DBUG_PRINT("syscall", ("splice(sock) failed"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    if (0 == len)			/* closed by server */
+    {
+	fprintf(stderr, "Connection closed by server.\n");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    DBUG_PRINT("response", ("splice %10ld, remaining %10ld",
+			    (long)len,
+			    state->contentLength - len));
+
+    loop->bodyBytes    += len;
+    state->contentLength -= len;
+
+    /*
+     * Drain the pipe into the output
+     */
+
+    while (len > 0)
+    {
+	ssize_t rc;
+
+	if (-1 == (rc = splice(state->pipefd[0],
+			       NULL,
+			       state->fd,
+			       NULL,
+			       len,
+			       SPLICE_F_MOVE)))
+	{
+	    if (EINTR == errno)
+	    {
+		continue;
+	    }
+
+	    if (EINVAL != errno)
+	    {
+		perror("splice(fd)");
+
+		DBUG_PRINT("syscall", ("splice(fd) failed"));
+
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    /* the output declined; copy what is in the pipe */
+	    state->isSplice = 0;
+
+	    if ((-1 == (rc = read(state->pipefd[0], state->so_rcvbuf, len)))
+	    ||  (rp_success != writeAll(state->fd, state->so_rcvbuf, rc)))
+	    {
+		DBUG_RETURN(rp_failure);
+	    }
+	}
+
+	len -= rc;
+    }
+
+    if (0 == state->contentLength)
+    {
+	DBUG_RETURN(closeOutput(options, loop, state));
+    }
+
+    DBUG_RETURN(rp_pending);
+}
+#endif
+
+/*------------------------------------------------------------------------------
+ * isResendable() - may the rest of the batch go on a new connection, now that
+ * the server has closed this one?
+ *
+ * Only between responses: a pooled connection dropped before any answer, or
+ * one the server closed after answering part of the batch (say, after a
+ * "Connection: close", or at its limit of requests per connection).
+ */
+static int isResendable(rpState_t* state)
+{
+    return (rp_parse_headers == state->parse)
+	&& ((state->responses > 0) || (state->isReused && !state->isReceived));
+}
+
+/*------------------------------------------------------------------------------
+ * receiveResponses() - read from the socket, and process the responses
+ *
+ * The header parser and chunked decoder resume mid-line, so every parser
+ * consumes the whole of each read, in place; nothing is left over to carry
+ * into the next. Each read() therefore fills the buffer from its start, and
+ * the buffer is never compacted. (Bytes beyond the last pipelined response
+ * are the only exception; the connection is then closed, not pooled.)
+ *
+ * With io_uring, the bytes have already been received, into a pool buffer,
+ * and are processed there.
+ */
+static rpResult_t receiveResponses(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state,
+	Event_t* event)
+{
+    rpResult_t result;
+
+    int len;
+
+    DBUG_ENTER("receiveResponses");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+    assert(NULL != event);
+
+#ifdef __linux__
+    /*
+     * Once the buffered bytes are written, the rest of a Content-Length body
+     * may be splice()d.
+     */
+
+    if (state->isSplice
+    &&  (rp_parse_content_length == state->parse)
+    &&  (0 == state->bytes))
+    {
+	result = spliceResponse(options, loop, state);
+
+	if (state->isSplice || (rp_success != result))
+	{
+	    DBUG_RETURN(result);
+	}
+    }
+#endif
+
+    assert(0 == state->bytes);
+
+    if (event->events & EVENT_DATA)
+    {
+	state->pBuf = event->buf;
+
+	if ((len = event->result) < 0)
+	{
+	    errno = -len;
+	    len   = -1;
+	}
+    }
+    else
+    {
+	state->pBuf = state->so_rcvbuf;
+	len = read(state->sock, state->pBuf, state->so_rcvbuf_len);
+    }
+
+    if (-1 == len)
+    {
+	if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+	{
+	    DBUG_RETURN(rp_pending);
+	}
+
+	if ((ECONNRESET == errno) && isResendable(state))
+	{
+	    DBUG_RETURN(rp_retry);	/* server dropped the connection */
+	}
+
+	perror("read(sock)");
+
+	DBUG_PRINT("syscall", ("read(sock)"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    DBUG_PRINT("response", ("read  %10d, buffered %d", len, state->bytes));
+
+    if (0 == len)			/* closed by server */
+    {
+	if (rp_parse_until_close == state->parse)
+	{
+	    DBUG_RETURN(closeOutput(options, loop, state));
+	}
+
+	if (isResendable(state))
+	{
+	    DBUG_RETURN(rp_retry);	/* server dropped the connection */
+	}
+
+	fprintf(stderr, "Connection closed by server.\n");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    state->bytes      = len;
+    state->isReceived = 1;
+
+    result = processResponses(options, loop, state);
+
+    if ((rp_success == result) && (state->bytes > 0))
+    {
+	DBUG_PRINT("response", ("%d unexpected bytes ignored", state->bytes));
+    }
+
+    DBUG_RETURN(result);
+}
+
+/*------------------------------------------------------------------------------
+ * addRequest() - append one string to the request batch
+ */
+static rpResult_t addRequest(rpState_t* state, char* base, size_t len)
+{
+    DBUG_ENTER("addRequest");
+
+    assert(NULL != state);
+    assert(NULL != base);
+
+    if (state->iovcnt >= state->iovmax)	/* grow the batch */
+    {
+	int iovmax = (0 == state->iovmax) ? 64 : (state->iovmax << 1);
+
+	struct iovec* iov = realloc(state->iov, iovmax * sizeof(struct iovec));
+
+	if (NULL == iov)
+	{
+	    DBUG_PRINT("syslib", ("realloc() failed for iov, count %d", iovmax));
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	state->iov    = iov;
+	state->iovmax = iovmax;
+    }
+
+    state->iov[state->iovcnt].iov_base = base;
+    state->iov[state->iovcnt].iov_len  = len;
+    ++state->iovcnt;
+
+    state->batchBytes += len;
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * flushRequests() - write the request batch to the socket
+ *
+ * The whole batch goes out in as few sendmsg() calls as the kernel allows:
+ * at most IOV_MAX elements per call, and MSG_MORE (where available) while
+ * more elements follow, so the kernel can fill full sized TCP segments.
+ *
+ * Partial writes are handled by walking past the iovec elements that were
+ * fully written, and adjusting the first partially written element.
+ *
+ * Returns rp_pending when the socket buffer is full, and rp_retry when a
+ * pooled connection turns out to have been closed by the server.
+ */
+static rpResult_t flushRequests(rpState_t* state)
+{
+    DBUG_ENTER("flushRequests");
+
+    assert(NULL != state);
+
+    while (state->iovNext < state->iovcnt)
+    {
+	struct iovec* iov = &state->iov[state->iovNext];
+	int iovcnt = state->iovcnt - state->iovNext;
+
+	struct msghdr msg;
+	ssize_t rc;
+	int flags = 0;
+
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;		/* report EPIPE, rather than SIGPIPE */
+#endif
+
+	memset(&msg, 0, sizeof msg);
+
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = (iovcnt < IOV_MAX) ? iovcnt : IOV_MAX;
+
+#ifdef MSG_MORE
+	if (iovcnt > IOV_MAX)
+	{
+	    flags |= MSG_MORE;		/* more to follow */
+	}
+#endif
+
+	if (-1 == (rc = sendmsg(state->sock, &msg, flags)))
+	{
+	    if (EINTR == errno)
+	    {
+		continue;
+	    }
+
+	    if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+	    {
+		DBUG_RETURN(rp_pending);
+	    }
+
+	    if (((EPIPE == errno) || (ECONNRESET == errno)) && state->isReused)
+	    {
+		DBUG_RETURN(rp_retry);
+	    }
+
+	    perror("sendmsg(sock)");
+
+	    DBUG_PRINT("syscall", ("sendmsg(sock)"));
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	++state->batchSyscalls;
+
+	/* walk past what was written */
+	while ((state->iovNext < state->iovcnt) && ((size_t)rc >= iov->iov_len))
+	{
+	    rc -= iov->iov_len;
+	    ++iov;
+	    ++state->iovNext;
+	}
+
+	if (rc > 0)			/* partial element */
+	{
+	    iov->iov_base = (char*)iov->iov_base + rc;
+	    iov->iov_len -= rc;
+	}
+    }
+
+    DBUG_PRINT("request",
+	      ("batch %d requests, %ld bytes, %ld syscalls",
+	      state->pipeline,
+	      state->batchBytes,
+	      state->batchSyscalls));
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * sendRequests() send the [pipelined] HTTP requests
+ *
+ * Every request for this connection is serialized into one iovec batch, which
+ * 'flushRequests()' writes with as few system calls as possible. The batch
+ * points into the queued URLs, by their spans; they are not retired before
+ * their responses are done.
+ */
+static rpResult_t sendRequests(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    int i;
+
+    DBUG_ENTER("sendRequests");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    /*
+     * Make pipelined requests
+     */
+
+    state->iovcnt        = 0;
+    state->iovNext       = 0;
+    state->batchBytes    = 0;
+    state->batchSyscalls = 0;
+
+    for (i = 0; i < state->pipeline; ++i)
+    {
+	rpOutput_t* output = getOutput(loop->engine, state->urls[i]);
+
+	char* url = output->url;
+	char* conditional = output->conditional;
+	char* range;
+
+	UrlSpan_t path = output->spans.path;
+	UrlSpan_t query = output->spans.query_string;
+	UrlSpan_t domain = output->spans.domain;
+
+	if (options->isVerbose)
+	{
+	    printf("Path   %.*s%s%.*s\n",
+		   path.length,
+		   URL_SPAN(url, path),
+		   (query.length > 0) ? HTTP_QUERY : "",
+		   query.length,
+		   URL_SPAN(url, query));
+
+	    if (i > 0)
+	    {
+		printf("       ...pipelining next request\n");
+	    }
+	}
+
+	/*
+	 * GET ... (the path, and any query string; never the fragment id)
+	 * Host: ...
+	 * Connection: ... (may not be necessary)
+	 * Cache-control: ... (may not be necessary; not with a cache)
+	 * Range: ... (a segment, a probe for ranges, or a resume)
+	 * Accept-Encoding: ... (unless a byte range)
+	 * If-None-Match, If-Modified-Since: ... (a cached page)
+	 *
+	 * Terminate with blank line
+	 */
+
+	if ((rp_success != addRequest(state, HTTP_GET, strlen(HTTP_GET)))
+	||  ((path.length > 0)
+	     && (rp_success != addRequest(state,
+					  URL_SPAN(url, path),
+					  path.length)))
+	||  ((0 == path.length)
+	     && (rp_success != addRequest(state,
+					  URL_PATH_DEFAULT,
+					  strlen(URL_PATH_DEFAULT))))
+	||  ((query.length > 0)
+	     && ((rp_success != addRequest(state,
+					   HTTP_QUERY,
+					   strlen(HTTP_QUERY)))
+		 || (rp_success != addRequest(state,
+					      URL_SPAN(url, query),
+					      query.length))))
+	||  (rp_success != addRequest(state,
+				      HTTP_HTTP_1_1,
+				      strlen(HTTP_HTTP_1_1)))
+	||  (rp_success != addRequest(state, HTTP_HOST, strlen(HTTP_HOST)))
+	||  (rp_success != addRequest(state,
+				      URL_SPAN(url, domain),
+				      domain.length))
+	||  (rp_success != addRequest(state, HTTP_CRLF, strlen(HTTP_CRLF)))
+	||  (rp_success != addRequest(state,
+				      HTTP_CONNECTION,
+				      strlen(HTTP_CONNECTION)))
+	||  ((NULL == options->cacheDir)
+	     && (rp_success != addRequest(state,
+					  HTTP_CACHE_CONTROL,
+					  strlen(HTTP_CACHE_CONTROL))))
+	||  ((NULL != (range = getRange(options, loop, state, i)))
+	     && (rp_success != addRequest(state, range, strlen(range))))
+	||  ((NULL == range) && options->isCompressed
+	     && (rp_success != addRequest(state,
+					  HTTP_ACCEPT_ENCODING,
+					  strlen(HTTP_ACCEPT_ENCODING))))
+	||  ((NULL == range) && (NULL != conditional)
+	     && (rp_success != addRequest(state,
+					  conditional,
+					  strlen(conditional))))
+	||  (rp_success != addRequest(state, HTTP_CRLF, strlen(HTTP_CRLF))))
+	{
+	    DBUG_RETURN(rp_failure);
+	}
+    }
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * isBusy() - is the connection in flight?
+ */
+static int isBusy(rpState_t* state)
+{
+    return (rp_phase_idle != state->phase) && (rp_phase_pooled != state->phase);
+}
+
+/*------------------------------------------------------------------------------
+ * closeAttempt() - abandon one connect attempt
+ */
+static void closeAttempt(rpLoop_t* loop, rpState_t* state, int i)
+{
+    assert(i < state->attemptCount);
+
+    EventLoopDelete(loop->events, state->attempts[i].sock);
+    close(state->attempts[i].sock);
+
+    state->attempts[i] = state->attempts[--state->attemptCount];
+}
+
+/*------------------------------------------------------------------------------
+ * releaseBatch() - forget the pipelined URLs of this connection
+ *
+ * Resets the batch arena, so that everything carved from it for this batch
+ * goes back to the loop's pool of chunks at once.
+ */
+static void releaseBatch(rpLoop_t* loop, rpState_t* state)
+{
+    DBUG_ENTER("releaseBatch");
+
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    if (state->isQueued)
+    {
+	EventLoopClose(loop->events, state->fd);	/* abandoned response */
+    }
+    else if ((STDOUT_FILENO != state->fd) && (NULL == state->spool))
+    {
+	close(state->fd);		/* abandoned response */
+    }
+
+    if (NULL != state->spool)
+    {
+	fclose(state->spool);
+    }
+
+    state->fd       = STDOUT_FILENO;
+    state->spool    = NULL;
+    state->isQueued = 0;
+
+    ArenaReset(&state->arena);		/* URLs, headers and addresses */
+
+    state->urls      = NULL;
+    state->addrs     = NULL;
+    state->addrCount = 0;
+    state->nextAddr  = 0;
+    state->pipeline  = 0;
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * closeConnection() - close the connection, and free its slot
+ */
+static rpResult_t closeConnection(rpLoop_t* loop, rpState_t* state)
+{
+    rpResult_t result = rp_success;
+
+    int rc;
+
+    DBUG_ENTER("closeConnection");
+
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    if (RP_SOCK_CLOSED != state->sock)
+    {
+	if (-1 == (rc = EventLoopClose(loop->events, state->sock)))
+	{
+	    perror("close(sock)");
+
+	    DBUG_PRINT("syscall", ("close(sock) failed"));
+
+	    result = rp_failure;
+	}
+
+	state->sock = RP_SOCK_CLOSED;
+    }
+
+    while (state->attemptCount > 0)
+    {
+	closeAttempt(loop, state, 0);
+    }
+
+    releaseBatch(loop, state);
+
+    if (NULL != state->serverInfo)
+    {
+	ResolveFreeInfo(state->serverInfo);
+	state->serverInfo = NULL;
+    }
+
+    if (isBusy(state))
+    {
+	--loop->active;
+	--loop->busy[state->origin->id];
+    }
+
+    state->origin = NULL;
+
+    state->phase = rp_phase_idle;
+
+    DBUG_RETURN(result);
+}
+
+/*------------------------------------------------------------------------------
+ * poolConnection() - keep a connection, whose batch is done, for reuse
+ *
+ * Unless the server will close it, the connection waits in the pool for
+ * more URLs to the same server. Meanwhile it is watched for reading, to
+ * notice if the server closes it after all.
+ */
+static rpResult_t poolConnection(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    int rc;
+
+    DBUG_ENTER("poolConnection");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    if (state->isClose || (state->bytes > 0) || (0 == options->idleTimeout))
+    {
+	DBUG_PRINT("pool", ("not reusable: %s", state->origin->domain));
+
+	DBUG_RETURN(closeConnection(loop, state));
+    }
+
+    releaseBatch(loop, state);
+
+    --loop->active;
+    --loop->busy[state->origin->id];
+
+    state->phase     = rp_phase_pooled;
+    state->idleSince = now();
+
+    DBUG_PRINT("pool", ("pooled %s:%s",
+			state->origin->domain,
+			state->origin->port));
+
+    if (-1 == (rc = EventLoopModify(loop->events,
+				    state->sock,
+				    EVENT_READ,
+				    state)))
+    {
+	perror("EventLoopModify()");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * getFamily() - the address family allowed by the command line
+ */
+static int getFamily(rpOptions_t* options)
+{
+    if (options->isIPV4only)
+    {
+	return AF_INET;			/* only IPv4 */
+    }
+
+    if (options->isIPV6only)
+    {
+	return AF_INET6;		/* only IPv6 */
+    }
+
+    return AF_UNSPEC;			/* IPV4 or IPv6 */
+}
+
+/*------------------------------------------------------------------------------
+ * isSameServer() - does the connection go to this server?
+ *
+ * Connections are keyed by origin (scheme, domain and port, interned) and
+ * address family.
+ */
+static int isSameServer(
+	rpOptions_t* options,
+	rpState_t* state,
+	rpOrigin_t* origin)
+{
+    int family = getFamily(options);
+
+    return (origin == state->origin)
+	&& ((AF_UNSPEC == family) || (family == state->family));
+}
+
+/*------------------------------------------------------------------------------
+ * findPooled() - find an idle connection to this server
+ */
+static rpState_t* findPooled(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpOrigin_t* origin)
+{
+    int i;
+
+    for (i = 0; i < loop->slotCount; ++i)
+    {
+	rpState_t* state = &loop->conns[i];
+
+	if ((rp_phase_pooled == state->phase)
+	&&  isSameServer(options, state, origin))
+	{
+	    return state;
+	}
+    }
+
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+ * countInFlight() - count connections in flight to this server
+ *
+ * Kept per origin ID as connections start and finish their batches; a
+ * server this loop has never connected to has none.
+ */
+static int countInFlight(rpLoop_t* loop, rpOrigin_t* origin)
+{
+    return (origin->id < loop->busyMax) ? loop->busy[origin->id] : 0;
+}
+
+/*------------------------------------------------------------------------------
+ * findSlot() - find a free connection slot
+ *
+ * If every slot is taken, the connection idle longest is closed.
+ */
+static rpState_t* findSlot(rpLoop_t* loop)
+{
+    rpState_t* oldest = NULL;
+
+    int i;
+
+    DBUG_ENTER("findSlot");
+
+    for (i = 0; i < loop->slotCount; ++i)
+    {
+	rpState_t* state = &loop->conns[i];
+
+	if (rp_phase_idle == state->phase)
+	{
+	    DBUG_RETURN(state);
+	}
+
+	if ((rp_phase_pooled == state->phase)
+	&&  ((NULL == oldest) || (state->idleSince < oldest->idleSince)))
+	{
+	    oldest = state;
+	}
+    }
+
+    if (NULL != oldest)
+    {
+	DBUG_PRINT("pool", ("evict %s:%s",
+			    oldest->origin->domain,
+			    oldest->origin->port));
+
+	closeConnection(loop, oldest);
+    }
+
+    DBUG_RETURN(oldest);
+}
+
+/*------------------------------------------------------------------------------
+ * expireIdle() - close pooled connections idle too long
+ *
+ * Returns the milliseconds until the next one expires, or -1 if none remain.
+ */
+static int expireIdle(rpOptions_t* options, rpLoop_t* loop)
+{
+    double t = now();
+    double next = -1;
+
+    int i;
+
+    DBUG_ENTER("expireIdle");
+
+    for (i = 0; i < loop->slotCount; ++i)
+    {
+	rpState_t* state = &loop->conns[i];
+
+	double expiry;
+
+	if (rp_phase_pooled != state->phase)
+	{
+	    continue;
+	}
+
+	expiry = state->idleSince + options->idleTimeout;
+
+	if (expiry <= t)
+	{
+	    DBUG_PRINT("pool", ("expire %s:%s",
+				state->origin->domain,
+				state->origin->port));
+
+	    closeConnection(loop, state);
+	}
+	else if ((next < 0) || (expiry < next))
+	{
+	    next = expiry;
+	}
+    }
+
+    DBUG_RETURN((next < 0) ? -1 : (int)((next - t) * 1000) + 1);
+}
+
+/*------------------------------------------------------------------------------
+ * reportAttempt() - report the outcome, and latency, of a connect attempt
+ */
+static void reportAttempt(
+	rpOptions_t* options,
+	rpAttempt_t* attempt,
+	const char* outcome)
+{
+    char printableAddress[INET6_ADDRSTRLEN];
+
+    struct addrinfo* p = attempt->addr;
+
+    void* addr;
+
+    double ms = (now() - attempt->started) * 1000;
+
+    if (AF_INET == p->ai_family)	/* IPv4 */
+    {
+	addr = &((struct sockaddr_in*)p->ai_addr)->sin_addr;
+    }
+    else				/* IPv6 */
+    {
+	addr = &((struct sockaddr_in6*)p->ai_addr)->sin6_addr;
+    }
+
+    inet_ntop(p->ai_family, addr, printableAddress, sizeof printableAddress);
+
+    DBUG_PRINT("connection", ("%s %s after %.3f ms",
+			      printableAddress,
+			      outcome,
+			      ms));
+
+    if (options->isVerbose)
+    {
+	printf("       %s %s after %.3f ms\n", printableAddress, outcome, ms);
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * startAttempt() - start a non-blocking connect to the next address
+ *
+ * Skips addresses that fail at once. Returns rp_failure when none remain.
+ */
+static rpResult_t startAttempt(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    int rc;				/* return codes from system calls */
+
+    DBUG_ENTER("startAttempt");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    while ((state->nextAddr < state->addrCount)
+    &&     (state->attemptCount < RP_MAX_ATTEMPTS))
+    {
+	struct addrinfo* p = state->addrs[state->nextAddr++];
+
+	rpAttempt_t* attempt = &state->attempts[state->attemptCount];
+
+	void* addr;
+	char* ipVersion;
+	char printableAddress[INET6_ADDRSTRLEN];
+
+	if (AF_INET == p->ai_family)	/* IPv4 */
+	{
+	    struct sockaddr_in* ipv4 = (struct sockaddr_in*)p->ai_addr;
+	    addr = &ipv4->sin_addr;
+	    ipVersion = "IPv4";
+	}
+	else				/* IPv6 */
+	{
+	    struct sockaddr_in6* ipv6 = (struct sockaddr_in6*)p->ai_addr;
+	    addr = &ipv6->sin6_addr;
+	    ipVersion = "IPv6";
+	}
+
+	inet_ntop(p->ai_family,
+		  addr,
+		  printableAddress,
+		  sizeof printableAddress);
+
+	if (options->isVerbose)
+	{
+	    printf("%-6s %s\n", ipVersion, printableAddress);
+	}
+
+	/*
+	 * Open the socket
+	 */
+
+	if (-1 == (attempt->sock = socket(p->ai_family,
+					  p->ai_socktype,
+					  p->ai_protocol)))
+	{
+	    perror("socket()");
+
+	    DBUG_PRINT("syscall", ("socket() failed"));
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	if (-1 == (rc = fcntl(attempt->sock,
+			      F_SETFL,
+			      fcntl(attempt->sock, F_GETFL) | O_NONBLOCK)))
+	{
+	    perror("fcntl()");
+
+	    DBUG_PRINT("syscall", ("fcntl() failed"));
+
+	    close(attempt->sock);
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	attempt->addr    = p;
+	attempt->started = now();
+
+	/*
+	 * Connect
+	 */
+
+	if ((-1 == (rc = connect(attempt->sock, p->ai_addr, p->ai_addrlen)))
+	&&  (EINPROGRESS != errno))
+	{
+	    DBUG_PRINT("syscall",
+		       ("connect() failed for %s",
+		       printableAddress));
+
+	    reportAttempt(options, attempt, "failed");
+
+	    close(attempt->sock);
+
+	    continue;			/* try the next address */
+	}
+
+	if (-1 == (rc = EventLoopAdd(loop->events,
+				     attempt->sock,
+				     EVENT_WRITE,
+				     state)))
+	{
+	    perror("EventLoopAdd()");
+
+	    close(attempt->sock);
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	++state->attemptCount;
+
+	DBUG_RETURN(rp_success);
+    }
+
+    DBUG_RETURN(rp_failure);
+}
+
+/*------------------------------------------------------------------------------
+ * nextAttempt() - start an attempt on the next address, if any remain
+ *
+ * That none can be started fails the connection only when no other attempt
+ * is still in flight.
+ */
+static rpResult_t nextAttempt(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    DBUG_ENTER("nextAttempt");
+
+    if ((rp_success != startAttempt(options, loop, state))
+    &&  (0 == state->attemptCount))
+    {
+	fprintf(stderr, "Unable to connect to host\n");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * startConnect() - start connecting to the server's addresses
+ *
+ * Addresses are tried in the order of RFC 8305 ("Happy Eyeballs"): the
+ * families alternate, starting with that of the first address. Another
+ * attempt starts every 'connectDelay' ms, or as soon as one fails, until one
+ * connects; see 'staggerConnects()' and 'finishConnect()'.
+ */
+static rpResult_t startConnect(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    struct addrinfo* first;		/* next of the first family */
+    struct addrinfo* other;		/* next of the other family */
+    struct addrinfo* p;
+
+    int family;
+    int count = 0;
+
+    DBUG_ENTER("startConnect");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+    assert(NULL != state->serverInfo);
+
+    for (p = state->serverInfo; NULL != p; p = p->ai_next)
+    {
+	++count;
+    }
+
+    /* a reconnect leaves the old ones, until the batch is released */
+    if (NULL == (state->addrs = ArenaAlloc(&state->arena,
+					   count * sizeof(struct addrinfo*))))
+    {
+	DBUG_PRINT("syslib", ("ArenaAlloc() failed for addresses"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    state->addrCount    = 0;
+    state->nextAddr     = 0;
+    state->attemptCount = 0;
+
+    /*
+     * Interleave the families
+     */
+
+    family = state->serverInfo->ai_family;
+    first  = state->serverInfo;
+    other  = state->serverInfo;
+
+    while ((NULL != first) || (NULL != other))
+    {
+	while ((NULL != first) && (family != first->ai_family))
+	{
+	    first = first->ai_next;
+	}
+
+	if (NULL != first)
+	{
+	    state->addrs[state->addrCount++] = first;
+	    first = first->ai_next;
+	}
+
+	while ((NULL != other) && (family == other->ai_family))
+	{
+	    other = other->ai_next;
+	}
+
+	if (NULL != other)
+	{
+	    state->addrs[state->addrCount++] = other;
+	    other = other->ai_next;
+	}
+    }
+
+    DBUG_RETURN(nextAttempt(options, loop, state));
+}
+
+/*------------------------------------------------------------------------------
+ * finishConnect() - check the connect attempts that are ready
+ *
+ * The first to connect wins; the others are cancelled. Sets 'isConnected'.
+ */
+static rpResult_t finishConnect(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state,
+	int* isConnected)
+{
+    struct pollfd fds[RP_MAX_ATTEMPTS];
+
+    unsigned long len = 0;
+    socklen_t size = sizeof len;
+
+    int failed = 0;
+    int rc;
+    int i;
+
+    DBUG_ENTER("finishConnect");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    *isConnected = 0;
+
+    /* find which attempts are ready */
+    for (i = 0; i < state->attemptCount; ++i)
+    {
+	fds[i].fd      = state->attempts[i].sock;
+	fds[i].events  = POLLOUT;
+	fds[i].revents = 0;
+    }
+
+    if (-1 == (rc = poll(fds, state->attemptCount, 0)))
+    {
+	perror("poll()");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    for (i = state->attemptCount - 1; i >= 0; --i)
+    {
+	int error = 0;
+
+	size = sizeof error;
+
+	if (0 == fds[i].revents)
+	{
+	    continue;			/* still in progress */
+	}
+
+	if ((-1 == (rc = getsockopt(state->attempts[i].sock,
+				    SOL_SOCKET,
+				    SO_ERROR,
+				    &error,
+				    &size)))
+	||  (0 != error))
+	{
+	    DBUG_PRINT("syscall", ("connect() failed, error %d", error));
+
+	    reportAttempt(options, &state->attempts[i], "failed");
+	    closeAttempt(loop, state, i);
+
+	    ++failed;
+
+	    continue;
+	}
+
+	/*
+	 * Connected; cancel the others
+	 */
+
+	reportAttempt(options, &state->attempts[i], "connected");
+
+	if (options->isStats)
+	{
+	    recordLatency(options,
+			  loop,
+			  state,
+			  rp_timing_connect,
+			  state->connectAt,
+			  now());
+	}
+
+	state->sock       = state->attempts[i].sock;
+	state->family     = state->attempts[i].addr->ai_family;
+	state->attempts[i] = state->attempts[--state->attemptCount];
+
+	while (state->attemptCount > 0)
+	{
+	    reportAttempt(options, &state->attempts[0], "cancelled");
+	    closeAttempt(loop, state, 0);
+	}
+
+	*isConnected = 1;
+
+	break;
+    }
+
+    if (!*isConnected)
+    {
+	/* each failure starts the next address, without waiting */
+	while (failed-- > 0)
+	{
+	    if (rp_success != nextAttempt(options, loop, state))
+	    {
+		DBUG_RETURN(rp_failure);
+	    }
+	}
+
+	DBUG_RETURN(rp_success);	/* keep waiting */
+    }
+
+    DBUG_PRINT("connection", ("connected, socket %d", state->sock));
+
+    /*
+     * Set optimal socket receive buffer size.
+     *
+     * (The remote server may use a different size.)
+     */
+
+    size = sizeof len;
+
+    if (-1 == (rc = getsockopt(state->sock,
+			       SOL_SOCKET,
+			       SO_RCVBUF,
+			       &len,
+			       &size)))
+    {
+	perror("getsockopt()");
+
+	DBUG_PRINT("syscall", ("getsockopt() failed"));
+    }
+    else
+    {
+	DBUG_PRINT("syscall",
+		   ("getsockopt() size %d, len %lu", size, len));
+    }
+
+    if ((NULL == state->so_rcvbuf) || (len > state->so_rcvbuf_len))
+    {
+	/* first time, or we need to grow the buffer */
+
+	free(state->so_rcvbuf);
+
+	state->so_rcvbuf_len = len;
+
+	if (NULL == (state->so_rcvbuf = malloc(state->so_rcvbuf_len)))
+	{
+	    DBUG_PRINT("syslib",
+		       ("malloc() failed for so_rcvbuf, size %lu",
+			(unsigned long)state->so_rcvbuf_len));
+
+	    DBUG_RETURN(rp_failure);
+	}
+    }
+
+    state->pBuf = state->so_rcvbuf;
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * staggerConnects() - start the next connect attempt, where one is due
+ *
+ * Sets 'timeout' to the milliseconds until the next is due, or -1 if none
+ * are.
+ */
+static rpResult_t staggerConnects(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	int* timeout)
+{
+    double t = now();
+    double next = -1;
+
+    int i;
+
+    DBUG_ENTER("staggerConnects");
+
+    for (i = 0; i < loop->slotCount; ++i)
+    {
+	rpState_t* state = &loop->conns[i];
+
+	double due;
+
+	if ((rp_phase_connecting != state->phase)
+	||  (0 == state->attemptCount)
+	||  (state->nextAddr == state->addrCount))
+	{
+	    continue;
+	}
+
+	due = state->attempts[state->attemptCount - 1].started
+	    + options->connectDelay / 1000.0;
+
+	if (due <= t)
+	{
+	    DBUG_PRINT("connection", ("no answer yet; next address"));
+
+	    if (rp_success != nextAttempt(options, loop, state))
+	    {
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    if (state->nextAddr == state->addrCount)
+	    {
+		continue;		/* the last is in flight */
+	    }
+
+	    /* the one after, unless this one answers first */
+	    due = state->attempts[state->attemptCount - 1].started
+		+ options->connectDelay / 1000.0;
+	}
+
+	if ((next < 0) || (due < next))
+	{
+	    next = due;
+	}
+    }
+
+    *timeout = (next < 0) ? -1
+	     : (next <= t) ? 0
+	     : (int)((next - t) * 1000) + 1;
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * resolveServer() - lookup the server of this connection, and connect
+ *
+ * When the resolver has yet to answer, the connection waits, resolving,
+ * and this is called again once any lookup completes.
+ */
+static rpResult_t resolveServer(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    int error;
+    int rc;
+
+    DBUG_ENTER("resolveServer");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    rc = ResolveLookup(loop->engine->resolver,
+		       state->origin->domain,
+		       state->origin->port,
+		       getFamily(options),
+		       &state->serverInfo,
+		       &error);
+
+    if (RESOLVE_PENDING == rc)
+    {
+	state->phase = rp_phase_resolving;
+
+	DBUG_RETURN(rp_success);	/* wait for the resolver */
+    }
+
+    if (RESOLVE_ERROR == rc)
+    {
+	fprintf(stderr,
+		"getaddrinfo(): %s %s\n",
+		state->origin->domain,
+		gai_strerror(error));
+
+	DBUG_PRINT("library",
+		   ("getaddrinfo() failed for %s:%s",
+		   state->origin->domain,
+		   state->origin->port));
+
+	DBUG_RETURN(rp_failure);	/* fatal */
+    }
+
+    if (options->isStats)
+    {
+	state->connectAt = now();
+
+	recordLatency(options,
+		      loop,
+		      state,
+		      rp_timing_dns,
+		      state->resolveAt,
+		      state->connectAt);
+    }
+
+    /*
+     * Attempt to connect at each address on this server,
+     * until successful
+     */
+
+    state->phase = rp_phase_connecting;
+
+    DBUG_RETURN(startConnect(options, loop, state));
+}
+
+/*------------------------------------------------------------------------------
+ * connectServer() - open a new connection to the server of this run
+ */
+static rpResult_t connectServer(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    DBUG_ENTER("connectServer");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+    assert(NULL != state->origin);	/* the pool key */
+
+    if (options->isVerbose)
+    {
+	printf("Server %s\n", state->origin->domain);
+    }
+
+    if (options->isStats)
+    {
+	state->resolveAt = now();
+    }
+
+    DBUG_RETURN(resolveServer(options, loop, state));
+}
+
+/*------------------------------------------------------------------------------
+ * resumeResolving() - continue connections whose lookup may have completed
+ */
+static rpResult_t resumeResolving(rpOptions_t* options, rpLoop_t* loop)
+{
+    rpResult_t result = rp_success;
+
+    int i;
+
+    DBUG_ENTER("resumeResolving");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+
+    ResolveDrain(loop->engine->resolver, loop->index);
+
+    for (i = 0; (i < loop->slotCount) && (rp_success == result); ++i)
+    {
+	if (rp_phase_resolving == loop->conns[i].phase)
+	{
+	    result = resolveServer(options, loop, &loop->conns[i]);
+	}
+    }
+
+    DBUG_RETURN(result);
+}
+
+/*------------------------------------------------------------------------------
+ * startBatch() - send the batch of URLs collected on a connection
+ *
+ * A pooled connection to the server is reused; otherwise, a new one is
+ * opened in this free slot.
+ */
+static rpResult_t startBatch(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    int rc;
+
+    DBUG_ENTER("startBatch");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+    assert(NULL != state->origin);
+    assert(!isBusy(state));
+
+    if (state->origin->id >= loop->busyMax)	/* a server new to this loop */
+    {
+	int busyMax = __atomic_load_n(&loop->engine->originSlots,
+				      __ATOMIC_RELAXED);
+
+	int* busy = realloc(loop->busy, busyMax * sizeof(int));
+
+	if (NULL == busy)
+	{
+	    DBUG_PRINT("syslib", ("realloc() failed for busy"));
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	memset(&busy[loop->busyMax], 0, (busyMax - loop->busyMax) * sizeof(int));
+
+	loop->busy = busy;
+
+	if (options->isStats)
+	{
+	    rpLatency_t* latency = realloc(loop->latency,
+					   busyMax * sizeof(rpLatency_t));
+
+	    if (NULL == latency)
+	    {
+		DBUG_PRINT("syslib", ("realloc() failed for latency"));
+
+		DBUG_RETURN(rp_failure);
+	    }
+
+	    memset(&latency[loop->busyMax],
+		   0,
+		   (busyMax - loop->busyMax) * sizeof(rpLatency_t));
+
+	    loop->latency = latency;
+	}
+
+	loop->busyMax = busyMax;
+    }
+
+    ++loop->active;
+    ++loop->busy[state->origin->id];
+
+    state->parse      = rp_parse_headers;
+    state->responses  = 0;
+    state->bytes      = 0;
+    state->pBuf       = state->so_rcvbuf;
+    state->fd         = STDOUT_FILENO;
+    state->spool      = NULL;
+    state->isClose    = 0;
+    state->isReceived = 0;
+
+    state->firstByteAt = 0;		/* no response byte yet */
+
+    HttpHeaderInit(&state->header, 0);
+
+    DBUG_PRINT("request", ("pipeline %d", state->pipeline));
+
+    if (rp_phase_pooled != state->phase)
+    {
+	state->isReused = 0;
+	state->phase    = rp_phase_connecting;
+
+	DBUG_RETURN(connectServer(options, loop, state));
+    }
+
+    /*
+     * Reuse the pooled connection
+     */
+
+    if (options->isVerbose)
+    {
+	printf("Reuse  %s\n", state->origin->domain);
+    }
+
+    state->isReused = 1;
+    state->phase    = rp_phase_sending;
+
+    if (rp_success != sendRequests(options, loop, state))
+    {
+	DBUG_RETURN(rp_failure);
+    }
+
+    if (-1 == (rc = EventLoopModify(loop->events,
+				    state->sock,
+				    EVENT_WRITE,
+				    state)))
+    {
+	perror("EventLoopModify()");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * openConnection() - start the next run of URLs on a connection
+ *
+ * When a sequence of URLs refer to the same remote server, they are all
+ * pipelined on this connection. A pooled connection to that server is
+ * reused; otherwise, a new one is opened in this free slot.
+ */
+static rpResult_t openConnection(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state,
+	rpOrigin_t* origin,
+	rpRun_t* run)
+{
+    rpEngine_t* engine;
+
+    int i;
+
+    DBUG_ENTER("openConnection");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+    assert(NULL != origin);
+    assert(NULL != run);
+
+    engine = loop->engine;
+
+    /*
+     * Collect this run of URLs; they were parsed when queued
+     */
+
+    if (NULL == (state->urls = ArenaAlloc(&state->arena,
+					   run->count * sizeof(int))))
+    {
+	DBUG_PRINT("syslib", ("ArenaAlloc() failed for pipeline"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    state->origin     = origin;
+    state->pipeline   = run->count;
+    state->rangeFirst = -1;
+
+    for (i = 0; i < run->count; ++i)
+    {
+	int url = *getOrder(engine, run->first + i);
+
+	state->urls[i] = url;
+
+	if ((rp_success != loadProgress(options,
+					&state->arena,
+					getOutput(engine, url)))
+	||  (rp_success != loadCache(options,
+				     &state->arena,
+				     getOutput(engine, url))))
+	{
+	    state->pipeline = i + 1;	/* to be released */
+
+	    DBUG_RETURN(rp_failure);
+	}
+    }
+
+    if (options->segments > 1)		/* for any probes */
+    {
+	snprintf(state->range,
+		 sizeof state->range,
+		 "%s0-%d%s",
+		 HTTP_RANGE,
+		 RP_SEGMENT_PROBE - 1,
+		 HTTP_CRLF);
+    }
+
+    DBUG_RETURN(startBatch(options, loop, state));
+}
+
+/*------------------------------------------------------------------------------
+ * openSegment() - start fetching one byte range of a page, on a connection
+ */
+static rpResult_t openSegment(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpSegment_t* segment)
+{
+    rpOrigin_t* origin;
+    rpState_t* state;
+
+    DBUG_ENTER("openSegment");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != segment);
+
+    origin = getOutput(loop->engine, segment->url)->origin;
+
+    if (NULL == (state = findPooled(options, loop, origin)))
+    {
+	state = findSlot(loop);
+    }
+
+    assert(NULL != state);
+
+    if (NULL == (state->urls = ArenaAlloc(&state->arena, sizeof(int))))
+    {
+	DBUG_PRINT("syslib", ("ArenaAlloc() failed for segment"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    state->origin     = origin;
+    state->urls[0]    = segment->url;
+    state->pipeline   = 1;
+    state->rangeFirst = segment->first;
+    state->rangeLast  = segment->last;
+    state->rangeTotal = segment->total;
+
+    snprintf(state->range,
+	     sizeof state->range,
+	     "%s%ld-%ld%s",
+	     HTTP_RANGE,
+	     segment->first,
+	     segment->last,
+	     HTTP_CRLF);
+
+    if (options->isVerbose)
+    {
+	printf("Range  %ld-%ld of %s\n",
+	       segment->first,
+	       segment->last,
+	       getOutput(loop->engine, segment->url)->filename);
+    }
+
+    DBUG_PRINT("segment", ("%ld-%ld/%ld",
+			   segment->first,
+			   segment->last,
+			   segment->total));
+
+    DBUG_RETURN(startBatch(options, loop, state));
+}
+
+/*------------------------------------------------------------------------------
+ * reconnect() - resend what is left of a batch the server dropped
+ *
+ * A server may close an idle keep-alive connection just as we reuse it, or
+ * close any connection after answering part of the batch. The requests not
+ * yet answered are sent again on a new connection to the same addresses;
+ * those answered are done, and dropped from the batch.
+ */
+static rpResult_t reconnect(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state)
+{
+    DBUG_ENTER("reconnect");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    DBUG_PRINT("pool", ("dropped %s:%s after %d of %d",
+			state->origin->domain,
+			state->origin->port,
+			state->responses,
+			state->pipeline));
+
+    if (options->isVerbose)
+    {
+	printf("Closed %s after %d of %d responses, reconnecting\n",
+	       state->origin->domain,
+	       state->responses,
+	       state->pipeline);
+    }
+
+    memmove(state->urls,
+	    &state->urls[state->responses],
+	    (state->pipeline - state->responses) * sizeof *state->urls);
+
+    state->pipeline  -= state->responses;
+    state->responses  = 0;
+
+    EventLoopClose(loop->events, state->sock);
+
+    state->sock       = RP_SOCK_CLOSED;
+    state->parse      = rp_parse_headers;
+    state->bytes      = 0;
+    state->pBuf       = state->so_rcvbuf;
+    state->isReused   = 0;
+    state->isReceived = 0;
+    state->isClose    = 0;
+    state->phase      = rp_phase_connecting;
+
+    state->firstByteAt = 0;		/* no response byte yet */
+
+    if (options->isStats)
+    {
+	state->connectAt = now();	/* the addresses are known */
+    }
+
+    HttpHeaderInit(&state->header, 0);
+
+    DBUG_RETURN(startConnect(options, loop, state));
+}
+
+/*------------------------------------------------------------------------------
+ * receiveMore() - with io_uring, receive the next slice of the responses
+ */
+static rpResult_t receiveMore(rpLoop_t* loop, rpState_t* state)
+{
+    DBUG_ENTER("receiveMore");
+
+    if (loop->isRing && (-1 == EventLoopRecv(loop->events, state->sock, state)))
+    {
+	perror("EventLoopRecv()");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * processConnection() - advance the connection, per its ready events
+ */
+static rpResult_t processConnection(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	rpState_t* state,
+	Event_t* event)
+{
+    rpResult_t result = rp_success;
+
+    int rc;
+
+    DBUG_ENTER("processConnection");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+    assert(NULL != state);
+
+    if (rp_phase_pooled == state->phase)
+    {
+	/* an idle connection is readable only once the server closes it */
+	DBUG_PRINT("pool", ("closed by server: %s", state->origin->domain));
+
+	DBUG_RETURN(closeConnection(loop, state));
+    }
+
+    if (rp_phase_connecting == state->phase)
+    {
+	int isConnected;
+
+	if (rp_success != finishConnect(options, loop, state, &isConnected))
+	{
+	    DBUG_RETURN(rp_failure);
+	}
+
+	if (!isConnected)
+	{
+	    DBUG_RETURN(rp_success);	/* still connecting */
+	}
+
+	if (rp_success != sendRequests(options, loop, state))
+	{
+	    DBUG_RETURN(rp_failure);
+	}
+
+	state->phase = rp_phase_sending;
+    }
+
+    if (rp_phase_sending == state->phase)
+    {
+	if (options->isStats && (0 == state->batchSyscalls))
+	{
+	    state->requestAt = now();	/* first request byte, about to go */
+	}
+
+	if (rp_pending == (result = flushRequests(state)))
+	{
+	    DBUG_RETURN(rp_success);	/* wait for the socket to drain */
+	}
+
+	if (rp_retry == result)
+	{
+	    DBUG_RETURN(reconnect(options, loop, state));
+	}
+
+	if (rp_success != result)
+	{
+	    DBUG_RETURN(result);
+	}
+
+	if (options->isVerbose)
+	{
+	    printf("Sent   %d requests, %ld bytes, %ld syscalls\n",
+		   state->pipeline,
+		   state->batchBytes,
+		   state->batchSyscalls);
+	}
+
+	state->phase = rp_phase_receiving;
+
+	/* with io_uring, receive rather than wait to read */
+	if (-1 == (rc = EventLoopModify(loop->events,
+					state->sock,
+					loop->isRing ? 0 : EVENT_READ,
+					state)))
+	{
+	    perror("EventLoopModify()");
+
+	    DBUG_RETURN(rp_failure);
+	}
+
+	DBUG_RETURN(receiveMore(loop, state));
+    }
+
+    if ((rp_phase_receiving == state->phase)
+    &&  (event->events & (EVENT_READ|EVENT_ERROR)))
+    {
+	result = receiveResponses(options, loop, state, event);
+
+	EventLoopRecycle(loop->events, event->bufId);
+
+	if (rp_retry == result)
+	{
+	    DBUG_RETURN(reconnect(options, loop, state));
+	}
+
+	if (rp_failure == result)
+	{
+	    DBUG_RETURN(rp_failure);
+	}
+
+	if (state->responses == state->pipeline)
+	{
+	    result = poolConnection(options, loop, state);
+	}
+	else if (state->isClose)
+	{
+	    /* the server answers no more on this connection */
+	    result = reconnect(options, loop, state);
+	}
+	else
+	{
+	    result = receiveMore(loop, state);
+	}
+    }
+
+    DBUG_RETURN(result);
+}
+
+/*------------------------------------------------------------------------------
+ * isHttpScheme() - is a URL's scheme http or https (or left to default)?
+ */
+static int isHttpScheme(const char* url, UrlSpans_t* spans)
+{
+    return (0 == spans->scheme.length)
+	|| UrlSpanIs(url, spans->scheme, "http")
+	|| UrlSpanIs(url, spans->scheme, "https");
+}
+
+/*------------------------------------------------------------------------------
+ * isSpanOf() - is a URL's part this origin's, ignoring case?
+ */
+static int isSpanOf(
+	const char* url,
+	UrlSpan_t span,
+	const char* defaultValue,
+	const char* part)
+{
+    return (0 == span.length) ? (0 == strcasecmp(defaultValue, part))
+			      : UrlSpanIs(url, span, part);
+}
+
+/*------------------------------------------------------------------------------
+ * hashSpan() - add a URL's part, in lower case, to an FNV-1a hash
+ */
+static unsigned int hashSpan(
+	unsigned int h,
+	const char* url,
+	UrlSpan_t span,
+	const char* defaultValue)
+{
+    const char* p = (0 == span.length) ? defaultValue : URL_SPAN(url, span);
+    int len = (0 == span.length) ? (int)strlen(defaultValue) : span.length;
+    int i;
+
+    for (i = 0; i < len; ++i)
+    {
+	h = (h ^ (unsigned char)tolower((unsigned char)p[i])) * 16777619u;
+    }
+
+    return (h ^ '/') * 16777619u;	/* so parts cannot run together */
+}
+
+/*------------------------------------------------------------------------------
+ * internOrigin() - the server of a parsed URL; added, if new
+ *
+ * Servers are found by a hash of their lower case scheme, domain and port,
+ * in an open addressed table of IDs, grown at half full. Called with the
+ * engine lock held. Returns NULL if out of memory.
+ */
+static rpOrigin_t* internOrigin(
+	rpEngine_t* engine,
+	const char* url,
+	UrlSpans_t* spans)
+{
+    rpOrigin_t* origin;
+
+    unsigned int h = 2166136261u;	/* FNV-1a */
+    unsigned int i;
+
+    size_t lens[3];
+    char* to;
+
+    DBUG_ENTER("internOrigin");
+
+    h = hashSpan(h, url, spans->scheme, URL_SCHEME_DEFAULT);
+    h = hashSpan(h, url, spans->domain, "");
+    h = hashSpan(h, url, spans->port, URL_PORT_DEFAULT);
+
+    /*
+     * Look it up
+     */
+
+    for (i = h; engine->originSlots > 0; ++i)
+    {
+	int id = engine->originIndex[i & (engine->originSlots - 1)];
+
+	if (0 == id)
+	{
+	    break;			/* not interned */
+	}
+
+	origin = engine->origins[id - 1];
+
+	if ((h == origin->hash)
+	&&  isSpanOf(url, spans->domain, "", origin->domain)
+	&&  isSpanOf(url, spans->port, URL_PORT_DEFAULT, origin->port)
+	&&  isSpanOf(url, spans->scheme, URL_SCHEME_DEFAULT, origin->scheme))
+	{
+	    DBUG_RETURN(origin);
+	}
+    }
+
+    /*
+     * Grow the table, keeping it at most half full
+     */
+
+    if (2 * (engine->originCount + 1) > engine->originSlots)
+    {
+	int slots = (0 == engine->originSlots) ? 64 : 2 * engine->originSlots;
+
+	int* index = calloc(slots, sizeof(int));
+
+	rpOrigin_t** origins = realloc(engine->origins,
+				       slots / 2 * sizeof(rpOrigin_t*));
+
+	if ((NULL == index) || (NULL == origins))
+	{
+	    free(index);
+
+	    if (NULL != origins)
+	    {
+		engine->origins = origins;
+	    }
+
+	    DBUG_PRINT("syslib", ("calloc() failed for origins"));
+
+	    DBUG_RETURN(NULL);
+	}
+
+	engine->origins = origins;
+
+	for (i = 0; i < (unsigned int)engine->originCount; ++i)
+	{
+	    unsigned int j = engine->origins[i]->hash;
+
+	    while (0 != index[j & (slots - 1)])
+	    {
+		++j;
+	    }
+
+	    index[j & (slots - 1)] = i + 1;
+	}
+
+	free(engine->originIndex);
+
+	engine->originIndex = index;
+	__atomic_store_n(&engine->originSlots, slots, __ATOMIC_RELAXED);
+    }
+
+    /*
+     * Add it, with its parts in the same allocation
+     */
+
+    lens[0] = (0 == spans->scheme.length) ? strlen(URL_SCHEME_DEFAULT)
+					  : (size_t)spans->scheme.length;
+    lens[1] = spans->domain.length;
+    lens[2] = (0 == spans->port.length) ? strlen(URL_PORT_DEFAULT)
+					: (size_t)spans->port.length;
+
+    if (NULL == (origin = malloc(sizeof(rpOrigin_t)
+				 + lens[0] + lens[1] + lens[2] + 3)))
+    {
+	DBUG_PRINT("syslib", ("malloc() failed for origin"));
+
+	DBUG_RETURN(NULL);
+    }
+
+    to = origin->parts;
+
+    origin->scheme = to;
+    memcpy(to, (0 == spans->scheme.length) ? URL_SCHEME_DEFAULT
+					   : URL_SPAN(url, spans->scheme),
+	   lens[0]);
+    to += lens[0];
+    *to++ = '\0';
+
+    origin->domain = to;
+    memcpy(to, URL_SPAN(url, spans->domain), lens[1]);
+    to += lens[1];
+    *to++ = '\0';
+
+    origin->port = to;
+    memcpy(to, (0 == spans->port.length) ? URL_PORT_DEFAULT
+					 : URL_SPAN(url, spans->port),
+	   lens[2]);
+    to += lens[2];
+    *to = '\0';
+
+    origin->hash   = h;
+    origin->id     = engine->originCount;
+    origin->rank   = 0;
+    origin->refill = -1;
+
+    for (i = h; 0 != engine->originIndex[i & (engine->originSlots - 1)]; ++i)
+    {
+	;				/* find a free slot */
+    }
+
+    engine->originIndex[i & (engine->originSlots - 1)] = origin->id + 1;
+    engine->origins[engine->originCount++] = origin;
+
+    DBUG_PRINT("origin", ("%d %s://%s:%s",
+			  origin->id,
+			  origin->scheme,
+			  origin->domain,
+			  origin->port));
+
+    DBUG_RETURN(origin);
+}
+
+/*------------------------------------------------------------------------------
+ * pushRun() - queue a run to a loop, at the back
+ */
+static void pushRun(rpLoop_t* loop, rpRun_t* run)
+{
+    rpEngine_t* engine = loop->engine;
+
+    pthread_mutex_lock(&loop->lock);
+
+    loop->runs[(loop->runFirst + loop->runCount) % engine->queueSize] = *run;
+    __atomic_add_fetch(&loop->runCount, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&loop->lock);
+
+    __atomic_add_fetch(&engine->undispatched, run->count, __ATOMIC_RELAXED);
+}
+
+/*------------------------------------------------------------------------------
+ * popRun() - take the run at the front of a loop's queue
+ *
+ * Returns 0 if the queue is empty. The run still counts as undispatched
+ * until its connection has read its URLs.
+ */
+static int popRun(rpLoop_t* loop, rpRun_t* run)
+{
+    rpEngine_t* engine = loop->engine;
+
+    int isFound = 0;
+
+    pthread_mutex_lock(&loop->lock);
+
+    if (loop->runCount > 0)
+    {
+	*run = loop->runs[loop->runFirst];
+
+	loop->runFirst = (loop->runFirst + 1) % engine->queueSize;
+	__atomic_sub_fetch(&loop->runCount, 1, __ATOMIC_RELAXED);
+	isFound = 1;
+    }
+
+    pthread_mutex_unlock(&loop->lock);
+
+    return isFound;
+}
+
+/*------------------------------------------------------------------------------
+ * deferRun() - hold a run whose server is at its limit, at the back
+ */
+static void deferRun(rpLoop_t* loop, rpRun_t* run)
+{
+    rpEngine_t* engine = loop->engine;
+
+    pthread_mutex_lock(&loop->lock);
+
+    loop->deferred[(loop->deferredFirst + loop->deferredCount)
+		   % engine->queueSize] = *run;
+    __atomic_add_fetch(&loop->deferredCount, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&loop->lock);
+}
+
+/*------------------------------------------------------------------------------
+ * dropDeferred() - remove the i'th deferred run; the later ones move up
+ *
+ * The caller holds the loop's lock.
+ */
+static void dropDeferred(rpLoop_t* loop, int i)
+{
+    int size = loop->engine->queueSize;
+
+    for (; i < loop->deferredCount - 1; ++i)
+    {
+	loop->deferred[(loop->deferredFirst + i) % size] =
+	    loop->deferred[(loop->deferredFirst + i + 1) % size];
+    }
+
+    __atomic_sub_fetch(&loop->deferredCount, 1, __ATOMIC_RELAXED);
+}
+
+/*------------------------------------------------------------------------------
+ * hasRoom() - may 'loop' start another connection to the server of 'run'?
+ */
+static int hasRoom(rpOptions_t* options, rpLoop_t* loop, rpRun_t* run)
+{
+    rpEngine_t* engine = loop->engine;
+    rpOrigin_t* origin = getOutput(engine, *getOrder(engine, run->first))->origin;
+
+    return countInFlight(loop, origin) < options->maxPerHost;
+}
+
+/*------------------------------------------------------------------------------
+ * takeDeferred() - take the oldest deferred run whose server now has room
+ *
+ * Looks from the 'from'th run on, and leaves 'from' where to look next, so
+ * that one dispatch looks at each run once. Each server's runs stay in
+ * order. Returns 0 if none was found.
+ */
+static int takeDeferred(
+	rpOptions_t* options,
+	rpLoop_t* loop,
+	int* from,
+	rpRun_t* run)
+{
+    int isFound = 0;
+    int i;
+
+    pthread_mutex_lock(&loop->lock);
+
+    for (i = *from; i < loop->deferredCount; ++i)
+    {
+	*run = loop->deferred[(loop->deferredFirst + i)
+			      % loop->engine->queueSize];
+
+	if (hasRoom(options, loop, run))
+	{
+	    dropDeferred(loop, i);
+	    isFound = 1;
+	    break;
+	}
+    }
+
+    *from = i;
+
+    pthread_mutex_unlock(&loop->lock);
+
+    return isFound;
+}
+
+/*------------------------------------------------------------------------------
+ * stealRun() - take the run at the back of the busiest other loop's queue
+ *
+ * The victim is chosen without its lock, so it may have emptied meanwhile;
+ * then nothing is stolen. Failing that, its deferred runs may be stolen, the
+ * newest first. Either way, only a run whose server 'loop' has room for is
+ * taken, lest it be deferred again, here. Returns 0 if nothing was.
+ */
+static int stealRun(rpOptions_t* options, rpLoop_t* loop, rpRun_t* run)
+{
+    rpEngine_t* engine = loop->engine;
+    rpLoop_t* victim = NULL;
+
+    int isFound = 0;
+    int most = 0;
+    int i;
+
+    for (i = 0; i < engine->loopCount; ++i)
+    {
+	int count = __atomic_load_n(&engine->loops[i].runCount,
+				    __ATOMIC_RELAXED)
+		  + __atomic_load_n(&engine->loops[i].deferredCount,
+				    __ATOMIC_RELAXED);
+
+	if ((&engine->loops[i] != loop) && (count > most))
+	{
+	    victim = &engine->loops[i];
+	    most   = count;
+	}
+    }
+
+    if (NULL == victim)
+    {
+	return 0;
+    }
+
+    pthread_mutex_lock(&victim->lock);
+
+    if (victim->runCount > 0)
+    {
+	*run = victim->runs[(victim->runFirst + victim->runCount - 1)
+			    % engine->queueSize];
+
+	if (hasRoom(options, loop, run))
+	{
+	    __atomic_sub_fetch(&victim->runCount, 1, __ATOMIC_RELAXED);
+	    isFound = 1;
+	}
+    }
+
+    for (i = victim->deferredCount - 1; !isFound && (i >= 0); --i)
+    {
+	*run = victim->deferred[(victim->deferredFirst + i)
+				% engine->queueSize];
+
+	if (hasRoom(options, loop, run))
+	{
+	    dropDeferred(victim, i);
+	    isFound = 1;
+	}
+    }
+
+    pthread_mutex_unlock(&victim->lock);
+
+    if (isFound)
+    {
+	DBUG_PRINT("steal", ("loop %d took %d URLs from loop %d",
+			     loop->index,
+			     run->count,
+			     victim->index));
+    }
+
+    return isFound;
+}
+
+/*------------------------------------------------------------------------------
+ * queueRun() - queue a run to the loop chosen by its server
+ *
+ * Servers are dealt to loops by ID, so that each server's runs find its
+ * pool, and servers spread evenly.
+ * The resolver starts looking up the server now, so that the answer is
+ * likely cached by the time the run is dispatched, by whichever loop.
+ */
+static void queueRun(
+	rpOptions_t* options,
+	rpEngine_t* engine,
+	rpOrigin_t* origin,
+	rpRun_t* run)
+{
+    rpLoop_t* loop = &engine->loops[origin->id % engine->loopCount];
+
+    ResolvePrefetch(engine->resolver,
+		    origin->domain,
+		    origin->port,
+		    getFamily(options));
+
+    pushRun(loop, run);
+}
+
+/*------------------------------------------------------------------------------
+ * carveRuns() - split newly queued URLs into runs, one per server in turn
+ *
+ * Consecutive URLs to one server form a run, sent as one pipeline. With
+ * several loops, runs are capped, so that idle loops have runs to steal.
+ */
+static void carveRuns(
+	rpOptions_t* options,
+	rpEngine_t* engine,
+	int from,
+	int to)
+{
+    rpOrigin_t* origin = NULL;
+    rpRun_t run;
+
+    int maxRun = (engine->loopCount > 1) ? RP_MAX_RUN : engine->queueSize;
+    int i;
+
+    DBUG_ENTER("carveRuns");
+
+    run.first = from;
+    run.count = 0;
+
+    for (i = from; i < to; ++i)
+    {
+	rpOrigin_t* next = getOutput(engine, *getOrder(engine, i))->origin;
+
+	if ((next == origin) && (run.count < maxRun))
+	{
+	    ++run.count;
+	    continue;
+	}
+
+	if (NULL != origin)
+	{
+	    queueRun(options, engine, origin, &run);
+	}
+
+	origin    = next;
+	run.first = i;
+	run.count = 1;
+    }
+
+    if (NULL != origin)
+    {
+	queueRun(options, engine, origin, &run);
+    }
+
+    DBUG_VOID_RETURN;
+}
+
+/*------------------------------------------------------------------------------
+ * dispatchUrls() - start runs of URLs, while connections are available
+ *
+ * Runs are dispatched in the order queued to this loop; once it has none,
+ * it steals from another. A run whose server already has 'maxPerHost'
+ * connections in flight is deferred, and dispatch goes on to the next; the
+ * deferred runs go first, in order, once their server has room again.
+ *
+ * Segments of pages already begun go first. They may take 'segments' times
+ * as many connections, and are not limited per server.
+ */
+static rpResult_t dispatchUrls(rpOptions_t* options, rpLoop_t* loop)
+{
+    rpResult_t result = rp_success;
+
+    int deferred = 0;			/* deferred runs looked at */
+
+    DBUG_ENTER("dispatchUrls");
+
+    assert(NULL != options);
+    assert(NULL != loop);
+
+    while ((loop->segmentCount > 0)
+    &&     (loop->active < options->maxConnections * options->segments)
+    &&     !__atomic_load_n(&loop->engine->isFailed, __ATOMIC_RELAXED)
+    &&     (rp_success == result))
+    {
+	result = openSegment(options,
+			     loop,
+			     &loop->segments[loop->segmentFirst]);
+
+	++loop->segmentFirst;
+	--loop->segmentCount;
+    }
+
+    while ((loop->active < options->maxConnections)
+    &&     !__atomic_load_n(&loop->engine->isFailed, __ATOMIC_RELAXED)
+    &&     (rp_success == result))
+    {
+	rpEngine_t* engine = loop->engine;
+	rpOrigin_t* origin;
+	rpState_t* state;
+	rpRun_t run;
+
+	if (!takeDeferred(options, loop, &deferred, &run)
+	&&  !popRun(loop, &run)
+	&&  !stealRun(options, loop, &run))
+	{
+	    break;			/* nothing queued */
+	}
+
+	origin = getOutput(engine, *getOrder(engine, run.first))->origin;
+
+	if (countInFlight(loop, origin) >= options->maxPerHost)
+	{
+	    DBUG_PRINT("pool", ("per-host limit: %s", origin->domain));
+
+	    deferRun(loop, &run);	/* looked at, next time round */
+	    ++deferred;
+	    continue;
+	}
+
+	if (NULL == (state = findPooled(options, loop, origin)))
+	{
+	    state = findSlot(loop);
+	}
+
+	assert(NULL != state);
+
+	result = openConnection(options, loop, state, origin, &run);
+
+	/* its positions may now be refilled */
+	__atomic_sub_fetch(&engine->undispatched, run.count, __ATOMIC_RELEASE);
+    }
+
+    DBUG_RETURN(result);
+}
+
+/*------------------------------------------------------------------------------
+ * compareRank() - order URLs by their server's first appearance
+ */
+static int compareRank(const void* a, const void* b)
+{
+    const rpGroup_t* x = a;
+    const rpGroup_t* y = b;
+
+    if (x->rank != y->rank)
+    {
+	return x->rank - y->rank;
+    }
+
+    return x->url - y->url;
+}
+
+/*------------------------------------------------------------------------------
+ * groupByHost() - order dispatch so that URLs to one server are adjacent
+ *
+ * Each server's URLs then form one run, and so one deep pipeline. Servers
+ * keep the order of their first URL on the command line, as do the URLs of
+ * each server. Only the dispatch order changes: responses still go to the
+ * output paired with their URL.
+ *
+ * Groups the queued URLs 'from' up to 'to', those of the refill. Each
+ * server's rank is noted on its origin, once per refill, so no names are
+ * compared.
+ */
+static rpResult_t groupByHost(
+	rpOptions_t* options,
+	rpEngine_t* engine,
+	rpRefill_t* refill,
+	int from,
+	int to)
+{
+    rpGroup_t* groups;
+
+    int count = to - from;
+    int servers = 0;
+    int i;
+
+    DBUG_ENTER("groupByHost");
+
+    assert(NULL != options);
+    assert(NULL != engine);
+
+    if (NULL == (groups = ArenaAlloc(&refill->arena,
+				     count * sizeof(rpGroup_t))))
+    {
+	DBUG_PRINT("syslib", ("ArenaAlloc() failed for groups"));
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+	rpOrigin_t* origin = getOutput(engine, from + i)->origin;
+
+	if (from != origin->refill)	/* first URL to it, this refill */
+	{
+	    origin->refill = from;
+	    origin->rank   = from + i;
+	    ++servers;
+	}
+
+	groups[i].url  = from + i;
+	groups[i].rank = origin->rank;
+    }
+
+    qsort(groups, count, sizeof(rpGroup_t), compareRank);
+
+    for (i = 0; i < count; ++i)
+    {
+	*getOrder(engine, from + i) = groups[i].url;
+    }
+
+    if (options->isVerbose)
+    {
+	printf("Group  %d URLs by %d servers\n", count, servers);
+    }
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * queueUrl() - queue one URL, with its output filename
+ *
+ * The URL is parsed here, once, into spans over it, and its server is
+ * interned; every later stage works from those. Both strings must last
+ * until the URL retires: they are command line arguments, or in the arena
+ * of the refill.
+ */
+static rpResult_t queueUrl(
+	rpOptions_t* options,
+	rpEngine_t* engine,
+	char* url,
+	char* filename)
+{
+    rpOutput_t* output;
+
+    DBUG_ENTER("queueUrl");
+
+    assert(NULL != options);
+    assert(NULL != engine);
+    assert(NULL != url);
+
+    output = getOutput(engine, engine->queued);
+
+    if ((0 != UrlParseSpans(url, &output->spans))
+    ||  !isHttpScheme(url, &output->spans))
+    {
+	if (NULL != engine->input)
+	{
+	    fprintf(stderr, "Line %ld: ", engine->input->lineNumber);
+	}
+
+	fprintf(stderr,
+		"%s: %s.\n",
+		url,
+		(0 == output->spans.domain.length)
+		? "no server name"
+		: "only the http and https schemes are supported");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    if (NULL == (output->origin = internOrigin(engine, url, &output->spans)))
+    {
+	DBUG_RETURN(rp_failure);
+    }
+
+    output->spool       = NULL;
+    output->resume      = NULL;
+    output->conditional = NULL;
+    output->pending     = 0;
+    output->isDone      = 0;
+    output->url         = url;
+    output->filename    = filename;
+
+    *getOrder(engine, engine->queued) = engine->queued;
+
+    /* the first loop reads the output once it sees it queued */
+    __atomic_store_n(&engine->queued, engine->queued + 1, __ATOMIC_RELEASE);
+
+    DBUG_RETURN(rp_success);
+}
+
+/*------------------------------------------------------------------------------
+ * fillQueue() - queue more URLs, from the command line or input file
+ *
+ * Fills whatever room the ring has, and carves the new URLs into runs for
+ * the loops. When grouping by host, waits until every queued URL is
+ * dispatched, so that each refill is grouped as a whole.
+ *
+ * Any loop may refill; if another is already doing so, this one gets on
+ * with its connections instead. Room is made by the first loop retiring
+ * URLs; until it has, the lock is not even tried. The refills whose URLs
+ * have all retired are released here, under the lock, as their pools are
+ * shared with refilling.
+ *
+ * Command line URLs are queued as they are. Input lines are decoded, and
+ * copied into the refill's arena, as the input buffer is reused.
+ */
+static rpResult_t fillQueue(rpOptions_t* options, rpEngine_t* engine)
+{
+    rpResult_t result = rp_success;
+
+    rpRefill_t* refill;
+
+    int nextRetire;
+    int from;
+
+    DBUG_ENTER("fillQueue");
+
+    assert(NULL != options);
+    assert(NULL != engine);
+
+    if (__atomic_load_n(&engine->isInputDone, __ATOMIC_RELAXED)
+    ||  (options->isGroupByHost
+	 && (0 < __atomic_load_n(&engine->undispatched, __ATOMIC_ACQUIRE)))
+    ||  (__atomic_load_n(&engine->queued, __ATOMIC_RELAXED)
+	 - __atomic_load_n(&engine->nextRetire, __ATOMIC_RELAXED)
+	 >= engine->queueSize)
+    ||  (0 != pthread_mutex_trylock(&engine->lock)))
+    {
+	DBUG_RETURN(rp_success);	/* nothing to do, or being done */
+    }
+
+    /* retired outputs are not read again by the first loop */
+    nextRetire = __atomic_load_n(&engine->nextRetire, __ATOMIC_ACQUIRE);
+
+    while ((NULL != engine->oldest) && (engine->oldest->last <= nextRetire))
+    {
+	refill = engine->oldest;
+
+	if (NULL == (engine->oldest = refill->next))
+	{
+	    engine->newest = NULL;
+	}
+
+	ArenaReset(&refill->arena);
+	PoolPut(&engine->refills, refill);
+    }
+
+    if (NULL == (refill = PoolGet(&engine->refills)))
+    {
+	DBUG_PRINT("syslib", ("PoolGet() failed for refill"));
+
+	pthread_mutex_unlock(&engine->lock);
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    ArenaInitPooled(&refill->arena, &engine->chunks);
+    refill->next = NULL;
+
+    from = engine->queued;
+
+    while (!engine->isInputDone
+    &&     (engine->queued - nextRetire < engine->queueSize)
+    &&     (rp_success == result))
+    {
+	char* url;
+	char* filename = NULL;
+
+	int rc;
+
+	if (NULL == engine->input)
+	{
+	    if (engine->nextArg == options->urlCount)
+	    {
+		__atomic_store_n(&engine->isInputDone, 1, __ATOMIC_RELAXED);
+		break;
+	    }
+
+	    if (engine->nextArg < options->filenameCount)
+	    {
+		filename = options->filenames[engine->nextArg];
+	    }
+
+	    url = options->urls[engine->nextArg++];
+	}
+	else if (URL_INPUT_LINE == (rc = UrlInputNext(engine->input,
+							&url,
+							&filename)))
+	{
+	    size_t len = strlen(url);
+	    char* decoded = ArenaAlloc(&refill->arena, len + 1);
+
+	    if ((NULL != decoded)	/* un-encode and save URL */
+	    &&  (0 > UrlDecodeTo(decoded, url, len)))
+	    {
+		fprintf(stderr,
+			"Line %ld: %s: malformed %%-escape.\n",
+			engine->input->lineNumber,
+			url);
+
+		result = rp_failure;
+		break;
+	    }
+
+	    url = decoded;
+
+	    if ((NULL != filename)
+	    &&  (NULL == (filename = ArenaStrdup(&refill->arena, filename))))
+	    {
+		url = NULL;
+	    }
+	}
+	else
+	{
+	    if (URL_INPUT_ERROR == rc)
+	    {
+		perror("read(input)");
+
+		result = rp_failure;
+	    }
+
+	    __atomic_store_n(&engine->isInputDone, 1, __ATOMIC_RELAXED);
+	    break;
+	}
+
+	if (NULL == url)
+	{
+	    DBUG_PRINT("syslib", ("malloc() failed for URL"));
+
+	    result = rp_failure;
+	    break;
+	}
+
+	if (rp_success != queueUrl(options, engine, url, filename))
+	{
+	    result = rp_failure;
+	}
+    }
+
+    if (engine->queued == from)
+    {
+	ArenaReset(&refill->arena);	/* nothing queued */
+	PoolPut(&engine->refills, refill);
+    }
+    else
+    {
+	refill->last = engine->queued;
+
+	if (NULL == engine->newest)
+	{
+	    engine->oldest = refill;
+	}
+	else
+	{
+	    engine->newest->next = refill;
+	}
+
+	engine->newest = refill;
+    }
+
+    if ((rp_success == result)
+    &&  options->isGroupByHost
+    &&  (engine->queued > from))
+    {
+	result = groupByHost(options, engine, refill, from, engine->queued);
+    }
+
+    if (rp_success == result)
+    {
+	carveRuns(options, engine, from, engine->queued);
+    }
+
+    pthread_mutex_unlock(&engine->lock);
+
+    DBUG_RETURN(result);
+}
+
+/*------------------------------------------------------------------------------
+ * isLoopDone() - has a loop nothing left to do, ever?
+ *
+ * Asked only when the loop is idle. The input is finished under the engine
+ * lock, along with queueing its last runs, so both are checked under it.
+ */
+static int isLoopDone(rpLoop_t* loop)
+{
+    rpEngine_t* engine = loop->engine;
+
+    int isDone;
+
+    if ((0 != loop->active)
+    ||  (0 != loop->segmentCount)
+    ||  (0 != __atomic_load_n(&loop->runCount, __ATOMIC_RELAXED))
+    ||  (0 != __atomic_load_n(&loop->deferredCount, __ATOMIC_RELAXED)))
+    {
+	return 0;
+    }
+
+    pthread_mutex_lock(&engine->lock);
+
+    isDone = engine->isInputDone
+	  && (0 == __atomic_load_n(&engine->undispatched, __ATOMIC_RELAXED));
+
+    pthread_mutex_unlock(&engine->lock);
+
+    return isDone;
+}
+
+/*------------------------------------------------------------------------------
+ * runLoop() - run one event loop, until every URL is retrieved
+ *
+ * Keeps up to 'maxConnections' connections in flight, and advances whichever
+ * are ready. Connections whose batch is done stay open in a pool, keyed by
+ * server, for later URLs to the same server, until 'idleTimeout' expires.
+ *
+ * Called directly for the first loop, and as the thread body of the rest.
+ * The first loop also copies pages to stdout in order, and retires URLs;
+ * so it runs until every other loop has finished.
+ */
+static void* runLoop(void* arg)
+{
+    rpLoop_t* loop = arg;
+    rpEngine_t* engine = loop->engine;
+    rpOptions_t* options = engine->options;
+
+    rpResult_t result = rp_success;
+
+    int i;
+
+    DBUG_ENTER("runLoop");
+
+    while ((rp_success == result)
+    &&     !__atomic_load_n(&engine->isFailed, __ATOMIC_RELAXED))
+    {
+	int timeout;
+	int stagger;
+	int count;
+
+	if (((0 == loop->index)
+	     && (rp_success != (result = flushOutputs(options, engine))))
+	||  (rp_success != (result = fillQueue(options, engine)))
+	||  (rp_success != (result = dispatchUrls(options, loop))))
+	{
+	    break;			/* failed */
+	}
+
+	if (isLoopDone(loop)
+	&&  ((0 != loop->index)
+	     || (1 == __atomic_load_n(&engine->running, __ATOMIC_ACQUIRE))))
+	{
+	    break;			/* all done */
+	}
+
+	timeout = expireIdle(options, loop);
+
+	if (rp_success != (result = staggerConnects(options, loop, &stagger)))
+	{
+	    break;			/* failed */
+	}
 
-	++state->currUrl;		/* walk to next URL */
+	if ((-1 == timeout) || ((-1 != stagger) && (stagger < timeout)))
+	{
+	    timeout = stagger;
+	}
 
-	if (NULL != *state->currUrl)
+	if ((engine->loopCount > 1)
+	&&  ((-1 == timeout) || (RP_THREAD_POLL < timeout)))
 	{
-	    parsed = UrlParse(*state->currUrl);
+	    timeout = RP_THREAD_POLL;	/* look for runs to steal */
+	}
+
+	++loop->waits;
 
-	    if ((0 == strcmp(parsed->domain, prevUrl->domain))
-	    &&  (0 == strcmp(parsed->port,   prevUrl->port)))
+	if (-1 == (count = EventLoopWait(loop->events,
+					 loop->ready,
+					 loop->slotCount + 1,
+					 timeout)))
+	{
+	    if (EINTR == errno)
 	    {
-		++state->pipeline;	/* same server */
+		continue;
+	    }
 
-		if (options->isVerbose)
-		{
-		    printf("       ...pipelining next request\n");
-		}
+	    perror("EventLoopWait()");
 
-		DBUG_PRINT("request", ("pipeline %d", state->pipeline));
+	    result = rp_failure;
+	    break;
+	}
+
+	for (i = 0; (i < count) && (rp_success == result); ++i)
+	{
+	    if (NULL == loop->ready[i].data)	/* a lookup completed */
+	    {
+		result = resumeResolving(options, loop);
+	    }
+	    else if (loop == loop->ready[i].data)	/* a queued write failed */
+	    {
+		errno = -loop->ready[i].result;
+		perror("write(fd)");
 
-		UrlParseFree(prevUrl);	/* cleanup */
+		result = rp_failure;
 	    }
 	    else
 	    {
-		break;			/* different server */
+		result = processConnection(options,
+					   loop,
+					   loop->ready[i].data,
+					   &loop->ready[i]);
 	    }
 	}
-	else
+    }
+
+    /*
+     * Cleanup every connection; only pooled ones remain open, unless failed
+     */
+
+    for (i = 0; i < loop->slotCount; ++i)
+    {
+	if (rp_phase_idle != loop->conns[i].phase)
 	{
-	    break;			/* final URL */
+	    closeConnection(loop, &loop->conns[i]);
 	}
     }
 
-    UrlParseFree(parsed);		/* cleanup */
+    /* let queued writes, and the closes behind them, finish */
+    if (-1 == EventLoopFlush(loop->events))
+    {
+	perror("write(fd)");
+	result = rp_failure;
+    }
 
-    DBUG_RETURN(result);
+    if (rp_success != result)
+    {
+	/* stop the other loops */
+	__atomic_store_n(&engine->isFailed, 1, __ATOMIC_RELAXED);
+    }
+
+    loop->result = result;
+
+    __atomic_sub_fetch(&engine->running, 1, __ATOMIC_RELEASE);
+
+    DBUG_RETURN(NULL);
 }
 
 /*------------------------------------------------------------------------------
- * processConnection() - process the connection
+ * createLoop() - allocate one event loop, with its connections
  */
-static rpResult_t processConnection(rpOptions_t* options, rpState_t* state)
+static rpResult_t createLoop(rpOptions_t* options, rpLoop_t* loop)
 {
-    rpResult_t result = rp_success;
+    int i;
 
-    DBUG_ENTER("processConnection");
+    DBUG_ENTER("createLoop");
+
+    /* each connection may be joined by its page's segments */
+    loop->slotCount = options->maxConnections * options->segments
+		    + RP_MAX_IDLE;
+
+    pthread_mutex_init(&loop->lock, NULL);
+    PoolInit(&loop->chunks, ARENA_POOL_SIZE(RP_BATCH_CHUNK));
+
+    if ((NULL == (loop->conns = calloc(loop->slotCount, sizeof(rpState_t))))
+    ||  (NULL == (loop->ready = calloc(loop->slotCount + 1, sizeof(Event_t))))
+    ||  (NULL == (loop->runs =
+		  malloc(loop->engine->queueSize * sizeof(rpRun_t))))
+    ||  (NULL == (loop->deferred =
+		  malloc(loop->engine->queueSize * sizeof(rpRun_t))))
+    ||  (NULL == (loop->spools =
+		  malloc((loop->engine->queueSize + 1) * sizeof(FILE*)))))
+    {
+	DBUG_PRINT("syslib", ("calloc() failed for loop"));
 
-    if (rp_success == (result = sendRequests(options, state)))
+	DBUG_RETURN(rp_failure);
+    }
+
+    if (options->isRing
+    &&  (NULL != (loop->events =
+		  EventLoopCreateRing(loop->slotCount + 1,
+				      RP_RING_BUFFERS * loop->slotCount,
+				      RP_RING_BUFFER_SIZE))))
+    {
+	loop->isRing = 1;
+    }
+    else if (options->isRing && options->isVerbose && (0 == loop->index))
     {
-	result = processResponses(options, state);
+	printf("Using  epoll, as io_uring is unavailable (%s)\n",
+	       strerror(errno));
     }
 
-    DBUG_RETURN(result);
+    /* one more descriptor, for the resolver */
+    if (((NULL == loop->events)
+	 && (NULL == (loop->events = EventLoopCreate(loop->slotCount + 1))))
+    ||  (-1 == EventLoopAdd(loop->events,
+			    ResolveFd(loop->engine->resolver, loop->index),
+			    EVENT_READ,
+			    NULL)))
+    {
+	perror("EventLoopCreate()");
+
+	DBUG_RETURN(rp_failure);
+    }
+
+    for (i = 0; i < loop->slotCount; ++i)
+    {
+	loop->conns[i].sock      = RP_SOCK_CLOSED;
+	loop->conns[i].fd        = STDOUT_FILENO;
+	loop->conns[i].pipefd[0] = -1;
+	loop->conns[i].pipefd[1] = -1;
+
+	ArenaInitPooled(&loop->conns[i].arena, &loop->chunks);
+    }
+
+    DBUG_RETURN(rp_success);
 }
 
 /*------------------------------------------------------------------------------
  * retrievePages() - retrieve one or more web pages
+ *
+ * Runs 'threads' event loops, the first in this thread. The URLs are carved
+ * into runs, one server's URLs at a time, and each run is queued to the loop
+ * that server hashes to, so that its connections are pooled in one place. A
+ * loop with no runs of its own steals from the busiest.
+ *
+ * Loops share only the URL ring, under the engine lock when refilling, and
+ * their run queues, each under its own lock; responses are parsed and
+ * written, and outputs opened and closed, without either.
  */
-static rpResult_t retrievePages(rpOptions_t* options, rpState_t* state)
+static rpResult_t retrievePages(rpOptions_t* options, rpEngine_t* engine)
 {
     rpResult_t result = rp_success;
 
-    int rc;				/* return codes from system calls */
+    int started = 0;
+    int i;
 
     DBUG_ENTER("retrievePages");
 
     assert(NULL != options);
-    assert(NULL != state);
+    assert(NULL != engine);
 
-    /*
-     * Each URL
-     *
-     * We expect 'processConnection()' to walk to next URL.
-     */
+    engine->options   = options;
+    engine->loopCount = options->threads;
+    engine->queueSize = options->urlCount;
 
-    state->sock         = RP_SOCK_CLOSED;
-    state->currUrl      = options->urls;
-    state->currFilename = options->filenames;
+    pthread_mutex_init(&engine->lock, NULL);
+    PoolInit(&engine->chunks, ARENA_POOL_SIZE(RP_REFILL_CHUNK));
+    PoolInit(&engine->refills, sizeof(rpRefill_t));
 
-    while ((NULL != *state->currUrl) && (rp_success == result))
+    if (NULL != options->storeDir)
     {
-	void* voidp;
-
-	struct addrinfo* p;
-	struct addrinfo* serverInfo;
-	struct addrinfo serverHints;
+	char path[PATH_MAX];
 
-	int isConnected;
-
-	UrlParse_t* parsed = UrlParse(*state->currUrl);
+	snprintf(path, sizeof path, "%s/" RP_STORE_MANIFEST, options->storeDir);
 
-	if (options->isVerbose)
+	if (NULL == (engine->manifest = fopen(path, "a")))
 	{
-	    printf("Server %s\n", parsed->domain);
-	}
-
-	/*
-	 * Lookup host
-	 */
-
-	voidp = memset((void*)&serverHints, 0, sizeof serverHints);
+	    perror(path);
 
-	assert((void*)&serverHints == voidp);
-
-	serverHints.ai_socktype = SOCK_STREAM;/* TCP */
-
-	if (options->isIPV4only)
-	{
-	    serverHints.ai_family = AF_INET;/* only IPv4 */
-	}
-	else
-	{
-	    if (options->isIPV6only)
-	    {
-		serverHints.ai_family = AF_INET6;/* only IPv6 */
-	    }
-	    else
-	    {
-		serverHints.ai_family = AF_UNSPEC;/* IPV4 or IPv6 */
-	    }
+	    DBUG_RETURN(rp_failure);
 	}
+    }
 
-	serverInfo = NULL;
-
-	if (0 != (rc = getaddrinfo(parsed->domain,
-				   parsed->port,
-				   &serverHints,
-				   &serverInfo)))
+    if (NULL != options->inputPath)
+    {
+	if (NULL == (engine->input = UrlInputOpen(options->inputPath)))
 	{
-	    fprintf(stderr,
-		    "getaddrinfo(): %s %s\n",
-		    parsed->domain,
-		    gai_strerror(rc));
+	    perror(options->inputPath);
 
-	    DBUG_PRINT("library",
-	               ("getaddrinfo() failed for %s:%s",
-		       parsed->domain,
-		       parsed->port));
-
-	    result = rp_failure;	/* fatal */
+	    DBUG_RETURN(rp_failure);
 	}
 
-	/*
-	 * Attempt to connect at each address on this server,
-	 * until successful
-	 */
-
-	for (p = serverInfo, isConnected = 0;
-	     (NULL != p) && (rp_success == result) && !isConnected;
-	     p = p->ai_next)
-	{
-	    void* addr;
-	    char* ipVersion;
-	    char printableAddress[INET6_ADDRSTRLEN];
-
-	    if (AF_INET == p->ai_family)/* IPv4 */
-	    {
-		struct sockaddr_in* ipv4 = (struct sockaddr_in*)p->ai_addr;
-		addr = &ipv4->sin_addr;
-		ipVersion = "IPv4";
-	    }
-	    else			/* IPv6 */
-	    {
-		struct sockaddr_in6* ipv6 = (struct sockaddr_in6*)p->ai_addr;
-		addr = &ipv6->sin6_addr;
-		ipVersion = "IPv6";
-	    }
-
-	    inet_ntop(p->ai_family,
-		      addr,
-		      printableAddress,
-		      sizeof printableAddress);
-
-	    if (options->isVerbose)
-	    {
-		printf("%-6s %s\n", ipVersion, printableAddress);
-	    }
-
-	    /*
-	     * Open the socket
-	     */
-
-	    if (-1 == (state->sock = socket(serverInfo->ai_family,
-				     serverInfo->ai_socktype,
-				     serverInfo->ai_protocol)))
-	    {
-		perror("socket()");
-
-		DBUG_PRINT("syscall", ("socket() failed"));
-		
-		result = rp_failure;
-	    }
-	    else
-	    {
-		/*
-		 * Set optimal socket receive buffer size.
-		 *
-		 * (The remote server may use a different size.)
-		 */
-
-		unsigned long len = 0;
-		socklen_t size = sizeof len;
-
-		if (-1 == (rc = getsockopt(state->sock,
-					   SOL_SOCKET,
-					   SO_RCVBUF,
-					   &len,
-					   &size)))
-		{
-		    perror("getsockopt()");
+	engine->queueSize = RP_QUEUE_SIZE;
+    }
 
-		    DBUG_PRINT("syscall", ("getsockopt() failed"));
-		}
-		else
-		{
-		    DBUG_PRINT("syscall",
-			       ("getsockopt() size %d, len %lu", size, len));
-		}
+    if ((NULL == (engine->outputs =
+		  calloc(engine->queueSize, sizeof(rpOutput_t))))
+    ||  (NULL == (engine->order = malloc(engine->queueSize * sizeof(int))))
+    ||  (NULL == (engine->loops =
+		  calloc(engine->loopCount, sizeof(rpLoop_t)))))
+    {
+	DBUG_PRINT("syslib", ("calloc() failed for engine"));
 
-		if (NULL == state->so_rcvbuf)/* first time */
-		{
-		    state->so_rcvbuf_len = len;
+	DBUG_RETURN(rp_failure);
+    }
 
-		    if (NULL ==
-			    (state->so_rcvbuf = malloc(state->so_rcvbuf_len)))
-		    {
-			DBUG_PRINT("syslib",
-				   ("malloc() failed for so_rcvbuf, size %lu",
-				    state->so_rcvbuf_len));
+    /* one cache, and one set of threads, however many loops */
+    if (NULL == (engine->resolver = ResolveCreate(RESOLVE_THREADS,
+						  options->dnsTtl,
+						  options->hostsFile,
+						  engine->loopCount)))
+    {
+	perror((NULL == options->hostsFile) ? "ResolveCreate()"
+					    : options->hostsFile);
 
-			DBUG_RETURN(rp_failure);
-		    }
-		}
-		else			/* see if we need to grow the buffer */
-		{
-		    if (len > state->so_rcvbuf_len)
-		    {
-			free(state->so_rcvbuf);
-
-			state->so_rcvbuf_len = len;
-
-			if (NULL ==
-				(state->so_rcvbuf = malloc(state->so_rcvbuf_len)))
-			{
-			    DBUG_PRINT("syslib",
-				       ("malloc() failed for so_rcvbuf, size %lu",
-					state->so_rcvbuf_len));
-
-			    DBUG_RETURN(rp_failure);
-			}
-		    }
-		}
+	DBUG_RETURN(rp_failure);
+    }
 
-		/*
-		 * Connect
-		 */
+    for (i = 0; i < engine->loopCount; ++i)
+    {
+	engine->loops[i].engine = engine;
+	engine->loops[i].index  = i;
 
-		if (-1 == (rc = connect(state->sock,
-					serverInfo->ai_addr,
-					serverInfo->ai_addrlen)))
-		{
-		    DBUG_PRINT("syscall",
-			       ("connect() failed for %s",
-			       printableAddress));
-		}
-		else
-		{
-		    isConnected = 1;
+	if (rp_success != createLoop(options, &engine->loops[i]))
+	{
+	    DBUG_RETURN(rp_failure);
+	}
+    }
 
-		    result = processConnection(options, state);
-		}
+    if (options->isVerbose && ((options->maxConnections > 1) || options->isRing))
+    {
+	printf("Using  %s, %d connections\n",
+	       EventLoopName(engine->loops[0].events),
+	       options->maxConnections);
+    }
 
-		/*
-		 * Close the socket
-		 */
+    if (options->isVerbose && (engine->loopCount > 1))
+    {
+	printf("Using  %d threads, each with its own event loop\n",
+	       engine->loopCount);
+    }
 
-		if (-1 == (rc = close(state->sock)))
-		{
-		    perror("close(sock)");
+    engine->running = 1;
 
-		    DBUG_PRINT("syscall", ("close(sock) failed"));
+    for (started = 1; started < engine->loopCount; ++started)
+    {
+	__atomic_add_fetch(&engine->running, 1, __ATOMIC_RELAXED);
 
-		    result = rp_failure;
-		}
+	if (0 != pthread_create(&engine->loops[started].thread,
+				NULL,
+				runLoop,
+				&engine->loops[started]))
+	{
+	    perror("pthread_create()");
 
-		state->sock = RP_SOCK_CLOSED;
-	    }
+	    __atomic_sub_fetch(&engine->running, 1, __ATOMIC_RELAXED);
+	    __atomic_store_n(&engine->isFailed, 1, __ATOMIC_RELAXED);
+	    result = rp_failure;
+	    break;
 	}
+    }
 
-	if (!isConnected)
-	{
-	    /*
-	     * All attempts to connect to this host failed
-	     */
+    runLoop(&engine->loops[0]);
 
-	    fprintf(stderr, "Unable to connect to host\n");
+    for (i = 1; i < started; ++i)
+    {
+	pthread_join(engine->loops[i].thread, NULL);
+    }
 
+    for (i = 0; i < started; ++i)
+    {
+	if (rp_success != engine->loops[i].result)
+	{
 	    result = rp_failure;
 	}
-
-	freeaddrinfo(serverInfo);	/* cleanup */
     }
 
-    assert(RP_SOCK_CLOSED == state->sock);
+    if (rp_success == result)
+    {
+	result = flushOutputs(options, engine);
+    }
 
     DBUG_RETURN(result);
 }
@@ -1157,8 +6020,34 @@ static void usage(char* programName)
 	"-h --help              Print this message",
 	"-4 --ipv4              Use IPv4 only",
 	"-6 --ipv6              Use IPv6 only",
+	"-c --max-connections <n>",
+	"                       Connections in flight at once (default 1)",
+	"-t --threads <n>       Event loops, one per thread (default 1)",
+	"-p --max-per-host <n>  Connections in flight per server (default 2)",
+	"-k --idle-timeout <seconds>",
+	"                       Keep idle connections open (default 5)",
+	"-g --group-by-host     Pipeline all URLs to a server together",
+	"-H --hosts-file <filename>",
+	"                       Resolve names listed, as in /etc/hosts, first",
+	"-d --dns-ttl <seconds> Cache DNS answers (default 60)",
+	"-D --connect-delay <ms>",
+	"                       Start the next connect attempt after (default 250)",
+	"-i --input-file <filename>",
+	"                       Read \"URL [output-filename]\" lines, - for stdin",
 	"-o --output <filename> Specify output filename",
+	"-C --continue          Resume partial output files, if pages unchanged",
+	"-Z --compressed        Ask for gzip or deflate, and decode pages",
+	"-K --cache-dir <dir>   Keep pages written to files, and fetch them",
+	"                       again only if modified",
+	"-S --store <dir>       Store each page once by content hash; outputs",
+	"                       of identical pages are hard links to it",
+	"-s --segments <n>      Fetch large pages to files in byte ranges, over",
+	"                       up to n connections each (default 1)",
+	"-z --zero-copy         Move page bodies to output with splice()",
+	"-u --io-uring          Receive, and write files, with io_uring",
 	"-v --verbose           Enable verbose messages",
+	"-T --stats[=json]      At exit, report latency percentiles per server",
+	"                       and overall, to the standard error",
 	"-V --version           Print version info",
 #ifndef DBUG_OFF
 	"-# --dbug <state>      Specify DBUG state (development and test)",
@@ -1169,8 +6058,69 @@ static void usage(char* programName)
 	"If fewer output filenames are specified than are URLs, all remaining",
 	"pages are written to the standard output.",
 	"",
+	"An input file is read as it is needed, so it may list any number of",
+	"URLs. A line without an output filename is written to the standard",
+	"output. Blank lines, and lines starting with '#', are ignored.",
+	"",
+	"Server names are resolved in the background, ahead of their URLs.",
+	"Connect attempts to a server's addresses are staggered, alternating",
+	"IPv6 and IPv4; the first to connect is used (RFC 8305).",
+	"",
 	"When a sequence of URLs refer to the same remote server, HTTP 1.1",
-	"pipelining is used for more efficient retrieval.",
+	"pipelining is used for more efficient retrieval. Grouping by host",
+	"extends this to every URL to that server, wherever it appears; each",
+	"page still goes to the output filename paired with its URL.",
+	"",
+	"With more than one connection, pages from different servers are",
+	"retrieved concurrently. Pages are still written to the standard",
+	"output in command line order.",
+	"",
+	"With more than one thread, each runs its own event loop, with up to",
+	"the maximum connections and its own pool. URLs to a server go to the",
+	"same loop; an idle loop takes work from the busiest.",
+	"",
+	"Connections stay open after their pages are retrieved, and are reused",
+	"for later URLs to the same server, until idle for the idle timeout.",
+	"",
+	"To continue, a page written to a file records its length and ETag",
+	"(or Last-Modified) in a \"" RP_RESUME_SUFFIX "\" file beside it, until",
+	"complete. A later run then asks for just the rest of the page, if",
+	"unchanged (If-Range); if the whole page is sent, the file is",
+	"rewritten. Segmented pages are not recorded.",
+	"",
+	"With a cache, each page written whole to a file is kept, with its",
+	"ETag and Last-Modified. The next request for it is conditional; if",
+	"the page is not modified (304), the file is cloned from the cache.",
+	"",
+	"With a store, each page is hashed (SHA-256) as it is written, then",
+	"hard linked into the store as <dir>/<2 digits>/<hash>; a page whose",
+	"hash is already stored has its output linked to that copy instead.",
+	"Stored copies, and the outputs linked to them, are read-only.",
+	"Pages with no output filename are kept only in the store. Each page",
+	"gets a line, \"<hash> <length> <url>\", in <dir>/" RP_STORE_MANIFEST ".",
+	"The store must be on the same file system as the output files.",
+	"",
+	"With compression, pages are decoded as they arrive; byte ranges",
+	"(segments, probes and resumes) are asked for uncompressed.",
+	"",
+	"With segments, each page written to a file is first asked for its",
+	"first megabyte. If the server sends it as a byte range, the file is",
+	"preallocated, and the rest is fetched in up to n ranges at once, in",
+	"addition to the maximum connections; otherwise the page is fetched",
+	"as one stream.",
+	"",
+	"Zero-copy mode applies to Content-Length pages written to a file or",
+	"pipe; elsewhere pages are copied with read() and write().",
+	"",
+	"With stats, the time to resolve each server, to connect, from each",
+	"request to the first byte of its response (or from the end of the",
+	"previous pipelined response, if later), and to its last byte, are",
+	"kept in histograms; p50, p90, p99 and max are reported, in ms.",
+	"",
+	"With io_uring, responses are received into a pool of registered",
+	"buffers, and writes to output files are queued from them, so one",
+	"system call submits a whole batch. Zero-copy mode is then unused;",
+	"without io_uring (Linux 5.11 or later), epoll is used instead.",
 #ifndef DBUG_OFF
 	"",
 	"See \"dbug.c\" for details on specifying DBUG state.",
@@ -1215,8 +6165,26 @@ static int initialize(int argc, char** argv, rpOptions_t* options)
 	{ "help",         no_argument, NULL, 'h' },
 	{ "ipv4",         no_argument, NULL, '4' },
 	{ "ipv6",         no_argument, NULL, '6' },
+	{ "max-connections", required_argument, NULL, 'c' },
+	{ "threads",      required_argument, NULL, 't' },
+	{ "max-per-host", required_argument, NULL, 'p' },
+	{ "idle-timeout", required_argument, NULL, 'k' },
+	{ "group-by-host", no_argument, NULL, 'g' },
+	{ "hosts-file", required_argument, NULL, 'H' },
+	{ "dns-ttl", required_argument, NULL, 'd' },
+	{ "connect-delay", required_argument, NULL, 'D' },
+	{ "input-file", required_argument, NULL, 'i' },
+	{ "input",  required_argument, NULL, 'i' },
 	{ "output", required_argument, NULL, 'o' },
 	{ "verbose",      no_argument, NULL, 'v' },
+	{ "stats",        optional_argument, NULL, 'T' },
+	{ "continue",     no_argument, NULL, 'C' },
+	{ "compressed",   no_argument, NULL, 'Z' },
+	{ "cache-dir",    required_argument, NULL, 'K' },
+	{ "store",        required_argument, NULL, 'S' },
+	{ "segments",     required_argument, NULL, 's' },
+	{ "zero-copy",    no_argument, NULL, 'z' },
+	{ "io-uring",     no_argument, NULL, 'u' },
 	{ "version",      no_argument, NULL, 'V' },
 #ifndef DBUG_OFF
 	{ "dbug",   required_argument, NULL, '#' },
@@ -1249,7 +6217,7 @@ static int initialize(int argc, char** argv, rpOptions_t* options)
      * Process each command line argument
      */
 
-    while (-1 != (opt = getopt_long(argc, argv, "h46o:vV#:", opts, NULL)))
+    while (-1 != (opt = getopt_long(argc, argv, "h46c:t:p:k:gH:d:D:i:o:CZK:S:s:vT::Vzu#:", opts, NULL)))
     {
 	switch (opt)
 	{
@@ -1268,10 +6236,100 @@ static int initialize(int argc, char** argv, rpOptions_t* options)
 	    DBUG_PRINT("cmdline", ("6"));
 	    break;
 
+	case 'c':
+	    options->maxConnections = atoi(optarg);
+	    DBUG_PRINT("cmdline", ("c %s", optarg));
+
+	    if (options->maxConnections < 1)
+	    {
+		fprintf(stderr, "Must specify at least one connection.\n");
+
+		result = rp_failure;
+	    }
+	    break;
+
+	case 't':
+	    options->threads = atoi(optarg);
+	    DBUG_PRINT("cmdline", ("t %s", optarg));
+
+	    if ((options->threads < 1) || (options->threads > RP_MAX_THREADS))
+	    {
+		fprintf(stderr,
+			"Must specify from 1 to %d threads.\n",
+			RP_MAX_THREADS);
+
+		result = rp_failure;
+	    }
+	    break;
+
+	case 'p':
+	    options->maxPerHost = atoi(optarg);
+	    DBUG_PRINT("cmdline", ("p %s", optarg));
+
+	    if (options->maxPerHost < 1)
+	    {
+		fprintf(stderr, "Must specify at least one connection per host.\n");
+
+		result = rp_failure;
+	    }
+	    break;
+
+	case 'k':
+	    options->idleTimeout = atoi(optarg);
+	    DBUG_PRINT("cmdline", ("k %s", optarg));
+
+	    if (options->idleTimeout < 0)
+	    {
+		fprintf(stderr, "Idle timeout may not be negative.\n");
+
+		result = rp_failure;
+	    }
+	    break;
+
+	case 'g':
+	    options->isGroupByHost = 1;
+	    DBUG_PRINT("cmdline", ("g"));
+	    break;
+
+	case 'H':
+	    options->hostsFile = optarg;
+	    DBUG_PRINT("cmdline", ("H %s", optarg));
+	    break;
+
+	case 'd':
+	    options->dnsTtl = atoi(optarg);
+	    DBUG_PRINT("cmdline", ("d %s", optarg));
+
+	    if (options->dnsTtl < 0)
+	    {
+		fprintf(stderr, "DNS TTL may not be negative.\n");
+
+		result = rp_failure;
+	    }
+	    break;
+
+	case 'D':
+	    options->connectDelay = atoi(optarg);
+	    DBUG_PRINT("cmdline", ("D %s", optarg));
+
+	    if (options->connectDelay < 0)
+	    {
+		fprintf(stderr, "Connect delay may not be negative.\n");
+
+		result = rp_failure;
+	    }
+	    break;
+
+	case 'i':
+	    options->inputPath = optarg;
+	    DBUG_PRINT("cmdline", ("i %s", optarg));
+	    break;
+
 	case 'o':
 	    if (NULL != optarg)
 	    {
 		*p++ = strdup(optarg); /* accumulate filenames */
+		++options->filenameCount;
 		DBUG_PRINT("cmdline", ("o %s", optarg));
 	    }
 	    else
@@ -1281,16 +6339,77 @@ static int initialize(int argc, char** argv, rpOptions_t* options)
 	    }
 	    break;
 
+	case 'C':
+	    options->isContinue = 1;
+	    DBUG_PRINT("cmdline", ("C"));
+	    break;
+
+	case 'Z':
+	    options->isCompressed = 1;
+	    DBUG_PRINT("cmdline", ("Z"));
+	    break;
+
+	case 'K':
+	    options->cacheDir = optarg;
+	    DBUG_PRINT("cmdline", ("K %s", optarg));
+	    break;
+
+	case 'S':
+	    options->storeDir = optarg;
+	    DBUG_PRINT("cmdline", ("S %s", optarg));
+	    break;
+
+	case 's':
+	    options->segments = atoi(optarg);
+	    DBUG_PRINT("cmdline", ("s %s", optarg));
+
+	    if ((options->segments < 1)
+	    ||  (options->segments > RP_MAX_SEGMENTS))
+	    {
+		fprintf(stderr,
+			"Must specify from 1 to %d segments.\n",
+			RP_MAX_SEGMENTS);
+
+		result = rp_failure;
+	    }
+	    break;
+
 	case 'v':
 	    options->isVerbose = 1;
 	    DBUG_PRINT("cmdline", ("v"));
 	    break;
 
+	case 'T':
+	    options->isStats = 1;
+	    DBUG_PRINT("cmdline", ("T %s", (NULL == optarg) ? "" : optarg));
+
+	    if ((NULL != optarg) && (0 == strcmp(optarg, "json")))
+	    {
+		options->isStatsJson = 1;
+	    }
+	    else if (NULL != optarg)
+	    {
+		fprintf(stderr, "Stats may only be reported as json.\n");
+
+		result = rp_failure;
+	    }
+	    break;
+
 	case 'V':
 	    isShowVersion = 1;
 	    DBUG_PRINT("cmdline", ("V"));
 	    break;
 
+	case 'z':
+	    options->isZeroCopy = 1;
+	    DBUG_PRINT("cmdline", ("z"));
+	    break;
+
+	case 'u':
+	    options->isRing = 1;
+	    DBUG_PRINT("cmdline", ("u"));
+	    break;
+
 #ifndef DBUG_OFF
 	case '#':
 	    if (NULL != optarg)
@@ -1326,7 +6445,19 @@ static int initialize(int argc, char** argv, rpOptions_t* options)
 	while (optind < argc)
 	{
 	    DBUG_PRINT("cmdline", ("URL %s", argv[optind]));
-	    *p++ = UrlDecode(argv[optind++]);/* un-encode and save URL */
+
+	    if (NULL != (*p = UrlDecode(argv[optind])))
+	    {
+		++p;			/* un-encoded and saved URL */
+		++options->urlCount;
+	    }
+	    else
+	    {
+		fprintf(stderr, "%s: malformed %%-escape.\n", argv[optind]);
+		result = rp_failure;
+	    }
+
+	    ++optind;
 	}
 
 	*p = NULL;			/* terminate array of pointers */
@@ -1362,84 +6493,586 @@ static int initialize(int argc, char** argv, rpOptions_t* options)
 	result = rp_failure;
     }
 
+    if ((NULL != options->cacheDir)
+    &&  (-1 == mkdir(options->cacheDir, 0777))
+    &&  (EEXIST != errno))
+    {
+	perror(options->cacheDir);
+
+	result = rp_failure;
+    }
+
+    /* a stored page is hashed whole, in order, as it is written */
+    if ((NULL != options->storeDir)
+    &&  (options->isContinue
+	 || (options->segments > 1)
+	 || (NULL != options->cacheDir)))
+    {
+	fprintf(stderr,
+		"Cannot specify a store with --continue, --segments or"
+		" --cache-dir.\n");
+
+	result = rp_failure;
+    }
+
+    if ((NULL != options->storeDir)
+    &&  (-1 == mkdir(options->storeDir, 0777))
+    &&  (EEXIST != errno))
+    {
+	perror(options->storeDir);
+
+	result = rp_failure;
+    }
+
     /*
-     * Validate URL scheme
+     * URLs are parsed, and their schemes checked, as they are queued
      */
 
-    if (isUrlSpecified)
+    if (!isUrlSpecified && (NULL == options->inputPath))
     {
-	for (p = options->urls; NULL != *p; ++p)
+	if (!isShowHelp)
+	{
+	    fprintf(stderr, "Must specify at least one URL.\n");
+	}
+
+	result = rp_failure;
+    }
+
+    if (isUrlSpecified && (NULL != options->inputPath))
+    {
+	fprintf(stderr, "Cannot specify URLs and an input file.\n");
+
+	result = rp_failure;
+    }
+
+    DBUG_RETURN(result);
+}
+
+/*------------------------------------------------------------------------------
+ * seconds() - convert a timeval to seconds
+ */
+static double seconds(struct timeval* tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/*------------------------------------------------------------------------------
+ * getSyscalls() - read- and write-class system calls made so far
+ *
+ * Counted by the kernel, in /proc/self/io; returns -1 where unavailable.
+ */
+static int getSyscalls(long* reads, long* writes)
+{
+    char line[128];
+    FILE* fp;
+    int found = 0;
+
+    DBUG_ENTER("getSyscalls");
+
+    if (NULL == (fp = fopen("/proc/self/io", "r")))
+    {
+	DBUG_RETURN(-1);
+    }
+
+    while (NULL != fgets(line, sizeof line, fp))
+    {
+	found += sscanf(line, "syscr: %ld", reads);
+	found += sscanf(line, "syscw: %ld", writes);
+    }
+
+    fclose(fp);
+
+    DBUG_RETURN((2 == found) ? 0 : -1);
+}
+
+/*------------------------------------------------------------------------------
+ * mergeLatency() - the latencies of every loop, for one server or for all
+ * (origin ID -1); -1 if out of memory
+ */
+static int mergeLatency(rpEngine_t* engine, int id, rpLatency_t* latency)
+{
+    int i;
+    int j;
+    int k;
+
+    memset(latency, 0, sizeof *latency);
+
+    for (i = 0; i < engine->loopCount; ++i)
+    {
+	rpLoop_t* loop = &engine->loops[i];
+
+	int last = (-1 == id) ? loop->busyMax : id + 1;
+
+	for (k = (-1 == id) ? 0 : id;
+	     (NULL != loop->latency) && (k < last) && (k < loop->busyMax);
+	     ++k)
+	{
+	    for (j = 0; j < RP_TIMINGS; ++j)
+	    {
+		if (0 != HistogramMerge(&latency->timings[j],
+					&loop->latency[k].timings[j]))
+		{
+		    return -1;
+		}
+	    }
+	}
+    }
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * printJsonString() - a string, quoted and escaped for JSON
+ */
+static void printJsonString(FILE* fp, const char* s)
+{
+    fputc('"', fp);
+
+    for (; '\0' != *s; ++s)
+    {
+	if (('"' == *s) || ('\\' == *s))
+	{
+	    fprintf(fp, "\\%c", *s);
+	}
+	else if ((unsigned char)*s < 0x20)
+	{
+	    fprintf(fp, "\\u%04x", (unsigned char)*s);
+	}
+	else
+	{
+	    fputc(*s, fp);
+	}
+    }
+
+    fputc('"', fp);
+}
+
+/*------------------------------------------------------------------------------
+ * printLatency() - one server's latencies, or all; as table rows, or as the
+ * members of a JSON object
+ */
+static void printLatency(
+	rpOptions_t* options,
+	rpLatency_t* latency,
+	const char* name)
+{
+    static const char* timingNames[RP_TIMINGS] =
+    {
+	"dns", "connect", "ttfb", "transfer"
+    };
+
+    static const double percents[] = { 50, 90, 99 };
+
+    int i;
+    int j;
+
+    if (!options->isStatsJson)
+    {
+	fprintf(stderr, "Stats  %s\n", name);
+    }
+
+    for (i = 0; i < RP_TIMINGS; ++i)
+    {
+	Histogram_t* histogram = &latency->timings[i];
+
+	if (options->isStatsJson)
 	{
-	    static char* httpScheme = "http";
-	    static char* httpsScheme = "https";
+	    fprintf(stderr,
+		    "%s\"%s\":{\"count\":%lld",
+		    (0 == i) ? "" : ",",
+		    timingNames[i],
+		    histogram->count);
 
-	    UrlParse_t* parsed = UrlParse(*p);
-	    
-	    if ((0 != strcasecmp(httpScheme, parsed->scheme))
-	    &&  (0 != strcasecmp(httpsScheme, parsed->scheme)))
+	    for (j = 0; j < (int)(sizeof percents / sizeof percents[0]); ++j)
 	    {
 		fprintf(stderr,
-			"Only the %s and %s schemes are supported.\n",
-			httpScheme,
-			httpsScheme);
+			",\"p%.0f\":%.3f",
+			percents[j],
+			HistogramPercentile(histogram, percents[j]) / 1e3);
+	    }
 
-		result = rp_failure;
-		break;
+	    fprintf(stderr, ",\"max\":%.3f}", histogram->max / 1e3);
+	}
+	else if (histogram->count > 0)
+	{
+	    fprintf(stderr, "       %-9s %8lld", timingNames[i], histogram->count);
+
+	    for (j = 0; j < (int)(sizeof percents / sizeof percents[0]); ++j)
+	    {
+		fprintf(stderr,
+			" %10.3f",
+			HistogramPercentile(histogram, percents[j]) / 1e3);
 	    }
+
+	    fprintf(stderr, " %10.3f\n", histogram->max / 1e3);
 	}
     }
+}
+
+/*------------------------------------------------------------------------------
+ * reportLatency() - with '--stats', report each server's latencies, and all
+ *
+ * To the standard error, as pages may be going to the standard output.
+ * Servers with nothing measured (every URL served by a pooled connection
+ * of another loop, say) still appear, with counts of 0.
+ */
+static void reportLatency(rpOptions_t* options, rpEngine_t* engine)
+{
+    rpLatency_t latency;
+
+    char name[1024];
+    int i;
+    int j;
+
+    DBUG_ENTER("reportLatency");
+
+    if (options->isStatsJson)
+    {
+	fprintf(stderr, "{\"unit\":\"ms\",\"all\":{");
+    }
     else
     {
-	if (!isShowHelp)
+	fprintf(stderr,
+		"Stats  %-9s %8s %10s %10s %10s %10s\n",
+		"(ms)",
+		"count",
+		"p50",
+		"p90",
+		"p99",
+		"max");
+    }
+
+    if (0 == mergeLatency(engine, -1, &latency))
+    {
+	printLatency(options, &latency, "all servers");
+    }
+
+    for (j = 0; j < RP_TIMINGS; ++j)
+    {
+	HistogramFree(&latency.timings[j]);
+    }
+
+    if (options->isStatsJson)
+    {
+	fprintf(stderr, "},\"servers\":[");
+    }
+
+    for (i = 0; i < engine->originCount; ++i)
+    {
+	rpOrigin_t* origin = engine->origins[i];
+
+	if (0 == mergeLatency(engine, i, &latency))
 	{
-	    fprintf(stderr, "Must specify at least one URL.\n");
+	    if (options->isStatsJson)
+	    {
+		fprintf(stderr, "%s{\"scheme\":", (0 == i) ? "" : ",");
+		printJsonString(stderr, origin->scheme);
+		fprintf(stderr, ",\"domain\":");
+		printJsonString(stderr, origin->domain);
+		fprintf(stderr, ",\"port\":");
+		printJsonString(stderr, origin->port);
+		fprintf(stderr, ",");
+	    }
+
+	    snprintf(name,
+		     sizeof name,
+		     "%s://%s:%s",
+		     origin->scheme,
+		     origin->domain,
+		     origin->port);
+
+	    printLatency(options, &latency, name);
+
+	    if (options->isStatsJson)
+	    {
+		fprintf(stderr, "}");
+	    }
 	}
 
-	result = rp_failure;
+	for (j = 0; j < RP_TIMINGS; ++j)
+	{
+	    HistogramFree(&latency.timings[j]);
+	}
     }
 
-    DBUG_RETURN(result);
+    if (options->isStatsJson)
+    {
+	fprintf(stderr, "]}\n");
+    }
+
+    DBUG_VOID_RETURN;
 }
 
 /*------------------------------------------------------------------------------
  * run() - fetch, and optionally save, the pages
+ *
+ * In verbose mode, reports body throughput and CPU time, so the zero-copy
+ * and read()/write() modes may be compared; then the page rate, system calls
+ * per page, and peak resident size, for benchmarking.
  */
-static rpResult_t run(rpOptions_t* options, rpState_t* state)
+static rpResult_t run(rpOptions_t* options, rpEngine_t* engine)
 {
     rpResult_t result = rp_success;
 
+    struct timespec start;
+    struct timespec end;
+    struct rusage usage;
+
+    double elapsed;
+
+    long long bodyBytes = 0;
+    long long encodedBytes = 0;
+    long long decodedBytes = 0;
+    long long duplicateBytes = 0;
+    long cacheHits = 0;
+    long stored = 0;
+    long duplicates = 0;
+    long reads;
+    long writes;
+    long waits = 0;
+    long mallocs;
+
+    int i;
+
     DBUG_ENTER("run");
 
-    result = retrievePages(options, state);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    mallocs = ArenaMallocs();
+
+    result = retrievePages(options, engine);
+
+    mallocs = (0 > mallocs) ? -1 : ArenaMallocs() - mallocs;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &usage);
+
+    for (i = 0; (NULL != engine->loops) && (i < engine->loopCount); ++i)
+    {
+	bodyBytes    += engine->loops[i].bodyBytes;
+	encodedBytes += engine->loops[i].encodedBytes;
+	decodedBytes += engine->loops[i].decodedBytes;
+	cacheHits    += engine->loops[i].cacheHits;
+	stored       += engine->loops[i].stored;
+	duplicates   += engine->loops[i].duplicates;
+	duplicateBytes += engine->loops[i].duplicateBytes;
+	waits        += engine->loops[i].waits;
+    }
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (options->isVerbose)
+    {
+	printf("Body   %lld bytes in %.3f s, %.1f MB/s, "
+	       "user %.3f s, system %.3f s (%s)\n",
+	       bodyBytes,
+	       elapsed,
+	       (elapsed > 0) ? bodyBytes / elapsed / (1024 * 1024) : 0,
+	       seconds(&usage.ru_utime),
+	       seconds(&usage.ru_stime),
+	       options->isRing     ? "io_uring"
+	     : options->isZeroCopy ? "zero-copy" : "read/write");
+
+	if (options->isCompressed)
+	{
+	    printf("Decode %lld bytes from %lld compressed, %.1f%% saved\n",
+		   decodedBytes,
+		   encodedBytes,
+		   (decodedBytes > 0)
+		   ? 100.0 * (decodedBytes - encodedBytes) / decodedBytes
+		   : 0);
+	}
+
+	if (NULL != options->cacheDir)
+	{
+	    printf("Cache  %ld of %d pages not modified\n",
+		   cacheHits,
+		   engine->queued);
+	}
+
+	if (NULL != options->storeDir)
+	{
+	    printf("Store  %ld pages, %ld duplicates, %lld bytes not stored"
+		   " again\n",
+		   stored,
+		   duplicates,
+		   duplicateBytes);
+	}
+
+	printf("Pages  %d in %.3f s, %.0f/s, ",
+	       engine->queued,
+	       elapsed,
+	       (elapsed > 0) ? engine->queued / elapsed : 0);
+
+	if ((engine->queued > 0) && (0 == getSyscalls(&reads, &writes)))
+	{
+	    printf("syscalls per page: read %.2f, write %.2f, wait %.2f, ",
+		   (double)reads / engine->queued,
+		   (double)writes / engine->queued,
+		   (double)waits / engine->queued);
+	}
+
+	if ((engine->queued > 0) && (0 <= mallocs))
+	{
+	    printf("mallocs per page %.2f, ", (double)mallocs / engine->queued);
+	}
+
+	printf("peak RSS %ld KB\n", usage.ru_maxrss);
+    }
+
+    if (options->isStats && (NULL != engine->loops))
+    {
+	reportLatency(options, engine);
+    }
 
     DBUG_RETURN(result);
 }
 
+/*------------------------------------------------------------------------------
+ * freeLoop() - free one event loop, with its connections
+ */
+static void freeLoop(rpLoop_t* loop)
+{
+    int i;
+
+    if (NULL != loop->conns)
+    {
+	for (i = 0; i < loop->slotCount; ++i)
+	{
+	    free(loop->conns[i].so_rcvbuf);
+	    free(loop->conns[i].iov);
+	    ArenaFree(&loop->conns[i].arena);
+
+	    if (loop->conns[i].isInflate)
+	    {
+		HttpInflateEnd(&loop->conns[i].inflater);
+	    }
+
+	    if (-1 != loop->conns[i].pipefd[0])
+	    {
+		close(loop->conns[i].pipefd[0]);
+		close(loop->conns[i].pipefd[1]);
+	    }
+	}
+
+	free(loop->conns);
+    }
+
+    PoolFree(&loop->chunks);
+
+    if (NULL != loop->events)
+    {
+	EventLoopFree(loop->events);
+    }
+
+
+    for (i = loop->spoolsTaken;
+	 (NULL != loop->spools) && (i != loop->spoolsPut);
+	 i = (i + 1) % (loop->engine->queueSize + 1))
+    {
+	fclose(loop->spools[i]);
+    }
+
+    free(loop->spools);
+    free(loop->ready);
+    free(loop->runs);
+    free(loop->deferred);
+    free(loop->segments);
+    free(loop->busy);
+
+    for (i = 0; (NULL != loop->latency) && (i < loop->busyMax); ++i)
+    {
+	int j;
+
+	for (j = 0; j < RP_TIMINGS; ++j)
+	{
+	    HistogramFree(&loop->latency[i].timings[j]);
+	}
+    }
+
+    free(loop->latency);
+}
+
 /*------------------------------------------------------------------------------
  * terminate() - cleanup and exit
  */
-static void terminate(rpOptions_t* options, rpState_t* state)
+static void terminate(rpOptions_t* options, rpEngine_t* engine)
 {
     DBUG_ENTER("terminate");
 
     assert(NULL != options);
-    assert(NULL != state);
+    assert(NULL != engine);
 
     if (NULL != options->urls)
     {
+	char** p;
+
+	for (p = options->urls; NULL != *p; ++p)
+	{
+	    free(*p);
+	}
+
 	free(options->urls);
     }
 
     if (NULL != options->filenames)
     {
+	char** p;
+
+	for (p = options->filenames; NULL != *p; ++p)
+	{
+	    free(*p);
+	}
+
 	free(options->filenames);
     }
     
-    if (NULL != state->so_rcvbuf)
+    if (NULL != engine->loops)
     {
-	free(state->so_rcvbuf);
+	int i;
+
+	for (i = 0; i < engine->loopCount; ++i)
+	{
+	    freeLoop(&engine->loops[i]);
+	}
+
+	free(engine->loops);
+    }
+
+    ResolveFree(engine->resolver);
+
+    while (NULL != engine->oldest)
+    {
+	ArenaFree(&engine->oldest->arena);
+	engine->oldest = engine->oldest->next;
+    }
+
+    PoolFree(&engine->refills);
+    PoolFree(&engine->chunks);
+
+    free(engine->outputs);
+
+    UrlInputClose(engine->input);
+
+    if (NULL != engine->origins)
+    {
+	int i;
+
+	for (i = 0; i < engine->originCount; ++i)
+	{
+	    free(engine->origins[i]);
+	}
+
+	free(engine->origins);
+    }
+
+    free(engine->originIndex);
+
+    if ((NULL != engine->manifest) && (0 != fclose(engine->manifest)))
+    {
+	perror(RP_STORE_MANIFEST);
     }
 
+    free(engine->order);
+
     DBUG_VOID_RETURN;
 }
 
@@ -1453,22 +7086,33 @@ int main(int argc, char** argv)
     int exitCode = 1;			/* failure */
 
     rpOptions_t options;
-    rpState_t state;
+    rpEngine_t engine;
 
     DBUG_ENTER("main");
 
     memset(&options, 0, sizeof options);
-    memset(&state, 0, sizeof state);
+    memset(&engine, 0, sizeof engine);
+
+    options.maxConnections = RP_MAX_CONNECTIONS;
+    options.threads        = 1;
+    options.maxPerHost     = RP_MAX_PER_HOST;
+    options.idleTimeout    = RP_IDLE_TIMEOUT;
+    options.dnsTtl         = RESOLVE_TTL;
+    options.connectDelay   = RP_CONNECT_DELAY;
+    options.segments       = 1;
+
+    ScanInit();				/* select parsing kernels */
+    UrlEncodeInit();			/* select escaping kernels */
 
     if (rp_success == initialize(argc, argv, &options))
     {
-	if (rp_success == run(&options, &state))
+	if (rp_success == run(&options, &engine))
 	{
 	    exitCode = 0;		/* success */
 	}
     }
 
-    terminate(&options, &state);
+    terminate(&options, &engine);
 
     DBUG_RETURN(exitCode);
 }